@@ -5,12 +5,36 @@ PAX_PATH       ?=../pax-gfx
 PAXC_BUILD_DIR ?=build
 PAXC_CCOPTIONS ?=-c -fPIC -DPAXC_STANDALONE -Iinclude -I$(PAX_PATH)/src -Ilibspng/spng -Izlib
 PAXC_LDOPTIONS ?=-shared
-PAXC_LIBS      ?=-lz
+PAXC_LIBS      ?=-lz -lpthread
+PAXC_STATS     ?=0
+
+ifeq ($(PAXC_STATS),1)
+PAXC_CCOPTIONS += -DPAX_CODECS_STATS=1
+endif
 
 # Sources
 SOURCES        =src/pax_codecs.c \
+				src/pax_codecs_rows.c \
+				src/pax_codec_arena.c \
+				src/pax_codec_error.c \
+				src/pax_codec_stats.c \
+				src/pax_decode_pool.c \
+				src/pax_png_writer.c \
+				src/pax_png_filter.c \
+				src/pax_png_parallel.c \
+				src/pax_png_screen.c \
+				src/pax_apng_enc.c \
+				src/pax_apng_dec.c \
+				src/pax_qoi.c \
+				src/pax_jpeg.c \
+				src/pax_gif.c \
+				src/pax_bitmap.c \
+				src/pax_png_index.c \
+				src/pax_tiles.c \
+				src/pax_native.c \
 				libspng/spng/spng.c
 HEADERS        =include/pax_codecs.h \
+				src/pax_codecs_internal.h \
 				libspng/spng/spng.h
 
 # Outputs
@@ -18,8 +42,12 @@ OBJECTS        =$(shell echo " $(SOURCES)" | sed -E 's/ (src|libspng)/ $(PAXC_BU
 OBJECTS_DEBUG  =$(shell echo " $(SOURCES)" | sed -E 's/ (src|libspng)/ $(PAXC_BUILD_DIR)\/\1/g;s/\.c/.c.debug.o/g')
 PAXC_LIB_PATH ?=build/libpaxcodecs.so
 
+PAXC_BAKE_PATH ?=build/pax_bake
+PAXC_BENCH_PATH ?=build/pax_bench
+PAXC_CORPUS_PATH ?=build/pax_corpus
+
 # Actions
-.PHONY: all debug clean
+.PHONY: all debug clean tools bench
 
 all: build/pax_codecs_lib.so
 	@mkdir -p build
@@ -29,6 +57,10 @@ debug: build/pax_codecs_lib.debug.so
 	@mkdir -p build
 	@cp build/pax_codecs_lib.debug.so $(PAXC_LIB_PATH)
 
+tools: $(PAXC_BAKE_PATH) $(PAXC_CORPUS_PATH)
+
+bench: $(PAXC_BENCH_PATH)
+
 clean:
 	rm -rf build
 
@@ -49,3 +81,16 @@ build/pax_codecs_lib.debug.so: $(OBJECTS_DEBUG)
 build/%.debug.o: % $(HEADERS)
 	@mkdir -p $(shell dirname $@)
 	$(CC) $(PAXC_CCOPTIONS) -ggdb -o $@ $< $(PAXC_LIBS)
+
+# Host tools
+$(PAXC_BAKE_PATH): tools/pax_bake.c $(OBJECTS) $(HEADERS)
+	@mkdir -p $(shell dirname $@)
+	$(CC) -Iinclude -I$(PAX_PATH)/src -Izlib -o $@ $< $(OBJECTS) -L$(PAX_PATH)/build -lpax $(PAXC_LIBS)
+
+$(PAXC_BENCH_PATH): tools/pax_bench.c tools/png_synth.c $(OBJECTS) $(HEADERS)
+	@mkdir -p $(shell dirname $@)
+	$(CC) -O2 -Iinclude -I$(PAX_PATH)/src -Izlib -o $@ tools/pax_bench.c tools/png_synth.c $(OBJECTS) -L$(PAX_PATH)/build -lpax $(PAXC_LIBS) -lm
+
+$(PAXC_CORPUS_PATH): tools/pax_corpus.c tools/png_synth.c tools/png_synth.h
+	@mkdir -p $(shell dirname $@)
+	$(CC) -O2 -Izlib -o $@ tools/pax_corpus.c tools/png_synth.c -lz -lm
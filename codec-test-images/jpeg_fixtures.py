@@ -0,0 +1,33 @@
+#!/usr/bin/env python3
+# Generates the JPEG fixtures for jpeg_test.c and their reference pixels, decoded with libjpeg through Pillow.
+# Run from this directory; needs Pillow and numpy.
+
+from PIL import Image
+import numpy as np
+
+W, H = 48, 32
+
+# Gentle color ramps with luma stripes: chroma stays smooth, so the results of
+# different 4:2:0 upsampling filters stay close.
+y, x = np.mgrid[0:H, 0:W]
+r = 64 + x * 128 // W
+g = 64 + y * 128 // H
+b = 128 + 60 * np.sin(x / 9.0) * np.cos(y / 11.0)
+img = np.stack([r, g, b], -1) + (x[..., None] // 4 % 2) * 24 - 12
+im = Image.fromarray(img.clip(0, 255).astype(np.uint8), 'RGB')
+
+def save(name, size=None, **kwargs):
+	if kwargs:
+		im.save(name + '.jpg', quality=90, **kwargs)
+	ref = Image.open(name.split('@')[0] + '.jpg')
+	if size:
+		# libjpeg's DCT scaling, like CODEC_FLAG_SCALE_*.
+		ref.draft('RGB', size)
+	ref.convert('RGB').save(name.replace('@', '_') + '.ppm')
+
+save('jpeg_baseline', subsampling=0)
+save('jpeg_progressive', subsampling=0, progressive=True)
+save('jpeg_restart', subsampling=0, restart_marker_blocks=1)
+save('jpeg_420', subsampling=2)
+save('jpeg_420@half', (W // 2, H // 2))
+save('jpeg_420@quarter', (W // 4, H // 4))
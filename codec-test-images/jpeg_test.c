@@ -0,0 +1,134 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+// jpeg_test: decodes the JPEG fixtures in this directory and compares them to reference pixels.
+// The fixtures and references come from jpeg_fixtures.py; the references were decoded with libjpeg.
+// Usage: jpeg_test <directory with the fixtures>
+
+#include "pax_codecs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	const char *jpeg;
+	const char *reference;
+	int         flags;
+	// Largest difference allowed per channel.
+	int         tolerance;
+} test_case_t;
+
+// libjpeg interpolates subsampled chroma where the decoder replicates it, and keeps chroma at full
+// resolution when scaling, so 4:2:0 gets more slack the smaller the scale.
+static const test_case_t cases[] = {
+	{"jpeg_baseline.jpg",    "jpeg_baseline.ppm",    0,                    2},
+	{"jpeg_progressive.jpg", "jpeg_progressive.ppm", 0,                    2},
+	{"jpeg_restart.jpg",     "jpeg_restart.ppm",     0,                    2},
+	{"jpeg_420.jpg",         "jpeg_420.ppm",         0,                    8},
+	{"jpeg_420.jpg",         "jpeg_420_half.ppm",    CODEC_FLAG_SCALE_1_2, 12},
+	{"jpeg_420.jpg",         "jpeg_420_quarter.ppm", CODEC_FLAG_SCALE_1_4, 24},
+};
+
+// Reads a whole file from `dir`; returns NULL if it can't.
+static uint8_t *read_file(const char *dir, const char *name, size_t *len) {
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE *fd = fopen(path, "rb");
+	if (!fd) {
+		printf("%s: can't open\n", path);
+		return NULL;
+	}
+	fseek(fd, 0, SEEK_END);
+	long size = ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+	uint8_t *data = size > 0 ? malloc(size) : NULL;
+	if (!data || fread(data, 1, size, fd) != (size_t) size) {
+		printf("%s: can't read\n", path);
+		free(data);
+		data = NULL;
+	}
+	fclose(fd);
+	*len = size;
+	return data;
+}
+
+// Decodes one fixture; returns true if it matches the reference.
+static bool run_case(const char *dir, const test_case_t *tc) {
+	size_t   jpeg_len, ref_len;
+	uint8_t *jpeg = read_file(dir, tc->jpeg, &jpeg_len);
+	uint8_t *ref  = read_file(dir, tc->reference, &ref_len);
+	bool     ok   = false;
+	int      width, height, header;
+	if (!jpeg || !ref) goto done;
+	if (sscanf((const char *) ref, "P6 %d %d 255%n", &width, &height, &header) != 2
+		|| ref_len < (size_t) header + 1 + 3 * width * height) {
+		printf("%s: not a binary PPM\n", tc->reference);
+		goto done;
+	}
+	const uint8_t *pixels = ref + header + 1;
+
+	pax_buf_t buf;
+	if (!pax_decode_jpeg_buf(&buf, jpeg, jpeg_len, PAX_BUF_32_8888ARGB, tc->flags)) {
+		printf("%s: decode failed: %s\n", tc->reference, pax_codec_last_error()->message);
+		goto done;
+	}
+	if (pax_buf_get_width(&buf) != width || pax_buf_get_height(&buf) != height) {
+		printf("%s: decoded %dx%d, expected %dx%d\n", tc->reference, pax_buf_get_width(&buf), pax_buf_get_height(&buf), width, height);
+		pax_buf_destroy(&buf);
+		goto done;
+	}
+	int max_diff = 0;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			pax_col_t      col = pax_get_pixel(&buf, x, y);
+			const uint8_t *p   = pixels + 3 * (y * width + x);
+			int diff[3] = {
+				abs((int) ((col >> 16) & 0xff) - p[0]),
+				abs((int) ((col >> 8) & 0xff) - p[1]),
+				abs((int) (col & 0xff) - p[2]),
+			};
+			for (int c = 0; c < 3; c++) {
+				if (diff[c] > max_diff) max_diff = diff[c];
+			}
+		}
+	}
+	pax_buf_destroy(&buf);
+	ok = max_diff <= tc->tolerance;
+	printf("%s: largest difference %d, %s\n", tc->reference, max_diff, ok ? "ok" : "too large");
+
+	done:
+	free(jpeg);
+	free(ref);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	const char *dir    = argc > 1 ? argv[1] : ".";
+	int         failed = 0;
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		if (!run_case(dir, &cases[i])) failed++;
+	}
+	return failed ? 1 : 0;
+}
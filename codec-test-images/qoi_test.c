@@ -0,0 +1,142 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+// qoi_test: encodes buffers to QOI and decodes them again, expecting identical pixels.
+// Covers ARGB8888, RGB565 and 8-bit palette buffers; the pattern exercises every QOI chunk type.
+
+#include "pax_codecs.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WIDTH  61
+#define HEIGHT 23
+
+// Palette for the palette buffer case; distinct, opaque colors.
+static pax_col_t test_palette[16] = {
+	0xff000000, 0xff800000, 0xff008000, 0xff808000, 0xff000080, 0xff800080, 0xff008080, 0xffc0c0c0,
+	0xff808080, 0xffff0000, 0xff00ff00, 0xffffff00, 0xff0000ff, 0xffff00ff, 0xff00ffff, 0xffffffff,
+};
+
+// Test pattern: runs, gentle gradients, large jumps and varying alpha.
+static pax_col_t pattern(int x, int y) {
+	if (y % 5 == 0 && x < 40) {
+		// Runs of one color.
+		return 0xff204080;
+	} else if (y % 5 == 1) {
+		// Small steps, for the diff and luma chunks.
+		return 0xff000000 | ((x * 2) << 16) | ((x * 3 + y) << 8) | (x + 2 * y);
+	} else if (y % 5 == 2) {
+		// A few colors repeating, for the index chunk.
+		return test_palette[(x / 3) % 4 + 8];
+	} else if (y % 5 == 3) {
+		// Varying alpha.
+		return ((pax_col_t) x * 4 << 24) | 0x00406080;
+	}
+	// Pseudo random colors.
+	uint32_t h = ((uint32_t) x * 73856093u) ^ ((uint32_t) y * 19349663u);
+	return 0xff000000 | (h * 2654435761u >> 8);
+}
+
+// Round trips one buffer type; returns the number of mismatching pixels, or -1 on error.
+static int round_trip(pax_buf_type_t type, const char *name) {
+	bool      palette = PAX_IS_PALETTE(type);
+	pax_buf_t src, dst;
+	pax_buf_init(&src, NULL, WIDTH, HEIGHT, type);
+	if (palette) {
+		src.palette      = test_palette;
+		src.palette_size = 16;
+	}
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			pax_col_t col = pattern(x, y);
+			pax_set_pixel(&src, palette ? (x * 7 + y * (col & 3)) % 16 : col, x, y);
+		}
+	}
+
+	void  *qoi;
+	size_t qoi_len;
+	if (!pax_encode_qoi_buf(&src, &qoi, &qoi_len, 0, 0, WIDTH, HEIGHT)) {
+		printf("%s: encode failed: %s\n", name, pax_codec_last_error()->message);
+		pax_buf_destroy(&src);
+		return -1;
+	}
+
+	// Palette buffers can't be decoded into a new buffer of their type, so insert into a copy instead.
+	bool ok;
+	if (palette) {
+		pax_buf_init(&dst, NULL, WIDTH, HEIGHT, type);
+		dst.palette      = test_palette;
+		dst.palette_size = 16;
+		ok = pax_insert_qoi_buf(&dst, qoi, qoi_len, 0, 0, 0);
+	} else {
+		ok = pax_decode_qoi_buf(&dst, qoi, qoi_len, type, 0);
+	}
+	free(qoi);
+	if (!ok) {
+		printf("%s: decode failed: %s\n", name, pax_codec_last_error()->message);
+		pax_buf_destroy(&src);
+		return -1;
+	}
+
+	int errors = 0;
+	if (dst.type != type || pax_buf_get_width(&dst) != WIDTH || pax_buf_get_height(&dst) != HEIGHT) {
+		printf("%s: decoded to a %dx%d buffer of type %08x\n", name, pax_buf_get_width(&dst), pax_buf_get_height(&dst), dst.type);
+		errors = -1;
+	} else {
+		for (int y = 0; y < HEIGHT; y++) {
+			for (int x = 0; x < WIDTH; x++) {
+				pax_col_t want = pax_get_pixel(&src, x, y);
+				pax_col_t got  = pax_get_pixel(&dst, x, y);
+				if (want != got && errors++ < 8) {
+					printf("%s: pixel (%d, %d) is %08x, expected %08x\n", name, x, y, got, want);
+				}
+			}
+		}
+	}
+	pax_buf_destroy(&src);
+	pax_buf_destroy(&dst);
+	return errors;
+}
+
+int main(void) {
+	struct {
+		pax_buf_type_t type;
+		const char    *name;
+	} cases[] = {
+		{PAX_BUF_32_8888ARGB, "ARGB8888"},
+		{PAX_BUF_16_565RGB,   "RGB565"},
+		{PAX_BUF_8_PAL,       "8-bit palette"},
+	};
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		int errors = round_trip(cases[i].type, cases[i].name);
+		if (errors) {
+			failed++;
+		} else {
+			printf("%s: ok\n", cases[i].name);
+		}
+	}
+	return failed ? 1 : 0;
+}
@@ -1,9 +1,28 @@
 idf_component_register(
 	SRCS
 	"src/pax_codecs.c"
+	"src/pax_codecs_rows.c"
+	"src/pax_codec_arena.c"
+	"src/pax_codec_error.c"
+	"src/pax_codec_stats.c"
+	"src/pax_decode_pool.c"
+	"src/pax_png_writer.c"
+	"src/pax_png_filter.c"
+	"src/pax_png_parallel.c"
+	"src/pax_png_screen.c"
+	"src/pax_apng_enc.c"
+	"src/pax_apng_dec.c"
+	"src/pax_qoi.c"
+	"src/pax_jpeg.c"
+	"src/pax_gif.c"
+	"src/pax_bitmap.c"
+	"src/pax_png_index.c"
+	"src/pax_tiles.c"
+	"src/pax_native.c"
 	"libspng/spng/spng.c"
+	"src/pax_codecs.cpp"
 	INCLUDE_DIRS "include" "libspng/spng" "zlib"
-	REQUIRES pax-gfx esp_rom
+	REQUIRES pax-gfx esp_rom pthread
 )
 
 # Build static library, do not build test executables.
@@ -38,6 +38,65 @@ typedef struct {
 	int color_type;
 } pax_png_info_t;
 
+typedef struct {
+	uint32_t width, height;
+	// 3 for RGB, 4 for RGBA.
+	int channels;
+	// 0 for sRGB with linear alpha, 1 for all linear.
+	int colorspace;
+} pax_qoi_info_t;
+
+typedef struct {
+	uint32_t width, height;
+	// 1 for greyscale, 3 for color.
+	int components;
+	bool progressive;
+} pax_jpeg_info_t;
+
+// Details of a codec error; see pax_codec_last_error.
+typedef struct {
+	// One of the PAX_ERR_* codes, or PAX_OK if there was no error.
+	pax_err_t code;
+	// What went wrong, for logs and error dialogs; empty if there was no error.
+	char      message[96];
+} pax_codec_error_t;
+
+// Error code of a decode that was canceled before it finished.
+#define PAX_CODEC_ERR_CANCELED -64
+
+// Timings and counters for PNG encode and decode calls; see pax_codec_set_stats.
+// Times are in nanoseconds and every field accumulates over the calls measured.
+typedef struct {
+	// Signature, IHDR and the other chunks around the image data.
+	uint64_t header_ns;
+	// Decompression. libspng unfilters while inflating, so for pax_decode_png_* this includes unfiltering.
+	uint64_t inflate_ns;
+	// Undoing row filters where that is a separate step.
+	uint64_t unfilter_ns;
+	// Converting between PNG samples and pax colors; for encoding, reading pixels from the buffer.
+	uint64_t convert_ns;
+	// Writing pixels into the buffer; for encoding, passing output to the sink.
+	uint64_t write_ns;
+	// Resolving palettes and mapping colors onto the buffer's palette.
+	uint64_t palette_ns;
+	// Encoding only: choosing and applying row filters.
+	uint64_t filter_ns;
+	// Encoding only: compression.
+	uint64_t deflate_ns;
+	// The whole call.
+	uint64_t total_ns;
+	// Encoded bytes read, or decoded pixel bytes fed to the encoder.
+	uint64_t bytes_in;
+	// Pixel bytes produced, or encoded bytes written.
+	uint64_t bytes_out;
+	// Rows decoded or encoded; interlaced images count the rows of every pass.
+	uint32_t rows;
+	// Heap allocations, including those of libspng and zlib.
+	uint32_t allocs;
+	// Highest heap usage during any one call, including the output.
+	size_t   peak_mem;
+} pax_codec_stats_t;
+
 // Indicates that any buffer format is acceptable.
 // The codec will select the most optimal format available.
 #define CODEC_FLAG_OPTIMAL  0x0001
@@ -47,40 +106,607 @@ typedef struct {
 #define CODEC_FLAG_EXISTING 0x0100
 // Don't try to fix the order of the palette.
 #define CODEC_FLAG_KEEP_PAL 0x0004
+// JPEG only: decode at half, a quarter or an eighth of the size, rounded up.
+// The scaling happens inside the IDCT, so it is much faster than a full decode.
+#define CODEC_FLAG_SCALE_1_2  0x0010
+#define CODEC_FLAG_SCALE_1_4  0x0020
+#define CODEC_FLAG_SCALE_1_8  0x0030
+#define CODEC_FLAG_SCALE_MASK 0x0030
+
+// PNG row filter types, as stored in the image data.
+#define PAX_PNG_ROW_FILTER_NONE  0
+#define PAX_PNG_ROW_FILTER_SUB   1
+#define PAX_PNG_ROW_FILTER_UP    2
+#define PAX_PNG_ROW_FILTER_AVG   3
+#define PAX_PNG_ROW_FILTER_PAETH 4
+
+// Deflate strategy used by the PNG encoder.
+typedef enum {
+	// zlib's default strategy.
+	PAX_PNG_STRATEGY_DEFAULT,
+	// Z_FILTERED: favors Huffman coding of small filtered values.
+	PAX_PNG_STRATEGY_FILTERED,
+	// Z_RLE: only run-length matches, very fast.
+	PAX_PNG_STRATEGY_RLE,
+	// Z_HUFFMAN_ONLY: no string matching at all.
+	PAX_PNG_STRATEGY_HUFFMAN_ONLY,
+} pax_png_strategy_t;
+
+// How the PNG encoder selects row filters.
+typedef enum {
+	// Every row uses filter type None.
+	PAX_PNG_FILTER_NONE,
+	// Every row uses the filter type in `pax_png_encode_opts_t::filter`.
+	PAX_PNG_FILTER_FIXED,
+	// Every row is tried with all five filters and the one with the lowest
+	// sum of absolute differences is kept.
+	PAX_PNG_FILTER_ADAPTIVE,
+	// Every row gets the filter with the lowest estimated cost, scored on a
+	// small evenly spaced sample of the row; only the chosen filter is applied.
+	// Close to PAX_PNG_FILTER_ADAPTIVE in size at close to PAX_PNG_FILTER_NONE in speed.
+	PAX_PNG_FILTER_FAST,
+} pax_png_filter_mode_t;
+
+// Tuning knobs for the PNG encoder.
+typedef struct {
+	// zlib compression level, 0-9, or -1 for the zlib default.
+	int                   level;
+	// Deflate strategy.
+	pax_png_strategy_t    strategy;
+	// Base-2 logarithm of the deflate window size, 9-15.
+	int                   window_bits;
+	// zlib memory level, 1-9.
+	int                   mem_level;
+	// Row filter selection.
+	pax_png_filter_mode_t filter_mode;
+	// Row filter used for PAX_PNG_FILTER_FIXED, one of PAX_PNG_ROW_FILTER_*.
+	int                   filter;
+	// Maximum payload size of IDAT chunks in bytes.
+	size_t                idat_size;
+	// Worker threads to encode with; 0 or 1 encodes on the calling thread.
+	// With more threads the image is split into horizontal bands that are filtered
+	// and deflated in parallel, which keeps the whole filtered image in memory.
+	// Ignored on targets built without PAX_CODECS_THREADS.
+	int                   threads;
+} pax_png_encode_opts_t;
+
+// Receives `len` bytes of encoder output; returns false to abort the encode.
+typedef bool (*pax_codec_sink_t)(void *cookie, const void *data, size_t len);
+
+// Supplies row `y` of a streamed PNG encode.
+// `row` must be filled with `width` pixels in the layout of the PNG color type, 8 bits per channel.
+// Returns false to abort the encode.
+typedef bool (*pax_png_row_source_t)(void *cookie, uint32_t y, uint8_t *row, uint32_t width);
 
+// The settings used by pax_encode_png_fd and pax_encode_png_buf.
+extern const pax_png_encode_opts_t pax_png_opts_default;
+// Fastest useful encode, for screenshots and telemetry: level 1, RLE, Sub filter.
+extern const pax_png_encode_opts_t pax_png_opts_fast_screenshot;
+// Smallest output, for assets that are encoded once: level 9, adaptive filters.
+extern const pax_png_encode_opts_t pax_png_opts_archive;
+
+
+// Gets the most recent error reported by a codec call on this thread.
+// Unlike pax_last_error, which is shared by all threads and kept only for compatibility,
+// this is safe to use when decoding on several threads at once.
+// Successful calls don't reset it; use pax_codec_clear_error before a call to tell its errors apart.
+const pax_codec_error_t *pax_codec_last_error(void);
+// Resets this thread's codec error to PAX_OK.
+void pax_codec_clear_error(void);
+
+// Starts collecting stats of the PNG encode and decode calls made on this thread into `stats`.
+// Values accumulate until collection is stopped by passing NULL; zero `stats` first to measure a single call.
+// Only collected when built with PAX_CODECS_STATS; otherwise `stats` is left untouched.
+void pax_codec_set_stats(pax_codec_stats_t *stats);
 
 // Retrieves basic PNG metadata from a file.
-// Returns 1 on successful decode, refer to pax_last_error otherwise.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
 bool pax_info_png_fd (pax_png_info_t *info, FILE *fd);
 // Retrieves basic PNG metadata from a buffer.
-// Returns 1 on successful decode, refer to pax_last_error otherwise.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
 bool pax_info_png_buf(pax_png_info_t *info, const void *png, size_t png_len);
 
 // Encodes a pax buffer into a PNG file.
-// Returns 1 on successful encode, refer to pax_last_error otherwise.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
 bool pax_encode_png_fd (const pax_buf_t *buf, FILE *fd, int x, int y, int width, int height);
 // Encodes a pax buffer into a PNG buffer.
-// Returns 1 on successful encode, refer to pax_last_error otherwise.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
 bool pax_encode_png_buf(const pax_buf_t *buf, void **outbuf, size_t *len, int x, int y, int width, int height);
+// Encodes a pax buffer into a PNG file with the given encoder settings.
+// A NULL `opts` is equivalent to `&pax_png_opts_default`.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_encode_png_fd_opts (const pax_buf_t *buf, FILE *fd, int x, int y, int width, int height, const pax_png_encode_opts_t *opts);
+// Encodes a pax buffer into a PNG buffer with the given encoder settings.
+// A NULL `opts` is equivalent to `&pax_png_opts_default`.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_encode_png_buf_opts(const pax_buf_t *buf, void **outbuf, size_t *len, int x, int y, int width, int height, const pax_png_encode_opts_t *opts);
+
+// Encodes a PNG from rows produced by `source` and streams the output to `sink`.
+// `color_type` is the PNG color type of the rows: 0 (grey), 2 (RGB), 4 (grey and alpha) or 6 (RGBA).
+// Rows are requested in order; besides one row, at most one IDAT chunk of output is buffered.
+// The `threads` option is ignored. A NULL `opts` is equivalent to `&pax_png_opts_default`.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_encode_png_stream(uint32_t width, uint32_t height, int color_type, pax_png_row_source_t source, void *source_cookie, pax_codec_sink_t sink, void *sink_cookie, const pax_png_encode_opts_t *opts);
+
+// Persistent PNG encoder for capturing the same region of a buffer over and over.
+// The region is split into bands of rows whose compressed form is cached; an encode only
+// recompresses bands that intersect the dirty area and splices the cached ones back in.
+typedef struct pax_png_screen_enc pax_png_screen_enc_t;
+
+// Creates an incremental encoder for a `width` by `height` region at (`x`, `y`).
+// `band_rows` is the number of rows per cached band, 0 for the default of 16.
+// Costs roughly one compressed image of memory. Returns NULL on error, refer to pax_codec_last_error.
+pax_png_screen_enc_t *pax_png_screen_enc_new(int x, int y, int width, int height, int band_rows, const pax_png_encode_opts_t *opts);
+// Frees an incremental encoder and all cached data.
+void pax_png_screen_enc_free(pax_png_screen_enc_t *enc);
+// Forces the next encode to recompress every band.
+void pax_png_screen_enc_invalidate(pax_png_screen_enc_t *enc);
+// Encodes the region as a complete PNG, recompressing only the bands that overlap the
+// dirty rectangle (`dirty_x`, `dirty_y`, `dirty_w`, `dirty_h`) in buffer coordinates.
+// The first encode compresses everything. The output is written to `sink`.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_png_screen_enc_encode(pax_png_screen_enc_t *enc, const pax_buf_t *buf, int dirty_x, int dirty_y, int dirty_w, int dirty_h, pax_codec_sink_t sink, void *cookie);
+// Like pax_png_screen_enc_encode, but takes the dirty rectangle tracked by the buffer itself.
+// Marking the buffer clean afterwards is left to the caller.
+bool pax_png_screen_enc_encode_dirty(pax_png_screen_enc_t *enc, const pax_buf_t *buf, pax_codec_sink_t sink, void *cookie);
+
+// APNG encoder for capturing animations from a sequence of frames.
+// Each frame after the first only stores the rectangle that changed since the previous one.
+typedef struct pax_apng_enc pax_apng_enc_t;
+
+// Starts an APNG animation of the `width` by `height` region at (`x`, `y`) and writes the headers to `sink`.
+// `num_frames` frames must be added before finishing; `num_plays` is the loop count, 0 to loop forever.
+// Keeps two RGBA copies of the region. Returns NULL on error, refer to pax_codec_last_error.
+pax_apng_enc_t *pax_apng_enc_new(int x, int y, int width, int height, uint32_t num_frames, uint32_t num_plays, const pax_png_encode_opts_t *opts, pax_codec_sink_t sink, void *cookie);
+// Frees an APNG encoder without finishing the file.
+void pax_apng_enc_free(pax_apng_enc_t *enc);
+// Adds the next frame, taken from the encoder's region of `buf` and shown for `delay_ms` milliseconds.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_apng_enc_add_frame(pax_apng_enc_t *enc, const pax_buf_t *buf, uint16_t delay_ms);
+// Finishes the animation; fails if fewer frames were added than announced.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_apng_enc_finish(pax_apng_enc_t *enc);
+
+// APNG frame dispose ops.
+#define PAX_APNG_DISPOSE_NONE       0
+#define PAX_APNG_DISPOSE_BACKGROUND 1
+#define PAX_APNG_DISPOSE_PREVIOUS   2
+// APNG frame blend ops.
+#define PAX_APNG_BLEND_SOURCE 0
+#define PAX_APNG_BLEND_OVER   1
+
+// Properties of an APNG animation.
+typedef struct {
+	uint32_t width;
+	uint32_t height;
+	uint32_t num_frames;
+	// Number of times to play the animation, 0 for forever.
+	uint32_t num_plays;
+} pax_apng_info_t;
+
+// Properties of a single APNG frame.
+typedef struct {
+	// Position and size relative to the animation.
+	uint32_t x, y;
+	uint32_t width, height;
+	// How long the frame is shown.
+	uint32_t delay_ms;
+	// PAX_APNG_DISPOSE_* and PAX_APNG_BLEND_* ops.
+	uint8_t  dispose_op;
+	uint8_t  blend_op;
+} pax_apng_frame_info_t;
+
+// Persistent APNG playback decoder.
+// The file is parsed once on open; rendering a frame only inflates that frame's data.
+typedef struct pax_apng_dec pax_apng_dec_t;
+
+// Opens an APNG held in memory; the memory must stay valid until the decoder is freed.
+// Plain PNGs open as an animation of one frame. Returns NULL on error, refer to pax_codec_last_error.
+pax_apng_dec_t *pax_apng_dec_new_buf(const void *png, size_t png_len);
+// Opens an APNG from a file; the rest of the file is read into memory.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_apng_dec_t *pax_apng_dec_new_fd(FILE *fd);
+// Frees an APNG decoder.
+void pax_apng_dec_free(pax_apng_dec_t *dec);
+// Gets the size, frame count and loop count of the animation.
+void pax_apng_dec_info(const pax_apng_dec_t *dec, pax_apng_info_t *info);
+// Gets the placement, timing and ops of frame `index`.
+bool pax_apng_dec_frame_info(const pax_apng_dec_t *dec, uint32_t index, pax_apng_frame_info_t *info);
+// Renders frame `index` of the animation into `framebuffer` with its top-left corner at (`x`, `y`).
+// The area acts as the animation canvas: rendering the frames in order into the same spot only
+// decodes the new frame, anything else replays the animation from the first frame.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_apng_dec_render(pax_apng_dec_t *dec, pax_buf_t *framebuffer, uint32_t index, int x, int y);
+
+// Reads a PNG one row at a time, for spreading a decode over time or putting the pixels anywhere.
+typedef struct pax_png_rows pax_png_rows_t;
+
+// A decoded row handed out by pax_png_rows_next.
+typedef struct {
+	// Image row, and the Adam7 pass it belongs to; the pass is always 0 without interlacing.
+	uint32_t         y;
+	uint32_t         pass;
+	// Pixel `i` belongs in column `x + i * dx`; interlaced passes only cover some columns.
+	uint32_t         x;
+	uint32_t         dx;
+	// The pixels as ARGB, valid until the next call on the reader.
+	const pax_col_t *pixels;
+	uint32_t         count;
+} pax_png_row_t;
+
+// Opens a PNG held in memory for reading row by row; the memory must stay valid until the reader is freed.
+// Interlaced images hand out the rows of each Adam7 pass in turn.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_png_rows_t *pax_png_rows_new_buf(const void *png, size_t png_len);
+// Frees a row reader; the rows don't have to be read to the end first.
+void pax_png_rows_free(pax_png_rows_t *rows);
+// Gets the size and format of the PNG.
+void pax_png_rows_info(const pax_png_rows_t *rows, pax_png_info_t *info);
+// Decodes the next row into `row`.
+// Returns 1 on success, 0 after the last row or on error, which pax_png_rows_done tells apart.
+bool pax_png_rows_next(pax_png_rows_t *rows, pax_png_row_t *row);
+// Whether every row has been read without error.
+bool pax_png_rows_done(const pax_png_rows_t *rows);
+
+// A PNG decode spread over several calls, for render loops that can only spare part of each frame.
+// Between steps, the buffer holds the rows decoded so far and may be drawn;
+// interlaced images fill in over the passes, and palette buffers get their palette at the end.
+typedef struct pax_png_step pax_png_step_t;
+
+// Starts decoding a PNG held in memory into `buf` like pax_decode_png_buf, without decoding any rows yet.
+// The memory must stay valid until pax_png_decode_end. Returns NULL on error, refer to pax_codec_last_error.
+pax_png_step_t *pax_png_decode_begin(pax_buf_t *buf, const void *png, size_t png_len, pax_buf_type_t buf_type, int flags);
+// Starts drawing a PNG held in memory onto `buf` like pax_insert_png_buf, without decoding any rows yet.
+// The memory must stay valid until pax_png_decode_end. Returns NULL on error, refer to pax_codec_last_error.
+pax_png_step_t *pax_png_insert_begin(pax_buf_t *buf, const void *png, size_t png_len, int x, int y, int flags);
+// Decodes up to `max_rows` rows or for up to `max_us` microseconds, whichever comes first;
+// 0 leaves that limit out. Decodes at least one row per call, so the time limit can be overshot by a row.
+// Returns 1 once the decode has finished or failed, which pax_png_decode_end tells apart.
+bool pax_png_decode_step(pax_png_step_t *step, uint32_t max_rows, uint32_t max_us);
+// Finishes a stepped decode and frees its state; ending it early abandons the decode.
+// A buffer allocated by pax_png_decode_begin is destroyed if the decode didn't succeed.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_png_decode_end(pax_png_step_t *step);
+
+// A random-access index over the image data of a large PNG, for decoding bands of rows or regions
+// without inflating everything above them, such as when panning over a map or a scanned page.
+// Building it inflates the image once; each checkpoint keeps a 32 KiB inflate window and about two rows.
+// Interlaced PNGs can't be indexed.
+typedef struct pax_png_index pax_png_index_t;
+
+// Indexes a PNG held in memory, with a checkpoint about every `span_rows` rows;
+// 0 picks a span that keeps the index to a few percent of the image data.
+// The memory must stay valid until the index is freed. Returns NULL on error, refer to pax_codec_last_error.
+pax_png_index_t *pax_png_index_new_buf(const void *png, size_t png_len, uint32_t span_rows);
+// Indexes a PNG file; the file is mapped into memory, or read where mmap isn't available.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_png_index_t *pax_png_index_new_fd(FILE *fd, uint32_t span_rows);
+// Frees a PNG index.
+void pax_png_index_free(pax_png_index_t *index);
+// Gets the size and format of the PNG.
+void pax_png_index_info(const pax_png_index_t *index, pax_png_info_t *info);
+// Draws the region at (`x`, `y`) sized `width` by `height` of the PNG onto `buf` with its top-left corner at (`dx`, `dy`).
+// Inflating starts at the closest checkpoint above the region, or carries on from the previous call when that is closer.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_png_index_decode(pax_png_index_t *index, pax_buf_t *buf, int x, int y, int width, int height, int dx, int dy);
+
+// A PNG decoded into tiles of a fixed size in a file, for images too big to hold in memory.
+// Tiles are stored in pax's own memory layout, so a viewer can fetch just the visible ones
+// and draw them without decoding; with mmap they are used in place from the file.
+// Like native images, tile stores are only portable between machines with the same byte order.
+typedef struct pax_tile_store pax_tile_store_t;
+
+// Size of a tile store's image and its tiles.
+typedef struct {
+	// Size of the image.
+	uint32_t       width;
+	uint32_t       height;
+	// Size of every tile, including those on the right and bottom edges, which are padded with zeroes.
+	uint32_t       tile_width;
+	uint32_t       tile_height;
+	// Number of tiles across and down.
+	uint32_t       tiles_x;
+	uint32_t       tiles_y;
+	// Buffer type of the tiles.
+	pax_buf_type_t type;
+} pax_tile_store_info_t;
+
+// Decodes a PNG file into a tile store file with square tiles of `tile_size` pixels, a multiple of 8; 0 picks 256.
+// Rows are decoded one at a time and only one row of tiles is kept in memory.
+// `store` must be seekable and is written from the start. Interlaced PNGs aren't supported.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_png_tiles_fd(FILE *png, FILE *store, pax_buf_type_t buf_type, uint32_t tile_size);
+// Opens a tile store file for fetching tiles; the file must stay open until the store is closed.
+// The file is mapped into memory, or tiles are read one at a time where mmap isn't available.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_tile_store_t *pax_tile_store_open(FILE *fd);
+// Closes a tile store; buffers from pax_tile_store_get must not be used afterwards.
+void pax_tile_store_close(pax_tile_store_t *store);
+// Gets the size of the image and its tiles.
+void pax_tile_store_info(const pax_tile_store_t *store, pax_tile_store_info_t *info);
+// Points `tile` at tile (`tx`, `ty`), which covers the image from (`tx` * tile width, `ty` * tile height).
+// Drawing into the tile doesn't change the file. Don't pax_buf_destroy the tile; it stays valid until
+// the store is closed, or when the file isn't mapped, until the next tile is fetched.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_tile_store_get(pax_tile_store_t *store, pax_buf_t *tile, uint32_t tx, uint32_t ty);
+
+// Priorities for pax_decode_pool_submit; any value works, higher values run first.
+#define PAX_DECODE_PRIO_PREFETCH 0
+#define PAX_DECODE_PRIO_VISIBLE  100
+
+// Decodes PNGs in the background, so that a UI thread can keep drawing frames while images stream in.
+// Jobs wait in order of priority and a job that is already running can be stopped between two rows.
+typedef struct pax_decode_pool pax_decode_pool_t;
+
+// Runs `task(arg)` on a thread of the caller's choosing, for instance by posting it to an event loop.
+typedef void (*pax_executor_t)(void *executor_cookie, void (*task)(void *arg), void *arg);
+
+// Receives the outcome of decode job `job`.
+// On success the callback takes over the image in `buf`: copy `*buf` to keep it, or pax_buf_destroy it.
+// On failure or cancellation `buf` is NULL and `error` says why; canceled jobs have PAX_CODEC_ERR_CANCELED.
+typedef void (*pax_decode_done_t)(void *cookie, uint32_t job, pax_buf_t *buf, const pax_codec_error_t *error);
+
+// Creates a pool that decodes on `threads` threads of its own.
+// Completions are handed to `executor`; without one, they wait until pax_decode_pool_poll is called.
+// With 0 threads, or when built without thread support, decoding happens in pax_decode_pool_poll instead.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_decode_pool_t *pax_decode_pool_new(int threads, pax_executor_t executor, void *executor_cookie);
+// Cancels every job, waits for the threads to stop and frees the pool.
+// Completions that would otherwise wait for pax_decode_pool_poll run before it returns.
+void pax_decode_pool_free(pax_decode_pool_t *pool);
+// Queues a decode of the PNG in `png` like pax_decode_png_buf, at `priority`.
+// The PNG must stay valid until `done` is called, which happens exactly once per job.
+// Returns the job ID, or 0 on error, refer to pax_codec_last_error.
+uint32_t pax_decode_pool_submit(pax_decode_pool_t *pool, const void *png, size_t png_len, pax_buf_type_t buf_type, int flags, int priority, pax_decode_done_t done, void *cookie);
+// Cancels a job; a job that is already decoding stops before its next row.
+// Returns 1 if the job will complete as canceled, 0 if it had already finished.
+bool pax_decode_pool_cancel(pax_decode_pool_t *pool, uint32_t job);
+// Changes the priority of a job that hasn't started yet.
+// Returns 1 if the job was still waiting, 0 otherwise.
+bool pax_decode_pool_set_priority(pax_decode_pool_t *pool, uint32_t job, int priority);
+// Runs the completions waiting for this thread, and without threads also decodes one job.
+// Returns the number of completions run.
+size_t pax_decode_pool_poll(pax_decode_pool_t *pool);
 
 // Decodes a PNG file into a PAX buffer with the specified type.
-// Returns 1 on successful decode, refer to pax_last_error otherwise.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
 // It is not gauranteed the type equals buf_type.
 bool pax_decode_png_fd (pax_buf_t *buf, FILE *fd, pax_buf_type_t buf_type, int flags);
 // Decodes a PNG buffer into a PAX buffer with the specified type.
-// Returns 1 on successful decode, refer to pax_last_error otherwise.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
 // It is not gauranteed the type equals buf_type.
 bool pax_decode_png_buf(pax_buf_t *buf, const void *png, size_t png_len, pax_buf_type_t buf_type, int flags);
 
 // Decodes a PNG file into an existing PAX buffer.
 // Takes an x/y pair for offset.
-// Returns 1 on successful decode, refer to pax_last_error otherwise.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
 bool pax_insert_png_fd (pax_buf_t *buf, FILE *fd, int x, int y, int flags);
 // Decodes a PNG buffer into an existing PAX buffer.
 // Takes an x/y pair for offset.
-// Returns 1 on successful decode, refer to pax_last_error otherwise.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
 bool pax_insert_png_buf(pax_buf_t *buf, const void *png, size_t png_len, int x, int y, int flags);
 
+// Reads the header of a QOI file.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_info_qoi_fd (pax_qoi_info_t *info, FILE *fd);
+// Reads the header of a QOI buffer.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_info_qoi_buf(pax_qoi_info_t *info, const void *qoi, size_t qoi_len);
+// Encodes a pax buffer into a QOI file.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_encode_qoi_fd (const pax_buf_t *buf, FILE *fd, int x, int y, int width, int height);
+// Encodes a pax buffer into a QOI buffer.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_encode_qoi_buf(const pax_buf_t *buf, void **outbuf, size_t *len, int x, int y, int width, int height);
+// Decodes a QOI file into a buffer with the specified type.
+// Palette types are swapped for a direct color type of the same size.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_qoi_fd (pax_buf_t *buf, FILE *fd, pax_buf_type_t buf_type, int flags);
+// Decodes a QOI buffer into a buffer with the specified type.
+// Palette types are swapped for a direct color type of the same size.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_qoi_buf(pax_buf_t *buf, const void *qoi, size_t qoi_len, pax_buf_type_t buf_type, int flags);
+// Decodes a QOI file into an existing PAX buffer.
+// Takes an x/y pair for offset; parts that fall outside the buffer are skipped.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_insert_qoi_fd (pax_buf_t *buf, FILE *fd, int x, int y, int flags);
+// Decodes a QOI buffer into an existing PAX buffer.
+// Takes an x/y pair for offset; parts that fall outside the buffer are skipped.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_insert_qoi_buf(pax_buf_t *buf, const void *qoi, size_t qoi_len, int x, int y, int flags);
+
+// Reads the size and format of a JPEG file.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_info_jpeg_fd (pax_jpeg_info_t *info, FILE *fd);
+// Reads the size and format of a JPEG buffer.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_info_jpeg_buf(pax_jpeg_info_t *info, const void *jpeg, size_t jpeg_len);
+// Decodes a baseline or progressive JPEG file into a buffer with the specified type.
+// Palette types are swapped for a direct color type of the same size.
+// Pass one of the CODEC_FLAG_SCALE_* flags to decode at a smaller size.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_jpeg_fd (pax_buf_t *buf, FILE *fd, pax_buf_type_t buf_type, int flags);
+// Decodes a baseline or progressive JPEG buffer into a buffer with the specified type.
+// Palette types are swapped for a direct color type of the same size.
+// Pass one of the CODEC_FLAG_SCALE_* flags to decode at a smaller size.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_jpeg_buf(pax_buf_t *buf, const void *jpeg, size_t jpeg_len, pax_buf_type_t buf_type, int flags);
+// Decodes a JPEG file into an existing PAX buffer.
+// Takes an x/y pair for offset; parts that fall outside the buffer are skipped.
+// Palette buffers get the closest entry of their palette for each pixel.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_insert_jpeg_fd (pax_buf_t *buf, FILE *fd, int x, int y, int flags);
+// Decodes a JPEG buffer into an existing PAX buffer.
+// Takes an x/y pair for offset; parts that fall outside the buffer are skipped.
+// Palette buffers get the closest entry of their palette for each pixel.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_insert_jpeg_buf(pax_buf_t *buf, const void *jpeg, size_t jpeg_len, int x, int y, int flags);
+
+// GIF frame disposal methods.
+#define PAX_GIF_DISPOSE_NONE       0
+#define PAX_GIF_DISPOSE_BACKGROUND 1
+#define PAX_GIF_DISPOSE_PREVIOUS   2
+
+// Properties of a GIF animation.
+typedef struct {
+	uint32_t width;
+	uint32_t height;
+	uint32_t num_frames;
+	// Number of times to play the animation, 0 for forever.
+	uint32_t num_plays;
+	// Entries in the global color table, 0 if there is none.
+	uint16_t palette_size;
+} pax_gif_info_t;
+
+// Properties of a single GIF frame.
+typedef struct {
+	// Position and size relative to the animation.
+	uint32_t x, y;
+	uint32_t width, height;
+	// How long the frame is shown, as stored in the file.
+	uint32_t delay_ms;
+	// PAX_GIF_DISPOSE_* method.
+	uint8_t  dispose_op;
+	bool     interlaced;
+	// Color index that is left out when drawing, or -1 if there is none.
+	int16_t  transparent;
+} pax_gif_frame_info_t;
+
+// Persistent GIF playback decoder.
+// The file is parsed once on open, and the LZW tables and color conversion are reused from frame to frame.
+// Palette buffers get color indices written straight into them; other buffers get the colors.
+typedef struct pax_gif_dec pax_gif_dec_t;
+
+// Opens a GIF held in memory; the memory must stay valid until the decoder is freed.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_gif_dec_t *pax_gif_dec_new_buf(const void *gif, size_t gif_len);
+// Opens a GIF from a file; the rest of the file is read into memory.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_gif_dec_t *pax_gif_dec_new_fd(FILE *fd);
+// Frees a GIF decoder.
+void pax_gif_dec_free(pax_gif_dec_t *dec);
+// Gets the size, frame count and loop count of the animation.
+void pax_gif_dec_info(const pax_gif_dec_t *dec, pax_gif_info_t *info);
+// Gets the placement, timing and disposal of frame `index`.
+bool pax_gif_dec_frame_info(const pax_gif_dec_t *dec, uint32_t index, pax_gif_frame_info_t *info);
+// Allocates a buffer the size of the animation.
+// Palette types get the global color table as their palette, so frames using it are stored without any conversion.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_gif_dec_alloc_buf(const pax_gif_dec_t *dec, pax_buf_t *buf, pax_buf_type_t buf_type);
+// Renders frame `index` of the animation into `framebuffer` with its top-left corner at (`x`, `y`).
+// The area acts as the animation canvas: rendering the frames in order into the same spot only
+// decodes the new frame, anything else replays the animation from the first frame.
+// The canvas starts out as the background color in palette buffers and transparent in others.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_gif_dec_render(pax_gif_dec_t *dec, pax_buf_t *framebuffer, uint32_t index, int x, int y);
+// Decodes the first frame of a GIF file into a buffer with the specified type.
+// Palette types get the global color table as their palette; CODEC_FLAG_OPTIMAL picks PAX_BUF_8_PAL,
+// which the frame's indices are copied into without conversion.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_gif_fd (pax_buf_t *buf, FILE *fd, pax_buf_type_t buf_type, int flags);
+// Decodes the first frame of a GIF buffer into a buffer with the specified type.
+// Palette types get the global color table as their palette; CODEC_FLAG_OPTIMAL picks PAX_BUF_8_PAL,
+// which the frame's indices are copied into without conversion.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_gif_buf(pax_buf_t *buf, const void *gif, size_t gif_len, pax_buf_type_t buf_type, int flags);
+
+// Decodes a BMP file into a buffer with the specified type.
+// Uncompressed 1, 4, 8, 16, 24 and 32-bit images are supported; rows already laid out like the buffer are copied as they are.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_bmp_fd (pax_buf_t *buf, FILE *fd, pax_buf_type_t buf_type, int flags);
+// Decodes a BMP buffer into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_bmp_buf(pax_buf_t *buf, const void *bmp, size_t bmp_len, pax_buf_type_t buf_type, int flags);
+// Decodes a TGA file into a buffer with the specified type.
+// Uncompressed color-mapped, truecolor and 8-bit greyscale images are supported.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_tga_fd (pax_buf_t *buf, FILE *fd, pax_buf_type_t buf_type, int flags);
+// Decodes a TGA buffer into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_tga_buf(pax_buf_t *buf, const void *tga, size_t tga_len, pax_buf_type_t buf_type, int flags);
+// Decodes a binary PBM, PGM or PPM file into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_ppm_fd (pax_buf_t *buf, FILE *fd, pax_buf_type_t buf_type, int flags);
+// Decodes a binary PBM, PGM or PPM buffer into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_ppm_buf(pax_buf_t *buf, const void *ppm, size_t ppm_len, pax_buf_type_t buf_type, int flags);
+
+// Native images hold pixels in pax's own memory layout, so loading them needs no decode at all.
+// Files are only portable between machines with the same byte order.
+typedef struct pax_native_map pax_native_map_t;
+
+// Stores a pax buffer as a native image file.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_encode_native_fd (const pax_buf_t *buf, FILE *fd);
+// Stores a pax buffer as a native image in memory.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_encode_native_buf(const pax_buf_t *buf, void **outbuf, size_t *len);
+// Maps a native image file into memory and points `buf` at it without decoding or copying.
+// The mapping is private, so drawing into `buf` doesn't change the file.
+// Where mmap isn't available the file is read into memory instead.
+// Don't pax_buf_destroy the buffer; release it with pax_unmap_native.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_native_map_t *pax_map_native_fd(pax_buf_t *buf, FILE *fd);
+// Maps a BMP, TGA or PNM file like pax_map_native_fd when its pixels are top-down, unpadded
+// and already in a pax buffer layout, such as 8-bit palette, 565 or BGRA BMPs.
+// Other images are decoded to their closest buffer type into memory owned by the map.
+// Don't pax_buf_destroy the buffer; release it with pax_unmap_native.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_native_map_t *pax_map_bitmap_fd(pax_buf_t *buf, FILE *fd);
+// Releases the memory behind a buffer loaded with pax_map_native_fd or pax_map_bitmap_fd.
+void pax_unmap_native(pax_native_map_t *map);
+// Points `buf` at a native image held in memory, such as an asset embedded in flash; nothing is copied.
+// The memory must stay valid and suitably aligned, and can only be drawn to if it is writable.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_load_native_buf(pax_buf_t *buf, const void *data, size_t len);
+// Decodes a zlib-compressed native image into a newly allocated buffer.
+// The pixels are inflated straight into the buffer; there is no format conversion.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_native_z_buf(pax_buf_t *buf, const void *data, size_t len);
+
+// Archive entry holds a zlib-compressed native image.
+#define PAX_NATIVE_ENTRY_COMPRESSED 0x0001
+// Archive entry holds a banded image; see pax_decode_banded_buf.
+#define PAX_NATIVE_ENTRY_BANDED     0x0002
+
+// An entry of a native archive, as written by the pax_bake tool.
+typedef struct {
+	// Entry data, pointing into the archive and aligned to 64 bytes.
+	const void *data;
+	size_t      len;
+	// PAX_NATIVE_ENTRY_* flags.
+	uint32_t    flags;
+} pax_native_entry_t;
+
+// Looks up an entry of a native archive by name.
+// Uncompressed entries can be passed to pax_load_native_buf, compressed ones to pax_decode_native_z_buf.
+// Returns 1 if found, refer to pax_codec_last_error otherwise.
+bool pax_native_archive_find(const void *archive, size_t archive_len, const char *name, pax_native_entry_t *entry);
+
+// Banded images hold the same pixels as native images, deflated in independent bands of rows.
+// Bands can be inflated on several threads, or only those a viewport needs; neither converts pixels.
+
+// Stores a pax buffer as a banded image file.
+// `band_rows` is the number of rows per band, 0 for the default; `level` is the zlib compression level.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_encode_banded_fd (const pax_buf_t *buf, FILE *fd, int band_rows, int level);
+// Stores a pax buffer as a banded image in memory.
+// `band_rows` is the number of rows per band, 0 for the default; `level` is the zlib compression level.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_encode_banded_buf(const pax_buf_t *buf, void **outbuf, size_t *len, int band_rows, int level);
+// Decodes a banded image into a newly allocated buffer, inflating bands on up to `threads` threads.
+// `threads` is ignored on targets built without PAX_CODECS_THREADS.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_banded_buf(pax_buf_t *buf, const void *data, size_t len, int threads);
+// Allocates a buffer matching a banded image, with its palette, but doesn't decode any pixels.
+// Use pax_decode_banded_rows to fill in the parts that are needed.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_alloc_banded_buf(pax_buf_t *buf, const void *data, size_t len);
+// Decodes only the bands of a banded image that cover rows `y` to `y + height - 1`.
+// `buf` must have the image's type and size, as made by pax_alloc_banded_buf.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_banded_rows(pax_buf_t *buf, const void *data, size_t len, int y, int height, int threads);
+
 #ifdef __cplusplus
 }
 #endif //__cplusplus
@@ -0,0 +1,292 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#ifndef PAX_CODECS_HPP
+#define PAX_CODECS_HPP
+
+#include "pax_codecs.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <memory>
+#define PAX_CODECS_COROUTINES 1
+#else
+#define PAX_CODECS_COROUTINES 0
+#endif
+
+// Internal state of the decoder and encoder.
+struct paxc_arena;
+struct paxc_png_writer;
+
+namespace pax {
+
+// A read-only view of bytes; made from a pointer and size, a std::string_view,
+// or any contiguous container of bytes such as std::span, std::array or std::vector.
+// Only refers to the memory, which must outlive the call it is passed to.
+class ByteView {
+	public:
+	constexpr ByteView() noexcept : ptr(nullptr), len(0) {}
+	ByteView(const void *data, size_t size) noexcept : ptr(static_cast<const uint8_t *>(data)), len(size) {}
+	ByteView(std::string_view str) noexcept : ptr(reinterpret_cast<const uint8_t *>(str.data())), len(str.size()) {}
+	template <typename C, typename = std::enable_if_t<sizeof(*std::declval<const C &>().data()) == 1>>
+	ByteView(const C &container) noexcept : ptr(reinterpret_cast<const uint8_t *>(container.data())), len(container.size()) {}
+	
+	constexpr const uint8_t *data() const noexcept { return ptr; }
+	constexpr size_t size() const noexcept { return len; }
+	
+	private:
+	const uint8_t *ptr;
+	size_t         len;
+};
+
+// A writable view of bytes, like ByteView.
+class MutableByteView {
+	public:
+	constexpr MutableByteView() noexcept : ptr(nullptr), len(0) {}
+	MutableByteView(void *data, size_t size) noexcept : ptr(static_cast<uint8_t *>(data)), len(size) {}
+	template <typename C, typename = std::enable_if_t<sizeof(*std::declval<C &>().data()) == 1 && !std::is_const_v<std::remove_reference_t<decltype(*std::declval<C &>().data())>>>>
+	MutableByteView(C &container) noexcept : ptr(reinterpret_cast<uint8_t *>(container.data())), len(container.size()) {}
+	
+	constexpr uint8_t *data() const noexcept { return ptr; }
+	constexpr size_t size() const noexcept { return len; }
+	
+	private:
+	uint8_t *ptr;
+	size_t   len;
+};
+
+// The outcome of a codec call: a value, or the error that prevented it.
+// Shaped after std::expected; accessing the value of a failed result is undefined.
+template <typename T>
+class Result {
+	public:
+	Result(T value) noexcept : val(std::move(value)), err{PAX_OK, {0}} {}
+	Result(const pax_codec_error_t &error) noexcept : val(), err(error) {}
+	
+	bool has_value() const noexcept { return err.code == PAX_OK; }
+	explicit operator bool() const noexcept { return has_value(); }
+	
+	T &value() & noexcept { return val; }
+	const T &value() const & noexcept { return val; }
+	T &operator*() & noexcept { return val; }
+	const T &operator*() const & noexcept { return val; }
+	T *operator->() noexcept { return &val; }
+	const T *operator->() const noexcept { return &val; }
+	T value_or(T fallback) const { return has_value() ? val : fallback; }
+	
+	// The error; code PAX_OK and an empty message on success.
+	const pax_codec_error_t &error() const noexcept { return err; }
+	
+	private:
+	T                 val;
+	pax_codec_error_t err;
+};
+
+// The outcome of a codec call that produces no value.
+template <>
+class Result<void> {
+	public:
+	Result() noexcept : err{PAX_OK, {0}} {}
+	Result(const pax_codec_error_t &error) noexcept : err(error) {}
+	
+	bool has_value() const noexcept { return err.code == PAX_OK; }
+	explicit operator bool() const noexcept { return has_value(); }
+	
+	// The error; code PAX_OK and an empty message on success.
+	const pax_codec_error_t &error() const noexcept { return err; }
+	
+	private:
+	pax_codec_error_t err;
+};
+
+namespace detail {
+// The error of the codec call that just failed on this thread.
+inline pax_codec_error_t last_failure() noexcept {
+	pax_codec_error_t err = *pax_codec_last_error();
+	if (err.code == PAX_OK) {
+		// Shouldn't happen, but a failed result must never look successful.
+		err.code = PAX_ERR_UNKNOWN;
+	}
+	return err;
+}
+} // namespace detail
+
+// A PNG decoder that keeps its memory between images.
+// Once it has seen an image of a given size and format, decoding more like it makes no heap allocations.
+// Not thread-safe; give each thread its own decoder.
+class PngDecoder {
+	public:
+	PngDecoder() noexcept;
+	~PngDecoder();
+	PngDecoder(const PngDecoder &) = delete;
+	PngDecoder &operator=(const PngDecoder &) = delete;
+	PngDecoder(PngDecoder &&other) noexcept;
+	PngDecoder &operator=(PngDecoder &&other) noexcept;
+	
+	// Reads the size and format of a PNG.
+	Result<pax_png_info_t> info(ByteView png);
+	// Decodes a PNG into `pixels` as a buffer of `type`, which may not be a palette type.
+	// `pixels` must hold at least PAX_BUF_CALC_SIZE(width, height, type) bytes; the buffer refers to it and owns nothing.
+	Result<pax_buf_t> decode(ByteView png, MutableByteView pixels, pax_buf_type_t type, int flags = 0);
+	// Draws a PNG onto an existing buffer with its top-left corner at (`x`, `y`), like pax_insert_png_buf.
+	Result<void> insert(ByteView png, pax_buf_t &buf, int x = 0, int y = 0, int flags = 0);
+	
+	private:
+	paxc_arena *arena;
+};
+
+// A PNG encoder that keeps its buffers and deflate state between images.
+// Once it has encoded an image of a given width, encoding more makes no heap allocations,
+// unless the settings ask for more than one thread.
+// Not thread-safe; give each thread its own encoder.
+class PngEncoder {
+	public:
+	explicit PngEncoder(const pax_png_encode_opts_t &opts = pax_png_opts_default) noexcept;
+	~PngEncoder();
+	PngEncoder(const PngEncoder &) = delete;
+	PngEncoder &operator=(const PngEncoder &) = delete;
+	PngEncoder(PngEncoder &&other) noexcept;
+	PngEncoder &operator=(PngEncoder &&other) noexcept;
+	
+	// Encodes the region at (`x`, `y`) sized `width` by `height` into `out`.
+	// Returns the length of the PNG, or PAX_ERR_BOUNDS if it doesn't fit.
+	Result<size_t> encode(const pax_buf_t &buf, MutableByteView out, int x, int y, int width, int height);
+	// Encodes all of `buf` into `out`.
+	Result<size_t> encode(const pax_buf_t &buf, MutableByteView out);
+	// Encodes the region at (`x`, `y`) sized `width` by `height` and streams it to `sink`.
+	Result<void> encode(const pax_buf_t &buf, pax_codec_sink_t sink, void *cookie, int x, int y, int width, int height);
+	
+	private:
+	paxc_png_writer *writer;
+	pax_codec_error_t init_error;
+};
+
+#if PAX_CODECS_COROUTINES
+// The rows of a PNG, decoded lazily by a coroutine; made by png_rows.
+// Each resume decodes one row, so a cooperative scheduler can interleave decoding with other work.
+// Destroying the generator cancels the decode and frees its memory.
+// Iterate with range-for, or call next() and row() by hand; then check status() for errors.
+class PngRows {
+	public:
+	struct promise_type {
+		const pax_png_row_t *row = nullptr;
+		pax_codec_error_t    error{PAX_OK, {0}};
+		
+		PngRows get_return_object() noexcept { return PngRows(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		// Without exceptions, a failed frame allocation becomes an empty generator.
+		static PngRows get_return_object_on_allocation_failure() noexcept { return PngRows(nullptr); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		std::suspend_always yield_value(const pax_png_row_t &value) noexcept {
+			row = &value;
+			return {};
+		}
+		void return_value(const pax_codec_error_t &value) noexcept { error = value; }
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+	
+	// Input iterator over the rows; each increment decodes the next one.
+	class iterator {
+		public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type        = pax_png_row_t;
+		using difference_type   = std::ptrdiff_t;
+		
+		explicit iterator(PngRows *rows = nullptr) noexcept : rows(rows) {}
+		const pax_png_row_t &operator*() const noexcept { return rows->row(); }
+		const pax_png_row_t *operator->() const noexcept { return &rows->row(); }
+		iterator &operator++() noexcept {
+			if (!rows->next()) rows = nullptr;
+			return *this;
+		}
+		void operator++(int) noexcept { ++*this; }
+		bool operator==(std::default_sentinel_t) const noexcept { return !rows; }
+		
+		private:
+		PngRows *rows;
+	};
+	
+	~PngRows() {
+		if (handle) handle.destroy();
+	}
+	PngRows(const PngRows &) = delete;
+	PngRows &operator=(const PngRows &) = delete;
+	PngRows(PngRows &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+	PngRows &operator=(PngRows &&other) noexcept {
+		std::swap(handle, other.handle);
+		return *this;
+	}
+	
+	// Decodes the next row; returns false after the last row or on error.
+	bool next() noexcept {
+		if (!handle || handle.done()) return false;
+		handle.promise().row = nullptr;
+		handle.resume();
+		return !handle.done();
+	}
+	// The row decoded by the last successful next(); valid until the generator is resumed.
+	const pax_png_row_t &row() const noexcept { return *handle.promise().row; }
+	// Why decoding stopped early; success while rows remain or after the last row.
+	Result<void> status() const noexcept {
+		if (!handle) return pax_codec_error_t{PAX_ERR_NOMEM, "Out of memory"};
+		return handle.promise().error;
+	}
+	
+	// Decodes the first row; iterating resumes the same generator, so it can only be done once.
+	iterator begin() noexcept { return next() ? iterator(this) : iterator(); }
+	std::default_sentinel_t end() const noexcept { return {}; }
+	
+	private:
+	explicit PngRows(std::coroutine_handle<promise_type> handle) noexcept : handle(handle) {}
+	
+	std::coroutine_handle<promise_type> handle;
+};
+
+// Decodes the PNG in `png` one row at a time, as pax_png_rows_next does.
+// Nothing happens until the first row is asked for; `png` must stay valid until the generator is destroyed.
+inline PngRows png_rows(ByteView png) {
+	pax_codec_clear_error();
+	std::unique_ptr<pax_png_rows_t, void (*)(pax_png_rows_t *)> rows(pax_png_rows_new_buf(png.data(), png.size()), pax_png_rows_free);
+	if (!rows) co_return detail::last_failure();
+	pax_png_row_t row;
+	while (pax_png_rows_next(rows.get(), &row)) {
+		co_yield row;
+	}
+	if (!pax_png_rows_done(rows.get())) co_return detail::last_failure();
+	co_return pax_codec_error_t{PAX_OK, {0}};
+}
+#endif // PAX_CODECS_COROUTINES
+
+} // namespace pax
+
+#endif // PAX_CODECS_HPP
@@ -4,6 +4,24 @@ cmake_minimum_required(VERSION 3.13)
 # C source files.
 set(PAX_CODECS_SRCS_C
 	${CMAKE_CURRENT_LIST_DIR}/src/pax_codecs.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_codecs_rows.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_codec_arena.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_codec_error.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_codec_stats.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_decode_pool.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_png_writer.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_png_filter.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_png_parallel.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_png_screen.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_apng_enc.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_apng_dec.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_qoi.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_jpeg.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_gif.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_bitmap.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_png_index.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_tiles.c
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_native.c
 	${CMAKE_CURRENT_LIST_DIR}/libspng/spng/spng.c
 )
 
@@ -12,10 +30,12 @@ set(PAX_CODECS_INCLUDE_C
 	${CMAKE_CURRENT_LIST_DIR}/include
 	${CMAKE_CURRENT_LIST_DIR}/src
 	${CMAKE_CURRENT_LIST_DIR}/libspng/spng
+	${CMAKE_CURRENT_LIST_DIR}/zlib
 )
 
 # C++ source files.
 set(PAX_CODECS_SRCS_CXX
+	${CMAKE_CURRENT_LIST_DIR}/src/pax_codecs.cpp
 )
 
 # C++ include directories.
@@ -0,0 +1,636 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "pax_apng_dec";
+
+static const uint8_t png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static const uint8_t adam7_x_start[7] = { 0, 4, 0, 2, 0, 1, 0 };
+static const uint8_t adam7_x_delta[7] = { 8, 8, 4, 4, 2, 2, 1 };
+static const uint8_t adam7_y_start[7] = { 0, 0, 4, 0, 2, 0, 1 };
+static const uint8_t adam7_y_delta[7] = { 8, 8, 8, 4, 4, 2, 2 };
+
+// A frame as described by its fcTL chunk.
+typedef struct {
+	pax_apng_frame_info_t info;
+	// File offset of the first IDAT or fdAT chunk holding the frame.
+	size_t                data;
+} apng_frame_t;
+
+struct pax_apng_dec {
+	// The file, and the copy owned by the decoder if any.
+	const uint8_t     *png;
+	size_t             png_len;
+	uint8_t           *owned;
+	// Image header.
+	pax_apng_info_t    info;
+	uint8_t            bit_depth;
+	uint8_t            color_type;
+	uint8_t            interlace;
+	uint8_t            filter_bpp;
+	// Palette, resolved to ARGB.
+	pax_col_t          palette[256];
+	size_t             palette_size;
+	// Colour key from tRNS for greyscale and RGB images, at the bit depth of the file.
+	bool               has_key;
+	uint16_t           key[3];
+	paxc_png_row_fmt_t fmt;
+	// Maps palette indices to those of a palette buffer; rebuilt when the buffer's palette changes.
+	bool               map_valid;
+	const pax_col_t   *map_buf_palette;
+	size_t             map_buf_palette_size;
+	uint16_t           map[256];
+	// Frame table, built once when opening the file.
+	apng_frame_t      *frames;
+	// Inflate state, reset for every frame.
+	z_stream           zs;
+	bool               zs_init;
+	// Offset of the next data chunk to feed to inflate.
+	size_t             chunk_next;
+	// Row buffers, sized for the full image width.
+	uint8_t           *row;
+	uint8_t           *prev;
+	uint8_t           *conv;
+	// Playback state: the canvas the previous frame was rendered to.
+	pax_buf_t         *canvas;
+	int                canvas_x, canvas_y;
+	uint32_t           next_frame;
+	// Pixels under the previous frame, for DISPOSE_PREVIOUS.
+	pax_col_t         *saved;
+};
+
+
+
+// Number of channels for a PNG color type.
+static int png_channels(int color_type) {
+	switch (color_type) {
+		case 2:  return 3;
+		case 4:  return 2;
+		case 6:  return 4;
+		default: return 1;
+	}
+}
+
+// Checks the IHDR fields.
+static bool ihdr_valid(int bit_depth, int color_type) {
+	switch (color_type) {
+		case 0:  return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8 || bit_depth == 16;
+		case 3:  return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8;
+		case 2:
+		case 4:
+		case 6:  return bit_depth == 8 || bit_depth == 16;
+		default: return false;
+	}
+}
+
+// Reads the chunk layout and frame table of the file.
+static bool parse_file(pax_apng_dec_t *dec) {
+	const uint8_t *png = dec->png;
+	size_t         pos = sizeof(png_signature);
+	bool     have_ihdr = false, have_actl = false, have_iend = false;
+	uint32_t num_frames = 0;
+	// The frame whose data chunks are expected next, if any.
+	apng_frame_t *pending = NULL;
+	// Whether the last chunk was part of a run of frame data.
+	bool     in_data = false;
+	// Whether the last fcTL was beyond the frame count in acTL, so its data gets skipped.
+	bool     ignored = false;
+
+	if (dec->png_len < sizeof(png_signature) || memcmp(png, png_signature, sizeof(png_signature))) {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a PNG file");
+		return false;
+	}
+
+	while (!have_iend) {
+		if (dec->png_len - pos < 12) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "File ends before IEND");
+			return false;
+		}
+		uint32_t       len  = paxc_read_be32(png + pos);
+		const uint8_t *type = png + pos + 4;
+		const uint8_t *data = png + pos + 8;
+		if (len > 0x7fffffff || len > dec->png_len - pos - 12) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "Chunk runs past the end of the file");
+			return false;
+		}
+		if (crc32(crc32(0, type, 4), data, len) != paxc_read_be32(data + len)) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "Bad CRC in %.4s chunk", (const char *) type);
+			return false;
+		}
+		if (!have_ihdr && memcmp(type, "IHDR", 4)) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "IHDR is not the first chunk");
+			return false;
+		}
+		bool is_data = !memcmp(type, "IDAT", 4) || !memcmp(type, "fdAT", 4);
+
+		if (!memcmp(type, "IHDR", 4)) {
+			if (have_ihdr || len != 13) goto corrupt;
+			dec->info.width  = paxc_read_be32(data);
+			dec->info.height = paxc_read_be32(data + 4);
+			dec->bit_depth   = data[8];
+			dec->color_type  = data[9];
+			dec->interlace   = data[12];
+			if (!dec->info.width || !dec->info.height || dec->info.width > 0x7fffffff || dec->info.height > 0x7fffffff
+				|| !ihdr_valid(dec->bit_depth, dec->color_type) || data[10] || data[11] || dec->interlace > 1) {
+				goto corrupt;
+			}
+			dec->filter_bpp = (png_channels(dec->color_type) * dec->bit_depth + 7) / 8;
+			have_ihdr = true;
+
+		} else if (!memcmp(type, "PLTE", 4)) {
+			dec->palette_size = len / 3 > 256 ? 256 : len / 3;
+			for (size_t i = 0; i < dec->palette_size; i++) {
+				dec->palette[i] = 0xff000000 | (data[3*i] << 16) | (data[3*i+1] << 8) | data[3*i+2];
+			}
+
+		} else if (!memcmp(type, "tRNS", 4) && dec->color_type == 3) {
+			for (size_t i = 0; i < len && i < dec->palette_size; i++) {
+				dec->palette[i] = (dec->palette[i] & 0x00ffffff) | (data[i] << 24);
+			}
+
+		} else if (!memcmp(type, "tRNS", 4) && (dec->color_type == 0 || dec->color_type == 2)) {
+			int channels = png_channels(dec->color_type);
+			if (len != 2 * (uint32_t) channels) goto corrupt;
+			for (int i = 0; i < channels; i++) {
+				dec->key[i] = (data[2*i] << 8) | data[2*i+1];
+			}
+			dec->has_key = true;
+
+		} else if (!memcmp(type, "acTL", 4)) {
+			if (len != 8) goto corrupt;
+			num_frames           = paxc_read_be32(data);
+			dec->info.num_plays  = paxc_read_be32(data + 4);
+			if (!num_frames || num_frames > 0x7fffffff) goto corrupt;
+			dec->frames = calloc(num_frames, sizeof(apng_frame_t));
+			if (!dec->frames) {
+				PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+				return false;
+			}
+			have_actl = true;
+
+		} else if (!memcmp(type, "fcTL", 4)) {
+			if (!have_actl || len != 26 || (pending && !pending->data)) goto corrupt;
+			if (dec->info.num_frames >= num_frames) {
+				PAX_LOGW(TAG, "Ignoring frames beyond the %" PRIu32 " in acTL", num_frames);
+				pending = NULL;
+				ignored = true;
+			} else {
+				ignored = false;
+				apng_frame_t          *frame = &dec->frames[dec->info.num_frames++];
+				pax_apng_frame_info_t *fi    = &frame->info;
+				fi->width      = paxc_read_be32(data + 4);
+				fi->height     = paxc_read_be32(data + 8);
+				fi->x          = paxc_read_be32(data + 12);
+				fi->y          = paxc_read_be32(data + 16);
+				uint16_t num   = (data[20] << 8) | data[21];
+				uint16_t den   = (data[22] << 8) | data[23];
+				fi->delay_ms   = num * 1000 / (den ? den : 100);
+				fi->dispose_op = data[24];
+				fi->blend_op   = data[25];
+				if (!fi->width || !fi->height || fi->x > dec->info.width || fi->y > dec->info.height
+					|| fi->width > dec->info.width - fi->x || fi->height > dec->info.height - fi->y
+					|| fi->dispose_op > PAX_APNG_DISPOSE_PREVIOUS || fi->blend_op > PAX_APNG_BLEND_OVER) {
+					goto corrupt;
+				}
+				// The first frame can't restore what was there before it.
+				if (dec->info.num_frames == 1 && fi->dispose_op == PAX_APNG_DISPOSE_PREVIOUS) {
+					fi->dispose_op = PAX_APNG_DISPOSE_BACKGROUND;
+				}
+				pending = frame;
+			}
+
+		} else if (is_data) {
+			if (!have_actl && !dec->frames) {
+				// A still image: IDAT is the only frame.
+				dec->frames = calloc(1, sizeof(apng_frame_t));
+				if (!dec->frames) {
+					PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+					return false;
+				}
+				dec->info.num_frames        = 1;
+				dec->frames[0].info.width   = dec->info.width;
+				dec->frames[0].info.height  = dec->info.height;
+				pending = dec->frames;
+			}
+			if (type[0] == 'f' && len < 4) goto corrupt;
+			if (pending && !pending->data) {
+				// Frame data must be a single run of chunks of the same type.
+				pending->data = pos;
+			} else if (!in_data && !(type[0] == 'I' && !pending) && !(type[0] == 'f' && ignored)) {
+				goto corrupt;
+			}
+
+		} else if (!memcmp(type, "IEND", 4)) {
+			have_iend = true;
+		}
+
+		in_data = is_data;
+		pos    += 12 + len;
+	}
+
+	if (!dec->info.num_frames || !dec->frames[dec->info.num_frames - 1].data) {
+		PAXC_ERROR(PAX_ERR_NODATA, "No image data");
+		return false;
+	}
+	if (dec->color_type == 3 && !dec->palette_size) goto corrupt;
+	// Indices past the end of the palette are treated as index 0.
+	for (size_t i = dec->palette_size; i < 256; i++) {
+		dec->palette[i] = dec->palette[0];
+	}
+	if (have_actl && dec->info.num_frames < num_frames) {
+		PAX_LOGW(TAG, "acTL announces %" PRIu32 " frames, found %" PRIu32, num_frames, dec->info.num_frames);
+	}
+	return true;
+
+	corrupt:
+	PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid %.4s chunk", (const char *) png + pos + 4);
+	return false;
+}
+
+// Opens an APNG held in memory; the memory must stay valid until the decoder is freed.
+pax_apng_dec_t *pax_apng_dec_new_buf(const void *png, size_t png_len) {
+	pax_apng_dec_t *dec = calloc(1, sizeof(pax_apng_dec_t));
+	if (!dec) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return NULL;
+	}
+	dec->png     = png;
+	dec->png_len = png_len;
+	if (!parse_file(dec)) {
+		pax_apng_dec_free(dec);
+		return NULL;
+	}
+	// A colour key turns greyscale and RGB rows into greyscale and alpha or RGBA rows.
+	int out_type = dec->color_type;
+	if (dec->has_key) {
+		out_type = dec->color_type == 0 ? 4 : 6;
+	}
+	paxc_png_row_fmt(&dec->fmt, out_type, dec->bit_depth);
+	dec->fmt.palette      = dec->palette;
+	dec->fmt.palette_size = dec->palette_size;
+
+	// Allocate everything rendering needs up front, with some slack for paxc_png_put_row.
+	size_t row_bytes = ((size_t) dec->info.width * png_channels(dec->color_type) * dec->bit_depth + 7) / 8;
+	dec->row  = malloc(1 + row_bytes + 3);
+	dec->prev = malloc(row_bytes + 3);
+	dec->conv = malloc((size_t) dec->info.width * png_channels(out_type) + 3);
+	if (!dec->row || !dec->prev || !dec->conv) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		pax_apng_dec_free(dec);
+		return NULL;
+	}
+	int zerr = inflateInit(&dec->zs);
+	if (zerr != Z_OK) {
+		PAXC_ERROR(zerr == Z_MEM_ERROR ? PAX_ERR_NOMEM : PAX_ERR_DECODE, "Inflate init error %d", zerr);
+		pax_apng_dec_free(dec);
+		return NULL;
+	}
+	dec->zs_init = true;
+
+	return dec;
+}
+
+// Opens an APNG from a file; the rest of the file is read into memory.
+pax_apng_dec_t *pax_apng_dec_new_fd(FILE *fd) {
+	paxc_membuf_t mem = {0};
+	uint8_t       tmp[1024];
+	size_t        len;
+	while ((len = fread(tmp, 1, sizeof(tmp), fd)) > 0) {
+		if (!paxc_sink_mem(&mem, tmp, len)) {
+			free(mem.data);
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			return NULL;
+		}
+	}
+	pax_apng_dec_t *dec = pax_apng_dec_new_buf(mem.data, mem.len);
+	if (!dec) {
+		free(mem.data);
+		return NULL;
+	}
+	dec->owned = mem.data;
+	return dec;
+}
+
+// Frees an APNG decoder.
+void pax_apng_dec_free(pax_apng_dec_t *dec) {
+	if (!dec) return;
+	if (dec->zs_init) inflateEnd(&dec->zs);
+	free(dec->frames);
+	free(dec->row);
+	free(dec->prev);
+	free(dec->conv);
+	free(dec->saved);
+	free(dec->owned);
+	free(dec);
+}
+
+// Gets the size, frame count and loop count of the animation.
+void pax_apng_dec_info(const pax_apng_dec_t *dec, pax_apng_info_t *info) {
+	*info = dec->info;
+}
+
+// Gets the placement, timing and ops of frame `index`.
+bool pax_apng_dec_frame_info(const pax_apng_dec_t *dec, uint32_t index, pax_apng_frame_info_t *info) {
+	if (index >= dec->info.num_frames) {
+		PAXC_ERROR(PAX_ERR_PARAM, "No frame %" PRIu32 " in a %" PRIu32 "-frame animation", index, dec->info.num_frames);
+		return false;
+	}
+	*info = dec->frames[index].info;
+	return true;
+}
+
+// Inflates exactly `len` bytes of the current frame's data.
+static bool inflate_bytes(pax_apng_dec_t *dec, uint8_t *out, size_t len) {
+	dec->zs.next_out  = out;
+	dec->zs.avail_out = len;
+	while (dec->zs.avail_out) {
+		// Feed the next data chunk straight from the file.
+		while (!dec->zs.avail_in) {
+			const uint8_t *chunk = dec->png + dec->chunk_next;
+			if (memcmp(chunk + 4, "IDAT", 4) && memcmp(chunk + 4, "fdAT", 4)) {
+				PAXC_ERROR(PAX_ERR_CORRUPT, "Frame data ends early");
+				return false;
+			}
+			size_t skip = chunk[4] == 'f' ? 4 : 0;
+			size_t clen = paxc_read_be32(chunk);
+			dec->zs.next_in   = (Bytef *) chunk + 8 + skip;
+			dec->zs.avail_in  = clen - skip;
+			dec->chunk_next  += 12 + clen;
+		}
+		int zerr = inflate(&dec->zs, Z_NO_FLUSH);
+		bool ended = zerr == Z_STREAM_END && dec->zs.avail_out;
+		if ((zerr != Z_OK && zerr != Z_BUF_ERROR && zerr != Z_STREAM_END) || ended) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "Inflate error %d", zerr);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Reads sample `index` of an unfiltered row.
+static inline uint16_t row_sample(const uint8_t *row, size_t index, int bits) {
+	if (bits == 16) {
+		return (row[2*index] << 8) | row[2*index+1];
+	} else if (bits == 8) {
+		return row[index];
+	}
+	size_t bit = index * bits;
+	return (row[bit / 8] >> (8 - bits - bit % 8)) & ((1 << bits) - 1);
+}
+
+// Brings an unfiltered row into the layout paxc_png_put_row expects: 8 bits per channel.
+static const uint8_t *convert_row(pax_apng_dec_t *dec, const uint8_t *row, uint32_t width) {
+	if (dec->has_key) {
+		// Add an alpha channel that clears the pixels matching the colour key.
+		int      bits     = dec->bit_depth;
+		int      channels = png_channels(dec->color_type);
+		uint16_t max      = bits == 16 ? 0xffff : (1 << bits) - 1;
+		uint8_t *out      = dec->conv;
+		for (uint32_t x = 0; x < width; x++) {
+			bool keyed = true;
+			for (int c = 0; c < channels; c++) {
+				uint16_t sample  = row_sample(row, (size_t) x * channels + c, bits);
+				keyed           &= sample == dec->key[c];
+				*out++           = bits == 16 ? sample >> 8 : sample * (255 / max);
+			}
+			*out++ = keyed ? 0 : 255;
+		}
+		return dec->conv;
+	}
+	if (dec->bit_depth == 8 || dec->color_type == 3) {
+		return row;
+	}
+	uint8_t *out = dec->conv;
+	if (dec->bit_depth == 16) {
+		// Keep the high byte of each sample.
+		size_t n = (size_t) width * png_channels(dec->color_type);
+		for (size_t i = 0; i < n; i++) out[i] = row[2*i];
+	} else {
+		// Expand 1, 2 or 4 bit greyscale.
+		int     bits  = dec->bit_depth;
+		uint8_t mask  = (1 << bits) - 1;
+		uint8_t scale = 255 / mask;
+		for (uint32_t x = 0; x < width; x++) {
+			size_t bit = (size_t) x * bits;
+			out[x] = ((row[bit / 8] >> (8 - bits - bit % 8)) & mask) * scale;
+		}
+	}
+	return out;
+}
+
+// Maps the palette indices of the file to the closest entries of the palette of `buf`.
+static void prepare_map(pax_apng_dec_t *dec, const pax_buf_t *buf) {
+	if (dec->map_valid && dec->map_buf_palette == buf->palette && dec->map_buf_palette_size == buf->palette_size) {
+		return;
+	}
+	// Indices can be copied as they are if the buffer has the same colors, or no palette at all.
+	bool identity = true;
+	if (buf->palette) {
+		for (size_t i = 0; i < dec->palette_size && identity; i++) {
+			identity = i < buf->palette_size && buf->palette[i] == dec->palette[i];
+		}
+	}
+	for (size_t i = 0; i < 256; i++) {
+		size_t entry = i < dec->palette_size ? i : 0;
+		dec->map[i]  = identity ? entry : paxc_closest_palette_index(buf, dec->palette[i], true);
+	}
+	dec->map_valid            = true;
+	dec->map_buf_palette      = buf->palette;
+	dec->map_buf_palette_size = buf->palette_size;
+}
+
+// Writes a row of palette indices to a palette buffer, like paxc_png_put_row with PAXC_PUT_INDEX.
+// With `blend`, fully transparent pixels leave the canvas as it is.
+static void put_index_row(pax_apng_dec_t *dec, pax_buf_t *buf, const uint8_t *row, uint32_t x, uint32_t dx, uint32_t width, int x_offset, int y, bool blend) {
+	for (size_t i = 0; x < width; x += dx, i++) {
+		uint16_t entry = row_sample(row, i, dec->bit_depth);
+		if (!blend || dec->palette[entry] >> 24) {
+			pax_set_pixel(buf, dec->map[entry], x_offset + x, y);
+		}
+	}
+}
+
+// Decodes a frame and composites it onto the canvas at (`dx`, `dy`).
+static bool decode_frame(pax_apng_dec_t *dec, pax_buf_t *buf, const apng_frame_t *frame, int dx, int dy) {
+	const pax_apng_frame_info_t *fi = &frame->info;
+	bool blend = fi->blend_op == PAX_APNG_BLEND_OVER;
+	int  mode  = paxc_png_put_mode(buf, dec->fmt.color_type, blend);
+	if (mode == PAXC_PUT_INDEX) {
+		prepare_map(dec, buf);
+	}
+
+	inflateReset(&dec->zs);
+	dec->zs.avail_in = 0;
+	dec->chunk_next  = frame->data;
+
+	for (int pass = 0; pass < (dec->interlace ? 7 : 1); pass++) {
+		uint32_t x0 = 0, xd = 1, y0 = 0, yd = 1;
+		if (dec->interlace) {
+			x0 = adam7_x_start[pass];
+			xd = adam7_x_delta[pass];
+			y0 = adam7_y_start[pass];
+			yd = adam7_y_delta[pass];
+		}
+		if (x0 >= fi->width || y0 >= fi->height) continue;
+		uint32_t pw        = (fi->width - x0 + xd - 1) / xd;
+		size_t   row_bytes = ((size_t) pw * png_channels(dec->color_type) * dec->bit_depth + 7) / 8;
+		memset(dec->prev, 0, row_bytes);
+
+		for (uint32_t y = y0; y < fi->height; y += yd) {
+			if (!inflate_bytes(dec, dec->row, 1 + row_bytes)) return false;
+			uint8_t *row = dec->row + 1;
+			if (!paxc_png_unfilter_row(dec->row[0], row, dec->prev, row_bytes, dec->filter_bpp)) {
+				PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid filter type %d", dec->row[0]);
+				return false;
+			}
+			if (mode == PAXC_PUT_INDEX) {
+				put_index_row(dec, buf, row, x0, xd, fi->width, dx + fi->x, dy + fi->y + y, blend);
+			} else {
+				paxc_png_put_row(buf, &dec->fmt, convert_row(dec, row, pw), x0, xd, fi->width, dx + fi->x, dy + fi->y + y, mode);
+			}
+			memcpy(dec->prev, row, row_bytes);
+		}
+	}
+	return true;
+}
+
+// Fills a rectangle of the canvas with transparent black.
+static void clear_rect(pax_buf_t *buf, int x, int y, uint32_t width, uint32_t height) {
+	for (uint32_t py = 0; py < height; py++) {
+		for (uint32_t px = 0; px < width; px++) {
+			pax_set_pixel(buf, 0, x + px, y + py);
+		}
+	}
+}
+
+// Copies the pixels under a frame to or from `dec->saved`, for DISPOSE_PREVIOUS.
+static void save_rect(pax_apng_dec_t *dec, pax_buf_t *buf, const pax_apng_frame_info_t *fi, int dx, int dy, bool restore) {
+	int x = dx + fi->x;
+	int y = dy + fi->y;
+	if (buf->type == PAX_BUF_8_PAL && pax_buf_get_orientation(buf) == PAX_O_UPRIGHT) {
+		uint8_t *saved = (uint8_t *) dec->saved;
+		for (uint32_t py = 0; py < fi->height; py++, saved += fi->width) {
+			uint8_t *row = (uint8_t *) buf->buf + (size_t) (y + py) * buf->width + x;
+			if (restore) {
+				memcpy(row, saved, fi->width);
+			} else {
+				memcpy(saved, row, fi->width);
+			}
+		}
+	} else if (PAX_IS_PALETTE(buf->type)) {
+		// pax_get_pixel resolves palette indices to colors, so keep the indices instead.
+		pax_col_t *saved = dec->saved;
+		for (uint32_t py = 0; py < fi->height; py++) {
+			for (uint32_t px = 0; px < fi->width; px++, saved++) {
+				if (restore) {
+					pax_set_pixel(buf, *saved, x + px, y + py);
+				} else {
+					*saved = paxc_closest_palette_index(buf, pax_get_pixel(buf, x + px, y + py), false);
+				}
+			}
+		}
+	} else {
+		paxc_row_fetch_t fetch = paxc_get_row_fetch(buf);
+		paxc_row_store_t store = paxc_get_row_store(buf);
+		uint8_t         *saved = (uint8_t *) dec->saved;
+		for (uint32_t py = 0; py < fi->height; py++, saved += 4 * fi->width) {
+			if (restore) {
+				store(buf, x, y + py, fi->width, saved);
+			} else {
+				fetch(buf, x, y + py, fi->width, saved);
+			}
+		}
+	}
+}
+
+// Applies the dispose op of a frame that has been shown.
+static void dispose_frame(pax_apng_dec_t *dec, pax_buf_t *buf, const pax_apng_frame_info_t *fi, int dx, int dy) {
+	if (fi->dispose_op == PAX_APNG_DISPOSE_BACKGROUND) {
+		clear_rect(buf, dx + fi->x, dy + fi->y, fi->width, fi->height);
+	} else if (fi->dispose_op == PAX_APNG_DISPOSE_PREVIOUS) {
+		save_rect(dec, buf, fi, dx, dy, true);
+	}
+}
+
+// Renders frame `index` of the animation into `framebuffer` with its top-left corner at (`x`, `y`).
+bool pax_apng_dec_render(pax_apng_dec_t *dec, pax_buf_t *framebuffer, uint32_t index, int x, int y) {
+	if (index >= dec->info.num_frames) {
+		PAXC_ERROR(PAX_ERR_PARAM, "No frame %" PRIu32 " in a %" PRIu32 "-frame animation", index, dec->info.num_frames);
+		return false;
+	}
+	if (x < 0 || y < 0 || x + dec->info.width > (uint32_t) pax_buf_get_width(framebuffer) || y + dec->info.height > (uint32_t) pax_buf_get_height(framebuffer)) {
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Animation does not fit the buffer");
+		return false;
+	}
+
+	PAXC_STATS_CALL_BEGIN();
+
+	// Continue from the previous frame if possible, otherwise start over from a clear canvas.
+	uint32_t start = dec->next_frame;
+	if (dec->canvas != framebuffer || dec->canvas_x != x || dec->canvas_y != y || index < start) {
+		start = 0;
+	}
+	dec->canvas = NULL;
+	if (start == 0) {
+		clear_rect(framebuffer, x, y, dec->info.width, dec->info.height);
+	}
+
+	bool ok = true;
+	for (uint32_t i = start; i <= index && ok; i++) {
+		const pax_apng_frame_info_t *fi = &dec->frames[i].info;
+		if (i > 0) {
+			dispose_frame(dec, framebuffer, &dec->frames[i - 1].info, x, y);
+		}
+		if (fi->dispose_op == PAX_APNG_DISPOSE_PREVIOUS) {
+			// Remember what's under the frame; sized for the whole image so it's only allocated once.
+			if (!dec->saved) {
+				dec->saved = malloc(sizeof(pax_col_t) * dec->info.width * dec->info.height);
+				if (!dec->saved) {
+					PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+					ok = false;
+					break;
+				}
+			}
+			save_rect(dec, framebuffer, fi, x, y, false);
+		}
+		ok = decode_frame(dec, framebuffer, &dec->frames[i], x, y);
+	}
+
+	if (ok) {
+		dec->canvas     = framebuffer;
+		dec->canvas_x   = x;
+		dec->canvas_y   = y;
+		dec->next_frame = index + 1;
+	}
+	pax_mark_dirty2(framebuffer, x, y, dec->info.width, dec->info.height);
+	PAXC_STATS_CALL_END();
+	return ok;
+}
@@ -0,0 +1,250 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "pax_apng_enc";
+
+// fcTL dispose and blend ops.
+#define APNG_DISPOSE_NONE 0
+#define APNG_BLEND_SOURCE 0
+#define APNG_BLEND_OVER   1
+
+struct pax_apng_enc {
+	// Captured region.
+	int               x, y, width, height;
+	// Frames announced in acTL and frames written so far.
+	uint32_t          num_frames;
+	uint32_t          frame;
+	// Shared fcTL / fdAT sequence number.
+	uint32_t          seq;
+	// Chunk output and compression.
+	paxc_png_writer_t writer;
+	// The previous and current frame as RGBA.
+	uint8_t          *prev;
+	uint8_t          *cur;
+	// Row assembly for sub-frames.
+	uint8_t          *row;
+};
+
+
+
+// Starts an APNG animation of the region at (`x`, `y`) sized `width` by `height`.
+pax_apng_enc_t *pax_apng_enc_new(int x, int y, int width, int height, uint32_t num_frames, uint32_t num_plays, const pax_png_encode_opts_t *opts, pax_codec_sink_t sink, void *cookie) {
+	if (width <= 0 || height <= 0 || num_frames == 0 || num_frames > 0x7fffffff) {
+		PAXC_ERROR(PAX_ERR_PARAM, "Invalid animation size or frame count");
+		return NULL;
+	}
+	pax_apng_enc_t *enc = calloc(1, sizeof(pax_apng_enc_t));
+	if (!enc) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return NULL;
+	}
+	if (!paxc_png_writer_init(&enc->writer, opts, sink, cookie)) {
+		free(enc);
+		return NULL;
+	}
+	enc->x          = x;
+	enc->y          = y;
+	enc->width      = width;
+	enc->height     = height;
+	enc->num_frames = num_frames;
+
+	size_t stride = (size_t) width * 4;
+	enc->prev = malloc(stride * height);
+	enc->cur  = malloc(stride * height);
+	enc->row  = malloc(stride);
+	if (!enc->prev || !enc->cur || !enc->row) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		pax_apng_enc_free(enc);
+		return NULL;
+	}
+
+	// Headers: IHDR followed by the animation control chunk.
+	uint8_t actl[8];
+	paxc_write_be32(actl + 0, num_frames);
+	paxc_write_be32(actl + 4, num_plays);
+	if (!paxc_png_write_ihdr(&enc->writer, width, height, 8, 6) || !paxc_png_write_chunk(&enc->writer, "acTL", actl, sizeof(actl))) {
+		pax_apng_enc_free(enc);
+		return NULL;
+	}
+
+	return enc;
+}
+
+// Frees an APNG encoder without finishing the file.
+void pax_apng_enc_free(pax_apng_enc_t *enc) {
+	if (!enc) return;
+	paxc_png_writer_destroy(&enc->writer);
+	free(enc->prev);
+	free(enc->cur);
+	free(enc->row);
+	free(enc);
+}
+
+// Writes the frame control chunk for the next frame.
+static bool write_fctl(pax_apng_enc_t *enc, int x, int y, int width, int height, uint16_t delay_ms, uint8_t blend) {
+	uint8_t fctl[26];
+	paxc_write_be32(fctl + 0,  enc->seq++);
+	paxc_write_be32(fctl + 4,  width);
+	paxc_write_be32(fctl + 8,  height);
+	paxc_write_be32(fctl + 12, x);
+	paxc_write_be32(fctl + 16, y);
+	fctl[20] = delay_ms >> 8;
+	fctl[21] = delay_ms;
+	fctl[22] = 1000 >> 8;
+	fctl[23] = 1000 & 0xff;
+	fctl[24] = APNG_DISPOSE_NONE;
+	fctl[25] = blend;
+	return paxc_png_write_chunk(&enc->writer, "fcTL", fctl, sizeof(fctl));
+}
+
+// Finds the bounding box of pixels that differ between the previous and current frame.
+// Returns false if nothing changed.
+static bool find_changes(const pax_apng_enc_t *enc, int *x0, int *y0, int *x1, int *y1) {
+	size_t stride = (size_t) enc->width * 4;
+	int    top    = -1, bottom = -1;
+	int    left   = enc->width, right = -1;
+
+	for (int y = 0; y < enc->height; y++) {
+		const uint32_t *a = (const uint32_t *) (enc->prev + y * stride);
+		const uint32_t *b = (const uint32_t *) (enc->cur  + y * stride);
+		if (!memcmp(a, b, stride)) continue;
+		if (top < 0) top = y;
+		bottom = y;
+		// Only scan the parts of the row outside the box found so far.
+		int x = 0;
+		while (x < left && a[x] == b[x]) x++;
+		if (x < left) left = x;
+		x = enc->width - 1;
+		while (x > right && a[x] == b[x]) x--;
+		if (x > right) right = x;
+	}
+
+	if (top < 0) return false;
+	*x0 = left;
+	*y0 = top;
+	*x1 = right;
+	*y1 = bottom;
+	return true;
+}
+
+// Adds the next frame, taken from the encoder's region of `buf` and shown for `delay_ms` milliseconds.
+bool pax_apng_enc_add_frame(pax_apng_enc_t *enc, const pax_buf_t *buf, uint16_t delay_ms) {
+	if (enc->frame >= enc->num_frames) {
+		PAXC_ERROR(PAX_ERR_PARAM, "More frames than the %" PRIu32 " announced", enc->num_frames);
+		return false;
+	}
+	if (enc->x < 0 || enc->y < 0 || enc->x + enc->width > pax_buf_get_width(buf) || enc->y + enc->height > pax_buf_get_height(buf)) {
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Region does not fit the buffer");
+		return false;
+	}
+
+	// Capture the frame.
+	size_t           stride = (size_t) enc->width * 4;
+	paxc_row_fetch_t fetch  = paxc_get_row_fetch(buf);
+	for (int y = 0; y < enc->height; y++) {
+		fetch(buf, enc->x, enc->y + y, enc->width, enc->cur + y * stride);
+	}
+
+	paxc_png_writer_t *w = &enc->writer;
+	bool ok;
+	if (enc->frame == 0) {
+		// The first frame is the default image and goes into IDAT.
+		ok = write_fctl(enc, 0, 0, enc->width, enc->height, delay_ms, APNG_BLEND_SOURCE)
+			&& paxc_png_image_begin(w, enc->width, enc->height);
+		for (int y = 0; ok && y < enc->height; y++) {
+			ok = paxc_png_image_row(w, enc->cur + y * stride);
+		}
+		ok = ok && paxc_png_image_end(w);
+
+	} else {
+		int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+		bool changed = find_changes(enc, &x0, &y0, &x1, &y1);
+		int  bw      = x1 - x0 + 1;
+		int  bh      = y1 - y0 + 1;
+
+		// Blending over the previous frame lets unchanged pixels become transparent, which
+		// compresses much better, but only reproduces changed pixels exactly if they're opaque.
+		bool opaque = true;
+		for (int y = y0; changed && opaque && y <= y1; y++) {
+			const uint8_t *a = enc->prev + y * stride;
+			const uint8_t *b = enc->cur  + y * stride;
+			for (int x = x0; x <= x1; x++) {
+				if (b[4*x+3] != 255 && memcmp(a + 4*x, b + 4*x, 4)) {
+					opaque = false;
+					break;
+				}
+			}
+		}
+
+		// Frames must be at least 1x1; an unchanged frame is a single transparent pixel blended over.
+		ok = write_fctl(enc, x0, y0, bw, bh, delay_ms, opaque ? APNG_BLEND_OVER : APNG_BLEND_SOURCE)
+			&& paxc_png_image_begin(w, bw, bh);
+		w->fdat_seq = &enc->seq;
+		for (int y = y0; ok && y <= y1; y++) {
+			const uint8_t *a = enc->prev + y * stride + x0 * 4;
+			const uint8_t *b = enc->cur  + y * stride + x0 * 4;
+			if (!changed) {
+				memset(enc->row, 0, 4);
+			} else if (opaque) {
+				for (int x = 0; x < bw * 4; x += 4) {
+					if (memcmp(a + x, b + x, 4)) {
+						memcpy(enc->row + x, b + x, 4);
+					} else {
+						memset(enc->row + x, 0, 4);
+					}
+				}
+			} else {
+				memcpy(enc->row, b, bw * 4);
+			}
+			ok = paxc_png_image_row(w, enc->row);
+		}
+		ok = ok && paxc_png_image_end(w);
+		w->fdat_seq = NULL;
+	}
+
+	if (!ok) return false;
+
+	// The current frame is what the next one gets compared against.
+	uint8_t *tmp = enc->prev;
+	enc->prev = enc->cur;
+	enc->cur  = tmp;
+	enc->frame++;
+	return true;
+}
+
+// Finishes the animation by writing IEND.
+bool pax_apng_enc_finish(pax_apng_enc_t *enc) {
+	if (enc->frame != enc->num_frames) {
+		PAXC_ERROR(PAX_ERR_ENCODE, "Only %" PRIu32 " of %" PRIu32 " frames were added", enc->frame, enc->num_frames);
+		return false;
+	}
+	return paxc_png_write_iend(&enc->writer);
+}
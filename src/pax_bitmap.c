@@ -0,0 +1,903 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if PAXC_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#if PAXC_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+static const char *TAG = "pax_bitmap";
+
+// BMP compression types.
+#define BMP_RGB            0
+#define BMP_RLE8           1
+#define BMP_RLE4           2
+#define BMP_BITFIELDS      3
+#define BMP_ALPHABITFIELDS 6
+// BMP header sizes.
+#define BMP_FILE_HEADER    14
+#define BMP_CORE_HEADER    12
+#define BMP_INFO_HEADER    40
+
+// TGA image types; adding 8 gives the run-length encoded variant.
+#define TGA_COLORMAPPED 1
+#define TGA_TRUECOLOR   2
+#define TGA_GREY        3
+#define TGA_HEADER      18
+
+// Words in the file are little-endian, so on little-endian hosts they can be used as they are.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_LE 0
+#else
+#define HOST_LE 1
+#endif
+
+// Pixel layouts as stored in the file.
+typedef enum {
+	// Palette indices of 1, 4 or 8 bits, the leftmost pixel in the highest bits.
+	SRC_INDEX1,
+	SRC_INDEX4,
+	SRC_INDEX8,
+	// PBM bits, 1 for black.
+	SRC_PBM,
+	// Greyscale samples, 16-bit ones big-endian.
+	SRC_GREY8,
+	SRC_GREY16,
+	// RGB samples in that order, 16-bit ones big-endian.
+	SRC_RGB24,
+	SRC_RGB48,
+	// Little-endian words: BGR bytes, BGR with an unused fourth byte, and BGRA.
+	SRC_BGR24,
+	SRC_BGRX32,
+	SRC_BGRA32,
+	// Little-endian 16-bit words.
+	SRC_RGB555,
+	SRC_ARGB1555,
+	SRC_RGB565,
+	SRC_ARGB4444,
+	// Little-endian words with arbitrary BMP channel masks.
+	SRC_MASK16,
+	SRC_MASK32,
+} src_fmt_t;
+
+// A parsed image, pointing into the file.
+typedef struct {
+	uint32_t       width, height;
+	src_fmt_t      format;
+	// First row as stored, the distance between rows, and whether the bottom row is stored first.
+	const uint8_t *pixels;
+	size_t         stride;
+	bool           bottom_up;
+	// The buffer type closest to the pixels, and whether the rows are already laid out like it.
+	pax_buf_type_t natural;
+	bool           direct;
+	bool           color;
+	bool           alpha;
+	// Palette as ARGB, for indexed formats.
+	pax_col_t      palette[256];
+	uint32_t       palette_size;
+	// Largest sample value of PNM images.
+	uint32_t       maxval;
+	// BMP channel masks, in R, G, B, A order, with the shift and maximum of each channel.
+	uint32_t       masks[4];
+	uint8_t        shift[4];
+	uint32_t       max[4];
+} bitmap_t;
+
+
+
+static inline uint16_t read_le16(const uint8_t *in) {
+	return in[0] | (in[1] << 8);
+}
+
+static inline uint32_t read_le32(const uint8_t *in) {
+	return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+// Checks that the image isn't too large and that `height` rows of `stride` bytes fit in the file after `offset`.
+static bool pixels_fit(bitmap_t *bm, const uint8_t *data, size_t len, size_t offset) {
+	if (bm->width > 0x7fffffff / 8 || bm->height > 0x7fffffff) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Image is too large");
+		return false;
+	}
+	if (offset > len || (uint64_t) bm->stride * bm->height > len - offset) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Pixel data runs past the end of the file");
+		return false;
+	}
+	bm->pixels = data + offset;
+	return true;
+}
+
+// Works out the shift and range of the BMP channel masks.
+static void setup_masks(bitmap_t *bm) {
+	for (int c = 0; c < 4; c++) {
+		uint32_t mask = bm->masks[c];
+		int      shift = 0;
+		while (mask && !(mask & 1)) {
+			mask >>= 1;
+			shift++;
+		}
+		bm->shift[c] = shift;
+		bm->max[c]   = mask;
+	}
+}
+
+// Parses a BMP file.
+static bool parse_bmp(bitmap_t *bm, const uint8_t *data, size_t len) {
+	if (len < BMP_FILE_HEADER + BMP_CORE_HEADER || data[0] != 'B' || data[1] != 'M') {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a BMP file");
+		return false;
+	}
+	uint32_t offset      = read_le32(data + 10);
+	uint32_t header_size = read_le32(data + 14);
+	int32_t  width, height;
+	int      bpp;
+	uint32_t compression = BMP_RGB;
+	uint32_t colors      = 0;
+	int      entry_size  = 4;
+	if (header_size == BMP_CORE_HEADER) {
+		width      = read_le16(data + 18);
+		height     = (int16_t) read_le16(data + 20);
+		bpp        = read_le16(data + 24);
+		entry_size = 3;
+	} else if (header_size >= BMP_INFO_HEADER && header_size <= len - BMP_FILE_HEADER) {
+		width       = (int32_t) read_le32(data + 18);
+		height      = (int32_t) read_le32(data + 22);
+		bpp         = read_le16(data + 28);
+		compression = read_le32(data + 30);
+		colors      = read_le32(data + 46);
+	} else {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid BMP header size %" PRIu32, header_size);
+		return false;
+	}
+	if (width <= 0 || height == 0 || height == INT32_MIN) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid BMP size");
+		return false;
+	}
+	if (compression != BMP_RGB && compression != BMP_BITFIELDS && compression != BMP_ALPHABITFIELDS) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Compressed BMPs are not supported");
+		return false;
+	}
+	bm->width     = width;
+	bm->height    = height < 0 ? -height : height;
+	bm->bottom_up = height > 0;
+	bm->stride    = ((uint64_t) bm->width * bpp + 31) / 32 * 4;
+	bm->color     = true;
+
+	// Channel masks are part of newer headers, or follow the 40-byte one.
+	size_t table = BMP_FILE_HEADER + header_size;
+	if (compression != BMP_RGB) {
+		int count = compression == BMP_ALPHABITFIELDS || header_size >= 56 ? 4 : 3;
+		size_t at = header_size >= 52 ? BMP_FILE_HEADER + BMP_INFO_HEADER : table;
+		if (at + 4 * count > len) goto corrupt;
+		for (int c = 0; c < count; c++) bm->masks[c] = read_le32(data + at + 4 * c);
+		if (header_size < 52) table += 4 * count;
+		setup_masks(bm);
+	}
+
+	if (bpp == 1 || bpp == 4 || bpp == 8) {
+		if (compression != BMP_RGB) goto corrupt;
+		bm->format       = bpp == 1 ? SRC_INDEX1 : bpp == 4 ? SRC_INDEX4 : SRC_INDEX8;
+		bm->natural      = bpp == 1 ? PAX_BUF_1_PAL : bpp == 4 ? PAX_BUF_4_PAL : PAX_BUF_8_PAL;
+		bm->direct       = bpp == 8;
+		bm->palette_size = colors && colors < (1u << bpp) ? colors : 1u << bpp;
+		if (table > len || (uint64_t) bm->palette_size * entry_size > len - table) goto corrupt;
+		for (uint32_t i = 0; i < bm->palette_size; i++) {
+			const uint8_t *e = data + table + i * entry_size;
+			bm->palette[i]   = 0xff000000 | (e[2] << 16) | (e[1] << 8) | e[0];
+		}
+	} else if (bpp == 16) {
+		uint32_t *m = bm->masks;
+		bm->natural = PAX_BUF_16_565RGB;
+		if (compression == BMP_RGB || (m[0] == 0x7c00 && m[1] == 0x03e0 && m[2] == 0x001f && !m[3])) {
+			bm->format = SRC_RGB555;
+		} else if (m[0] == 0x7c00 && m[1] == 0x03e0 && m[2] == 0x001f && m[3] == 0x8000) {
+			bm->format  = SRC_ARGB1555;
+			bm->natural = PAX_BUF_16_4444ARGB;
+			bm->alpha   = true;
+		} else if (m[0] == 0xf800 && m[1] == 0x07e0 && m[2] == 0x001f && !m[3]) {
+			bm->format = SRC_RGB565;
+			bm->direct = HOST_LE;
+		} else if (m[0] == 0x0f00 && m[1] == 0x00f0 && m[2] == 0x000f && m[3] == 0xf000) {
+			bm->format  = SRC_ARGB4444;
+			bm->natural = PAX_BUF_16_4444ARGB;
+			bm->direct  = HOST_LE;
+			bm->alpha   = true;
+		} else {
+			bm->format  = SRC_MASK16;
+			bm->alpha   = m[3];
+			if (bm->alpha) bm->natural = PAX_BUF_16_4444ARGB;
+		}
+	} else if (bpp == 24 && compression == BMP_RGB) {
+		bm->format  = SRC_BGR24;
+		bm->natural = PAX_BUF_32_8888ARGB;
+	} else if (bpp == 32) {
+		uint32_t *m = bm->masks;
+		bm->natural = PAX_BUF_32_8888ARGB;
+		if (compression == BMP_RGB || (m[0] == 0xff0000 && m[1] == 0xff00 && m[2] == 0xff && !m[3])) {
+			// Without an alpha mask, the fourth byte is unused.
+			bm->format = SRC_BGRX32;
+		} else if (m[0] == 0xff0000 && m[1] == 0xff00 && m[2] == 0xff && m[3] == 0xff000000) {
+			bm->format = SRC_BGRA32;
+			bm->direct = HOST_LE;
+			bm->alpha  = true;
+		} else {
+			bm->format = SRC_MASK32;
+			bm->alpha  = m[3];
+		}
+	} else {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Unsupported BMP with %d bits per pixel", bpp);
+		return false;
+	}
+	return pixels_fit(bm, data, len, offset);
+
+	corrupt:
+	PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid BMP header");
+	return false;
+}
+
+// Converts a TGA color map entry of `bits` bits to ARGB.
+static pax_col_t tga_color(const uint8_t *e, int bits) {
+	if (bits == 15 || bits == 16) {
+		uint16_t v = read_le16(e);
+		uint8_t  r = (v >> 10) & 31, g = (v >> 5) & 31, b = v & 31;
+		return 0xff000000 | (((r << 3) | (r >> 2)) << 16) | (((g << 3) | (g >> 2)) << 8) | ((b << 3) | (b >> 2));
+	} else if (bits == 32) {
+		return ((pax_col_t) e[3] << 24) | (e[2] << 16) | (e[1] << 8) | e[0];
+	} else {
+		return 0xff000000 | (e[2] << 16) | (e[1] << 8) | e[0];
+	}
+}
+
+// Parses a TGA file.
+static bool parse_tga(bitmap_t *bm, const uint8_t *data, size_t len) {
+	if (len < TGA_HEADER || data[1] > 1 || (data[2] & ~8) < TGA_COLORMAPPED || (data[2] & ~8) > TGA_GREY) {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a TGA file");
+		return false;
+	}
+	int      type       = data[2];
+	uint16_t cmap_first = read_le16(data + 3);
+	uint16_t cmap_len   = read_le16(data + 5);
+	int      cmap_bits  = data[7];
+	int      bpp        = data[16];
+	uint8_t  desc       = data[17];
+	bm->width     = read_le16(data + 12);
+	bm->height    = read_le16(data + 14);
+	bm->bottom_up = !(desc & 0x20);
+	if (type & 8) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Compressed TGAs are not supported");
+		return false;
+	}
+	if (desc & 0x10) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Right-to-left TGAs are not supported");
+		return false;
+	}
+	if (!bm->width || !bm->height) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid TGA size");
+		return false;
+	}
+
+	// The color map follows the image ID.
+	size_t offset     = TGA_HEADER + data[0];
+	size_t entry_size = (cmap_bits + 7) / 8;
+	if (data[1]) {
+		if (cmap_bits != 15 && cmap_bits != 16 && cmap_bits != 24 && cmap_bits != 32) goto corrupt;
+		if (offset > len || cmap_len * entry_size > len - offset) goto corrupt;
+	}
+	if (type == TGA_COLORMAPPED) {
+		if (!data[1] || bpp != 8) goto corrupt;
+		// Index i refers to entry i - cmap_first.
+		bm->palette_size = cmap_first + cmap_len > 256 ? 256 : cmap_first + cmap_len;
+		for (uint32_t i = 0; i < bm->palette_size; i++) {
+			bm->palette[i] = i < cmap_first ? 0xff000000 : tga_color(data + offset + (i - cmap_first) * entry_size, cmap_bits);
+			if (bm->palette[i] >> 24 != 0xff) bm->alpha = true;
+		}
+		bm->format  = SRC_INDEX8;
+		bm->natural = PAX_BUF_8_PAL;
+		bm->direct  = true;
+		bm->color   = true;
+	} else if (type == TGA_GREY) {
+		if (bpp != 8) {
+			PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Unsupported greyscale TGA with %d bits per pixel", bpp);
+			return false;
+		}
+		bm->format  = SRC_GREY8;
+		bm->natural = PAX_BUF_8_GREY;
+		bm->direct  = true;
+	} else {
+		// The low bits of the descriptor count the alpha bits.
+		int alpha_bits = desc & 15;
+		bm->color   = true;
+		bm->natural = PAX_BUF_32_8888ARGB;
+		if (bpp == 15 || bpp == 16) {
+			bm->alpha   = bpp == 16 && alpha_bits == 1;
+			bm->format  = bm->alpha ? SRC_ARGB1555 : SRC_RGB555;
+			bm->natural = bm->alpha ? PAX_BUF_16_4444ARGB : PAX_BUF_16_565RGB;
+		} else if (bpp == 24) {
+			bm->format = SRC_BGR24;
+		} else if (bpp == 32 && alpha_bits) {
+			bm->format = SRC_BGRA32;
+			bm->direct = HOST_LE;
+			bm->alpha  = true;
+		} else if (bpp == 32) {
+			bm->format = SRC_BGRX32;
+		} else {
+			PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Unsupported TGA with %d bits per pixel", bpp);
+			return false;
+		}
+	}
+	bm->stride = (size_t) bm->width * ((bpp + 7) / 8);
+	return pixels_fit(bm, data, len, offset + (data[1] ? cmap_len * entry_size : 0));
+
+	corrupt:
+	PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid TGA header");
+	return false;
+}
+
+// Reads a decimal number from a PNM header, skipping whitespace and comments before it.
+static bool pnm_number(const uint8_t *data, size_t len, size_t *pos, uint32_t *value) {
+	while (*pos < len) {
+		uint8_t c = data[*pos];
+		if (c == '#') {
+			while (*pos < len && data[*pos] != '\n' && data[*pos] != '\r') ++*pos;
+		} else if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f') {
+			++*pos;
+		} else {
+			break;
+		}
+	}
+	if (*pos >= len || data[*pos] < '0' || data[*pos] > '9') return false;
+	*value = 0;
+	while (*pos < len && data[*pos] >= '0' && data[*pos] <= '9') {
+		if (*value > 0x7fffffff / 10) return false;
+		*value = *value * 10 + data[*pos] - '0';
+		++*pos;
+	}
+	return true;
+}
+
+// Parses a binary PBM, PGM or PPM file.
+static bool parse_pnm(bitmap_t *bm, const uint8_t *data, size_t len) {
+	if (len < 3 || data[0] != 'P' || data[1] < '1' || data[1] > '6') {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a PNM file");
+		return false;
+	}
+	int kind = data[1] - '0';
+	if (kind <= 3) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Plain text PNM files are not supported");
+		return false;
+	}
+	size_t pos = 2;
+	bm->maxval = 1;
+	if (!pnm_number(data, len, &pos, &bm->width) || !pnm_number(data, len, &pos, &bm->height)
+		|| (kind != 4 && !pnm_number(data, len, &pos, &bm->maxval))) {
+		goto corrupt;
+	}
+	// Exactly one whitespace character separates the header from the pixels.
+	if (pos >= len || !bm->width || !bm->height || !bm->maxval || bm->maxval > 65535) goto corrupt;
+	pos++;
+
+	bool wide = bm->maxval > 255;
+	if (kind == 4) {
+		bm->format  = SRC_PBM;
+		bm->natural = PAX_BUF_1_GREY;
+		bm->stride  = (bm->width + 7) / 8;
+	} else if (kind == 5) {
+		bm->format  = wide ? SRC_GREY16 : SRC_GREY8;
+		bm->natural = PAX_BUF_8_GREY;
+		bm->direct  = bm->maxval == 255;
+		bm->stride  = (size_t) bm->width * (wide ? 2 : 1);
+	} else {
+		bm->format  = wide ? SRC_RGB48 : SRC_RGB24;
+		bm->natural = PAX_BUF_32_8888ARGB;
+		bm->color   = true;
+		bm->stride  = (size_t) bm->width * (wide ? 6 : 3);
+	}
+	return pixels_fit(bm, data, len, pos);
+
+	corrupt:
+	PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid PNM header");
+	return false;
+}
+
+
+
+// Reads a little-endian 32-bit word that may be unaligned.
+static inline uint32_t load_le32(const uint8_t *in) {
+#if HOST_LE
+	uint32_t v;
+	memcpy(&v, in, 4);
+	return v;
+#else
+	return read_le32(in);
+#endif
+}
+
+// Scales a sample with maximum `max` to 8 bits.
+static inline uint8_t scale_sample(uint32_t v, uint32_t max) {
+	if (v >= max) return 255;
+	return (v * 255 + max / 2) / max;
+}
+
+// Swizzles a row of BGR or BGRX pixels into an 8888ARGB row, which as little-endian words is BGRA.
+// With `swap`, the input is RGB instead.
+static void row_to_argb(uint32_t *out, const uint8_t *in, uint32_t width, int in_bytes, bool swap) {
+	uint32_t i = 0;
+#if PAXC_SIMD_NEON
+	if (in_bytes == 3) {
+		for (; i + 16 <= width; i += 16) {
+			uint8x16x3_t c = vld3q_u8(in + 3*i);
+			uint8x16x4_t o;
+			o.val[0] = swap ? c.val[2] : c.val[0];
+			o.val[1] = c.val[1];
+			o.val[2] = swap ? c.val[0] : c.val[2];
+			o.val[3] = vdupq_n_u8(0xff);
+			vst4q_u8((uint8_t *) (out + i), o);
+		}
+	} else {
+		uint32x4_t alpha = vdupq_n_u32(0xff000000);
+		for (; i + 4 <= width; i += 4) {
+			vst1q_u32(out + i, vorrq_u32(vreinterpretq_u32_u8(vld1q_u8(in + 4*i)), alpha));
+		}
+	}
+#elif PAXC_SIMD_SSE2
+	// SSE2 has no byte shuffle, so only the 32-bit layout is done four pixels at a time.
+	if (in_bytes == 4) {
+		__m128i alpha = _mm_set1_epi32((int) 0xff000000);
+		for (; i + 4 <= width; i += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i *) (in + 4*i));
+			_mm_storeu_si128((__m128i *) (out + i), _mm_or_si128(v, alpha));
+		}
+	}
+#endif
+#if HOST_LE
+	if (in_bytes == 3 && width) {
+		// Every pixel but the last can be read as a whole word; the extra byte is replaced by alpha.
+		for (; i + 1 < width; i++) {
+			uint32_t v = load_le32(in + 3*i);
+			if (swap) v = ((v & 0xff) << 16) | (v & 0xff00) | ((v >> 16) & 0xff);
+			out[i] = v | 0xff000000;
+		}
+	}
+#endif
+	for (; i < width; i++) {
+		const uint8_t *p = in + in_bytes * i;
+		uint8_t        r = swap ? p[0] : p[2];
+		uint8_t        b = swap ? p[2] : p[0];
+		out[i] = 0xff000000 | (r << 16) | (p[1] << 8) | b;
+	}
+}
+
+// Swaps the red and blue bytes of 32-bit pixels; with `opaque`, also sets alpha to 255.
+static void row_swap_rb(uint8_t *out, const uint8_t *in, uint32_t width, bool opaque) {
+	uint32_t i = 0;
+#if PAXC_SIMD_NEON
+	for (; i + 16 <= width; i += 16) {
+		uint8x16x4_t c = vld4q_u8(in + 4*i);
+		uint8x16_t   b = c.val[0];
+		c.val[0] = c.val[2];
+		c.val[2] = b;
+		if (opaque) c.val[3] = vdupq_n_u8(0xff);
+		vst4q_u8(out + 4*i, c);
+	}
+#elif PAXC_SIMD_SSE2
+	__m128i ga    = _mm_set1_epi32((int) 0xff00ff00);
+	__m128i rb    = _mm_set1_epi32(0x00ff00ff);
+	__m128i alpha = _mm_set1_epi32(opaque ? (int) 0xff000000 : 0);
+	for (; i + 4 <= width; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (in + 4*i));
+		__m128i c = _mm_and_si128(v, rb);
+		c = _mm_or_si128(_mm_slli_epi32(c, 16), _mm_srli_epi32(c, 16));
+		v = _mm_or_si128(_mm_or_si128(_mm_and_si128(v, ga), c), alpha);
+		_mm_storeu_si128((__m128i *) (out + 4*i), v);
+	}
+#endif
+	for (; i < width; i++) {
+		const uint8_t *p = in + 4*i;
+		uint8_t       *o = out + 4*i;
+		uint8_t        b = p[0];
+		o[0] = p[2];
+		o[1] = p[1];
+		o[2] = b;
+		o[3] = opaque ? 255 : p[3];
+	}
+}
+
+// Writes the ARGB color `col` as RGBA bytes.
+static inline void put_argb(uint8_t *o, pax_col_t col) {
+	o[0] = col >> 16;
+	o[1] = col >> 8;
+	o[2] = col;
+	o[3] = col >> 24;
+}
+
+// Converts a row as stored in the file to RGBA bytes.
+static void row_to_rgba(const bitmap_t *bm, uint8_t *out, const uint8_t *in) {
+	uint32_t w = bm->width;
+	switch (bm->format) {
+		case SRC_INDEX1:
+		case SRC_INDEX4:
+		case SRC_INDEX8: {
+			int bits = bm->format == SRC_INDEX1 ? 1 : bm->format == SRC_INDEX4 ? 4 : 8;
+			int per  = 8 / bits;
+			for (uint32_t x = 0; x < w; x++) {
+				uint8_t i = (in[x / per] >> (8 - bits - bits * (x % per))) & ((1 << bits) - 1);
+				put_argb(out + 4*x, i < bm->palette_size ? bm->palette[i] : 0xff000000);
+			}
+		} break;
+		case SRC_PBM:
+			for (uint32_t x = 0; x < w; x++) {
+				uint8_t v = (in[x / 8] >> (7 - x % 8)) & 1 ? 0 : 255;
+				out[4*x] = out[4*x+1] = out[4*x+2] = v;
+				out[4*x+3] = 255;
+			}
+			break;
+		case SRC_GREY8:
+		case SRC_GREY16:
+			for (uint32_t x = 0; x < w; x++) {
+				uint32_t v = bm->format == SRC_GREY16 ? (in[2*x] << 8) | in[2*x+1] : in[x];
+				out[4*x] = out[4*x+1] = out[4*x+2] = scale_sample(v, bm->maxval);
+				out[4*x+3] = 255;
+			}
+			break;
+		case SRC_RGB24:
+			if (bm->maxval == 255) {
+				for (uint32_t x = 0; x < w; x++) {
+					memcpy(out + 4*x, in + 3*x, 3);
+					out[4*x+3] = 255;
+				}
+			} else {
+				for (uint32_t x = 0; x < w; x++) {
+					for (int c = 0; c < 3; c++) out[4*x+c] = scale_sample(in[3*x+c], bm->maxval);
+					out[4*x+3] = 255;
+				}
+			}
+			break;
+		case SRC_RGB48:
+			for (uint32_t x = 0; x < w; x++) {
+				for (int c = 0; c < 3; c++) {
+					out[4*x+c] = scale_sample((in[6*x+2*c] << 8) | in[6*x+2*c+1], bm->maxval);
+				}
+				out[4*x+3] = 255;
+			}
+			break;
+		case SRC_BGR24:
+			for (uint32_t x = 0; x < w; x++) {
+				out[4*x]   = in[3*x+2];
+				out[4*x+1] = in[3*x+1];
+				out[4*x+2] = in[3*x];
+				out[4*x+3] = 255;
+			}
+			break;
+		case SRC_BGRX32:
+		case SRC_BGRA32:
+			row_swap_rb(out, in, w, bm->format == SRC_BGRX32);
+			break;
+		case SRC_RGB555:
+		case SRC_ARGB1555:
+			for (uint32_t x = 0; x < w; x++) {
+				uint16_t v = read_le16(in + 2*x);
+				uint8_t  r = (v >> 10) & 31, g = (v >> 5) & 31, b = v & 31;
+				out[4*x]   = (r << 3) | (r >> 2);
+				out[4*x+1] = (g << 3) | (g >> 2);
+				out[4*x+2] = (b << 3) | (b >> 2);
+				out[4*x+3] = bm->format == SRC_RGB555 || (v & 0x8000) ? 255 : 0;
+			}
+			break;
+		case SRC_RGB565:
+			for (uint32_t x = 0; x < w; x++) {
+				uint16_t v = read_le16(in + 2*x);
+				uint8_t  r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+				out[4*x]   = (r << 3) | (r >> 2);
+				out[4*x+1] = (g << 2) | (g >> 4);
+				out[4*x+2] = (b << 3) | (b >> 2);
+				out[4*x+3] = 255;
+			}
+			break;
+		case SRC_ARGB4444:
+			for (uint32_t x = 0; x < w; x++) {
+				uint16_t v = read_le16(in + 2*x);
+				out[4*x]   = ((v >> 8) & 15) * 0x11;
+				out[4*x+1] = ((v >> 4) & 15) * 0x11;
+				out[4*x+2] = (v & 15) * 0x11;
+				out[4*x+3] = (v >> 12) * 0x11;
+			}
+			break;
+		case SRC_MASK16:
+		case SRC_MASK32:
+			for (uint32_t x = 0; x < w; x++) {
+				uint32_t v = bm->format == SRC_MASK16 ? read_le16(in + 2*x) : read_le32(in + 4*x);
+				for (int c = 0; c < 4; c++) {
+					// Missing color channels are 0 and a missing alpha channel is opaque.
+					uint32_t max = bm->max[c];
+					out[4*x+c]   = max ? scale_sample((v >> bm->shift[c]) & max, max) : c == 3 ? 255 : 0;
+				}
+			}
+			break;
+	}
+}
+
+// Stores a row of palette indices into a palette buffer.
+static void row_to_index(const bitmap_t *bm, pax_buf_t *buf, int y, const uint8_t *in) {
+	if (bm->format == SRC_INDEX8 && buf->type == PAX_BUF_8_PAL) {
+		memcpy((uint8_t *) buf->buf + (size_t) y * bm->width, in, bm->width);
+		return;
+	}
+	int bits = bm->format == SRC_INDEX1 ? 1 : bm->format == SRC_INDEX4 ? 4 : 8;
+	int per  = 8 / bits;
+	for (uint32_t x = 0; x < bm->width; x++) {
+		uint8_t i = (in[x / per] >> (8 - bits - bits * (x % per))) & ((1 << bits) - 1);
+		pax_set_pixel(buf, i, x, y);
+	}
+}
+
+// Picks the buffer type to decode into.
+static pax_buf_type_t pick_type(const bitmap_t *bm, pax_buf_type_t buf_type, int flags) {
+	bool indexed = bm->format == SRC_INDEX1 || bm->format == SRC_INDEX4 || bm->format == SRC_INDEX8;
+	if (flags & CODEC_FLAG_OPTIMAL) {
+		return bm->natural;
+	} else if (PAX_IS_PALETTE(buf_type) && indexed) {
+		if (PAX_GET_BPP(buf_type) < 8 && (1u << PAX_GET_BPP(buf_type)) < bm->palette_size) {
+			// Too many colors to index.
+			buf_type = bm->natural;
+			PAX_LOGW(TAG, "Changing buffer type to %08x", (int) buf_type);
+		}
+	} else if (PAX_IS_PALETTE(buf_type)) {
+		buf_type = paxc_pick_buf_type(buf_type, bm->color, bm->alpha);
+		PAX_LOGW(TAG, "Changing buffer type to %08x", (int) buf_type);
+	}
+	return buf_type;
+}
+
+// Copies the palette of an indexed image into `colors`.
+static void copy_palette(const bitmap_t *bm, pax_buf_t *buf, pax_col_t *colors) {
+	memcpy(colors, bm->palette, sizeof(pax_col_t) * bm->palette_size);
+	buf->palette      = colors;
+	buf->palette_size = bm->palette_size;
+}
+
+// Writes the pixels of `bm` into `buf`, which is upright and exactly as large.
+static void bitmap_fill(const bitmap_t *bm, pax_buf_t *buf, uint8_t *rgba) {
+	pax_buf_type_t   type    = buf->type;
+	bool             copy    = bm->direct && type == bm->natural;
+	bool             swizzle = type == PAX_BUF_32_8888ARGB
+		&& (bm->format == SRC_BGR24 || bm->format == SRC_BGRX32 || (bm->format == SRC_RGB24 && bm->maxval == 255));
+	bool             index   = PAX_IS_PALETTE(type) && bm->palette_size;
+	size_t           row_len = PAX_BUF_CALC_SIZE(bm->width, 1, type);
+	paxc_row_store_t store   = paxc_get_row_store(buf);
+
+	for (uint32_t y = 0; y < bm->height; y++) {
+		const uint8_t *in = bm->pixels + (size_t) (bm->bottom_up ? bm->height - 1 - y : y) * bm->stride;
+		if (copy) {
+			// Rows are already laid out like the buffer.
+			memcpy((uint8_t *) buf->buf + row_len * y, in, row_len);
+		} else if (swizzle) {
+			uint32_t *out = (uint32_t *) buf->buf + (size_t) y * bm->width;
+			row_to_argb(out, in, bm->width, bm->format == SRC_BGRX32 ? 4 : 3, bm->format == SRC_RGB24);
+		} else if (index) {
+			row_to_index(bm, buf, y, in);
+		} else {
+			row_to_rgba(bm, rgba, in);
+			store(buf, 0, y, bm->width, rgba);
+		}
+	}
+	PAXC_STATS_ADD(rows, bm->height);
+	PAXC_STATS_ADD(bytes_out, (uint64_t) row_len * bm->height);
+}
+
+// Whether filling a buffer of `type` needs an RGBA row.
+static bool needs_rgba(const bitmap_t *bm, pax_buf_type_t type) {
+	if (bm->direct && type == bm->natural) return false;
+	if (PAX_IS_PALETTE(type) && bm->palette_size) return false;
+	if (type == PAX_BUF_32_8888ARGB
+		&& (bm->format == SRC_BGR24 || bm->format == SRC_BGRX32 || (bm->format == SRC_RGB24 && bm->maxval == 255))) {
+		return false;
+	}
+	return true;
+}
+
+typedef bool (*bitmap_parser_t)(bitmap_t *bm, const uint8_t *data, size_t len);
+
+// Decodes an image of any of the supported formats into a new buffer.
+static bool bitmap_decode(pax_buf_t *framebuffer, bitmap_parser_t parse, const void *data, size_t len, pax_buf_type_t buf_type, int flags) {
+	PAXC_STATS_CALL_BEGIN();
+	bool      ok = false;
+	bitmap_t *bm = calloc(1, sizeof(bitmap_t));
+	if (!bm) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		goto cleanup;
+	}
+	bm->maxval = 255;
+	if (!parse(bm, data, len)) goto cleanup;
+
+	buf_type = pick_type(bm, buf_type, flags);
+	PAX_LOGD(TAG, "Decoding %dx%d to %08x", (int) bm->width, (int) bm->height, buf_type);
+	uint8_t *rgba = NULL;
+	if (needs_rgba(bm, buf_type)) {
+		rgba = malloc((size_t) bm->width * 4);
+		if (!rgba) {
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			goto cleanup;
+		}
+	}
+	if (!paxc_buf_init(framebuffer, NULL, bm->width, bm->height, buf_type)) {
+		free(rgba);
+		goto cleanup;
+	}
+	if (PAX_IS_PALETTE(buf_type)) {
+		// The palette belongs to the buffer, so it's a plain allocation.
+		size_t     size   = bm->palette_size ? bm->palette_size : 1;
+		pax_col_t *colors = malloc(sizeof(pax_col_t) * size);
+		if (!colors) {
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			pax_buf_destroy(framebuffer);
+			free(rgba);
+			goto cleanup;
+		}
+		if (bm->palette_size) {
+			copy_palette(bm, framebuffer, colors);
+		} else {
+			// Never happens for the types pick_type returns, but keep the buffer valid regardless.
+			colors[0]                 = 0xff000000;
+			framebuffer->palette      = colors;
+			framebuffer->palette_size = 1;
+		}
+		framebuffer->do_free_pal = true;
+	}
+	bitmap_fill(bm, framebuffer, rgba);
+	free(rgba);
+	pax_mark_dirty2(framebuffer, 0, 0, framebuffer->width, framebuffer->height);
+	ok = true;
+
+	cleanup:
+	free(bm);
+	PAXC_STATS_CALL_END();
+	return ok;
+}
+
+// Decodes an image file of any of the supported formats into a new buffer.
+static bool bitmap_decode_fd(pax_buf_t *framebuffer, bitmap_parser_t parse, FILE *fd, pax_buf_type_t buf_type, int flags) {
+	// The file is only read, so mapping it saves copying it first.
+	pax_native_map_t *map = paxc_map_file(fd);
+	if (!map) return false;
+	bool ok = bitmap_decode(framebuffer, parse, map->mem, map->len, buf_type, flags);
+	pax_unmap_native(map);
+	return ok;
+}
+
+
+
+// Decodes a BMP file into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_bmp_fd(pax_buf_t *framebuffer, FILE *fd, pax_buf_type_t buf_type, int flags) {
+	return bitmap_decode_fd(framebuffer, parse_bmp, fd, buf_type, flags);
+}
+
+// Decodes a BMP buffer into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_bmp_buf(pax_buf_t *framebuffer, const void *bmp, size_t bmp_len, pax_buf_type_t buf_type, int flags) {
+	return bitmap_decode(framebuffer, parse_bmp, bmp, bmp_len, buf_type, flags);
+}
+
+// Decodes a TGA file into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_tga_fd(pax_buf_t *framebuffer, FILE *fd, pax_buf_type_t buf_type, int flags) {
+	return bitmap_decode_fd(framebuffer, parse_tga, fd, buf_type, flags);
+}
+
+// Decodes a TGA buffer into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_tga_buf(pax_buf_t *framebuffer, const void *tga, size_t tga_len, pax_buf_type_t buf_type, int flags) {
+	return bitmap_decode(framebuffer, parse_tga, tga, tga_len, buf_type, flags);
+}
+
+// Decodes a PBM, PGM or PPM file into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_ppm_fd(pax_buf_t *framebuffer, FILE *fd, pax_buf_type_t buf_type, int flags) {
+	return bitmap_decode_fd(framebuffer, parse_pnm, fd, buf_type, flags);
+}
+
+// Decodes a PBM, PGM or PPM buffer into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_ppm_buf(pax_buf_t *framebuffer, const void *ppm, size_t ppm_len, pax_buf_type_t buf_type, int flags) {
+	return bitmap_decode(framebuffer, parse_pnm, ppm, ppm_len, buf_type, flags);
+}
+
+// Detects the format of a BMP, TGA or PNM file from its first bytes.
+static bitmap_parser_t detect_parser(const uint8_t *data, size_t len) {
+	if (len >= 2 && data[0] == 'B' && data[1] == 'M') return parse_bmp;
+	if (len >= 2 && data[0] == 'P' && data[1] >= '1' && data[1] <= '6') return parse_pnm;
+	// TGA has no signature.
+	return parse_tga;
+}
+
+// Maps a BMP, TGA or PNM file into memory and points `buf` at its pixels when they are already
+// laid out like a pax buffer; otherwise the image is decoded to its closest buffer type.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_native_map_t *pax_map_bitmap_fd(pax_buf_t *buf, FILE *fd) {
+	PAXC_STATS_CALL_BEGIN();
+	bool              ok  = false;
+	bitmap_t         *bm  = NULL;
+	pax_native_map_t *map = paxc_map_file(fd);
+	if (!map) goto cleanup;
+	bm = calloc(1, sizeof(bitmap_t));
+	if (!bm) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		goto cleanup;
+	}
+	bm->maxval = 255;
+	if (!detect_parser(map->mem, map->len)(bm, map->mem, map->len)) goto cleanup;
+
+	// The pixels can only be used in place if the rows are top-down, unpadded and aligned.
+	pax_buf_type_t type    = bm->natural;
+	size_t         row_len = PAX_BUF_CALC_SIZE(bm->width, 1, type);
+	size_t         align   = PAX_GET_BPP(type) >= 32 ? 4 : PAX_GET_BPP(type) >= 16 ? 2 : 1;
+	size_t         pal_len = sizeof(pax_col_t) * bm->palette_size;
+	if (bm->direct && !bm->bottom_up && bm->stride == row_len && (uintptr_t) bm->pixels % align == 0) {
+		PAX_LOGD(TAG, "Mapping %dx%d as %08x in place", (int) bm->width, (int) bm->height, type);
+		if (pal_len && !(map->owned = malloc(pal_len))) {
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			goto cleanup;
+		}
+		paxc_buf_init(buf, (void *) bm->pixels, bm->width, bm->height, type);
+		if (pal_len) copy_palette(bm, buf, map->owned);
+	} else {
+		// Decode into memory owned by the map, with the palette after the pixels.
+		PAX_LOGD(TAG, "Decoding %dx%d to %08x", (int) bm->width, (int) bm->height, type);
+		size_t   size = (PAX_BUF_CALC_SIZE(bm->width, bm->height, type) + 3) & ~(size_t) 3;
+		uint8_t *rgba = needs_rgba(bm, type) ? malloc((size_t) bm->width * 4) : NULL;
+		map->owned    = malloc(size + pal_len);
+		if (!map->owned || (needs_rgba(bm, type) && !rgba)) {
+			free(rgba);
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			goto cleanup;
+		}
+		paxc_buf_init(buf, map->owned, bm->width, bm->height, type);
+		if (pal_len) copy_palette(bm, buf, (pax_col_t *) ((uint8_t *) map->owned + size));
+		bitmap_fill(bm, buf, rgba);
+		free(rgba);
+		paxc_map_release_file(map);
+	}
+	buf->do_free_pal = false;
+	ok = true;
+
+	cleanup:
+	free(bm);
+	if (!ok && map) {
+		pax_unmap_native(map);
+		map = NULL;
+	}
+	PAXC_STATS_CALL_END();
+	return map;
+}
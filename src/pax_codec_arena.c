@@ -0,0 +1,140 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#include "pax_codecs_internal.h"
+
+#include <string.h>
+
+// The arena allocations on this thread come from.
+static PAXC_THREAD_LOCAL paxc_arena_t *cur_arena;
+
+// Size prefix of arena allocations, padded to keep the memory after it aligned.
+typedef union {
+	size_t      size;
+	max_align_t align;
+} arena_head_t;
+
+// Rounds `size` up to the alignment of arena allocations.
+static inline size_t arena_round(size_t size) {
+	return (size + sizeof(arena_head_t) - 1) / sizeof(arena_head_t) * sizeof(arena_head_t);
+}
+
+// Whether `head` lies in the arena's block.
+static inline bool arena_owns(const paxc_arena_t *arena, const arena_head_t *head) {
+	return arena->mem && (const uint8_t *) head >= arena->mem && (const uint8_t *) head < arena->mem + arena->cap;
+}
+
+
+
+// Makes `arena` the source of paxc_arena_malloc and friends on this thread and empties it.
+void paxc_arena_begin(paxc_arena_t *arena) {
+	arena->used   = 0;
+	arena->demand = 0;
+	cur_arena     = arena;
+}
+
+// Stops using `arena` and grows it if the call needed more memory than it had.
+void paxc_arena_end(paxc_arena_t *arena) {
+	cur_arena = NULL;
+	if (arena->demand > arena->cap) {
+		// Grow for next time; failing that, the next call spills to the heap again.
+		paxc_free(arena->mem);
+		arena->mem = paxc_malloc(arena->demand);
+		arena->cap = arena->mem ? arena->demand : 0;
+	}
+	arena->used   = 0;
+	arena->demand = 0;
+}
+
+// Frees the memory held by `arena`.
+void paxc_arena_destroy(paxc_arena_t *arena) {
+	paxc_free(arena->mem);
+	arena->mem = NULL;
+	arena->cap = 0;
+}
+
+// Allocates from the arena given to paxc_arena_begin on this thread.
+void *paxc_arena_malloc(size_t size) {
+	paxc_arena_t *arena = cur_arena;
+	if (size > SIZE_MAX / 2) return NULL;
+	size_t        total = sizeof(arena_head_t) + arena_round(size);
+	arena_head_t *head;
+	if (arena->cap - arena->used >= total) {
+		head         = (arena_head_t *) (arena->mem + arena->used);
+		arena->used += total;
+	} else {
+		head = paxc_malloc(total);
+		if (!head) return NULL;
+	}
+	head->size     = size;
+	arena->demand += total;
+	return head + 1;
+}
+
+// Allocates zeroed memory from the arena given to paxc_arena_begin on this thread.
+void *paxc_arena_calloc(size_t count, size_t size) {
+	if (size && count > SIZE_MAX / size) return NULL;
+	void *mem = paxc_arena_malloc(count * size);
+	if (mem) memset(mem, 0, count * size);
+	return mem;
+}
+
+// Resizes memory from the arena given to paxc_arena_begin on this thread.
+void *paxc_arena_realloc(void *ptr, size_t size) {
+	if (!ptr) return paxc_arena_malloc(size);
+	paxc_arena_t *arena = cur_arena;
+	arena_head_t *head  = (arena_head_t *) ptr - 1;
+	size_t        old   = arena_round(head->size);
+	if (arena_owns(arena, head) && (uint8_t *) ptr + old == arena->mem + arena->used && size <= SIZE_MAX / 2) {
+		// The most recent allocation can grow or shrink in place.
+		size_t want = arena_round(size);
+		if (want <= old || arena->cap - arena->used >= want - old) {
+			arena->used   = arena->used - old + want;
+			arena->demand = arena->demand - old + want;
+			head->size    = size;
+			return ptr;
+		}
+	}
+	void *mem = paxc_arena_malloc(size);
+	if (!mem) return NULL;
+	memcpy(mem, ptr, head->size < size ? head->size : size);
+	paxc_arena_free(ptr);
+	return mem;
+}
+
+// Frees memory from the arena given to paxc_arena_begin on this thread.
+// Space in the block is only reclaimed for the most recent allocation; the rest waits for the next call.
+void paxc_arena_free(void *ptr) {
+	if (!ptr) return;
+	paxc_arena_t *arena = cur_arena;
+	arena_head_t *head  = (arena_head_t *) ptr - 1;
+	size_t        total = sizeof(arena_head_t) + arena_round(head->size);
+	if (!arena_owns(arena, head)) {
+		paxc_free(head);
+	} else if ((uint8_t *) head + total == arena->mem + arena->used) {
+		arena->used   -= total;
+		arena->demand -= total;
+	}
+}
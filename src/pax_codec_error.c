@@ -0,0 +1,69 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+// The most recent error on this thread.
+static PAXC_THREAD_LOCAL pax_codec_error_t last_error;
+
+
+
+// Gets the most recent error reported by a codec call on this thread.
+const pax_codec_error_t *pax_codec_last_error(void) {
+	return &last_error;
+}
+
+// Resets this thread's codec error to PAX_OK.
+void pax_codec_clear_error(void) {
+	last_error.code       = PAX_OK;
+	last_error.message[0] = 0;
+}
+
+// Records an error for pax_codec_last_error, mirrors it into pax_last_error and logs it.
+void paxc_error(const char *tag, pax_err_t code, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(last_error.message, sizeof(last_error.message), fmt, args);
+	va_end(args);
+	last_error.code = code;
+	pax_last_error  = code;
+	PAX_LOGE(tag, "%s", last_error.message);
+}
+
+// Wraps pax_buf_init, reporting an error if the buffer can't be allocated.
+bool paxc_buf_init(pax_buf_t *buf, void *mem, int width, int height, pax_buf_type_t type) {
+	// pax_buf_init leaves the buffer untouched when it fails.
+	buf->buf = NULL;
+	pax_buf_init(buf, mem, width, height, type);
+	if (!buf->buf) {
+		paxc_error("pax_codecs", PAX_ERR_NOMEM, "Out of memory for a %dx%d buffer", width, height);
+		return false;
+	}
+	return true;
+}
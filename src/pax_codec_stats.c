@@ -0,0 +1,150 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+
+#if defined(ESP_PLATFORM)
+#include <esp_timer.h>
+#elif defined(PAX_PI_PICO) && PAX_PI_PICO
+#include <pico/time.h>
+#else
+#include <time.h>
+#endif
+
+#if PAX_CODECS_STATS
+
+// Stats of the codec call running on this thread, NULL when not collecting.
+PAXC_THREAD_LOCAL pax_codec_stats_t *paxc_stats;
+// Heap usage of the call running on this thread; may dip below zero when it frees older memory.
+static PAXC_THREAD_LOCAL ptrdiff_t mem_in_use;
+
+// Size prefix of tracked allocations, padded to keep the memory after it aligned.
+typedef union {
+	size_t      size;
+	max_align_t align;
+} alloc_head_t;
+
+#endif // PAX_CODECS_STATS
+
+
+
+// Starts collecting stats of the PNG encode and decode calls made on this thread into `stats`.
+void pax_codec_set_stats(pax_codec_stats_t *stats) {
+#if PAX_CODECS_STATS
+	paxc_stats = stats;
+#else
+	(void) stats;
+#endif
+}
+
+// Monotonic time in nanoseconds.
+uint64_t paxc_time_ns(void) {
+#if defined(ESP_PLATFORM)
+	return esp_timer_get_time() * 1000;
+#elif defined(PAX_PI_PICO) && PAX_PI_PICO
+	return time_us_64() * 1000;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#if PAX_CODECS_STATS
+
+// Starts a public codec call: resets the memory tracking and returns the start time.
+uint64_t paxc_stats_call_begin(void) {
+	if (!paxc_stats) return 0;
+	mem_in_use = 0;
+	return paxc_time_ns();
+}
+
+// Ends a public codec call started at `start`.
+void paxc_stats_call_end(uint64_t start) {
+	if (paxc_stats) paxc_stats->total_ns += paxc_time_ns() - start;
+}
+
+// Records `count` allocations and a change in heap usage of `delta` bytes.
+void paxc_stats_mem(int count, ptrdiff_t delta) {
+	if (!paxc_stats) return;
+	paxc_stats->allocs += count;
+	mem_in_use         += delta;
+	if (mem_in_use > 0 && (size_t) mem_in_use > paxc_stats->peak_mem) {
+		paxc_stats->peak_mem = mem_in_use;
+	}
+}
+
+// Allocation functions that keep track of heap usage for the stats.
+void *paxc_malloc(size_t size) {
+	if (size > SIZE_MAX - sizeof(alloc_head_t)) return NULL;
+	alloc_head_t *head = malloc(sizeof(alloc_head_t) + size);
+	if (!head) return NULL;
+	head->size = size;
+	paxc_stats_mem(1, size);
+	return head + 1;
+}
+
+void *paxc_calloc(size_t count, size_t size) {
+	if (size && count > (SIZE_MAX - sizeof(alloc_head_t)) / size) return NULL;
+	alloc_head_t *head = calloc(1, sizeof(alloc_head_t) + count * size);
+	if (!head) return NULL;
+	head->size = count * size;
+	paxc_stats_mem(1, count * size);
+	return head + 1;
+}
+
+void *paxc_realloc(void *ptr, size_t size) {
+	if (!ptr) return paxc_malloc(size);
+	if (size > SIZE_MAX - sizeof(alloc_head_t)) return NULL;
+	alloc_head_t *head     = (alloc_head_t *) ptr - 1;
+	size_t        old_size = head->size;
+	head = realloc(head, sizeof(alloc_head_t) + size);
+	if (!head) return NULL;
+	head->size = size;
+	paxc_stats_mem(1, (ptrdiff_t) size - (ptrdiff_t) old_size);
+	return head + 1;
+}
+
+void paxc_free(void *ptr) {
+	if (!ptr) return;
+	alloc_head_t *head = (alloc_head_t *) ptr - 1;
+	paxc_stats_mem(0, -(ptrdiff_t) head->size);
+	free(head);
+}
+
+// zlib allocation hooks built on the above.
+voidpf paxc_zalloc(voidpf opaque, uInt items, uInt size) {
+	(void) opaque;
+	if (size && items > SIZE_MAX / size) return NULL;
+	return paxc_malloc((size_t) items * size);
+}
+
+void paxc_zfree(voidpf opaque, voidpf ptr) {
+	(void) opaque;
+	paxc_free(ptr);
+}
+
+#endif // PAX_CODECS_STATS
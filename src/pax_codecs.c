@@ -23,28 +23,65 @@
 */
 
 #include "pax_codecs.h"
+#include "pax_codecs_internal.h"
 #include "pax_internal.h"
 #include "spng.h"
 #include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
 
 static const char *TAG = "pax_codecs";
 
 static const uint32_t adam7_x_start[7] = { 0, 4, 0, 2, 0, 1, 0 };
 static const uint32_t adam7_x_delta[7] = { 8, 8, 4, 4, 2, 2, 1 };
 
+// Allocation functions for libspng and the decoder's own scratch memory.
+static const struct spng_alloc png_alloc_default = {
+	.malloc_fn  = paxc_malloc,
+	.realloc_fn = paxc_realloc,
+	.calloc_fn  = paxc_calloc,
+	.free_fn    = paxc_free,
+};
+static const struct spng_alloc png_alloc_arena = {
+	.malloc_fn  = paxc_arena_malloc,
+	.realloc_fn = paxc_arena_realloc,
+	.calloc_fn  = paxc_arena_calloc,
+	.free_fn    = paxc_arena_free,
+};
+
+static spng_ctx *png_ctx_new(const struct spng_alloc *alloc);
+static void png_error(int err);
 static bool png_info(pax_png_info_t *info, spng_ctx *ctx);
-static bool png_encode(const pax_buf_t *framebuffer, spng_ctx *ctx, int x, int y, int width, int height);
-static bool png_decode(pax_buf_t *framebuffer, spng_ctx *ctx, pax_buf_type_t buf_type, int flags, int x, int y);
-static bool png_decode_progressive(pax_buf_t *framebuffer, spng_ctx *ctx, struct spng_ihdr ihdr, pax_buf_type_t buf_type, int dx, int dy, int flags);
+static bool png_decode(pax_buf_t *framebuffer, spng_ctx *ctx, const struct spng_alloc *alloc, pax_buf_type_t buf_type, int flags, int x, int y);
+
+// State of a PNG decode into a buffer, which may be spread over several calls.
+typedef struct {
+	pax_buf_t               *framebuffer;
+	const struct spng_alloc *alloc;
+	pax_buf_type_t           buf_type;
+	int                      flags;
+	int                      x_offset;
+	int                      y_offset;
+	// Whether the buffer is allocated by the decode, and whether that has happened yet.
+	bool                     do_alloc;
+	bool                     allocated;
+	int                      put_mode;
+	paxc_png_rows_t          rows;
+} png_decode_t;
+
+static bool png_decode_begin(png_decode_t *dec, pax_buf_t *framebuffer, spng_ctx *ctx, bool own_ctx, const struct spng_alloc *alloc, pax_buf_type_t buf_type, int flags, int x, int y);
+static int png_decode_rows(png_decode_t *dec, uint32_t max_rows, uint64_t deadline);
+static bool png_decode_end(png_decode_t *dec, bool ok);
+static bool png_decode_trailer(png_decode_t *dec);
 
 // Decodes a PNG file into a PAX buffer with the specified type.
-// Returns 1 on successful decode, refer to pax_last_error otherwise.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
 // It is not gauranteed the type equals buf_type.
 bool pax_info_png_fd(pax_png_info_t *info, FILE *fd) {
-	spng_ctx *ctx = spng_ctx_new(0);
+	spng_ctx *ctx = png_ctx_new(&png_alloc_default);
 	int err = spng_set_png_file(ctx, fd);
 	if (err) {
+		png_error(err);
 		spng_ctx_free(ctx);
 		return false;
 	}
@@ -54,12 +91,13 @@ bool pax_info_png_fd(pax_png_info_t *info, FILE *fd) {
 }
 
 // Decodes a PNG buffer into a PAX buffer with the specified type.
-// Returns 1 on successful decode, refer to pax_last_error otherwise.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
 // It is not gauranteed the type equals buf_type.
 bool pax_info_png_buf(pax_png_info_t *info, const void *buf, size_t buf_len) {
-	spng_ctx *ctx = spng_ctx_new(0);
+	spng_ctx *ctx = png_ctx_new(&png_alloc_default);
 	int err = spng_set_png_buffer(ctx, buf, buf_len);
 	if (err) {
+		png_error(err);
 		spng_ctx_free(ctx);
 		return false;
 	}
@@ -70,113 +108,374 @@ bool pax_info_png_buf(pax_png_info_t *info, const void *buf, size_t buf_len) {
 
 
 // Encodes a pax buffer into a PNG file.
-// Returns 1 on successful encode, refer to pax_last_error otherwise.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
 bool pax_encode_png_fd(const pax_buf_t *buf, FILE *fd, int x, int y, int width, int height) {
-	spng_ctx *ctx = spng_ctx_new(SPNG_CTX_ENCODER);
-	int err = spng_set_png_file(ctx, fd);
-	if (err) {
-		PAX_LOGE(TAG, "%s", spng_strerror(err));
-		spng_ctx_free(ctx);
-		pax_last_error = PAX_ERR_ENCODE;
-		return false;
-	}
-	bool ret = png_encode(buf, ctx, x, y, width, height);
-	spng_ctx_free(ctx);
-	return ret;
+	return pax_encode_png_fd_opts(buf, fd, x, y, width, height, NULL);
 }
 
 // Encodes a pax buffer into a PNG buffer.
-// Returns 1 on successful encode, refer to pax_last_error otherwise.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
 bool pax_encode_png_buf(const pax_buf_t *buf, void **outbuf, size_t *len, int x, int y, int width, int height) {
-	spng_ctx *ctx = spng_ctx_new(SPNG_CTX_ENCODER);
-    spng_set_option(ctx, SPNG_ENCODE_TO_BUFFER, 1);
-	bool ret = png_encode(buf, ctx, x, y, width, height);
-	if (!ret) {
-		spng_ctx_free(ctx);
-		pax_last_error = PAX_ERR_ENCODE;
-		return 0;
+	return pax_encode_png_buf_opts(buf, outbuf, len, x, y, width, height, NULL);
+}
+
+// Encodes a pax buffer into a PNG file with the given encoder settings.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_encode_png_fd_opts(const pax_buf_t *buf, FILE *fd, int x, int y, int width, int height, const pax_png_encode_opts_t *opts) {
+	PAXC_STATS_CALL_BEGIN();
+	paxc_png_writer_t writer;
+	bool              ret = false;
+	if (!paxc_png_writer_init(&writer, opts, paxc_sink_file, fd)) goto cleanup;
+	ret = paxc_png_encode(buf, &writer, x, y, width, height);
+	paxc_png_writer_destroy(&writer);
+
+	cleanup:
+	PAXC_STATS_CALL_END();
+	return ret;
+}
+
+// Encodes a pax buffer into a PNG buffer with the given encoder settings.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_encode_png_buf_opts(const pax_buf_t *buf, void **outbuf, size_t *len, int x, int y, int width, int height, const pax_png_encode_opts_t *opts) {
+	PAXC_STATS_CALL_BEGIN();
+	paxc_membuf_t     out = {0};
+	paxc_png_writer_t writer;
+	bool              ret = false;
+	*outbuf = NULL;
+	*len    = 0;
+	if (!paxc_png_writer_init(&writer, opts, paxc_sink_mem, &out)) goto cleanup;
+	ret = paxc_png_encode(buf, &writer, x, y, width, height);
+	paxc_png_writer_destroy(&writer);
+	if (ret) {
+		*outbuf = out.data;
+		*len    = out.len;
+	} else {
+		free(out.data);
+	}
+
+	cleanup:
+	PAXC_STATS_CALL_END();
+	return ret;
+}
+
+// Encodes a PNG from rows produced by `source` and streams the output to `sink`.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_encode_png_stream(uint32_t width, uint32_t height, int color_type, pax_png_row_source_t source, void *source_cookie, pax_codec_sink_t sink, void *sink_cookie, const pax_png_encode_opts_t *opts) {
+	if (color_type != 0 && color_type != 2 && color_type != 4 && color_type != 6) {
+		PAXC_ERROR(PAX_ERR_PARAM, "Unsupported color type %d", color_type);
+		return false;
 	}
+	PAXC_STATS_CALL_BEGIN();
+	paxc_png_writer_t writer;
+	size_t            row_bytes = paxc_png_row_bytes(width, 8, color_type);
+	uint8_t          *row       = NULL;
+	bool              ok        = false;
+	if (!paxc_png_writer_init(&writer, opts, sink, sink_cookie)) goto cleanup;
 	
-	int err;
-	*outbuf = spng_get_png_buffer(ctx, len, &err);
-	spng_ctx_free(ctx);
-	if (err) {
-		PAX_LOGE(TAG, "%s", spng_strerror(err));
-		pax_last_error = PAX_ERR_ENCODE;
-		*outbuf = NULL;
-		*len = 0;
+	row = paxc_malloc(row_bytes);
+	if (!row) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		goto destroy;
+	}
+	
+	ok = paxc_png_write_ihdr(&writer, width, height, 8, color_type) && paxc_png_image_begin(&writer, width, height);
+	for (uint32_t y = 0; ok && y < height; y++) {
+		// Pull a row from the source and feed it to the encoder.
+		PAXC_STATS_BEGIN(source);
+		bool have_row = source(source_cookie, y, row, width);
+		PAXC_STATS_END(source, convert_ns);
+		if (!have_row) {
+			PAXC_ERROR(PAX_ERR_ENCODE, "Row source failed at row %" PRIu32, y);
+			ok = false;
+			break;
+		}
+		PAXC_STATS_ADD(rows, 1);
+		PAXC_STATS_ADD(bytes_in, row_bytes);
+		ok = paxc_png_image_row(&writer, row);
 	}
-	return !err;
+	ok = ok && paxc_png_image_end(&writer) && paxc_png_write_iend(&writer);
+	
+	destroy:
+	paxc_free(row);
+	paxc_png_writer_destroy(&writer);
+	cleanup:
+	PAXC_STATS_CALL_END();
+	return ok;
 }
 
 
 // Decodes a PNG file into a buffer with the specified type.
-// Returns 1 on successful decode, refer to pax_last_error otherwise.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
 bool pax_decode_png_fd(pax_buf_t *framebuffer, FILE *fd, pax_buf_type_t buf_type, int flags) {
-	spng_ctx *ctx = spng_ctx_new(0);
+	PAXC_STATS_CALL_BEGIN();
+#if PAX_CODECS_STATS
+	long start = paxc_stats ? ftell(fd) : 0;
+#endif
+	spng_ctx *ctx = png_ctx_new(&png_alloc_default);
 	int err = spng_set_png_file(ctx, fd);
+	bool ret = false;
 	if (err) {
-		spng_ctx_free(ctx);
-		return false;
+		png_error(err);
+		goto cleanup;
 	}
-	bool ret = png_decode(framebuffer, ctx, buf_type, flags, 0, 0);
+	ret = png_decode(framebuffer, ctx, &png_alloc_default, buf_type, flags, 0, 0);
+
+	cleanup:
 	spng_ctx_free(ctx);
+#if PAX_CODECS_STATS
+	if (paxc_stats && start >= 0) paxc_stats->bytes_in += ftell(fd) - start;
+#endif
+	PAXC_STATS_CALL_END();
 	return ret;
 }
 
 // Decodes a PNG buffer into a PAX buffer with the specified type.
-// Returns 1 on successful decode, refer to pax_last_error otherwise.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
 bool pax_decode_png_buf(pax_buf_t *framebuffer, const void *buf, size_t buf_len, pax_buf_type_t buf_type, int flags) {
-	spng_ctx *ctx = spng_ctx_new(0);
+	PAXC_STATS_CALL_BEGIN();
+	spng_ctx *ctx = png_ctx_new(&png_alloc_default);
 	int err = spng_set_png_buffer(ctx, buf, buf_len);
+	bool ret = false;
 	if (err) {
-		spng_ctx_free(ctx);
-		return false;
+		png_error(err);
+		goto cleanup;
 	}
-	bool ret = png_decode(framebuffer, ctx, buf_type, flags, 0, 0);
+	ret = png_decode(framebuffer, ctx, &png_alloc_default, buf_type, flags, 0, 0);
+
+	cleanup:
 	spng_ctx_free(ctx);
+	PAXC_STATS_ADD(bytes_in, buf_len);
+	PAXC_STATS_CALL_END();
 	return ret;
 }
 
 
 // Decodes a PNG file into an existing PAX buffer.
 // Takes an x/y pair for offset.
-// Returns 1 on successful decode, refer to pax_last_error otherwise.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
 bool pax_insert_png_fd(pax_buf_t *framebuffer, FILE *fd, int x, int y, int flags) {
-	spng_ctx *ctx = spng_ctx_new(0);
+	PAXC_STATS_CALL_BEGIN();
+#if PAX_CODECS_STATS
+	long start = paxc_stats ? ftell(fd) : 0;
+#endif
+	spng_ctx *ctx = png_ctx_new(&png_alloc_default);
 	int err = spng_set_png_file(ctx, fd);
+	bool ret = false;
 	if (err) {
-		spng_ctx_free(ctx);
-		return false;
+		png_error(err);
+		goto cleanup;
 	}
-	bool ret = png_decode(framebuffer, ctx, framebuffer->type, flags | CODEC_FLAG_EXISTING, x, y);
+	ret = png_decode(framebuffer, ctx, &png_alloc_default, framebuffer->type, flags | CODEC_FLAG_EXISTING, x, y);
+
+	cleanup:
 	spng_ctx_free(ctx);
+#if PAX_CODECS_STATS
+	if (paxc_stats && start >= 0) paxc_stats->bytes_in += ftell(fd) - start;
+#endif
+	PAXC_STATS_CALL_END();
 	return ret;
 }
 
 // Decodes a PNG buffer into an existing PAX buffer.
 // Takes an x/y pair for offset.
-// Returns 1 on successful decode, refer to pax_last_error otherwise.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
 bool pax_insert_png_buf(pax_buf_t *framebuffer, const void *png, size_t png_len, int x, int y, int flags) {
-	spng_ctx *ctx = spng_ctx_new(0);
+	PAXC_STATS_CALL_BEGIN();
+	spng_ctx *ctx = png_ctx_new(&png_alloc_default);
 	int err = spng_set_png_buffer(ctx, png, png_len);
+	bool ret = false;
 	if (err) {
-		spng_ctx_free(ctx);
-		return false;
+		png_error(err);
+		goto cleanup;
 	}
-	bool ret = png_decode(framebuffer, ctx, framebuffer->type, flags | CODEC_FLAG_EXISTING, x, y);
+	ret = png_decode(framebuffer, ctx, &png_alloc_default, framebuffer->type, flags | CODEC_FLAG_EXISTING, x, y);
+
+	cleanup:
 	spng_ctx_free(ctx);
+	PAXC_STATS_ADD(bytes_in, png_len);
+	PAXC_STATS_CALL_END();
 	return ret;
 }
 
 
+// Row reader state behind pax_png_rows_t.
+struct pax_png_rows {
+	paxc_png_rows_t rows;
+	// The current row as ARGB.
+	pax_col_t      *pixels;
+};
+
+// Opens a PNG held in memory for reading row by row; the memory must stay valid until the reader is freed.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_png_rows_t *pax_png_rows_new_buf(const void *png, size_t png_len) {
+	pax_png_rows_t *reader = paxc_calloc(1, sizeof(pax_png_rows_t));
+	spng_ctx       *ctx    = png_ctx_new(&png_alloc_default);
+	if (!reader || !ctx) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		spng_ctx_free(ctx);
+		paxc_free(reader);
+		return NULL;
+	}
+	int err = spng_set_png_buffer(ctx, png, png_len);
+	if (err) {
+		png_error(err);
+		spng_ctx_free(ctx);
+		paxc_free(reader);
+		return NULL;
+	}
+	// From here on, the row reader owns the context.
+	if (!paxc_png_rows_begin(&reader->rows, ctx, &png_alloc_default, true)) {
+		pax_png_rows_free(reader);
+		return NULL;
+	}
+	reader->pixels = paxc_malloc(sizeof(pax_col_t) * reader->rows.width);
+	if (!reader->pixels) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		pax_png_rows_free(reader);
+		return NULL;
+	}
+	return reader;
+}
+
+// Frees a row reader; the rows don't have to be read to the end first.
+void pax_png_rows_free(pax_png_rows_t *reader) {
+	if (!reader) return;
+	paxc_png_rows_end(&reader->rows);
+	paxc_free(reader->pixels);
+	paxc_free(reader);
+}
+
+// Gets the size and format of the PNG.
+void pax_png_rows_info(const pax_png_rows_t *reader, pax_png_info_t *info) {
+	info->width      = reader->rows.width;
+	info->height     = reader->rows.height;
+	info->bit_depth  = reader->rows.bit_depth;
+	info->color_type = reader->rows.color_type;
+}
+
+// Decodes the next row into `row`.
+// Returns 1 on success, 0 after the last row or on error, which pax_png_rows_done tells apart.
+bool pax_png_rows_next(pax_png_rows_t *reader, pax_png_row_t *row) {
+	if (paxc_png_rows_next(&reader->rows) <= 0) return false;
+	PAXC_STATS_BEGIN(convert);
+	row->count  = paxc_png_rows_argb(&reader->rows, reader->pixels);
+	PAXC_STATS_END(convert, convert_ns);
+	row->pixels = reader->pixels;
+	row->y      = reader->rows.y;
+	row->pass   = reader->rows.pass;
+	row->x      = reader->rows.x;
+	row->dx     = reader->rows.dx;
+	return true;
+}
+
+// Whether every row has been read without error.
+bool pax_png_rows_done(const pax_png_rows_t *reader) {
+	return reader->rows.done && !reader->rows.failed;
+}
+
+
+// Decode state behind pax_png_step_t.
+struct pax_png_step {
+	png_decode_t dec;
+	// Whether rows remain, and once they don't, whether they all decoded.
+	bool         running;
+	bool         ok;
+};
+
+// Starts a stepped decode for pax_png_decode_begin and pax_png_insert_begin.
+static pax_png_step_t *png_step_begin(pax_buf_t *framebuffer, const void *png, size_t png_len, pax_buf_type_t buf_type, int flags, int x, int y) {
+	PAXC_STATS_CALL_BEGIN();
+	pax_png_step_t *step = paxc_calloc(1, sizeof(pax_png_step_t));
+	spng_ctx       *ctx  = png_ctx_new(&png_alloc_default);
+	int             err;
+	if (!step || !ctx) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		goto error;
+	}
+	err = spng_set_png_buffer(ctx, png, png_len);
+	if (err) {
+		png_error(err);
+		goto error;
+	}
+	// From here on, the decode owns the context.
+	step->running = png_decode_begin(&step->dec, framebuffer, ctx, true, &png_alloc_default, buf_type, flags, x, y);
+	if (!step->running) {
+		png_decode_end(&step->dec, false);
+		paxc_free(step);
+		step = NULL;
+	}
+	PAXC_STATS_ADD(bytes_in, png_len);
+	PAXC_STATS_CALL_END();
+	return step;
+
+	error:
+	spng_ctx_free(ctx);
+	paxc_free(step);
+	PAXC_STATS_CALL_END();
+	return NULL;
+}
+
+// Starts decoding a PNG held in memory into `buf` like pax_decode_png_buf, without decoding any rows yet.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_png_step_t *pax_png_decode_begin(pax_buf_t *framebuffer, const void *png, size_t png_len, pax_buf_type_t buf_type, int flags) {
+	return png_step_begin(framebuffer, png, png_len, buf_type, flags, 0, 0);
+}
+
+// Starts drawing a PNG held in memory onto `buf` like pax_insert_png_buf, without decoding any rows yet.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_png_step_t *pax_png_insert_begin(pax_buf_t *framebuffer, const void *png, size_t png_len, int x, int y, int flags) {
+	return png_step_begin(framebuffer, png, png_len, framebuffer->type, flags | CODEC_FLAG_EXISTING, x, y);
+}
+
+// Decodes up to `max_rows` rows or for up to `max_us` microseconds, whichever comes first.
+// Returns 1 once the decode has finished or failed, which pax_png_decode_end tells apart.
+bool pax_png_decode_step(pax_png_step_t *step, uint32_t max_rows, uint32_t max_us) {
+	if (!step->running) return true;
+	PAXC_STATS_CALL_BEGIN();
+	uint64_t deadline = max_us ? paxc_time_ns() + (uint64_t) max_us * 1000 : 0;
+	int      res      = png_decode_rows(&step->dec, max_rows, deadline);
+	if (res <= 0) {
+		step->running = false;
+		step->ok      = res == 0;
+	}
+	PAXC_STATS_CALL_END();
+	return !step->running;
+}
+
+// Finishes a stepped decode and frees its state.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_png_decode_end(pax_png_step_t *step) {
+	PAXC_STATS_CALL_BEGIN();
+	bool ok = step->ok;
+	if (step->running) {
+		PAXC_ERROR(PAX_CODEC_ERR_CANCELED, "Decode ended before the last row");
+		ok = false;
+	}
+	ok = png_decode_end(&step->dec, ok);
+	paxc_free(step);
+	PAXC_STATS_CALL_END();
+	return ok;
+}
+
+
+// Creates a libspng context that allocates through `alloc`.
+static spng_ctx *png_ctx_new(const struct spng_alloc *alloc) {
+	// libspng copies the functions; it never writes to them.
+	return spng_ctx_new2((struct spng_alloc *) alloc, 0);
+}
+
+// Reports a libspng error.
+static void png_error(int err) {
+	PAXC_ERROR(err == SPNG_EMEM ? PAX_ERR_NOMEM : PAX_ERR_DECODE, "PNG decode error %d: %s", err, spng_strerror(err));
+}
+
 // A generic wrapper for getting PNG infos.
 static bool png_info(pax_png_info_t *info, spng_ctx *ctx) {
 	struct spng_ihdr ihdr;
 	int err = spng_get_ihdr(ctx, &ihdr);
 	if (err) {
 		PAX_LOGE(TAG, "Failed at spng_get_ihdr");
-		PAX_LOGE(TAG, "PNG decode error %d: %s", err, spng_strerror(err));
+		png_error(err);
 		return false;
 	}
 	info->width  = ihdr.width;
@@ -186,16 +485,51 @@ static bool png_info(pax_png_info_t *info, spng_ctx *ctx) {
 	return true;
 }
 
-// A generic wrapper for encoding PNGs.
-static bool png_encode(const pax_buf_t *framebuffer, spng_ctx *ctx, int dx, int dy, int width, int height) {
+// Gets PNG metadata from memory, allocating only from `arena`.
+bool paxc_png_info_arena(paxc_arena_t *arena, pax_png_info_t *info, const void *png, size_t png_len) {
+	paxc_arena_begin(arena);
+	spng_ctx *ctx = png_ctx_new(&png_alloc_arena);
+	int err = spng_set_png_buffer(ctx, png, png_len);
+	bool ret = false;
+	if (err) {
+		png_error(err);
+	} else {
+		ret = png_info(info, ctx);
+	}
+	spng_ctx_free(ctx);
+	paxc_arena_end(arena);
+	return ret;
+}
+
+// Decodes a PNG from memory like pax_decode_png_buf or pax_insert_png_buf, allocating only from `arena`.
+bool paxc_png_decode_arena(paxc_arena_t *arena, pax_buf_t *framebuffer, const void *png, size_t png_len, pax_buf_type_t buf_type, int flags, int x, int y) {
+	PAXC_STATS_CALL_BEGIN();
+	paxc_arena_begin(arena);
+	spng_ctx *ctx = png_ctx_new(&png_alloc_arena);
+	int err = spng_set_png_buffer(ctx, png, png_len);
+	bool ret = false;
+	if (err) {
+		png_error(err);
+	} else {
+		ret = png_decode(framebuffer, ctx, &png_alloc_arena, buf_type, flags, x, y);
+	}
+	spng_ctx_free(ctx);
+	paxc_arena_end(arena);
+	PAXC_STATS_ADD(bytes_in, png_len);
+	PAXC_STATS_CALL_END();
+	return ret;
+}
+
+// Encodes a region of `buf` as an RGBA PNG through `writer`, clamping the region to the buffer.
+bool paxc_png_encode(const pax_buf_t *framebuffer, paxc_png_writer_t *writer, int dx, int dy, int width, int height) {
 	// Clamp: horizontal.
 	if (dx < 0) {
-		dx     = 0;
 		width += dx;
+		dx     = 0;
 	}
 	if (dx > pax_buf_get_width(framebuffer)) {
 		// Out of bounds error.
-		pax_last_error = PAX_ERR_BOUNDS;
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Region is outside the buffer");
 		return 0;
 	}
 	if (dx + width > pax_buf_get_width(framebuffer)) {
@@ -204,84 +538,142 @@ static bool png_encode(const pax_buf_t *framebuffer, spng_ctx *ctx, int dx, int
 	
 	// Clamp: vertical.
 	if (dy < 0) {
-		dy      = 0;
 		height += dy;
+		dy      = 0;
 	}
 	if (dy > pax_buf_get_height(framebuffer)) {
 		// Out of bounds error.
-		pax_last_error = PAX_ERR_BOUNDS;
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Region is outside the buffer");
 		return 0;
 	}
 	if (dy + height > pax_buf_get_height(framebuffer)) {
 		height = pax_buf_get_height(framebuffer) - dy;
 	}
+	if (width <= 0 || height <= 0) {
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Region is empty");
+		return 0;
+	}
 	
 	// Set image properties.
-    struct spng_ihdr ihdr = {0};
-    ihdr.width = width;
-    ihdr.height = height;
-    ihdr.color_type = SPNG_COLOR_TYPE_TRUECOLOR_ALPHA;
-    ihdr.bit_depth = 8;
-	spng_set_ihdr(ctx, &ihdr);
+	if (!paxc_png_write_ihdr(writer, width, height, 8, SPNG_COLOR_TYPE_TRUECOLOR_ALPHA)) return 0;
 	
-	// Set encoding mode.
-	int err = spng_encode_image(ctx, NULL, 0, SPNG_FMT_PNG, SPNG_ENCODE_PROGRESSIVE | SPNG_ENCODE_FINALIZE);
+#if PAX_CODECS_THREADS
+	// Hand large jobs off to the banded encoder.
+	if (writer->opts.threads > 1) {
+		return paxc_png_image_parallel(writer, framebuffer, dx, dy, width, height) && paxc_png_write_iend(writer);
+	}
+#endif
 	
-	// Encode a few rows.
-	size_t   rowbufcap = sizeof(uint8_t) * 4 * width;
-	uint8_t *rowbuf    = malloc(rowbufcap);
-	if (!rowbuf) {
-		pax_last_error = PAX_ERR_NOMEM;
-		return 0;
+	if (!paxc_png_image_begin(writer, width, height)) return 0;
+	
+	// Encode a few rows; the row buffer is kept with the writer for reuse.
+	if (writer->rgba_cap < 4 * (size_t) width) {
+		paxc_free(writer->rgba);
+		writer->rgba     = paxc_malloc(4 * (size_t) width);
+		writer->rgba_cap = writer->rgba ? 4 * (size_t) width : 0;
+		if (!writer->rgba) {
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			return 0;
+		}
 	}
+	uint8_t *rowbuf = writer->rgba;
 	
-	for (int y = 0; y < height; y++) {
+	bool ok = true;
+	paxc_row_fetch_t fetch = paxc_get_row_fetch(framebuffer);
+	for (int y = 0; y < height && ok; y++) {
 		// Grab a row of pixels.
-		for (int x = 0; x < width; x++) {
-			pax_col_t col = pax_get_pixel(framebuffer, x + dx, y + dy);
-			rowbuf[4*x+0] = col >> 16; // R
-			rowbuf[4*x+1] = col >> 8;  // G
-			rowbuf[4*x+2] = col >> 0;  // B
-			rowbuf[4*x+3] = col >> 24; // A
-		}
+		PAXC_STATS_BEGIN(fetch);
+		fetch(framebuffer, dx, y + dy, width, rowbuf);
+		PAXC_STATS_END(fetch, convert_ns);
+		PAXC_STATS_ADD(rows, 1);
+		PAXC_STATS_ADD(bytes_in, 4 * width);
 		
 		// Feed it to the encoder.
-		err = spng_encode_row(ctx, rowbuf, rowbufcap);
-		if (err) break;
+		ok = paxc_png_image_row(writer, rowbuf);
 	}
-	free(rowbuf);
 	
-	if (err != SPNG_EOI) {
-		PAX_LOGE(TAG, "%s", spng_strerror(err));
-		pax_last_error = PAX_ERR_ENCODE;
-		return 0;
+	return ok && paxc_png_image_end(writer) && paxc_png_write_iend(writer);
+}
+
+// Picks the buffer type to decode an image without a palette into when `buf_type` is a palette type.
+pax_buf_type_t paxc_pick_buf_type(pax_buf_type_t buf_type, bool color, bool alpha) {
+	int bpp = PAX_GET_BPP(buf_type);
+	if (bpp == 1) {
+		// For 1BPP, the only option is greyscale.
+		buf_type = PAX_BUF_1_GREY;
+	} else if (bpp == 2) {
+		// For 2BPP, the only option is also greyscale.
+		buf_type = PAX_BUF_2_PAL;
+	} else if (bpp == 4) {
+		if (alpha || color) {
+			// With alpha and/or color.
+			buf_type = PAX_BUF_4_1111ARGB;
+		} else {
+			// Greyscale.
+			buf_type = PAX_BUF_4_GREY;
+		}
+	} else if (bpp == 8) {
+		if (alpha) {
+			// With alpha and/or color.
+			buf_type = PAX_BUF_8_2222ARGB;
+		} else if (color) {
+			// With color.
+			buf_type = PAX_BUF_8_332RGB;
+		} else {
+			// Greyscale.
+			buf_type = PAX_BUF_8_GREY;
+		}
+	} else {
+		if (alpha) {
+			// With alpha and/or color.
+			buf_type = PAX_BUF_16_4444ARGB;
+		} else if (color) {
+			// With color.
+			buf_type = PAX_BUF_16_565RGB;
+		} else {
+			// Greyscale.
+			buf_type = PAX_BUF_8_GREY;
+		}
 	}
-	
-	return 1;
+	return buf_type;
 }
 
 // A generic wrapper for decoding PNGs.
 // Sets up the framebuffer if required.
-static bool png_decode(pax_buf_t *framebuffer, spng_ctx *ctx, pax_buf_type_t buf_type, int flags, int x_offset, int y_offset) {
-	bool do_alloc = !(flags & CODEC_FLAG_EXISTING);
-	if (do_alloc) {
+static bool png_decode(pax_buf_t *framebuffer, spng_ctx *ctx, const struct spng_alloc *alloc, pax_buf_type_t buf_type, int flags, int x_offset, int y_offset) {
+	png_decode_t dec;
+	bool ok = png_decode_begin(&dec, framebuffer, ctx, false, alloc, buf_type, flags, x_offset, y_offset);
+	// Without a budget, all rows get decoded in one go.
+	ok = ok && png_decode_rows(&dec, 0, 0) == 0;
+	return png_decode_end(&dec, ok);
+}
+
+// Starts a decode: reads the chunks before the image data and sets up the framebuffer if required.
+// Must be followed by png_decode_end, even if it fails.
+static bool png_decode_begin(png_decode_t *dec, pax_buf_t *framebuffer, spng_ctx *ctx, bool own_ctx, const struct spng_alloc *alloc, pax_buf_type_t buf_type, int flags, int x_offset, int y_offset) {
+	PAX_LOGD(TAG, "Decode with flags 0x%08x", flags);
+	dec->framebuffer = framebuffer;
+	dec->alloc       = alloc;
+	dec->flags       = flags;
+	dec->x_offset    = x_offset;
+	dec->y_offset    = y_offset;
+	dec->do_alloc    = !(flags & CODEC_FLAG_EXISTING);
+	dec->allocated   = false;
+	if (dec->do_alloc) {
 		framebuffer->width  = 0;
 		framebuffer->height = 0;
 	} else {
 		buf_type = framebuffer->type;
 	}
+	dec->buf_type = buf_type;
 	
-	// Fetch the IHDR.
-	struct spng_ihdr ihdr;
-	int err = spng_get_ihdr(ctx, &ihdr);
-	if (err) {
-		PAX_LOGE(TAG, "Failed at spng_get_ihdr");
-		PAX_LOGE(TAG, "PNG decode error %d: %s", err, spng_strerror(err));
+	// Fetch the IHDR and the chunks before the image data.
+	if (!paxc_png_rows_begin(&dec->rows, ctx, alloc, own_ctx)) {
 		return false;
 	}
-	uint32_t width      = ihdr.width;
-	uint32_t height     = ihdr.height;
-	if (do_alloc) {
+	uint32_t width  = dec->rows.width;
+	uint32_t height = dec->rows.height;
+	if (dec->do_alloc) {
 		framebuffer->width  = width;
 		framebuffer->height = height;
 	} else {
@@ -289,75 +681,31 @@ static bool png_decode(pax_buf_t *framebuffer, spng_ctx *ctx, pax_buf_type_t buf
 	}
 	
 	// Select a good buffer type.
-	if (do_alloc && PAX_IS_PALETTE(buf_type) && ihdr.color_type != 3) {
+	if (dec->do_alloc && PAX_IS_PALETTE(buf_type) && dec->rows.color_type != 3) {
 		// This is not a palleted image, change the output type.
-		int bpp = PAX_GET_BPP(buf_type);
-		if (bpp == 1) {
-			// For 1BPP, the only option is greyscale.
-			buf_type = PAX_BUF_1_GREY;
-		} else if (bpp == 2) {
-			// For 2BPP, the only option is also greyscale.
-			buf_type = PAX_BUF_2_PAL;
-		} else if (bpp == 4) {
-			if ((ihdr.color_type & 4) || (ihdr.color_type & 2)) {
-				// With alpha and/or color.
-				buf_type = PAX_BUF_4_1111ARGB;
-			} else {
-				// Greyscale.
-				buf_type = PAX_BUF_4_GREY;
-			}
-		} else if (bpp == 8) {
-			if (ihdr.color_type & 4) {
-				// With alpha and/or color.
-				buf_type = PAX_BUF_8_2222ARGB;
-			} else if (ihdr.color_type & 2) {
-				// With color.
-				buf_type = PAX_BUF_8_332RGB;
-			} else {
-				// Greyscale.
-				buf_type = PAX_BUF_8_GREY;
-			}
-		} else {
-			if (ihdr.color_type & 4) {
-				// With alpha and/or color.
-				buf_type = PAX_BUF_16_4444ARGB;
-			} else if (ihdr.color_type & 2) {
-				// With color.
-				buf_type = PAX_BUF_16_565RGB;
-			} else {
-				// Greyscale.
-				buf_type = PAX_BUF_8_GREY;
-			}
-		}
+		buf_type = paxc_pick_buf_type(buf_type, dec->rows.color_type & 2, dec->rows.color_type & 4);
+		dec->buf_type = buf_type;
 		PAX_LOGW(TAG, "Changing buffer type to %08x", (int)buf_type);
 	}
 	
 	// Determine whether to allocate a buffer.
-	if (do_alloc) {
+	if (dec->do_alloc) {
 		// Allocate some funny.
 		PAX_LOGD(TAG, "Decoding PNG %dx%d to %08x", (int) width, (int) height, buf_type);
-		pax_buf_init(framebuffer, NULL, width, height, buf_type);
-		if (pax_last_error) return false;
+		if (!paxc_buf_init(framebuffer, NULL, width, height, buf_type)) return false;
+		PAXC_STATS_MEM(1, PAX_BUF_CALC_SIZE(width, height, buf_type));
+		dec->allocated = true;
 	}
-	
-	// Decd.
-	if (!png_decode_progressive(framebuffer, ctx, ihdr, buf_type, x_offset, y_offset, flags)) {
-		goto error;
+	if (PAX_IS_PALETTE(buf_type)) {
+		PAX_LOGD(TAG, "Buf has palette");
 	}
-	
-	// Success.
+	bool merge    = (flags & CODEC_FLAG_EXISTING) && !(flags & PAXC_FLAG_OVERWRITE);
+	dec->put_mode = paxc_png_put_mode(framebuffer, dec->rows.color_type, merge);
 	return true;
-	
-	error:
-	if (do_alloc) {
-		// Clean up in case of erruer.
-		pax_buf_destroy(framebuffer);
-	}
-	return false;
 }
 
-// Get the closest palette color.
-static pax_col_t closest_palette_index(pax_buf_t *buf, pax_col_t argb, bool ignore_alpha) {
+// Gets the index of the entry in the palette of `buf` closest to `argb`.
+pax_col_t paxc_closest_palette_index(const pax_buf_t *buf, pax_col_t argb, bool ignore_alpha) {
 	pax_col_t closest_index = 0;
 	uint16_t  closest_err   = UINT16_MAX;
 	for (size_t y = 0; y < buf->palette_size; y++) {
@@ -383,58 +731,162 @@ static pax_col_t closest_palette_index(pax_buf_t *buf, pax_col_t argb, bool igno
 	return closest_index;
 }
 
-// A WIP decode inator.
-static bool png_decode_progressive(pax_buf_t *framebuffer, spng_ctx *ctx, struct spng_ihdr ihdr, pax_buf_type_t buf_type, int x_offset, int y_offset, int flags) {
-	int err = 0;
-	uint8_t          *row  = NULL;
-	struct spng_plte *plte = NULL;
-	struct spng_trns *trns = NULL;
-	
-	PAX_LOGD(TAG, "Decode with flags 0x%08x", flags);
-	
-	// Get image parameters.
-	uint32_t width    = ihdr.width;
-	uint32_t height   = ihdr.height;
-	
-	// Reduce 16pbc back to 8pbc.
-	int png_fmt;
-	int bits_per_pixel;
-	uint32_t channel_mask;
-	uint_fast8_t shift_max = 0;
-	switch (ihdr.color_type) {
+// Sets up the row format for decoded rows of a PNG with this color type and bit depth.
+// Rows hold 8 bits per channel, except for palette images, which keep their packed indices.
+void paxc_png_row_fmt(paxc_png_row_fmt_t *fmt, int color_type, int bit_depth) {
+	fmt->color_type   = color_type;
+	fmt->shift_max    = 0;
+	fmt->palette      = NULL;
+	fmt->palette_size = 0;
+	switch (color_type) {
 		case 0:
 			// Greyscale.
-			png_fmt = SPNG_FMT_G8;
-			bits_per_pixel = 1 * 8;
-			channel_mask = 0x000000ff;
+			fmt->bits_per_pixel = 1 * 8;
+			fmt->channel_mask   = 0x000000ff;
 			break;
 		case 2:
 			// RGB.
-			png_fmt = SPNG_FMT_RGB8;
-			bits_per_pixel = 3 * 8;
-			channel_mask = 0x00ffffff;
+			fmt->bits_per_pixel = 3 * 8;
+			fmt->channel_mask   = 0x00ffffff;
 			break;
 		case 3:
 			// Palette.
-			png_fmt = SPNG_FMT_RAW;
-			bits_per_pixel = 1 * ihdr.bit_depth;
-			channel_mask = (1 << bits_per_pixel) - 1;
-			shift_max = 8 - ihdr.bit_depth;
+			fmt->bits_per_pixel = 1 * bit_depth;
+			fmt->channel_mask   = (1 << fmt->bits_per_pixel) - 1;
+			fmt->shift_max      = 8 - bit_depth;
 			break;
 		case 4:
 			// Greyscale and alpha.
-			png_fmt = SPNG_FMT_GA8;
-			bits_per_pixel = 2 * 8;
-			channel_mask = 0x0000ffff;
+			fmt->bits_per_pixel = 2 * 8;
+			fmt->channel_mask   = 0x0000ffff;
 			break;
 		case 6:
 		default:
 			// RGBA.
-			png_fmt = SPNG_FMT_RGBA8;
-			bits_per_pixel = 4 * 8;
-			channel_mask = 0xffffffff;
+			fmt->bits_per_pixel = 4 * 8;
+			fmt->channel_mask   = 0xffffffff;
 			break;
 	}
+}
+
+// Picks how decoded pixels of a PNG with this color type get written to `buf`.
+int paxc_png_put_mode(const pax_buf_t *buf, int color_type, bool merge) {
+	bool has_palette = color_type == 3;
+	if (!has_palette && PAX_IS_PALETTE(buf->type)) {
+		return merge ? PAXC_PUT_NEAREST_OVER : PAXC_PUT_NEAREST;
+	} else if (has_palette && PAX_IS_PALETTE(buf->type)) {
+		return PAXC_PUT_INDEX;
+	} else {
+		return merge ? PAXC_PUT_MERGE : PAXC_PUT_SET;
+	}
+}
+
+// Converts the pixel at bit `offset` of a decoded row to the color paxc_png_put_row writes.
+static inline pax_col_t png_row_pixel(const paxc_png_row_fmt_t *fmt, const uint8_t *row, size_t offset, int mode) {
+	// Get the raw data.
+	const void *address = row + (offset / 8);
+	// A slightly complicated bit extraction.
+	uint32_t raw = fmt->channel_mask & (*(const uint32_t *) address >> (fmt->shift_max - (offset % 8)));
+	// Fix endianness.
+	if (fmt->bits_per_pixel == 16) raw = (raw << 8) | (raw >> 8);
+	else if (fmt->bits_per_pixel == 24) raw = (raw << 16) | (raw >> 16) | (raw & 0x00ff00);
+	else if (fmt->bits_per_pixel == 32) raw = (raw << 24) | ((raw << 8) & 0x00ff0000) | ((raw >> 8) & 0x0000ff00) | (raw >> 24);
+	
+	// Decode color information.
+	if (mode == PAXC_PUT_INDEX) {
+		return raw;
+	} else if (fmt->color_type == 3) {
+		// Palette, resolved to ARGB beforehand.
+		if (raw >= fmt->palette_size) raw = 0;
+		return fmt->palette_size ? fmt->palette[raw] : 0;
+	} else if (fmt->color_type == 0) {
+		// Greyscale.
+		return 0xff000000 | (raw * 0x010101);
+	} else if (fmt->color_type == 2) {
+		// RGB.
+		return 0xff000000 | raw;
+	} else if (fmt->color_type == 4) {
+		// Greyscale and alpha.
+		return (raw << 24) | (((raw >> 8) & 0xff) * 0x00010101);
+	} else if (fmt->color_type == 6) {
+		// RGBA.
+		return (raw >> 8) | (raw << 24);
+	}
+	return 0;
+}
+
+// Writes the pixels of one decoded row to `buf` at row `y`.
+// The row holds the pixels for columns `x`, `x + dx`, ... up to `width`, placed relative to `x_offset`.
+// Reads up to 3 bytes past the end of the row.
+// Pixels are converted in small batches so conversion and writing can be timed separately.
+void paxc_png_put_row(pax_buf_t *buf, const paxc_png_row_fmt_t *fmt, const uint8_t *row, uint32_t x, uint32_t dx, uint32_t width, int x_offset, int y, int mode) {
+	pax_col_t colors[64];
+	size_t    offset = 0;
+	while (x < width) {
+		// Convert a batch of pixels.
+		PAXC_STATS_BEGIN(convert);
+		size_t count = 0;
+		for (uint32_t cx = x; cx < width && count < 64; cx += dx, count++) {
+			colors[count]  = png_row_pixel(fmt, row, offset, mode);
+			offset        += fmt->bits_per_pixel;
+		}
+		PAXC_STATS_END(convert, convert_ns);
+		
+		// Output the pixels to the right spot.
+		PAXC_STATS_BEGIN(write);
+		if (mode == PAXC_PUT_NEAREST || mode == PAXC_PUT_NEAREST_OVER) {
+			for (size_t i = 0; i < count; i++, x += dx) {
+				if (mode == PAXC_PUT_NEAREST || colors[i] >> 24) {
+					pax_set_pixel(buf, paxc_closest_palette_index(buf, colors[i], true), x_offset + x, y);
+				}
+			}
+			PAXC_STATS_END(write, palette_ns);
+		} else if (mode == PAXC_PUT_MERGE) {
+			for (size_t i = 0; i < count; i++, x += dx) {
+				pax_merge_pixel(buf, colors[i], x_offset + x, y);
+			}
+			PAXC_STATS_END(write, write_ns);
+		} else {
+			for (size_t i = 0; i < count; i++, x += dx) {
+				pax_set_pixel(buf, colors[i], x_offset + x, y);
+			}
+			PAXC_STATS_END(write, write_ns);
+		}
+	}
+}
+
+// Starts reading rows from `ctx`, allocating through `alloc`; reads the chunks before the image data.
+bool paxc_png_rows_begin(paxc_png_rows_t *rows, spng_ctx *ctx, const struct spng_alloc *alloc, bool own_ctx) {
+	memset(rows, 0, sizeof(paxc_png_rows_t));
+	rows->ctx     = ctx;
+	rows->alloc   = alloc;
+	rows->own_ctx = own_ctx;
+	
+	// Get image parameters.
+	struct spng_ihdr ihdr;
+	PAXC_STATS_BEGIN(ihdr);
+	int err = spng_get_ihdr(ctx, &ihdr);
+	PAXC_STATS_END(ihdr, header_ns);
+	if (err) {
+		PAX_LOGE(TAG, "Failed at spng_get_ihdr");
+		goto error;
+	}
+	rows->width      = ihdr.width;
+	rows->height     = ihdr.height;
+	rows->bit_depth  = ihdr.bit_depth;
+	rows->color_type = ihdr.color_type;
+	rows->interlaced = ihdr.interlace_method;
+	
+	// Reduce 16pbc back to 8pbc.
+	int png_fmt;
+	switch (ihdr.color_type) {
+		case 0:  png_fmt = SPNG_FMT_G8;    break;
+		case 2:  png_fmt = SPNG_FMT_RGB8;  break;
+		case 3:  png_fmt = SPNG_FMT_RAW;   break;
+		case 4:  png_fmt = SPNG_FMT_GA8;   break;
+		default: png_fmt = SPNG_FMT_RGBA8; break;
+	}
+	paxc_png_row_fmt(&rows->fmt, ihdr.color_type, ihdr.bit_depth);
 	PAX_LOGD(TAG, "PNG FMT %d", png_fmt);
 	
 	// Get the size for the fancy buffer.
@@ -444,8 +896,10 @@ static bool png_decode_progressive(pax_buf_t *framebuffer, spng_ctx *ctx, struct
 		PAX_LOGE(TAG, "Failed at spng_decoded_image_size");
 		goto error;
 	}
-	size_t   row_size = decd_len / height;
-	row = malloc(row_size);
+	rows->row_size = decd_len / ihdr.height;
+	// Some slack for the 32-bit reads in paxc_png_put_row.
+	rows->row = alloc->malloc_fn(rows->row_size + 3);
+	PAXC_STATS_BEGIN(chunks);
 	err = spng_decode_chunks(ctx);
 	if (err) {
 		PAX_LOGE(TAG, "Failed at spng_decode_chunks (1)");
@@ -455,135 +909,219 @@ static bool png_decode_progressive(pax_buf_t *framebuffer, spng_ctx *ctx, struct
 	// Get the palette, if any.
 	bool has_palette = ihdr.color_type == 3;
 	bool has_trns    = has_palette;
-	plte = malloc(sizeof(struct spng_plte));
-	trns = malloc(sizeof(struct spng_trns));
-	if (!plte || !trns) {
-		PAX_LOGE(TAG, "Out of memory");
-		goto error;
+	rows->plte     = alloc->malloc_fn(sizeof(struct spng_plte));
+	rows->trns     = alloc->malloc_fn(sizeof(struct spng_trns));
+	rows->argb_pal = alloc->malloc_fn(sizeof(pax_col_t) * 256);
+	if (!rows->row || !rows->plte || !rows->trns || !rows->argb_pal) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		rows->failed = true;
+		return false;
 	}
 	if (has_palette) {
 		PAX_LOGD(TAG, "PNG has palette");
 		
 		// Color part of palette.
-		err = spng_get_plte(ctx, plte);
+		err = spng_get_plte(ctx, rows->plte);
 		if (err && err != SPNG_ECHUNKAVAIL) goto error;
 		
 		// Alpha part of palette.
-		err = spng_get_trns(ctx, trns);
+		err = spng_get_trns(ctx, rows->trns);
 		if (err == SPNG_ECHUNKAVAIL) has_trns = false;
 		else if (err) goto error;
 	}
-	if (PAX_IS_PALETTE(buf_type)) {
-		PAX_LOGD(TAG, "Buf has palette");
+	PAXC_STATS_END(chunks, header_ns);
+	PAXC_STATS_BEGIN(resolve);
+	if (has_palette) {
+		// Resolve the palette to ARGB once instead of for every pixel.
+		for (size_t i = 0; i < rows->plte->n_entries; i++) {
+			pax_col_t color = (has_trns && i < rows->trns->n_type3_entries) ? (pax_col_t) rows->trns->type3_alpha[i] << 24 : 0xff000000;
+			struct spng_plte_entry entry = rows->plte->entries[i];
+			rows->argb_pal[i] = color | (entry.red << 16) | (entry.green << 8) | entry.blue;
+		}
+		rows->fmt.palette      = rows->argb_pal;
+		rows->fmt.palette_size = rows->plte->n_entries;
 	}
+	PAXC_STATS_END(resolve, palette_ns);
 	
 	// Set the image to decode progressive.
+	PAXC_STATS_BEGIN(start);
 	err = spng_decode_image(ctx, NULL, 0, png_fmt, SPNG_DECODE_PROGRESSIVE);
+	PAXC_STATS_END(start, inflate_ns);
 	if (err) {
 		PAX_LOGE(TAG, "Failed at spng_decode_image");
 		goto error;
 	}
+	return true;
+	
+	error:
+	rows->failed = true;
+	png_error(err);
+	return false;
+}
+
+// Starts reading rows from a PNG file with a context of its own.
+// Must be followed by paxc_png_rows_end, even if it fails.
+bool paxc_png_rows_begin_fd(paxc_png_rows_t *rows, FILE *fd) {
+	memset(rows, 0, sizeof(paxc_png_rows_t));
+	spng_ctx *ctx = png_ctx_new(&png_alloc_default);
+	if (!ctx) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return false;
+	}
+	int err = spng_set_png_file(ctx, fd);
+	if (err) {
+		png_error(err);
+		spng_ctx_free(ctx);
+		return false;
+	}
+	return paxc_png_rows_begin(rows, ctx, &png_alloc_default, true);
+}
+
+// Polled by paxc_png_rows_next before every row decoded on this thread, NULL when not cancelable.
+PAXC_THREAD_LOCAL const paxc_cancel_t *paxc_cancel;
+
+// Decodes the next row. Returns 1 for a row, 0 after the last row and -1 on error.
+int paxc_png_rows_next(paxc_png_rows_t *rows) {
+	if (rows->failed) return -1;
+	if (rows->done) return 0;
+	if (paxc_cancel && paxc_cancel->check(paxc_cancel->cookie)) {
+		PAXC_ERROR(PAX_CODEC_ERR_CANCELED, "Decode canceled");
+		rows->failed = true;
+		return -1;
+	}
 	
-	// Decoding time!
+	// Get row metadata.
 	struct spng_row_info info;
-	while (1) {
-		// Get row metadata.
-		err = spng_get_row_info(ctx, &info);
-		if (err && err != SPNG_EOI) goto error;
-		
-		// Decode a row's data.
-		err = spng_decode_scanline(ctx, row, row_size);
-		if (err && err != SPNG_EOI) goto error;
+	PAXC_STATS_BEGIN(inflate);
+	int err = spng_get_row_info(rows->ctx, &info);
+	if (err && err != SPNG_EOI) goto error;
+	
+	// Decode a row's data.
+	err = spng_decode_scanline(rows->ctx, rows->row, rows->row_size);
+	PAXC_STATS_END(inflate, inflate_ns);
+	if (err && err != SPNG_EOI) goto error;
+	PAXC_STATS_ADD(rows, 1);
+	
+	// The last row comes with SPNG_EOI.
+	rows->done = err == SPNG_EOI;
+	rows->y    = info.row_num;
+	rows->pass = info.pass;
+	rows->x    = 0;
+	rows->dx   = 1;
+	if (rows->interlaced) {
+		// Adam7 interlace.
+		rows->x  = adam7_x_start[info.pass];
+		rows->dx = adam7_x_delta[info.pass];
+	}
+	return 1;
+	
+	error:
+	rows->failed = true;
+	png_error(err);
+	return -1;
+}
+
+// Converts the current row to ARGB, one color per pixel in `out`; returns the number of pixels.
+uint32_t paxc_png_rows_argb(const paxc_png_rows_t *rows, pax_col_t *out) {
+	uint32_t count  = 0;
+	size_t   offset = 0;
+	for (uint32_t x = rows->x; x < rows->width; x += rows->dx, count++) {
+		out[count]  = png_row_pixel(&rows->fmt, rows->row, offset, PAXC_PUT_SET);
+		offset     += rows->fmt.bits_per_pixel;
+	}
+	return count;
+}
+
+// Frees the memory of a row reader; safe on a zeroed or failed reader.
+void paxc_png_rows_end(paxc_png_rows_t *rows) {
+	if (!rows->alloc) return;
+	rows->alloc->free_fn(rows->row);
+	rows->alloc->free_fn(rows->plte);
+	rows->alloc->free_fn(rows->trns);
+	rows->alloc->free_fn(rows->argb_pal);
+	if (rows->own_ctx) spng_ctx_free(rows->ctx);
+	rows->row      = NULL;
+	rows->plte     = NULL;
+	rows->trns     = NULL;
+	rows->argb_pal = NULL;
+	rows->ctx      = NULL;
+}
+
+// Decodes rows into the framebuffer until all are done, `max_rows` rows have been decoded
+// or time `deadline` from paxc_time_ns has passed; 0 means no limit for either.
+// Decodes at least one row per call. Returns 1 while rows remain, 0 when done and -1 on error.
+static int png_decode_rows(png_decode_t *dec, uint32_t max_rows, uint64_t deadline) {
+	for (uint32_t count = 0; !max_rows || count < max_rows; count++) {
+		if (deadline && count && paxc_time_ns() >= deadline) break;
+		int res = paxc_png_rows_next(&dec->rows);
+		if (res <= 0) return res;
 		
 		// Have it sharted out.
-		uint32_t dx     = 1;
-		size_t   offset = 0;
-		uint32_t x      = 0;
-		if (ihdr.interlace_method) {
-			// Adam7 interlace.
-			x  = adam7_x_start[info.pass];
-			dx = adam7_x_delta[info.pass];
-		}
-		for (; x < width; x += dx) {
-			// Get the raw data.
-			void* address = row + (offset / 8);
-			// A slightly complicated bit extraction.
-			uint32_t raw = channel_mask & (*(uint32_t *) address >> (shift_max - (offset % 8)));
-			// Fix endianness.
-			if (bits_per_pixel == 16) raw = (raw << 8) | (raw >> 8);
-			else if (bits_per_pixel == 24) raw = (raw << 16) | (raw >> 16) | (raw & 0x00ff00);
-			else if (bits_per_pixel == 32) raw = (raw << 24) | ((raw << 8) & 0x00ff0000) | ((raw >> 8) & 0x0000ff00) | (raw >> 24);
-			offset += bits_per_pixel;
-			
-			// Decode color information.
-			pax_col_t color = 0;
-			if (has_palette && PAX_IS_PALETTE(buf_type)) {
-				color = raw;
-			} else if (has_palette) {
-				if (raw >= plte->n_entries) raw = 0;
-				// Alpha palette.
-				if (has_trns && raw < trns->n_type3_entries) {
-					color = trns->type3_alpha[raw] << 24;
-				} else {
-					color = 0xff000000;
-				}
-				// Non-alpha palette.
-				struct spng_plte_entry entry = plte->entries[raw];
-				color |= (entry.red << 16) | (entry.green << 8) | entry.blue;
-			} else if (ihdr.color_type == 0) {
-				// Greyscale.
-				color = 0xff000000 | (raw * 0x010101);
-			} else if (ihdr.color_type == 2) {
-				// RGB.
-				color = 0xff000000 | raw;
-			} else if (ihdr.color_type == 4) {
-				// Greyscale and alpha.
-				color = (raw << 24) | ((raw >> 8) * 0x00010101);
-			} else if (ihdr.color_type == 6) {
-				// RGBA.
-				color = (raw >> 8) | (raw << 24);
-			}
-			
-			// Output the pixel to the right spot.
-			if (!has_palette && PAX_IS_PALETTE(buf_type)) {
-				color = closest_palette_index(framebuffer, color, true);
-				pax_set_pixel(framebuffer, color, x_offset + x, y_offset + info.row_num);
-			} else if (flags & CODEC_FLAG_EXISTING && !(has_palette && PAX_IS_PALETTE(buf_type))) {
-				pax_merge_pixel(framebuffer, color, x_offset + x, y_offset + info.row_num);
-			} else {
-				pax_set_pixel(framebuffer, color, x_offset + x, y_offset + info.row_num);
-			}
-		}
-		
-		if (err == SPNG_EOI) break;
+		paxc_png_rows_t *rows = &dec->rows;
+		paxc_png_put_row(dec->framebuffer, &rows->fmt, rows->row, rows->x, rows->dx, rows->width, dec->x_offset, dec->y_offset + rows->y, dec->put_mode);
+		if (rows->done) return 0;
+	}
+	return 1;
+}
+
+// Finishes a decode after all rows if `ok`, or cleans up after a failed one.
+// Frees the decode state, and the framebuffer if the decode allocated it and failed.
+static bool png_decode_end(png_decode_t *dec, bool ok) {
+	ok = ok && png_decode_trailer(dec);
+	paxc_png_rows_end(&dec->rows);
+	if (ok) {
+		PAXC_STATS_ADD(bytes_out, PAX_BUF_CALC_SIZE((uint64_t) dec->rows.width, dec->rows.height, dec->framebuffer->type));
+	} else if (dec->allocated) {
+		// Clean up in case of erruer.
+		pax_buf_destroy(dec->framebuffer);
 	}
+	return ok;
+}
+
+// Reads the chunks after the image data and sorts out the palette.
+static bool png_decode_trailer(png_decode_t *dec) {
+	pax_buf_t               *framebuffer = dec->framebuffer;
+	const struct spng_alloc *alloc       = dec->alloc;
+	spng_ctx                *ctx         = dec->rows.ctx;
+	struct spng_plte        *plte        = dec->rows.plte;
+	pax_buf_type_t           buf_type    = dec->buf_type;
+	int                      flags       = dec->flags;
+	int                      x_offset    = dec->x_offset;
+	int                      y_offset    = dec->y_offset;
+	uint32_t                 width       = dec->rows.width;
+	uint32_t                 height      = dec->rows.height;
+	bool                     has_palette = dec->rows.color_type == 3;
 	
-	err = spng_decode_chunks(ctx);
+	PAXC_STATS_BEGIN(trailer);
+	int err = spng_decode_chunks(ctx);
+	PAXC_STATS_END(trailer, header_ns);
 	if (err) {
 		PAX_LOGE(TAG, "Failed at spng_decode_chunks (2)");
 	}
 	
 	// Get the palette, attempt two.
+	PAXC_STATS_BEGIN(remap);
 	if (has_palette) {
 		// Color part of palette.
 		err = spng_get_plte(ctx, plte);
 		if (err) {
 			PAX_LOGE(TAG, "spng_get_plte 2");
-			goto error;
+			png_error(err);
+			return false;
 		}
 		
 		// Re-map palette written from IDAT.
 		if (PAX_IS_PALETTE(buf_type) && (flags & CODEC_FLAG_EXISTING) && !(flags & CODEC_FLAG_KEEP_PAL)) {
 			// Search for closest fitting palette.
-			uint16_t *remap = malloc(sizeof(uint16_t) * plte->n_entries);
+			uint16_t *remap = alloc->malloc_fn(sizeof(uint16_t) * plte->n_entries);
 			PAX_LOGD(TAG, "Remapping palette");
 			if (!remap) {
-				PAX_LOGE(TAG, "Out of memory");
-				goto error;
+				PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+				return false;
 			}
 			for (size_t x = 0; x < plte->n_entries; x++) {
 				pax_col_t argb = (plte->entries[x].red << 16) | (plte->entries[x].green << 8) | plte->entries->blue;
-				remap[x] = closest_palette_index(framebuffer, argb, true);
+				remap[x] = paxc_closest_palette_index(framebuffer, argb, true);
 				PAX_LOGD(TAG, "%"PRId16" -> %"PRId16, x, remap[x]);
 			}
 			
@@ -599,13 +1137,14 @@ static bool png_decode_progressive(pax_buf_t *framebuffer, spng_ctx *ctx, struct
 				}
 			}
 			
-			free(remap);
+			alloc->free_fn(remap);
 		}
 	}
 	
 	if (has_palette && PAX_IS_PALETTE(buf_type) && !(flags & CODEC_FLAG_EXISTING)) {
-		// Copy over the palette.
+		// Copy over the palette; it belongs to the buffer, so it's a plain allocation.
 		pax_col_t *palette = malloc(sizeof(pax_col_t) * plte->n_entries);
+		PAXC_STATS_MEM(1, sizeof(pax_col_t) * plte->n_entries);
 		for (size_t i = 0; i < plte->n_entries; i++) {
 			// if (has_trns && i < trns->n_type3_entries) {
 			// 	palette[i] = trns->type3_alpha[i] << 24;
@@ -619,16 +1158,6 @@ static bool png_decode_progressive(pax_buf_t *framebuffer, spng_ctx *ctx, struct
 		framebuffer->palette_size = plte->n_entries;
 		framebuffer->do_free_pal  = true;
 	}
-	
-	free(plte);
-	free(trns);
-	free(row);
+	PAXC_STATS_END(remap, palette_ns);
 	return true;
-	
-	error:
-	if (row)  free(row);
-	if (plte) free(plte);
-	if (trns) free(trns);
-	PAX_LOGE(TAG, "PNG decode error %d: %s", err, spng_strerror(err));
-	return false;
 }
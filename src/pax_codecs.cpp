@@ -0,0 +1,192 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#include "pax_codecs.hpp"
+#include "pax_codecs_internal.h"
+
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+
+static const char *TAG = "pax_codecs";
+
+namespace pax {
+
+using detail::last_failure;
+
+// Output into a fixed amount of caller memory.
+struct FixedSink {
+	uint8_t *data;
+	size_t   cap;
+	size_t   len;
+	bool     overflow;
+};
+
+// Sink that copies into a FixedSink.
+static bool fixed_sink(void *cookie, const void *data, size_t len) {
+	FixedSink *out = static_cast<FixedSink *>(cookie);
+	if (len > out->cap - out->len) {
+		out->overflow = true;
+		return false;
+	}
+	memcpy(out->data + out->len, data, len);
+	out->len += len;
+	return true;
+}
+
+
+
+PngDecoder::PngDecoder() noexcept : arena(static_cast<paxc_arena *>(calloc(1, sizeof(paxc_arena)))) {}
+
+PngDecoder::~PngDecoder() {
+	if (arena) {
+		paxc_arena_destroy(arena);
+		free(arena);
+	}
+}
+
+PngDecoder::PngDecoder(PngDecoder &&other) noexcept : arena(std::exchange(other.arena, nullptr)) {}
+
+PngDecoder &PngDecoder::operator=(PngDecoder &&other) noexcept {
+	std::swap(arena, other.arena);
+	return *this;
+}
+
+// Reads the size and format of a PNG.
+Result<pax_png_info_t> PngDecoder::info(ByteView png) {
+	if (!arena) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Decoder has no memory");
+		return last_failure();
+	}
+	pax_codec_clear_error();
+	pax_png_info_t info;
+	if (!paxc_png_info_arena(arena, &info, png.data(), png.size())) return last_failure();
+	return info;
+}
+
+// Decodes a PNG into `pixels` as a buffer of `type`.
+Result<pax_buf_t> PngDecoder::decode(ByteView png, MutableByteView pixels, pax_buf_type_t type, int flags) {
+	if (PAX_IS_PALETTE(type)) {
+		PAXC_ERROR(PAX_ERR_PARAM, "Can't decode into caller memory with a palette type");
+		return last_failure();
+	}
+	size_t align = PAX_GET_BPP(type) >= 32 ? 4 : PAX_GET_BPP(type) >= 16 ? 2 : 1;
+	if (reinterpret_cast<uintptr_t>(pixels.data()) % align) {
+		PAXC_ERROR(PAX_ERR_PARAM, "Pixel memory is misaligned");
+		return last_failure();
+	}
+	Result<pax_png_info_t> info = this->info(png);
+	if (!info) return info.error();
+	if (PAX_BUF_CALC_SIZE(static_cast<uint64_t>(info->width), info->height, type) > pixels.size()) {
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Pixel memory too small for a %" PRIu32 "x%" PRIu32 " image", info->width, info->height);
+		return last_failure();
+	}
+	
+	// The buffer only refers to the caller's memory, so it can't fail to initialise.
+	pax_buf_t buf;
+	paxc_buf_init(&buf, pixels.data(), info->width, info->height, type);
+	if (!paxc_png_decode_arena(arena, &buf, png.data(), png.size(), type, flags | CODEC_FLAG_EXISTING | PAXC_FLAG_OVERWRITE, 0, 0)) {
+		return last_failure();
+	}
+	return buf;
+}
+
+// Draws a PNG onto an existing buffer with its top-left corner at (`x`, `y`).
+Result<void> PngDecoder::insert(ByteView png, pax_buf_t &buf, int x, int y, int flags) {
+	if (!arena) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Decoder has no memory");
+		return last_failure();
+	}
+	pax_codec_clear_error();
+	if (!paxc_png_decode_arena(arena, &buf, png.data(), png.size(), buf.type, flags | CODEC_FLAG_EXISTING, x, y)) {
+		return last_failure();
+	}
+	return {};
+}
+
+
+
+PngEncoder::PngEncoder(const pax_png_encode_opts_t &opts) noexcept
+	: writer(static_cast<paxc_png_writer *>(calloc(1, sizeof(paxc_png_writer)))), init_error{PAX_OK, {0}} {
+	if (!writer) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		init_error = last_failure();
+	} else if (!paxc_png_writer_init(writer, &opts, nullptr, nullptr)) {
+		init_error = last_failure();
+	}
+}
+
+PngEncoder::~PngEncoder() {
+	if (writer) {
+		paxc_png_writer_destroy(writer);
+		free(writer);
+	}
+}
+
+PngEncoder::PngEncoder(PngEncoder &&other) noexcept : writer(std::exchange(other.writer, nullptr)), init_error(other.init_error) {
+	other.init_error.code = PAX_ERR_NOBUF;
+	strcpy(other.init_error.message, "Encoder was moved from");
+}
+
+PngEncoder &PngEncoder::operator=(PngEncoder &&other) noexcept {
+	std::swap(writer, other.writer);
+	std::swap(init_error, other.init_error);
+	return *this;
+}
+
+// Encodes the region at (`x`, `y`) sized `width` by `height` into `out`.
+Result<size_t> PngEncoder::encode(const pax_buf_t &buf, MutableByteView out, int x, int y, int width, int height) {
+	if (init_error.code != PAX_OK) return init_error;
+	PAXC_STATS_CALL_BEGIN();
+	pax_codec_clear_error();
+	FixedSink sink = {out.data(), out.size(), 0, false};
+	paxc_png_writer_reuse(writer, fixed_sink, &sink);
+	bool ok = paxc_png_encode(&buf, writer, x, y, width, height);
+	PAXC_STATS_CALL_END();
+	if (!ok) {
+		if (sink.overflow) PAXC_ERROR(PAX_ERR_BOUNDS, "Output buffer too small");
+		return last_failure();
+	}
+	return sink.len;
+}
+
+// Encodes all of `buf` into `out`.
+Result<size_t> PngEncoder::encode(const pax_buf_t &buf, MutableByteView out) {
+	return encode(buf, out, 0, 0, pax_buf_get_width(&buf), pax_buf_get_height(&buf));
+}
+
+// Encodes the region at (`x`, `y`) sized `width` by `height` and streams it to `sink`.
+Result<void> PngEncoder::encode(const pax_buf_t &buf, pax_codec_sink_t sink, void *cookie, int x, int y, int width, int height) {
+	if (init_error.code != PAX_OK) return init_error;
+	PAXC_STATS_CALL_BEGIN();
+	pax_codec_clear_error();
+	paxc_png_writer_reuse(writer, sink, cookie);
+	bool ok = paxc_png_encode(&buf, writer, x, y, width, height);
+	PAXC_STATS_CALL_END();
+	if (!ok) return last_failure();
+	return {};
+}
+
+} // namespace pax
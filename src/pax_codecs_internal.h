@@ -0,0 +1,452 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef PAX_CODECS_INTERNAL_H
+#define PAX_CODECS_INTERNAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+#include "pax_codecs.h"
+#include "zlib.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// SIMD selection; define PAX_CODECS_NO_SIMD to force the scalar kernels.
+#if defined(__SSE2__) && !defined(PAX_CODECS_NO_SIMD)
+#define PAXC_SIMD_SSE2 1
+#else
+#define PAXC_SIMD_SSE2 0
+#endif
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(PAX_CODECS_NO_SIMD)
+#define PAXC_SIMD_NEON 1
+#else
+#define PAXC_SIMD_NEON 0
+#endif
+
+// Reads a big-endian 32-bit value.
+static inline uint32_t paxc_read_be32(const uint8_t *in) {
+	return ((uint32_t) in[0] << 24) | ((uint32_t) in[1] << 16) | ((uint32_t) in[2] << 8) | in[3];
+}
+
+// Writes a big-endian 32-bit value.
+static inline void paxc_write_be32(uint8_t *out, uint32_t value) {
+	out[0] = value >> 24;
+	out[1] = value >> 16;
+	out[2] = value >> 8;
+	out[3] = value;
+}
+
+// Multithreading support through pthreads; off for targets that lack it.
+#ifndef PAX_CODECS_THREADS
+#if defined(PAX_PI_PICO) && PAX_PI_PICO
+#define PAX_CODECS_THREADS 0
+#else
+#define PAX_CODECS_THREADS 1
+#endif
+#endif
+
+// Memory-mapped file support; ESP-IDF and the Pi Pico have no mmap.
+#ifndef PAXC_HAVE_MMAP
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(ESP_PLATFORM) && !(defined(PAX_PI_PICO) && PAX_PI_PICO)
+#define PAXC_HAVE_MMAP 1
+#else
+#define PAXC_HAVE_MMAP 0
+#endif
+#endif
+
+// Maximum number of worker threads a single call may use.
+#define PAXC_MAX_THREADS 64
+
+// Per-call stats collection; off unless asked for, since it costs a clock read per stage per row.
+#ifndef PAX_CODECS_STATS
+#define PAX_CODECS_STATS 0
+#endif
+
+#if defined(__cplusplus)
+#define PAXC_THREAD_LOCAL thread_local
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define PAXC_THREAD_LOCAL _Thread_local
+#else
+#define PAXC_THREAD_LOCAL __thread
+#endif
+
+
+/* ==== Error reporting ==== */
+
+#if defined(__GNUC__)
+#define PAXC_PRINTF(fmt_idx, arg_idx) __attribute__((format(printf, fmt_idx, arg_idx)))
+#else
+#define PAXC_PRINTF(fmt_idx, arg_idx)
+#endif
+
+// Records an error for pax_codec_last_error, mirrors it into pax_last_error and logs it.
+void paxc_error(const char *tag, pax_err_t code, const char *fmt, ...) PAXC_PRINTF(3, 4);
+// Reports an error from a file with a `TAG`.
+#define PAXC_ERROR(code, ...) paxc_error(TAG, code, __VA_ARGS__)
+
+// Wraps pax_buf_init, reporting an error if the buffer can't be allocated.
+// Checks the buffer rather than pax_last_error, which other threads may change at any moment.
+bool paxc_buf_init(pax_buf_t *buf, void *mem, int width, int height, pax_buf_type_t type);
+
+
+/* ==== Instrumentation ==== */
+
+// Monotonic time in nanoseconds.
+uint64_t paxc_time_ns(void);
+
+#if PAX_CODECS_STATS
+// Stats of the codec call running on this thread, NULL when not collecting.
+extern PAXC_THREAD_LOCAL pax_codec_stats_t *paxc_stats;
+// Starts a public codec call: resets the memory tracking and returns the start time.
+uint64_t paxc_stats_call_begin(void);
+// Ends a public codec call started at `start`.
+void paxc_stats_call_end(uint64_t start);
+// Records `count` allocations and a change in heap usage of `delta` bytes.
+void paxc_stats_mem(int count, ptrdiff_t delta);
+
+// Allocation functions that keep track of heap usage for the stats.
+// Memory from these must be released with paxc_free, so it can't be handed to the user.
+void *paxc_malloc(size_t size);
+void *paxc_calloc(size_t count, size_t size);
+void *paxc_realloc(void *ptr, size_t size);
+void  paxc_free(void *ptr);
+// zlib allocation hooks built on the above.
+voidpf paxc_zalloc(voidpf opaque, uInt items, uInt size);
+void   paxc_zfree(voidpf opaque, voidpf ptr);
+
+#define PAXC_STATS_CALL_BEGIN()        uint64_t paxc_call_start_ = paxc_stats_call_begin()
+#define PAXC_STATS_CALL_END()          paxc_stats_call_end(paxc_call_start_)
+#define PAXC_STATS_BEGIN(name)         uint64_t name##_start_ = paxc_stats ? paxc_time_ns() : 0
+#define PAXC_STATS_END(name, field)    do { if (paxc_stats) paxc_stats->field += paxc_time_ns() - name##_start_; } while (0)
+#define PAXC_STATS_ADD(field, amount)  do { if (paxc_stats) paxc_stats->field += (amount); } while (0)
+#define PAXC_STATS_MEM(count, delta)   paxc_stats_mem(count, delta)
+#define PAXC_STATS_ZSTREAM(zs)         ((zs)->zalloc = paxc_zalloc, (zs)->zfree = paxc_zfree, (zs)->opaque = NULL)
+#else
+#define paxc_malloc  malloc
+#define paxc_calloc  calloc
+#define paxc_realloc realloc
+#define paxc_free    free
+
+#define PAXC_STATS_CALL_BEGIN()        do {} while (0)
+#define PAXC_STATS_CALL_END()          do {} while (0)
+#define PAXC_STATS_BEGIN(name)         do {} while (0)
+#define PAXC_STATS_END(name, field)    do {} while (0)
+#define PAXC_STATS_ADD(field, amount)  do {} while (0)
+#define PAXC_STATS_MEM(count, delta)   do {} while (0)
+#define PAXC_STATS_ZSTREAM(zs)         do {} while (0)
+#endif
+
+
+/* ==== Reusable memory ==== */
+
+// Memory kept between calls, so that repeated decodes stop touching the heap once warmed up.
+// Allocations are carved from one block; whatever doesn't fit goes to the heap, and the block
+// is grown to fit everything the next time.
+typedef struct paxc_arena {
+	uint8_t *mem;
+	size_t   cap;
+	// Bytes handed out from the block.
+	size_t   used;
+	// Block size that would have fit every allocation of the current call.
+	size_t   demand;
+} paxc_arena_t;
+
+// Makes `arena` the source of paxc_arena_malloc and friends on this thread and empties it.
+void paxc_arena_begin(paxc_arena_t *arena);
+// Stops using `arena` and grows it if the call needed more memory than it had.
+// Everything allocated from it must have been freed.
+void paxc_arena_end(paxc_arena_t *arena);
+// Frees the memory held by `arena`.
+void paxc_arena_destroy(paxc_arena_t *arena);
+
+// Allocation functions that use the arena given to paxc_arena_begin on this thread.
+void *paxc_arena_malloc(size_t size);
+void *paxc_arena_calloc(size_t count, size_t size);
+void *paxc_arena_realloc(void *ptr, size_t size);
+void  paxc_arena_free(void *ptr);
+
+
+/* ==== Row kernels ==== */
+
+// Reads `width` pixels starting at (x, y) as 8-bit RGBA bytes.
+// The range must lie within the buffer.
+typedef void (*paxc_row_fetch_t)(const pax_buf_t *buf, int x, int y, int width, uint8_t *rgba);
+
+// Gets the fastest row reader available for this buffer.
+// Falls back to pax_get_pixel for buffer types without a dedicated kernel.
+paxc_row_fetch_t paxc_get_row_fetch(const pax_buf_t *buf);
+
+// Writes `width` pixels given as 8-bit RGBA bytes starting at (x, y), replacing what was there.
+// The range must lie within the buffer.
+typedef void (*paxc_row_store_t)(pax_buf_t *buf, int x, int y, int width, const uint8_t *rgba);
+
+// Gets the fastest row writer available for this buffer.
+// Falls back to pax_set_pixel for buffer types without a dedicated kernel,
+// and maps colors to the closest palette entry for palette types.
+paxc_row_store_t paxc_get_row_store(const pax_buf_t *buf);
+
+// Picks the buffer type to decode an image without a palette into when `buf_type` is a palette type.
+pax_buf_type_t paxc_pick_buf_type(pax_buf_type_t buf_type, bool color, bool alpha);
+// Gets the index of the entry in the palette of `buf` closest to `argb`.
+pax_col_t paxc_closest_palette_index(const pax_buf_t *buf, pax_col_t argb, bool ignore_alpha);
+
+
+/* ==== Output sinks ==== */
+
+// Receives encoder output; returns false to abort the encode.
+typedef pax_codec_sink_t paxc_sink_t;
+
+// Growable memory sink; start zero-initialised, `data` is owned by the caller afterwards.
+typedef struct {
+	uint8_t *data;
+	size_t   len;
+	size_t   cap;
+} paxc_membuf_t;
+
+// Sink that writes to a FILE *.
+bool paxc_sink_file(void *cookie, const void *data, size_t len);
+// Sink that appends to a paxc_membuf_t.
+bool paxc_sink_mem(void *cookie, const void *data, size_t len);
+
+
+/* ==== Mapped files ==== */
+
+// A file mapped or read into memory, behind the buffers of pax_map_native_fd and pax_map_bitmap_fd.
+struct pax_native_map {
+	void  *mem;
+	size_t len;
+	// Whether `mem` is a mapping rather than an allocation.
+	bool   mapped;
+	// Memory the buffer uses instead of or besides the file, such as a converted palette; freed with the map.
+	void  *owned;
+};
+
+// Maps a file into memory, or reads it where mmap isn't available.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_native_map_t *paxc_map_file(FILE *fd);
+// Releases the file memory of `map`, keeping anything else it owns.
+void paxc_map_release_file(pax_native_map_t *map);
+
+
+/* ==== PNG writer ==== */
+
+// Chunk-level PNG writer that does its own filtering and deflate.
+typedef struct paxc_png_writer {
+	// Output.
+	paxc_sink_t           sink;
+	void                 *cookie;
+	// Validated encoder settings.
+	pax_png_encode_opts_t opts;
+	// Format from IHDR.
+	uint8_t               bit_depth;
+	uint8_t               color_type;
+	// Bytes per complete pixel, at least 1; the filter distance.
+	uint8_t               filter_bpp;
+	// Current image geometry.
+	uint32_t              width;
+	uint32_t              height;
+	size_t                row_bytes;
+	uint32_t              rows_left;
+	// Previous raw row, zero before the first row.
+	uint8_t              *prev_row;
+	// Capacity of the row buffers, excluding the filter type byte.
+	size_t                row_cap;
+	// Filtered row candidates, each 1 + row_bytes long.
+	uint8_t              *filt;
+	// Deflate state and pending IDAT payload, which starts 4 bytes into `idat`.
+	z_stream              zs;
+	bool                  zs_init;
+	uint8_t              *idat;
+	size_t                idat_len;
+	// When set, image data goes into fdAT chunks numbered from this counter instead of IDAT.
+	uint32_t             *fdat_seq;
+	// Pixels fetched from a buffer by paxc_png_encode, 4 bytes per pixel.
+	uint8_t              *rgba;
+	size_t                rgba_cap;
+} paxc_png_writer_t;
+
+// Bytes in a PNG row without the filter type byte.
+size_t paxc_png_row_bytes(uint32_t width, int bit_depth, int color_type);
+// Maps a pax_png_strategy_t to the zlib strategy.
+int paxc_png_zstrategy(pax_png_strategy_t strategy);
+// The two-byte zlib stream header for the given settings, without preset dictionary.
+void paxc_zlib_header(const pax_png_encode_opts_t *opts, uint8_t out[2]);
+
+// Prepares a PNG writer; `opts` may be NULL for the defaults.
+bool paxc_png_writer_init(paxc_png_writer_t *w, const pax_png_encode_opts_t *opts, paxc_sink_t sink, void *cookie);
+// Points a PNG writer at a new output for the next image, keeping its buffers and deflate state.
+void paxc_png_writer_reuse(paxc_png_writer_t *w, paxc_sink_t sink, void *cookie);
+// Frees all memory held by a PNG writer.
+void paxc_png_writer_destroy(paxc_png_writer_t *w);
+// Writes a single chunk with the given type and payload.
+bool paxc_png_write_chunk(paxc_png_writer_t *w, const char type[4], const void *data, size_t len);
+// Writes the PNG signature and IHDR chunk.
+bool paxc_png_write_ihdr(paxc_png_writer_t *w, uint32_t width, uint32_t height, int bit_depth, int color_type);
+// Starts compressing image data for an image of the given size.
+bool paxc_png_image_begin(paxc_png_writer_t *w, uint32_t width, uint32_t height);
+// Filters and compresses one row of raw pixel data.
+bool paxc_png_image_row(paxc_png_writer_t *w, const uint8_t *row);
+// Appends already compressed image data to the pending IDAT payload.
+bool paxc_png_write_idat(paxc_png_writer_t *w, const void *data, size_t len);
+// Writes out the pending IDAT payload, if any.
+bool paxc_png_flush_idat(paxc_png_writer_t *w);
+// Finishes the image data and flushes the remaining IDAT chunks.
+bool paxc_png_image_end(paxc_png_writer_t *w);
+// Writes the IEND chunk.
+bool paxc_png_write_iend(paxc_png_writer_t *w);
+
+// The PNG Paeth predictor.
+static inline uint8_t paxc_paeth(uint8_t a, uint8_t b, uint8_t c) {
+	int p  = a + b - c;
+	int pa = p > a ? p - a : a - p;
+	int pb = p > b ? p - b : b - p;
+	int pc = p > c ? p - c : c - p;
+	if (pa <= pb && pa <= pc) return a;
+	if (pb <= pc) return b;
+	return c;
+}
+
+// Applies PNG filter `type` to `row`, writing the filter byte and `row_bytes` filtered bytes to `out`.
+// `prev` is the previous raw row, all zeroes for the first row.
+void paxc_png_filter_row(int type, uint8_t *out, const uint8_t *row, const uint8_t *prev, size_t row_bytes, size_t bpp);
+// Picks a filter for `row` from a sampled cost estimate, without filtering the row.
+int paxc_png_filter_estimate(const uint8_t *row, const uint8_t *prev, size_t row_bytes, int bpp);
+// Scratch memory needed by paxc_png_filter_apply.
+size_t paxc_png_filter_scratch(const pax_png_encode_opts_t *opts, size_t row_bytes);
+// Filters `row` according to the filter selection in `opts`.
+// Returns the filter type byte followed by the filtered row, stored somewhere in `scratch`.
+const uint8_t *paxc_png_filter_apply(const pax_png_encode_opts_t *opts, uint8_t *scratch, const uint8_t *row, const uint8_t *prev, size_t row_bytes, int bpp);
+
+
+
+/* ==== PNG decoding ==== */
+
+// Internal decode flag: with CODEC_FLAG_EXISTING, overwrite the pixels instead of blending over them.
+#define PAXC_FLAG_OVERWRITE 0x10000
+
+// Gets PNG metadata from memory, allocating only from `arena`.
+bool paxc_png_info_arena(paxc_arena_t *arena, pax_png_info_t *info, const void *png, size_t png_len);
+// Decodes a PNG from memory like pax_decode_png_buf or pax_insert_png_buf, allocating only from `arena`.
+// Apart from the buffer itself and its palette when those are allocated.
+bool paxc_png_decode_arena(paxc_arena_t *arena, pax_buf_t *framebuffer, const void *png, size_t png_len, pax_buf_type_t buf_type, int flags, int x, int y);
+
+// Layout of decoded PNG rows for paxc_png_put_row.
+typedef struct {
+	uint8_t          color_type;
+	uint8_t          bits_per_pixel;
+	uint8_t          shift_max;
+	uint32_t         channel_mask;
+	// Palette resolved to ARGB, for color type 3.
+	const pax_col_t *palette;
+	size_t           palette_size;
+} paxc_png_row_fmt_t;
+
+// How paxc_png_put_row writes pixels.
+#define PAXC_PUT_SET          0 // Overwrite with the decoded color.
+#define PAXC_PUT_MERGE        1 // Alpha blend over the existing pixel.
+#define PAXC_PUT_INDEX        2 // Copy palette indices into a palette buffer.
+#define PAXC_PUT_NEAREST      3 // Closest entry of the buffer's palette.
+#define PAXC_PUT_NEAREST_OVER 4 // Closest entry of the buffer's palette, skipping fully transparent pixels.
+
+// Sets up the row format for decoded rows of a PNG with this color type and bit depth.
+// Rows hold 8 bits per channel, except for palette images, which keep their packed indices.
+void paxc_png_row_fmt(paxc_png_row_fmt_t *fmt, int color_type, int bit_depth);
+// Picks how decoded pixels of a PNG with this color type get written to `buf`.
+int paxc_png_put_mode(const pax_buf_t *buf, int color_type, bool merge);
+// Writes the pixels of one decoded row to `buf` at row `y`.
+// The row holds the pixels for columns `x`, `x + dx`, ... up to `width`, placed relative to `x_offset`.
+// Reads up to 3 bytes past the end of the row.
+void paxc_png_put_row(pax_buf_t *buf, const paxc_png_row_fmt_t *fmt, const uint8_t *row, uint32_t x, uint32_t dx, uint32_t width, int x_offset, int y, int mode);
+// Reverses PNG filter `type` on `row` in place; `prev` is the previous unfiltered row, all zeroes for the first.
+// Returns false for an invalid filter type.
+bool paxc_png_unfilter_row(int type, uint8_t *row, const uint8_t *prev, size_t row_bytes, size_t bpp);
+
+// Lets a decode be abandoned part-way; see paxc_cancel.
+typedef struct {
+	// Returns true once the decode should stop.
+	bool (*check)(void *cookie);
+	void  *cookie;
+} paxc_cancel_t;
+
+// Polled by paxc_png_rows_next before every row decoded on this thread, NULL when not cancelable.
+// A canceled decode fails with PAX_CODEC_ERR_CANCELED.
+extern PAXC_THREAD_LOCAL const paxc_cancel_t *paxc_cancel;
+
+// Reads the rows of a PNG one at a time; the decode loop behind png_decode_progressive and pax_png_rows_t.
+typedef struct {
+	struct spng_ctx         *ctx;
+	const struct spng_alloc *alloc;
+	// Whether paxc_png_rows_end frees `ctx`.
+	bool                     own_ctx;
+	// Image size and format from IHDR.
+	uint32_t                 width;
+	uint32_t                 height;
+	uint8_t                  bit_depth;
+	uint8_t                  color_type;
+	bool                     interlaced;
+	paxc_png_row_fmt_t       fmt;
+	// Palette and transparency chunks, read for color type 3.
+	struct spng_plte        *plte;
+	struct spng_trns        *trns;
+	pax_col_t               *argb_pal;
+	// The current row: decoded data, image row and Adam7 pass, and its pixels' columns `x`, `x + dx`, ...
+	uint8_t                 *row;
+	size_t                   row_size;
+	uint32_t                 y;
+	uint8_t                  pass;
+	uint32_t                 x;
+	uint32_t                 dx;
+	// Set after the last row, or when decoding failed.
+	bool                     done;
+	bool                     failed;
+} paxc_png_rows_t;
+
+// Starts reading rows from `ctx`, allocating through `alloc`; reads the chunks before the image data.
+bool paxc_png_rows_begin(paxc_png_rows_t *rows, struct spng_ctx *ctx, const struct spng_alloc *alloc, bool own_ctx);
+// Starts reading rows from a PNG file with a context of its own.
+// Must be followed by paxc_png_rows_end, even if it fails.
+bool paxc_png_rows_begin_fd(paxc_png_rows_t *rows, FILE *fd);
+// Decodes the next row. Returns 1 for a row, 0 after the last row and -1 on error.
+int paxc_png_rows_next(paxc_png_rows_t *rows);
+// Converts the current row to ARGB, one color per pixel in `out`; returns the number of pixels.
+uint32_t paxc_png_rows_argb(const paxc_png_rows_t *rows, pax_col_t *out);
+// Frees the memory of a row reader; safe on a zeroed or failed reader.
+void paxc_png_rows_end(paxc_png_rows_t *rows);
+
+// Encodes a region of `buf` as an RGBA PNG through `writer`, clamping the region to the buffer.
+bool paxc_png_encode(const pax_buf_t *buf, paxc_png_writer_t *writer, int x, int y, int width, int height);
+
+#if PAX_CODECS_THREADS
+// Compresses the image data for a region of `buf` on several threads and writes the IDAT chunks.
+bool paxc_png_image_parallel(paxc_png_writer_t *w, const pax_buf_t *buf, int x, int y, int width, int height);
+#endif
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif //PAX_CODECS_INTERNAL_H
@@ -0,0 +1,393 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+#include <string.h>
+
+#if PAXC_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#if PAXC_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// Address of the first pixel of a row span in buffers with 8 or more bits per pixel.
+#define ROW_PTR(buf, type_t, x, y) ((const type_t *) (buf)->buf + (size_t) (y) * (buf)->width + (x))
+// Writable variant of ROW_PTR.
+#define ROW_PTR_W(buf, type_t, x, y) ((type_t *) (buf)->buf + (size_t) (y) * (buf)->width + (x))
+
+// Bit replication for expanding narrow channels to 8 bits.
+#define EXPAND_5(v) (((v) << 3) | ((v) >> 2))
+#define EXPAND_6(v) (((v) << 2) | ((v) >> 4))
+#define EXPAND_3(v) (((v) << 5) | ((v) << 2) | ((v) >> 1))
+// Reverses the byte order of a 32-bit value.
+#define BSWAP_32(v) (((v) << 24) | (((v) << 8) & 0x00ff0000) | (((v) >> 8) & 0x0000ff00) | ((v) >> 24))
+
+
+
+// Fallback for rotated buffers and types without a dedicated kernel.
+static void fetch_generic(const pax_buf_t *buf, int x, int y, int width, uint8_t *rgba) {
+	for (int i = 0; i < width; i++) {
+		pax_col_t col = pax_get_pixel(buf, x + i, y);
+		rgba[4*i+0] = col >> 16; // R
+		rgba[4*i+1] = col >> 8;  // G
+		rgba[4*i+2] = col >> 0;  // B
+		rgba[4*i+3] = col >> 24; // A
+	}
+}
+
+// 32BPP ARGB, stored as uint32_t in either byte order.
+static void fetch_32_8888argb(const pax_buf_t *buf, int x, int y, int width, uint8_t *rgba) {
+	const uint32_t *src  = ROW_PTR(buf, uint32_t, x, y);
+	bool            swap = buf->reverse_endianness;
+	int             i    = 0;
+
+#if PAXC_SIMD_SSE2
+	// Swap the R and B lanes, four pixels at a time; byte swapped pixels only need rotating.
+	const __m128i mask_ag = _mm_set1_epi32(0xff00ff00);
+	const __m128i mask_b  = _mm_set1_epi32(0x000000ff);
+	for (; i + 4 <= width; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+		if (swap) {
+			v = _mm_or_si128(_mm_srli_epi32(v, 8), _mm_slli_epi32(v, 24));
+		} else {
+			__m128i ag = _mm_and_si128(v, mask_ag);
+			__m128i r  = _mm_and_si128(_mm_srli_epi32(v, 16), mask_b);
+			__m128i b  = _mm_slli_epi32(_mm_and_si128(v, mask_b), 16);
+			v = _mm_or_si128(ag, _mm_or_si128(r, b));
+		}
+		_mm_storeu_si128((__m128i *) (rgba + 4*i), v);
+	}
+#elif PAXC_SIMD_NEON
+	// Deinterleave the bytes and store them back as RGBA.
+	for (; i + 16 <= width; i += 16) {
+		uint8x16x4_t v = vld4q_u8((const uint8_t *) (src + i));
+		uint8x16x4_t o;
+		if (swap) {
+			// Stored as A, R, G, B.
+			o.val[0] = v.val[1];
+			o.val[1] = v.val[2];
+			o.val[2] = v.val[3];
+			o.val[3] = v.val[0];
+		} else {
+			// Stored as B, G, R, A.
+			o.val[0] = v.val[2];
+			o.val[1] = v.val[1];
+			o.val[2] = v.val[0];
+			o.val[3] = v.val[3];
+		}
+		vst4q_u8(rgba + 4*i, o);
+	}
+#endif
+
+	for (; i < width; i++) {
+		uint32_t col = src[i];
+		if (swap) col = BSWAP_32(col);
+		rgba[4*i+0] = col >> 16;
+		rgba[4*i+1] = col >> 8;
+		rgba[4*i+2] = col;
+		rgba[4*i+3] = col >> 24;
+	}
+}
+
+// 16BPP RGB565, in either byte order.
+static void fetch_16_565rgb(const pax_buf_t *buf, int x, int y, int width, uint8_t *rgba) {
+	const uint16_t *src = ROW_PTR(buf, uint16_t, x, y);
+	bool swap = buf->reverse_endianness;
+	int  i    = 0;
+
+#if PAXC_SIMD_SSE2
+	// Eight pixels per iteration: split into 16-bit channel lanes, pack down to bytes and interleave.
+	const __m128i mask5  = _mm_set1_epi16(0x1f);
+	const __m128i mask6  = _mm_set1_epi16(0x3f);
+	const __m128i alpha  = _mm_set1_epi8((char) 0xff);
+	for (; i + 8 <= width; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+		if (swap) v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		__m128i r = _mm_srli_epi16(v, 11);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), mask6);
+		__m128i b = _mm_and_si128(v, mask5);
+		r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+		g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+		b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+		__m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g));
+		__m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), alpha);
+		_mm_storeu_si128((__m128i *) (rgba + 4*i),     _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i *) (rgba + 4*i + 16), _mm_unpackhi_epi16(rg, ba));
+	}
+#elif PAXC_SIMD_NEON
+	// Eight pixels per iteration, narrowing each channel straight to bytes.
+	for (; i + 8 <= width; i += 8) {
+		uint16x8_t v = vld1q_u16(src + i);
+		if (swap) v = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(v)));
+		uint8x8_t r5 = vshrn_n_u16(v, 11);
+		uint8x8_t g6 = vand_u8(vshrn_n_u16(v, 5), vdup_n_u8(0x3f));
+		uint8x8_t b5 = vand_u8(vmovn_u16(v), vdup_n_u8(0x1f));
+		uint8x8x4_t out;
+		out.val[0] = vorr_u8(vshl_n_u8(r5, 3), vshr_n_u8(r5, 2));
+		out.val[1] = vorr_u8(vshl_n_u8(g6, 2), vshr_n_u8(g6, 4));
+		out.val[2] = vorr_u8(vshl_n_u8(b5, 3), vshr_n_u8(b5, 2));
+		out.val[3] = vdup_n_u8(0xff);
+		vst4_u8(rgba + 4*i, out);
+	}
+#endif
+
+	for (; i < width; i++) {
+		uint16_t raw = src[i];
+		if (swap) raw = (raw << 8) | (raw >> 8);
+		uint8_t r = raw >> 11, g = (raw >> 5) & 0x3f, b = raw & 0x1f;
+		rgba[4*i+0] = EXPAND_5(r);
+		rgba[4*i+1] = EXPAND_6(g);
+		rgba[4*i+2] = EXPAND_5(b);
+		rgba[4*i+3] = 0xff;
+	}
+}
+
+// 16BPP ARGB4444, in either byte order.
+static void fetch_16_4444argb(const pax_buf_t *buf, int x, int y, int width, uint8_t *rgba) {
+	const uint16_t *src = ROW_PTR(buf, uint16_t, x, y);
+	bool swap = buf->reverse_endianness;
+	for (int i = 0; i < width; i++) {
+		uint16_t raw = src[i];
+		if (swap) raw = (raw << 8) | (raw >> 8);
+		rgba[4*i+0] = ((raw >> 8)  & 0xf) * 0x11;
+		rgba[4*i+1] = ((raw >> 4)  & 0xf) * 0x11;
+		rgba[4*i+2] = ( raw        & 0xf) * 0x11;
+		rgba[4*i+3] = ( raw >> 12       ) * 0x11;
+	}
+}
+
+// 8BPP RGB332.
+static void fetch_8_332rgb(const pax_buf_t *buf, int x, int y, int width, uint8_t *rgba) {
+	const uint8_t *src = ROW_PTR(buf, uint8_t, x, y);
+	for (int i = 0; i < width; i++) {
+		uint8_t raw = src[i];
+		uint8_t r = raw >> 5, g = (raw >> 2) & 7;
+		rgba[4*i+0] = EXPAND_3(r);
+		rgba[4*i+1] = EXPAND_3(g);
+		rgba[4*i+2] = (raw & 3) * 0x55;
+		rgba[4*i+3] = 0xff;
+	}
+}
+
+// 8BPP ARGB2222.
+static void fetch_8_2222argb(const pax_buf_t *buf, int x, int y, int width, uint8_t *rgba) {
+	const uint8_t *src = ROW_PTR(buf, uint8_t, x, y);
+	for (int i = 0; i < width; i++) {
+		uint8_t raw = src[i];
+		rgba[4*i+0] = ((raw >> 4) & 3) * 0x55;
+		rgba[4*i+1] = ((raw >> 2) & 3) * 0x55;
+		rgba[4*i+2] = ( raw       & 3) * 0x55;
+		rgba[4*i+3] = ( raw >> 6     ) * 0x55;
+	}
+}
+
+// 8BPP greyscale.
+static void fetch_8_grey(const pax_buf_t *buf, int x, int y, int width, uint8_t *rgba) {
+	const uint8_t *src = ROW_PTR(buf, uint8_t, x, y);
+	for (int i = 0; i < width; i++) {
+		rgba[4*i+0] = src[i];
+		rgba[4*i+1] = src[i];
+		rgba[4*i+2] = src[i];
+		rgba[4*i+3] = 0xff;
+	}
+}
+
+// 8BPP palette, resolved through the buffer's palette.
+static void fetch_8_pal(const pax_buf_t *buf, int x, int y, int width, uint8_t *rgba) {
+	const uint8_t *src = ROW_PTR(buf, uint8_t, x, y);
+	for (int i = 0; i < width; i++) {
+		pax_col_t col = src[i] < buf->palette_size ? buf->palette[src[i]] : 0;
+		rgba[4*i+0] = col >> 16;
+		rgba[4*i+1] = col >> 8;
+		rgba[4*i+2] = col;
+		rgba[4*i+3] = col >> 24;
+	}
+}
+
+// Gets the fastest row reader available for this buffer.
+// Falls back to pax_get_pixel for buffer types without a dedicated kernel.
+paxc_row_fetch_t paxc_get_row_fetch(const pax_buf_t *buf) {
+	// The kernels index memory directly and don't understand orientation.
+	if (pax_buf_get_orientation(buf) != PAX_O_UPRIGHT) {
+		return fetch_generic;
+	}
+
+	switch (buf->type) {
+		case PAX_BUF_32_8888ARGB: return fetch_32_8888argb;
+		case PAX_BUF_16_565RGB:   return fetch_16_565rgb;
+		case PAX_BUF_16_4444ARGB: return fetch_16_4444argb;
+		case PAX_BUF_8_332RGB:    return fetch_8_332rgb;
+		case PAX_BUF_8_2222ARGB:  return fetch_8_2222argb;
+		case PAX_BUF_8_GREY:      return fetch_8_grey;
+		case PAX_BUF_8_PAL:       return buf->palette ? fetch_8_pal : fetch_generic;
+		default:                  return fetch_generic;
+	}
+}
+
+
+
+// Fallback for rotated buffers and types without a dedicated kernel.
+static void store_generic(pax_buf_t *buf, int x, int y, int width, const uint8_t *rgba) {
+	for (int i = 0; i < width; i++) {
+		pax_col_t col = ((uint32_t) rgba[4*i+3] << 24) | (rgba[4*i+0] << 16) | (rgba[4*i+1] << 8) | rgba[4*i+2];
+		pax_set_pixel(buf, col, x + i, y);
+	}
+}
+
+// 32BPP ARGB, stored as uint32_t in either byte order.
+static void store_32_8888argb(pax_buf_t *buf, int x, int y, int width, const uint8_t *rgba) {
+	uint32_t *dst  = ROW_PTR_W(buf, uint32_t, x, y);
+	bool      swap = buf->reverse_endianness;
+	int       i    = 0;
+
+#if PAXC_SIMD_SSE2
+	// Same lane shuffles as the fetch kernel, in reverse.
+	const __m128i mask_ag = _mm_set1_epi32(0xff00ff00);
+	const __m128i mask_b  = _mm_set1_epi32(0x000000ff);
+	for (; i + 4 <= width; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (rgba + 4*i));
+		if (swap) {
+			v = _mm_or_si128(_mm_slli_epi32(v, 8), _mm_srli_epi32(v, 24));
+		} else {
+			__m128i ag = _mm_and_si128(v, mask_ag);
+			__m128i r  = _mm_and_si128(_mm_srli_epi32(v, 16), mask_b);
+			__m128i b  = _mm_slli_epi32(_mm_and_si128(v, mask_b), 16);
+			v = _mm_or_si128(ag, _mm_or_si128(r, b));
+		}
+		_mm_storeu_si128((__m128i *) (dst + i), v);
+	}
+#elif PAXC_SIMD_NEON
+	for (; i + 16 <= width; i += 16) {
+		uint8x16x4_t v = vld4q_u8(rgba + 4*i);
+		uint8x16x4_t o;
+		if (swap) {
+			o.val[0] = v.val[3];
+			o.val[1] = v.val[0];
+			o.val[2] = v.val[1];
+			o.val[3] = v.val[2];
+		} else {
+			o.val[0] = v.val[2];
+			o.val[1] = v.val[1];
+			o.val[2] = v.val[0];
+			o.val[3] = v.val[3];
+		}
+		vst4q_u8((uint8_t *) (dst + i), o);
+	}
+#endif
+
+	for (; i < width; i++) {
+		uint32_t col = ((uint32_t) rgba[4*i+3] << 24) | (rgba[4*i+0] << 16) | (rgba[4*i+1] << 8) | rgba[4*i+2];
+		dst[i] = swap ? BSWAP_32(col) : col;
+	}
+}
+
+// 16BPP RGB565, in either byte order.
+static void store_16_565rgb(pax_buf_t *buf, int x, int y, int width, const uint8_t *rgba) {
+	uint16_t *dst  = ROW_PTR_W(buf, uint16_t, x, y);
+	bool      swap = buf->reverse_endianness;
+	int       i    = 0;
+
+#if PAXC_SIMD_NEON
+	// Eight pixels per iteration, widening the top bits of each channel into place.
+	for (; i + 8 <= width; i += 8) {
+		uint8x8x4_t v = vld4_u8(rgba + 4*i);
+		uint16x8_t  r = vshll_n_u8(vshr_n_u8(v.val[0], 3), 8);
+		uint16x8_t  g = vshll_n_u8(vshr_n_u8(v.val[1], 2), 5);
+		uint16x8_t  b = vmovl_u8(vshr_n_u8(v.val[2], 3));
+		uint16x8_t  o = vorrq_u16(vorrq_u16(vshlq_n_u16(r, 3), g), b);
+		if (swap) o = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(o)));
+		vst1q_u16(dst + i, o);
+	}
+#endif
+
+	for (; i < width; i++) {
+		uint16_t raw = ((rgba[4*i+0] >> 3) << 11) | ((rgba[4*i+1] >> 2) << 5) | (rgba[4*i+2] >> 3);
+		if (swap) raw = (raw << 8) | (raw >> 8);
+		dst[i] = raw;
+	}
+}
+
+// 16BPP ARGB4444, in either byte order.
+static void store_16_4444argb(pax_buf_t *buf, int x, int y, int width, const uint8_t *rgba) {
+	uint16_t *dst  = ROW_PTR_W(buf, uint16_t, x, y);
+	bool      swap = buf->reverse_endianness;
+	for (int i = 0; i < width; i++) {
+		uint16_t raw = ((rgba[4*i+3] >> 4) << 12) | ((rgba[4*i+0] >> 4) << 8) | ((rgba[4*i+1] >> 4) << 4) | (rgba[4*i+2] >> 4);
+		if (swap) raw = (raw << 8) | (raw >> 8);
+		dst[i] = raw;
+	}
+}
+
+// 8BPP RGB332.
+static void store_8_332rgb(pax_buf_t *buf, int x, int y, int width, const uint8_t *rgba) {
+	uint8_t *dst = ROW_PTR_W(buf, uint8_t, x, y);
+	for (int i = 0; i < width; i++) {
+		dst[i] = (rgba[4*i+0] & 0xe0) | ((rgba[4*i+1] >> 3) & 0x1c) | (rgba[4*i+2] >> 6);
+	}
+}
+
+// 8BPP ARGB2222.
+static void store_8_2222argb(pax_buf_t *buf, int x, int y, int width, const uint8_t *rgba) {
+	uint8_t *dst = ROW_PTR_W(buf, uint8_t, x, y);
+	for (int i = 0; i < width; i++) {
+		dst[i] = ((rgba[4*i+3] >> 6) << 6) | ((rgba[4*i+0] >> 6) << 4) | ((rgba[4*i+1] >> 6) << 2) | (rgba[4*i+2] >> 6);
+	}
+}
+
+// Palette buffers, where pax_set_pixel takes an index: each color is mapped to the closest palette entry.
+static void store_palette(pax_buf_t *buf, int x, int y, int width, const uint8_t *rgba) {
+	pax_col_t last  = 0;
+	pax_col_t index = 0;
+	for (int i = 0; i < width; i++) {
+		pax_col_t col = ((uint32_t) rgba[4*i+3] << 24) | (rgba[4*i+0] << 16) | (rgba[4*i+1] << 8) | rgba[4*i+2];
+		// Runs of one color are common, and the search goes over the whole palette.
+		if (!i || col != last) {
+			index = paxc_closest_palette_index(buf, col, true);
+			last  = col;
+		}
+		pax_set_pixel(buf, index, x + i, y);
+	}
+}
+
+// Gets the fastest row writer available for this buffer.
+// Falls back to pax_set_pixel for buffer types without a dedicated kernel.
+paxc_row_store_t paxc_get_row_store(const pax_buf_t *buf) {
+	if (PAX_IS_PALETTE(buf->type)) {
+		return store_palette;
+	}
+	if (pax_buf_get_orientation(buf) != PAX_O_UPRIGHT) {
+		return store_generic;
+	}
+
+	switch (buf->type) {
+		case PAX_BUF_32_8888ARGB: return store_32_8888argb;
+		case PAX_BUF_16_565RGB:   return store_16_565rgb;
+		case PAX_BUF_16_4444ARGB: return store_16_4444argb;
+		case PAX_BUF_8_332RGB:    return store_8_332rgb;
+		case PAX_BUF_8_2222ARGB:  return store_8_2222argb;
+		default:                  return store_generic;
+	}
+}
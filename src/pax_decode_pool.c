@@ -0,0 +1,375 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if PAX_CODECS_THREADS
+#include <pthread.h>
+#define POOL_LOCK(pool)   pthread_mutex_lock(&(pool)->lock)
+#define POOL_UNLOCK(pool) pthread_mutex_unlock(&(pool)->lock)
+#else
+#define POOL_LOCK(pool)   do {} while (0)
+#define POOL_UNLOCK(pool) do {} while (0)
+#endif
+
+static const char *TAG = "pax_decode_pool";
+
+// Stack size for the decoder threads.
+#define WORKER_STACK 16384
+
+typedef struct job job_t;
+typedef struct worker worker_t;
+
+// One decode request; after decoding, it doubles as the completion handed to the executor.
+struct job {
+	job_t             *next;
+	pax_decode_pool_t *pool;
+	uint32_t           id;
+	int                priority;
+	// What to decode.
+	const void        *png;
+	size_t             png_len;
+	pax_buf_type_t     buf_type;
+	int                flags;
+	// Who to tell.
+	pax_decode_done_t  done;
+	void              *cookie;
+	// Set by pax_decode_pool_cancel; guarded by the pool lock.
+	bool               canceled;
+	// Outcome.
+	bool               ok;
+	pax_buf_t          buf;
+	pax_codec_error_t  error;
+};
+
+// A decoder thread.
+struct worker {
+	pax_decode_pool_t *pool;
+	// The job being decoded, NULL when idle; guarded by the pool lock.
+	job_t             *running;
+#if PAX_CODECS_THREADS
+	pthread_t          thread;
+#endif
+};
+
+struct pax_decode_pool {
+	pax_executor_t     executor;
+	void              *executor_cookie;
+	// Jobs waiting to be decoded, highest priority first and oldest first within a priority.
+	job_t             *pending;
+	// Finished jobs waiting for pax_decode_pool_poll, oldest first.
+	job_t             *completed;
+	job_t            **completed_tail;
+	uint32_t           next_id;
+	bool               stop;
+	// Without threads, worker 0 stands for pax_decode_pool_poll.
+	int                n_workers;
+	worker_t           workers[PAXC_MAX_THREADS];
+#if PAX_CODECS_THREADS
+	pthread_mutex_t    lock;
+	pthread_cond_t     wake;
+#endif
+};
+
+
+
+// Inserts a job into the pending list behind those of the same or higher priority.
+static void insert_pending(pax_decode_pool_t *pool, job_t *job) {
+	job_t **link = &pool->pending;
+	while (*link && (*link)->priority >= job->priority) {
+		link = &(*link)->next;
+	}
+	job->next = *link;
+	*link     = job;
+}
+
+// Takes a job out of the pending list, returning NULL if it isn't there.
+static job_t *remove_pending(pax_decode_pool_t *pool, uint32_t id) {
+	for (job_t **link = &pool->pending; *link; link = &(*link)->next) {
+		if ((*link)->id == id) {
+			job_t *job = *link;
+			*link      = job->next;
+			job->next  = NULL;
+			return job;
+		}
+	}
+	return NULL;
+}
+
+// Marks a job as canceled without decoding it.
+static void set_canceled(job_t *job) {
+	job->ok         = false;
+	job->error.code = PAX_CODEC_ERR_CANCELED;
+	strcpy(job->error.message, "Decode canceled");
+}
+
+// Cancel check polled by the decoder between rows.
+static bool job_canceled(void *cookie) {
+	job_t *job = cookie;
+	POOL_LOCK(job->pool);
+	bool canceled = job->canceled;
+	POOL_UNLOCK(job->pool);
+	return canceled;
+}
+
+// Calls the completion callback of a finished job and frees it.
+static void run_completion(void *arg) {
+	job_t *job = arg;
+	if (job->done) {
+		job->done(job->cookie, job->id, job->ok ? &job->buf : NULL, &job->error);
+	} else if (job->ok) {
+		pax_buf_destroy(&job->buf);
+	}
+	paxc_free(job);
+}
+
+// Hands a finished job to the executor, or queues it for pax_decode_pool_poll.
+static void finish_job(pax_decode_pool_t *pool, job_t *job) {
+	if (pool->executor) {
+		pool->executor(pool->executor_cookie, run_completion, job);
+		return;
+	}
+	POOL_LOCK(pool);
+	job->next             = NULL;
+	*pool->completed_tail = job;
+	pool->completed_tail  = &job->next;
+	POOL_UNLOCK(pool);
+}
+
+// Decodes a job on this thread on behalf of `worker`.
+static void decode_job(worker_t *worker, job_t *job) {
+	paxc_cancel_t cancel = {job_canceled, job};
+	paxc_cancel = &cancel;
+	pax_codec_clear_error();
+	job->ok = pax_decode_png_buf(&job->buf, job->png, job->png_len, job->buf_type, job->flags);
+	paxc_cancel = NULL;
+	
+	POOL_LOCK(worker->pool);
+	worker->running = NULL;
+	bool canceled   = job->canceled;
+	POOL_UNLOCK(worker->pool);
+	
+	if (canceled) {
+		// Finished anyway, but pax_decode_pool_cancel promised a canceled result.
+		if (job->ok) pax_buf_destroy(&job->buf);
+		set_canceled(job);
+	} else if (!job->ok) {
+		job->error = *pax_codec_last_error();
+		if (job->error.code == PAX_OK) job->error.code = PAX_ERR_UNKNOWN;
+	}
+	finish_job(worker->pool, job);
+}
+
+#if PAX_CODECS_THREADS
+// Decoder thread: decodes the most important pending job until the pool stops.
+static void *worker_main(void *arg) {
+	worker_t          *worker = arg;
+	pax_decode_pool_t *pool   = worker->pool;
+	POOL_LOCK(pool);
+	while (1) {
+		while (!pool->stop && !pool->pending) {
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+		if (pool->stop) break;
+		job_t *job      = pool->pending;
+		pool->pending   = job->next;
+		worker->running = job;
+		POOL_UNLOCK(pool);
+		decode_job(worker, job);
+		POOL_LOCK(pool);
+	}
+	POOL_UNLOCK(pool);
+	return NULL;
+}
+#endif
+
+
+
+// Creates a pool that decodes on `threads` threads of its own.
+pax_decode_pool_t *pax_decode_pool_new(int threads, pax_executor_t executor, void *executor_cookie) {
+	pax_decode_pool_t *pool = paxc_calloc(1, sizeof(pax_decode_pool_t));
+	if (!pool) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return NULL;
+	}
+	pool->executor        = executor;
+	pool->executor_cookie = executor_cookie;
+	pool->completed_tail  = &pool->completed;
+	pool->next_id         = 1;
+	for (int i = 0; i < PAXC_MAX_THREADS; i++) {
+		pool->workers[i].pool = pool;
+	}
+	
+#if PAX_CODECS_THREADS
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	if (threads > PAXC_MAX_THREADS) threads = PAXC_MAX_THREADS;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, WORKER_STACK);
+	for (int i = 0; i < threads; i++) {
+		if (pthread_create(&pool->workers[i].thread, &attr, worker_main, &pool->workers[i])) {
+			// Make do with the threads that did start; with none, pax_decode_pool_poll decodes.
+			PAX_LOGW(TAG, "Started only %d of %d decoder threads", i, threads);
+			break;
+		}
+		pool->n_workers++;
+	}
+	pthread_attr_destroy(&attr);
+#else
+	(void) threads;
+#endif
+	return pool;
+}
+
+// Cancels every job, waits for the threads to stop and frees the pool.
+void pax_decode_pool_free(pax_decode_pool_t *pool) {
+	if (!pool) return;
+	POOL_LOCK(pool);
+	pool->stop     = true;
+	job_t *pending = pool->pending;
+	pool->pending  = NULL;
+	for (int i = 0; i < pool->n_workers; i++) {
+		if (pool->workers[i].running) pool->workers[i].running->canceled = true;
+	}
+#if PAX_CODECS_THREADS
+	pthread_cond_broadcast(&pool->wake);
+#endif
+	POOL_UNLOCK(pool);
+	
+#if PAX_CODECS_THREADS
+	for (int i = 0; i < pool->n_workers; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+#endif
+	while (pending) {
+		job_t *next = pending->next;
+		set_canceled(pending);
+		finish_job(pool, pending);
+		pending = next;
+	}
+	pax_decode_pool_poll(pool);
+	
+#if PAX_CODECS_THREADS
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+#endif
+	paxc_free(pool);
+}
+
+// Queues a decode of the PNG in `png` like pax_decode_png_buf, at `priority`.
+uint32_t pax_decode_pool_submit(pax_decode_pool_t *pool, const void *png, size_t png_len, pax_buf_type_t buf_type, int flags, int priority, pax_decode_done_t done, void *cookie) {
+	job_t *job = paxc_calloc(1, sizeof(job_t));
+	if (!job) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return 0;
+	}
+	job->pool     = pool;
+	job->priority = priority;
+	job->png      = png;
+	job->png_len  = png_len;
+	job->buf_type = buf_type;
+	job->flags    = flags;
+	job->done     = done;
+	job->cookie   = cookie;
+	
+	POOL_LOCK(pool);
+	job->id = pool->next_id++;
+	if (!pool->next_id) pool->next_id = 1;
+	uint32_t id = job->id;
+	insert_pending(pool, job);
+#if PAX_CODECS_THREADS
+	pthread_cond_signal(&pool->wake);
+#endif
+	POOL_UNLOCK(pool);
+	return id;
+}
+
+// Cancels a job; a job that is already decoding stops before its next row.
+bool pax_decode_pool_cancel(pax_decode_pool_t *pool, uint32_t id) {
+	POOL_LOCK(pool);
+	job_t *job = remove_pending(pool, id);
+	if (!job) {
+		// Maybe it's running; worker 0 also covers decodes in pax_decode_pool_poll.
+		bool found = false;
+		int  slots = pool->n_workers ? pool->n_workers : 1;
+		for (int i = 0; i < slots; i++) {
+			job_t *running = pool->workers[i].running;
+			if (running && running->id == id) {
+				running->canceled = true;
+				found             = true;
+			}
+		}
+		POOL_UNLOCK(pool);
+		return found;
+	}
+	POOL_UNLOCK(pool);
+	set_canceled(job);
+	finish_job(pool, job);
+	return true;
+}
+
+// Changes the priority of a job that hasn't started yet.
+bool pax_decode_pool_set_priority(pax_decode_pool_t *pool, uint32_t id, int priority) {
+	POOL_LOCK(pool);
+	job_t *job = remove_pending(pool, id);
+	if (job) {
+		job->priority = priority;
+		insert_pending(pool, job);
+	}
+	POOL_UNLOCK(pool);
+	return job != NULL;
+}
+
+// Runs the completions waiting for this thread, and without threads also decodes one job.
+size_t pax_decode_pool_poll(pax_decode_pool_t *pool) {
+	POOL_LOCK(pool);
+	if (!pool->n_workers && !pool->stop && pool->pending) {
+		// No threads; decode the most important job right here.
+		job_t *job               = pool->pending;
+		pool->pending            = job->next;
+		pool->workers[0].running = job;
+		POOL_UNLOCK(pool);
+		decode_job(&pool->workers[0], job);
+		POOL_LOCK(pool);
+	}
+	job_t *completed     = pool->completed;
+	pool->completed      = NULL;
+	pool->completed_tail = &pool->completed;
+	POOL_UNLOCK(pool);
+	
+	size_t count = 0;
+	while (completed) {
+		job_t *next = completed->next;
+		run_completion(completed);
+		completed = next;
+		count++;
+	}
+	return count;
+}
@@ -0,0 +1,849 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "pax_gif";
+
+// Block introducers and extension labels.
+#define GIF_EXTENSION 0x21
+#define GIF_IMAGE     0x2c
+#define GIF_TRAILER   0x3b
+#define GIF_EXT_GCE   0xf9
+#define GIF_EXT_APP   0xff
+
+// LZW codes are at most 12 bits.
+#define LZW_MAX_BITS  12
+#define LZW_MAX_CODES 4096
+
+static const uint8_t interlace_start[4] = { 0, 4, 2, 1 };
+static const uint8_t interlace_step[4]  = { 8, 8, 4, 2 };
+
+// A frame as found in the file.
+typedef struct {
+	pax_gif_frame_info_t info;
+	// Color table of the frame, which is the global one unless it has its own.
+	const uint8_t       *palette;
+	uint16_t             palette_size;
+	// LZW minimum code size, and file offset of the first data sub-block.
+	uint8_t              min_code_size;
+	size_t               data;
+} gif_frame_t;
+
+// LZW string table: every code is an earlier code followed by one more byte.
+typedef struct {
+	uint16_t prefix[LZW_MAX_CODES];
+	uint16_t length[LZW_MAX_CODES];
+	uint8_t  suffix[LZW_MAX_CODES];
+	uint8_t  first[LZW_MAX_CODES];
+	// Strings that run into the next row are spelled out here first.
+	uint8_t  stack[LZW_MAX_CODES];
+} gif_lzw_t;
+
+struct pax_gif_dec {
+	// The file, and the copy owned by the decoder if any.
+	const uint8_t   *gif;
+	size_t           gif_len;
+	uint8_t         *owned;
+	// Logical screen.
+	pax_gif_info_t   info;
+	const uint8_t   *global;
+	uint8_t          bg_index;
+	// Frame table, built once when opening the file.
+	gif_frame_t     *frames;
+	uint32_t         frames_cap;
+	// String table, shared by all frames.
+	gif_lzw_t       *lzw;
+	// Palette indices of the row being decoded, and the same row as RGBA.
+	uint8_t         *row;
+	uint8_t         *rgba;
+	// Conversion of a color table for the target buffer, kept while the color table and buffer stay the same.
+	bool             map_valid;
+	const uint8_t   *map_palette;
+	pax_buf_type_t   map_type;
+	const pax_col_t *map_buf_palette;
+	size_t           map_buf_palette_size;
+	// Palette buffers: the value to store for each index, and whether that is the index itself.
+	uint16_t         map[256];
+	bool             map_identity;
+	// Other buffers: the RGBA bytes for each index.
+	uint8_t          lut[256][4];
+	// Playback state: the canvas the previous frame was rendered to.
+	pax_buf_t       *canvas;
+	int              canvas_x, canvas_y;
+	uint32_t         next_frame;
+	// Value palette buffers are cleared to.
+	pax_col_t        bg_value;
+	// Pixels under the previous frame, for DISPOSE_PREVIOUS.
+	pax_col_t       *saved;
+};
+
+// Reads LZW codes from a chain of data sub-blocks.
+typedef struct {
+	const uint8_t *ptr;
+	// Bytes left in the current sub-block.
+	size_t         block_left;
+	uint32_t       bits;
+	int            nbits;
+	bool           ended;
+} gif_bits_t;
+
+// Where the rows of a frame go.
+typedef struct {
+	pax_gif_dec_t     *dec;
+	pax_buf_t         *buf;
+	paxc_row_store_t   store;
+	// Palette indices are stored straight into an upright 8-bit palette buffer.
+	bool               direct;
+	int                transparent;
+	// Buffer position of the frame's top-left corner.
+	int                x0, y0;
+	// Frame size, and the part of it that lies within the logical screen.
+	uint32_t           width, height;
+	uint32_t           vis_width, vis_height;
+	// Fill position in the current row, the row in the frame, rows finished and the interlace pass.
+	uint32_t           pos;
+	uint32_t           y;
+	uint32_t           rows_done;
+	int                pass;
+	bool               interlaced;
+} gif_out_t;
+
+
+
+// Reads a little-endian 16-bit value.
+static inline uint16_t read_le16(const uint8_t *in) {
+	return in[0] | (in[1] << 8);
+}
+
+// Skips a chain of data sub-blocks starting at `pos`.
+// Returns the offset just past its terminator, or 0 if the file ends first.
+static size_t skip_blocks(const uint8_t *gif, size_t len, size_t pos) {
+	while (pos < len) {
+		uint8_t n = gif[pos];
+		if (!n) return pos + 1;
+		pos += 1 + n;
+	}
+	return 0;
+}
+
+// Adds a frame to the frame table.
+static gif_frame_t *add_frame(pax_gif_dec_t *dec) {
+	if (dec->info.num_frames == dec->frames_cap) {
+		uint32_t     cap    = dec->frames_cap ? 2 * dec->frames_cap : 8;
+		gif_frame_t *frames = realloc(dec->frames, cap * sizeof(gif_frame_t));
+		if (!frames) {
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			return NULL;
+		}
+		dec->frames     = frames;
+		dec->frames_cap = cap;
+	}
+	gif_frame_t *frame = &dec->frames[dec->info.num_frames++];
+	memset(frame, 0, sizeof(gif_frame_t));
+	return frame;
+}
+
+// Reads the block layout and frame table of the file.
+static bool parse_file(pax_gif_dec_t *dec) {
+	const uint8_t *gif = dec->gif;
+	size_t         len = dec->gif_len;
+	size_t         pos = 13;
+
+	if (len < 13 || (memcmp(gif, "GIF87a", 6) && memcmp(gif, "GIF89a", 6))) {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a GIF file");
+		return false;
+	}
+	dec->info.width     = read_le16(gif + 6);
+	dec->info.height    = read_le16(gif + 8);
+	dec->info.num_plays = 1;
+	dec->bg_index       = gif[11];
+	if (!dec->info.width || !dec->info.height) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid logical screen size");
+		return false;
+	}
+	if (gif[10] & 0x80) {
+		dec->info.palette_size = 2 << (gif[10] & 7);
+		if (len - pos < 3 * (size_t) dec->info.palette_size) goto truncated;
+		dec->global  = gif + pos;
+		pos         += 3 * (size_t) dec->info.palette_size;
+	}
+
+	// The graphic control extension applies to the image that follows it.
+	uint8_t  dispose     = 0;
+	int16_t  transparent = -1;
+	uint16_t delay       = 0;
+
+	while (true) {
+		if (pos >= len) goto truncated;
+		uint8_t type = gif[pos++];
+
+		if (type == GIF_TRAILER) {
+			break;
+
+		} else if (type == GIF_EXTENSION) {
+			if (pos >= len) goto truncated;
+			uint8_t        label = gif[pos++];
+			const uint8_t *block = gif + pos;
+			size_t         end   = skip_blocks(gif, len, pos);
+			if (!end) goto truncated;
+			if (label == GIF_EXT_GCE && block[0] >= 4) {
+				dispose     = (block[1] >> 2) & 7;
+				transparent = (block[1] & 1) ? block[4] : -1;
+				delay       = read_le16(block + 2);
+			} else if (label == GIF_EXT_APP && block[0] == 11 && !memcmp(block + 1, "NETSCAPE2.0", 11)
+				&& block[12] >= 3 && block[13] == 1) {
+				// The loop count says how often the animation repeats after playing once.
+				uint16_t loops = read_le16(block + 14);
+				dec->info.num_plays = loops ? loops + 1u : 0;
+			}
+			pos = end;
+
+		} else if (type == GIF_IMAGE) {
+			if (len - pos < 9) goto truncated;
+			const uint8_t *desc  = gif + pos;
+			uint8_t        flags = desc[8];
+			const uint8_t *palette      = dec->global;
+			uint16_t       palette_size = dec->info.palette_size;
+			pos += 9;
+			if (flags & 0x80) {
+				palette_size = 2 << (flags & 7);
+				if (len - pos < 3 * (size_t) palette_size) goto truncated;
+				palette  = gif + pos;
+				pos     += 3 * (size_t) palette_size;
+			}
+			if (pos >= len) goto truncated;
+			uint8_t min_code_size = gif[pos++];
+			size_t  data          = pos;
+			size_t  end           = skip_blocks(gif, len, pos);
+			if (!end) goto truncated;
+			if (!palette) {
+				PAXC_ERROR(PAX_ERR_CORRUPT, "Image without a color table");
+				return false;
+			}
+			if (min_code_size < 1 || min_code_size > 8) {
+				PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid LZW code size %d", min_code_size);
+				return false;
+			}
+
+			gif_frame_t *frame = add_frame(dec);
+			if (!frame) return false;
+			pax_gif_frame_info_t *fi = &frame->info;
+			fi->x           = read_le16(desc);
+			fi->y           = read_le16(desc + 2);
+			fi->width       = read_le16(desc + 4);
+			fi->height      = read_le16(desc + 6);
+			fi->delay_ms    = delay * 10;
+			fi->interlaced  = flags & 0x40;
+			fi->transparent = transparent;
+			// Disposal 0 means unspecified and 4 to 7 are reserved; all are left in place.
+			if (dispose == 2) {
+				fi->dispose_op = PAX_GIF_DISPOSE_BACKGROUND;
+			} else if (dispose == 3 && dec->info.num_frames > 1) {
+				fi->dispose_op = PAX_GIF_DISPOSE_PREVIOUS;
+			} else if (dispose == 3) {
+				// The first frame can't restore what was there before it.
+				fi->dispose_op = PAX_GIF_DISPOSE_BACKGROUND;
+			} else {
+				fi->dispose_op = PAX_GIF_DISPOSE_NONE;
+			}
+			frame->palette       = palette;
+			frame->palette_size  = palette_size;
+			frame->min_code_size = min_code_size;
+			frame->data          = data;
+
+			dispose     = 0;
+			transparent = -1;
+			delay       = 0;
+			pos         = end;
+
+		} else if (dec->info.num_frames) {
+			PAX_LOGW(TAG, "Ignoring unknown block 0x%02x and the rest of the file", type);
+			break;
+
+		} else {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "Unknown block 0x%02x", type);
+			return false;
+		}
+	}
+
+	if (!dec->info.num_frames) {
+		PAXC_ERROR(PAX_ERR_NODATA, "No image data");
+		return false;
+	}
+	return true;
+
+	truncated:
+	if (!dec->info.num_frames) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "File ends before the first image");
+		return false;
+	}
+	// Play what arrived of a partial download.
+	PAX_LOGW(TAG, "File ends early, keeping %" PRIu32 " complete frames", dec->info.num_frames);
+	return true;
+}
+
+// Opens a GIF held in memory; the memory must stay valid until the decoder is freed.
+pax_gif_dec_t *pax_gif_dec_new_buf(const void *gif, size_t gif_len) {
+	pax_gif_dec_t *dec = calloc(1, sizeof(pax_gif_dec_t));
+	if (!dec) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return NULL;
+	}
+	dec->gif     = gif;
+	dec->gif_len = gif_len;
+	if (!parse_file(dec)) {
+		pax_gif_dec_free(dec);
+		return NULL;
+	}
+
+	// Allocate everything rendering needs up front.
+	uint32_t max_width = dec->info.width;
+	for (uint32_t i = 0; i < dec->info.num_frames; i++) {
+		if (dec->frames[i].info.width > max_width) max_width = dec->frames[i].info.width;
+	}
+	dec->row  = malloc(max_width);
+	dec->rgba = malloc(4 * (size_t) dec->info.width);
+	dec->lzw  = malloc(sizeof(gif_lzw_t));
+	if (!dec->row || !dec->rgba || !dec->lzw) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		pax_gif_dec_free(dec);
+		return NULL;
+	}
+	return dec;
+}
+
+// Opens a GIF from a file; the rest of the file is read into memory.
+pax_gif_dec_t *pax_gif_dec_new_fd(FILE *fd) {
+	paxc_membuf_t mem = {0};
+	uint8_t       tmp[1024];
+	size_t        len;
+	while ((len = fread(tmp, 1, sizeof(tmp), fd)) > 0) {
+		if (!paxc_sink_mem(&mem, tmp, len)) {
+			free(mem.data);
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			return NULL;
+		}
+	}
+	pax_gif_dec_t *dec = pax_gif_dec_new_buf(mem.data, mem.len);
+	if (!dec) {
+		free(mem.data);
+		return NULL;
+	}
+	dec->owned = mem.data;
+	return dec;
+}
+
+// Frees a GIF decoder.
+void pax_gif_dec_free(pax_gif_dec_t *dec) {
+	if (!dec) return;
+	free(dec->frames);
+	free(dec->lzw);
+	free(dec->row);
+	free(dec->rgba);
+	free(dec->saved);
+	free(dec->owned);
+	free(dec);
+}
+
+// Gets the size, frame count and loop count of the animation.
+void pax_gif_dec_info(const pax_gif_dec_t *dec, pax_gif_info_t *info) {
+	*info = dec->info;
+}
+
+// Gets the placement, timing and disposal of frame `index`.
+bool pax_gif_dec_frame_info(const pax_gif_dec_t *dec, uint32_t index, pax_gif_frame_info_t *info) {
+	if (index >= dec->info.num_frames) {
+		PAXC_ERROR(PAX_ERR_PARAM, "No frame %" PRIu32 " in a %" PRIu32 "-frame animation", index, dec->info.num_frames);
+		return false;
+	}
+	*info = dec->frames[index].info;
+	return true;
+}
+
+// Allocates a buffer the size of the animation.
+bool pax_gif_dec_alloc_buf(const pax_gif_dec_t *dec, pax_buf_t *buf, pax_buf_type_t buf_type) {
+	const uint8_t *palette      = dec->global;
+	uint16_t       palette_size = dec->info.palette_size;
+	if (!palette) {
+		palette      = dec->frames[0].palette;
+		palette_size = dec->frames[0].palette_size;
+	}
+	if (PAX_IS_PALETTE(buf_type) && PAX_GET_BPP(buf_type) < 8 && (1u << PAX_GET_BPP(buf_type)) < palette_size) {
+		// Too many colors to index.
+		buf_type = PAX_BUF_8_PAL;
+		PAX_LOGW(TAG, "Changing buffer type to %08x", (int) buf_type);
+	}
+	PAX_LOGD(TAG, "Allocating GIF canvas %dx%d as %08x", (int) dec->info.width, (int) dec->info.height, buf_type);
+	if (!paxc_buf_init(buf, NULL, dec->info.width, dec->info.height, buf_type)) return false;
+
+	if (PAX_IS_PALETTE(buf_type)) {
+		// The palette belongs to the buffer, so it's a plain allocation.
+		pax_col_t *colors = malloc(sizeof(pax_col_t) * palette_size);
+		if (!colors) {
+			pax_buf_destroy(buf);
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			return false;
+		}
+		for (size_t i = 0; i < palette_size; i++) {
+			colors[i] = 0xff000000 | (palette[3*i] << 16) | (palette[3*i+1] << 8) | palette[3*i+2];
+		}
+		buf->palette      = colors;
+		buf->palette_size = palette_size;
+		buf->do_free_pal  = true;
+	}
+	return true;
+}
+
+// Prepares the conversion of a frame's color table for `buf`, unless the previous frame already did.
+static void prepare_map(pax_gif_dec_t *dec, const pax_buf_t *buf, const gif_frame_t *frame) {
+	bool is_pal = PAX_IS_PALETTE(buf->type);
+	if (dec->map_valid && dec->map_palette == frame->palette && dec->map_type == buf->type
+		&& (!is_pal || (dec->map_buf_palette == buf->palette && dec->map_buf_palette_size == buf->palette_size))) {
+		return;
+	}
+	PAXC_STATS_BEGIN(map);
+	const uint8_t *palette = frame->palette;
+	size_t         size    = frame->palette_size;
+
+	// Indices past the end of the table are black.
+	if (is_pal) {
+		// Indices can be copied as they are if the buffer has the same colors, or no palette at all.
+		bool identity = true;
+		if (buf->palette) {
+			for (size_t i = 0; i < size && identity; i++) {
+				pax_col_t argb = 0xff000000 | (palette[3*i] << 16) | (palette[3*i+1] << 8) | palette[3*i+2];
+				identity = i < buf->palette_size && buf->palette[i] == argb;
+			}
+		}
+		for (size_t i = 0; i < 256; i++) {
+			pax_col_t argb = 0xff000000;
+			if (i < size) argb |= (palette[3*i] << 16) | (palette[3*i+1] << 8) | palette[3*i+2];
+			dec->map[i] = identity ? i : paxc_closest_palette_index(buf, argb, true);
+		}
+		dec->map_identity = identity;
+	} else {
+		for (size_t i = 0; i < 256; i++) {
+			dec->lut[i][0] = i < size ? palette[3*i]   : 0;
+			dec->lut[i][1] = i < size ? palette[3*i+1] : 0;
+			dec->lut[i][2] = i < size ? palette[3*i+2] : 0;
+			dec->lut[i][3] = 0xff;
+		}
+	}
+
+	dec->map_valid            = true;
+	dec->map_palette          = palette;
+	dec->map_type             = buf->type;
+	dec->map_buf_palette      = buf->palette;
+	dec->map_buf_palette_size = buf->palette_size;
+	PAXC_STATS_END(map, palette_ns);
+}
+
+// Makes at least 25 bits available, unless the image data ends first.
+static void bits_fill(gif_bits_t *br) {
+	while (br->nbits <= 24) {
+		if (!br->block_left) {
+			// Sub-block chains were checked to lie within the file when it was opened.
+			if (br->ended || !*br->ptr) {
+				br->ended = true;
+				return;
+			}
+			br->block_left = *br->ptr++;
+		}
+		br->bits  |= (uint32_t) *br->ptr++ << br->nbits;
+		br->nbits += 8;
+		br->block_left--;
+	}
+}
+
+// Reads an LZW code of `size` bits; returns -1 at the end of the image data.
+static inline int bits_get(gif_bits_t *br, int size) {
+	if (br->nbits < size) {
+		bits_fill(br);
+		if (br->nbits < size) return -1;
+	}
+	int code    = br->bits & ((1u << size) - 1);
+	br->bits  >>= size;
+	br->nbits  -= size;
+	return code;
+}
+
+// The part of a frame that lies within the logical screen.
+static void visible_rect(const pax_gif_dec_t *dec, const pax_gif_frame_info_t *fi, uint32_t *width, uint32_t *height) {
+	*width  = fi->x >= dec->info.width  ? 0 : dec->info.width  - fi->x;
+	*height = fi->y >= dec->info.height ? 0 : dec->info.height - fi->y;
+	if (*width  > fi->width)  *width  = fi->width;
+	if (*height > fi->height) *height = fi->height;
+}
+
+// Writes the finished row to the buffer.
+static void put_row(gif_out_t *out) {
+	if (out->y >= out->vis_height || !out->vis_width) return;
+	pax_gif_dec_t *dec   = out->dec;
+	pax_buf_t     *buf   = out->buf;
+	const uint8_t *row   = dec->row;
+	uint32_t       n     = out->vis_width;
+	int            x     = out->x0;
+	int            y     = out->y0 + out->y;
+	int            trans = out->transparent;
+
+	PAXC_STATS_BEGIN(write);
+	if (out->direct) {
+		uint8_t *dst = (uint8_t *) buf->buf + (size_t) y * buf->width + x;
+		if (trans < 0 && dec->map_identity) {
+			memcpy(dst, row, n);
+		} else {
+			for (uint32_t i = 0; i < n; i++) {
+				if (row[i] != trans) dst[i] = dec->map[row[i]];
+			}
+		}
+	} else if (PAX_IS_PALETTE(buf->type)) {
+		for (uint32_t i = 0; i < n; i++) {
+			if (row[i] != trans) pax_set_pixel(buf, dec->map[row[i]], x + i, y);
+		}
+	} else {
+		// Store each run of opaque pixels; transparent ones leave the canvas as it is.
+		uint8_t *rgba = dec->rgba;
+		uint32_t i    = 0;
+		while (i < n) {
+			while (i < n && row[i] == trans) i++;
+			uint32_t start = i;
+			for (; i < n && row[i] != trans; i++) {
+				memcpy(rgba + 4*i, dec->lut[row[i]], 4);
+			}
+			if (i > start) out->store(buf, x + start, y, i - start, rgba + 4*start);
+		}
+	}
+	PAXC_STATS_END(write, write_ns);
+	PAXC_STATS_ADD(bytes_out, n);
+}
+
+// Finishes the current row and moves on to the next one in file order.
+static void next_row(gif_out_t *out) {
+	put_row(out);
+	PAXC_STATS_ADD(rows, 1);
+	out->pos = 0;
+	out->rows_done++;
+	if (!out->interlaced) {
+		out->y++;
+		return;
+	}
+	out->y += interlace_step[out->pass];
+	while (out->y >= out->height && out->pass < 3) {
+		out->pass++;
+		out->y = interlace_start[out->pass];
+	}
+}
+
+// Outputs the string of an LZW code.
+static inline void emit_code(gif_out_t *out, gif_lzw_t *lzw, uint32_t code) {
+	uint32_t len = lzw->length[code];
+	uint8_t *row = out->dec->row;
+	if (len <= out->width - out->pos) {
+		// The usual case: spell the string backwards straight into the row.
+		uint8_t *start = row + out->pos;
+		uint8_t *p     = start + len;
+		do {
+			*--p = lzw->suffix[code];
+			code = lzw->prefix[code];
+		} while (p > start);
+		out->pos += len;
+		if (out->pos == out->width) next_row(out);
+		return;
+	}
+
+	// The string runs into the next row; spell it out on the side first.
+	uint8_t *p = lzw->stack + len;
+	do {
+		*--p = lzw->suffix[code];
+		code = lzw->prefix[code];
+	} while (p > lzw->stack);
+	while (len && out->rows_done < out->height) {
+		uint32_t n = out->width - out->pos;
+		if (n > len) n = len;
+		memcpy(row + out->pos, p, n);
+		p        += n;
+		len      -= n;
+		out->pos += n;
+		if (out->pos == out->width) next_row(out);
+	}
+}
+
+// Decodes a frame and draws it onto the canvas at (`dx`, `dy`).
+static bool decode_frame(pax_gif_dec_t *dec, pax_buf_t *buf, uint32_t index, int dx, int dy) {
+	const gif_frame_t          *frame = &dec->frames[index];
+	const pax_gif_frame_info_t *fi    = &frame->info;
+	gif_lzw_t                  *lzw   = dec->lzw;
+	if (!fi->width || !fi->height) return true;
+	prepare_map(dec, buf, frame);
+
+	gif_out_t out = {
+		.dec         = dec,
+		.buf         = buf,
+		.store       = paxc_get_row_store(buf),
+		.direct      = buf->type == PAX_BUF_8_PAL && pax_buf_get_orientation(buf) == PAX_O_UPRIGHT,
+		.transparent = fi->transparent,
+		.x0          = dx + fi->x,
+		.y0          = dy + fi->y,
+		.width       = fi->width,
+		.height      = fi->height,
+		.interlaced  = fi->interlaced,
+	};
+	visible_rect(dec, fi, &out.vis_width, &out.vis_height);
+	gif_bits_t br = { .ptr = dec->gif + frame->data };
+
+	// The codes for single bytes, followed by the clear and end codes.
+	int      min_size = frame->min_code_size;
+	uint32_t clear    = 1u << min_size;
+	uint32_t end      = clear + 1;
+	for (uint32_t i = 0; i < clear; i++) {
+		lzw->prefix[i] = 0;
+		lzw->length[i] = 1;
+		lzw->suffix[i] = i;
+		lzw->first[i]  = i;
+	}
+	uint32_t next = end + 1;
+	int      size = min_size + 1;
+	int      prev = -1;
+
+	while (out.rows_done < out.height) {
+		int code = bits_get(&br, size);
+		if (code < 0 || (uint32_t) code == end) break;
+		if ((uint32_t) code == clear) {
+			next = end + 1;
+			size = min_size + 1;
+			prev = -1;
+			continue;
+		}
+		if (prev >= 0) {
+			if ((uint32_t) code > next) goto corrupt;
+			if (next < LZW_MAX_CODES) {
+				// The new string is the previous one plus the first byte of this one,
+				// which for the code being defined right now is the previous string's first byte.
+				lzw->prefix[next] = prev;
+				lzw->length[next] = lzw->length[prev] + 1;
+				lzw->suffix[next] = (uint32_t) code < next ? lzw->first[code] : lzw->first[prev];
+				lzw->first[next]  = lzw->first[prev];
+				next++;
+				if (next == (1u << size) && size < LZW_MAX_BITS) size++;
+			}
+		} else if ((uint32_t) code > clear) {
+			goto corrupt;
+		}
+		emit_code(&out, lzw, code);
+		prev = code;
+	}
+
+	if (out.rows_done < out.height) {
+		// Show what there is, as viewers do.
+		PAX_LOGW(TAG, "Frame %" PRIu32 " ends after %" PRIu32 " of %" PRIu32 " rows", index, out.rows_done, out.height);
+		if (out.pos) put_row(&out);
+	}
+	return true;
+
+	corrupt:
+	PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid LZW code in frame %" PRIu32, index);
+	return false;
+}
+
+// Clears a rectangle of the canvas: to the background color in palette buffers, to transparent black in others.
+static void clear_rect(pax_gif_dec_t *dec, pax_buf_t *buf, int x, int y, uint32_t width, uint32_t height) {
+	if (PAX_IS_PALETTE(buf->type)) {
+		bool direct = buf->type == PAX_BUF_8_PAL && pax_buf_get_orientation(buf) == PAX_O_UPRIGHT;
+		for (uint32_t py = 0; py < height; py++) {
+			if (direct) {
+				memset((uint8_t *) buf->buf + (size_t) (y + py) * buf->width + x, dec->bg_value, width);
+				continue;
+			}
+			for (uint32_t px = 0; px < width; px++) {
+				pax_set_pixel(buf, dec->bg_value, x + px, y + py);
+			}
+		}
+	} else {
+		paxc_row_store_t store = paxc_get_row_store(buf);
+		memset(dec->rgba, 0, 4 * (size_t) width);
+		for (uint32_t py = 0; py < height; py++) {
+			store(buf, x, y + py, width, dec->rgba);
+		}
+	}
+}
+
+// Copies the pixels under a frame to or from `dec->saved`, for DISPOSE_PREVIOUS.
+static void save_rect(pax_gif_dec_t *dec, pax_buf_t *buf, const pax_gif_frame_info_t *fi, int dx, int dy, bool restore) {
+	uint32_t width, height;
+	visible_rect(dec, fi, &width, &height);
+	if (!width) return;
+	int x = dx + fi->x;
+	int y = dy + fi->y;
+	if (buf->type == PAX_BUF_8_PAL && pax_buf_get_orientation(buf) == PAX_O_UPRIGHT) {
+		uint8_t *saved = (uint8_t *) dec->saved;
+		for (uint32_t py = 0; py < height; py++, saved += width) {
+			uint8_t *row = (uint8_t *) buf->buf + (size_t) (y + py) * buf->width + x;
+			if (restore) {
+				memcpy(row, saved, width);
+			} else {
+				memcpy(saved, row, width);
+			}
+		}
+	} else if (PAX_IS_PALETTE(buf->type)) {
+		// pax_get_pixel resolves palette indices to colors, so keep the indices instead.
+		pax_col_t *saved = dec->saved;
+		for (uint32_t py = 0; py < height; py++) {
+			for (uint32_t px = 0; px < width; px++, saved++) {
+				if (restore) {
+					pax_set_pixel(buf, *saved, x + px, y + py);
+				} else {
+					*saved = paxc_closest_palette_index(buf, pax_get_pixel(buf, x + px, y + py), false);
+				}
+			}
+		}
+	} else {
+		paxc_row_fetch_t fetch = paxc_get_row_fetch(buf);
+		paxc_row_store_t store = paxc_get_row_store(buf);
+		uint8_t         *saved = (uint8_t *) dec->saved;
+		for (uint32_t py = 0; py < height; py++, saved += 4 * width) {
+			if (restore) {
+				store(buf, x, y + py, width, saved);
+			} else {
+				fetch(buf, x, y + py, width, saved);
+			}
+		}
+	}
+}
+
+// Applies the disposal of a frame that has been shown.
+static void dispose_frame(pax_gif_dec_t *dec, pax_buf_t *buf, const pax_gif_frame_info_t *fi, int dx, int dy) {
+	if (fi->dispose_op == PAX_GIF_DISPOSE_BACKGROUND) {
+		uint32_t width, height;
+		visible_rect(dec, fi, &width, &height);
+		if (width) clear_rect(dec, buf, dx + fi->x, dy + fi->y, width, height);
+	} else if (fi->dispose_op == PAX_GIF_DISPOSE_PREVIOUS) {
+		save_rect(dec, buf, fi, dx, dy, true);
+	}
+}
+
+// Renders frame `index` of the animation into `framebuffer` with its top-left corner at (`x`, `y`).
+bool pax_gif_dec_render(pax_gif_dec_t *dec, pax_buf_t *framebuffer, uint32_t index, int x, int y) {
+	if (index >= dec->info.num_frames) {
+		PAXC_ERROR(PAX_ERR_PARAM, "No frame %" PRIu32 " in a %" PRIu32 "-frame animation", index, dec->info.num_frames);
+		return false;
+	}
+	if (x < 0 || y < 0 || x + dec->info.width > (uint32_t) pax_buf_get_width(framebuffer) || y + dec->info.height > (uint32_t) pax_buf_get_height(framebuffer)) {
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Animation does not fit the buffer");
+		return false;
+	}
+	PAXC_STATS_CALL_BEGIN();
+
+	// Continue from the previous frame if possible, otherwise start over from a clear canvas.
+	uint32_t start = dec->next_frame;
+	if (dec->canvas != framebuffer || dec->canvas_x != x || dec->canvas_y != y || index < start) {
+		start = 0;
+	}
+	dec->canvas = NULL;
+	if (start == 0) {
+		dec->bg_value = 0;
+		if (PAX_IS_PALETTE(framebuffer->type) && dec->global && dec->bg_index < dec->info.palette_size) {
+			const uint8_t *rgb = dec->global + 3 * dec->bg_index;
+			pax_col_t      bg  = 0xff000000 | (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+			dec->bg_value = framebuffer->palette ? paxc_closest_palette_index(framebuffer, bg, true) : dec->bg_index;
+		}
+		clear_rect(dec, framebuffer, x, y, dec->info.width, dec->info.height);
+	}
+
+	bool ok = true;
+	for (uint32_t i = start; i <= index && ok; i++) {
+		const pax_gif_frame_info_t *fi = &dec->frames[i].info;
+		if (i > 0) {
+			dispose_frame(dec, framebuffer, &dec->frames[i - 1].info, x, y);
+		}
+		if (fi->dispose_op == PAX_GIF_DISPOSE_PREVIOUS) {
+			// Remember what's under the frame; sized for the whole canvas so it's only allocated once.
+			if (!dec->saved) {
+				dec->saved = malloc(sizeof(pax_col_t) * (size_t) dec->info.width * dec->info.height);
+				if (!dec->saved) {
+					PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+					ok = false;
+					break;
+				}
+			}
+			save_rect(dec, framebuffer, fi, x, y, false);
+		}
+		ok = decode_frame(dec, framebuffer, i, x, y);
+	}
+
+	if (ok) {
+		dec->canvas     = framebuffer;
+		dec->canvas_x   = x;
+		dec->canvas_y   = y;
+		dec->next_frame = index + 1;
+	}
+	pax_mark_dirty2(framebuffer, x, y, dec->info.width, dec->info.height);
+	PAXC_STATS_CALL_END();
+	return ok;
+}
+
+// Decodes the first frame of a GIF held in memory into a new buffer.
+static bool gif_decode(pax_buf_t *framebuffer, const void *gif, size_t gif_len, pax_buf_type_t buf_type, int flags) {
+	pax_gif_dec_t *dec = pax_gif_dec_new_buf(gif, gif_len);
+	if (!dec) return false;
+	if (flags & CODEC_FLAG_OPTIMAL) {
+		// Indices are copied into 8-bit palette buffers as they are.
+		buf_type = PAX_BUF_8_PAL;
+	}
+	bool ok = pax_gif_dec_alloc_buf(dec, framebuffer, buf_type);
+	if (ok && !pax_gif_dec_render(dec, framebuffer, 0, 0, 0)) {
+		pax_buf_destroy(framebuffer);
+		ok = false;
+	}
+	pax_gif_dec_free(dec);
+	return ok;
+}
+
+// Decodes the first frame of a GIF file into a buffer with the specified type.
+bool pax_decode_gif_fd(pax_buf_t *framebuffer, FILE *fd, pax_buf_type_t buf_type, int flags) {
+	paxc_membuf_t mem = {0};
+	uint8_t       tmp[1024];
+	size_t        len;
+	while ((len = fread(tmp, 1, sizeof(tmp), fd)) > 0) {
+		if (!paxc_sink_mem(&mem, tmp, len)) {
+			free(mem.data);
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			return false;
+		}
+	}
+	bool ok = gif_decode(framebuffer, mem.data, mem.len, buf_type, flags);
+	free(mem.data);
+	return ok;
+}
+
+// Decodes the first frame of a GIF buffer into a buffer with the specified type.
+bool pax_decode_gif_buf(pax_buf_t *framebuffer, const void *gif, size_t gif_len, pax_buf_type_t buf_type, int flags) {
+	return gif_decode(framebuffer, gif, gif_len, buf_type, flags);
+}
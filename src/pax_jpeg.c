@@ -0,0 +1,1313 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if PAXC_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#if PAXC_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+static const char *TAG = "pax_jpeg";
+
+// Markers.
+#define M_SOF0 0xc0
+#define M_SOF1 0xc1
+#define M_SOF2 0xc2
+#define M_DHT  0xc4
+#define M_RST0 0xd0
+#define M_RST7 0xd7
+#define M_SOI  0xd8
+#define M_EOI  0xd9
+#define M_SOS  0xda
+#define M_DQT  0xdb
+#define M_DRI  0xdd
+#define M_APP0 0xe0
+#define M_APP14 0xee
+
+// Bits of Huffman code resolved by a single table lookup.
+#define FAST_BITS  9
+// Fixed-point precision of the IDCT, as in the libjpeg "islow" IDCT.
+#define CONST_BITS 13
+#define PASS1_BITS 2
+
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+// Natural index of each coefficient, in the zigzag order they are stored in.
+static const uint8_t zigzag[64] = {
+	 0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// For the coefficients up to each zigzag index: the number of rows << 4 | the number of columns they span.
+static const uint8_t zz_extent[64] = {
+	0x11, 0x12, 0x22, 0x32, 0x32, 0x33, 0x34, 0x34, 0x34, 0x44, 0x54, 0x54, 0x54, 0x54, 0x55, 0x56,
+	0x56, 0x56, 0x56, 0x56, 0x66, 0x76, 0x76, 0x76, 0x76, 0x76, 0x76, 0x77, 0x78, 0x78, 0x78, 0x78,
+	0x78, 0x78, 0x78, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88,
+	0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88,
+};
+
+// Weights of the 8-point IDCT averaged over groups of 2 or 4 samples, in CONST_BITS fixed point.
+// Evaluating these instead of the full IDCT downscales a block without ever producing all 64 samples.
+static const int16_t idct_w4[4][8] = {
+	{ 2896,  3711,  2676,  1303, 0,  -871, -1108, -738 },
+	{ 2896,  1537, -2676, -3146, 0,  2102,  1108, -306 },
+	{ 2896, -1537, -2676,  3146, 0, -2102,  1108,  306 },
+	{ 2896, -3711,  2676, -1303, 0,   871, -1108,  738 },
+};
+static const int16_t idct_w2[2][8] = {
+	{ 2896,  2624, 0, -922, 0,  616, 0, -522 },
+	{ 2896, -2624, 0,  922, 0, -616, 0,  522 },
+};
+
+// A Huffman table.
+typedef struct {
+	// For the next FAST_BITS bits of input: code length << 8 | symbol, or 0 if the code is longer.
+	uint16_t fast[1 << FAST_BITS];
+	// AC tables only: for the next FAST_BITS bits, a whole coefficient if its code and value fit,
+	// as value << 8 | zero run << 4 | bits used, or 0 if not.
+	int16_t  fast_ac[1 << FAST_BITS];
+	// Largest code of each length, -1 if there are none.
+	int32_t  maxcode[17];
+	// Difference between the index of a symbol and its code, for each length.
+	int32_t  delta[17];
+	uint8_t  symbols[256];
+	bool     present;
+} jpeg_huff_t;
+
+// A color component.
+typedef struct {
+	uint8_t  id;
+	// Sampling factors.
+	uint8_t  h, v;
+	// Quantization table.
+	uint8_t  tq;
+	// Huffman tables of the current scan.
+	uint8_t  td, ta;
+	int      dc_pred;
+	// Blocks across and down, padded to whole MCUs.
+	int      bw, bh;
+	// Coefficients of every block, when the image takes more than one scan.
+	int16_t *coefs;
+	// Samples of one MCU row after the IDCT.
+	uint8_t *plane;
+	int      stride;
+	// One row upsampled to the width of the image, for subsampled components.
+	uint8_t *up;
+} jpeg_comp_t;
+
+typedef struct jpeg jpeg_t;
+
+// Decodes a block of a scan in the progressive or multi-scan case.
+typedef bool (*jpeg_block_fn_t)(jpeg_t *j, jpeg_comp_t *c, int16_t *blk);
+
+struct jpeg {
+	// Input.
+	const uint8_t  *ptr;
+	const uint8_t  *end;
+	// Entropy-coded bits, most significant first.
+	uint32_t        bits;
+	int             nbits;
+	// The bit reader reached a marker or the end of the data, and now reads zeroes.
+	bool            stopped;
+	bool            ran_out;
+
+	// Tables.
+	uint16_t        qt[4][64];
+	jpeg_huff_t     dc[4];
+	jpeg_huff_t     ac[4];
+	int             restart_interval;
+
+	// Frame.
+	bool            seen_sof;
+	bool            progressive;
+	// Samples are RGB rather than YCbCr.
+	bool            rgb;
+	bool            jfif;
+	// Transform flag of an Adobe APP14 segment, -1 without one.
+	int             adobe_transform;
+	jpeg_comp_t     comp[3];
+	int             ncomp;
+	int             width, height;
+	int             hmax, vmax;
+	int             mcux, mcuy;
+
+	// Current scan.
+	jpeg_comp_t    *scomp[3];
+	int             ns;
+	int             ss, se, ah, al;
+	int             eobrun;
+	int             restart_left;
+	jpeg_block_fn_t decode;
+	// Decoding straight to pixels, because the scan holds the whole image.
+	bool            direct;
+	int16_t         block[64];
+
+	// Output: scale as a shift, and the size of a block after the IDCT.
+	int             scale;
+	int             bs;
+	int             out_w, out_h;
+	// Part of the image that lands on the buffer.
+	int             x0, y0, x1, y1;
+	pax_buf_t      *fb;
+	int             x_offset, y_offset;
+	paxc_row_store_t store;
+	uint8_t        *rgba;
+};
+
+static bool jpeg_decode(pax_buf_t *framebuffer, const uint8_t *data, size_t len, pax_buf_type_t buf_type, int flags, int x_offset, int y_offset);
+static bool jpeg_info(pax_jpeg_info_t *info, const uint8_t *data, size_t len);
+
+// Reads the rest of a file into memory.
+static bool read_fd(FILE *fd, paxc_membuf_t *mem) {
+	uint8_t tmp[1024];
+	size_t  len;
+	while ((len = fread(tmp, 1, sizeof(tmp), fd)) > 0) {
+		if (!paxc_sink_mem(mem, tmp, len)) {
+			free(mem->data);
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			return false;
+		}
+	}
+	return true;
+}
+
+
+
+// Reads the size and format of a JPEG file.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_info_jpeg_fd(pax_jpeg_info_t *info, FILE *fd) {
+	paxc_membuf_t mem = {0};
+	if (!read_fd(fd, &mem)) return false;
+	bool ret = jpeg_info(info, mem.data, mem.len);
+	free(mem.data);
+	return ret;
+}
+
+// Reads the size and format of a JPEG buffer.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_info_jpeg_buf(pax_jpeg_info_t *info, const void *jpeg, size_t jpeg_len) {
+	return jpeg_info(info, jpeg, jpeg_len);
+}
+
+// Decodes a JPEG file into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_jpeg_fd(pax_buf_t *framebuffer, FILE *fd, pax_buf_type_t buf_type, int flags) {
+	paxc_membuf_t mem = {0};
+	if (!read_fd(fd, &mem)) return false;
+	bool ret = jpeg_decode(framebuffer, mem.data, mem.len, buf_type, flags, 0, 0);
+	free(mem.data);
+	return ret;
+}
+
+// Decodes a JPEG buffer into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_jpeg_buf(pax_buf_t *framebuffer, const void *jpeg, size_t jpeg_len, pax_buf_type_t buf_type, int flags) {
+	return jpeg_decode(framebuffer, jpeg, jpeg_len, buf_type, flags, 0, 0);
+}
+
+// Decodes a JPEG file into an existing PAX buffer.
+// Takes an x/y pair for offset.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_insert_jpeg_fd(pax_buf_t *framebuffer, FILE *fd, int x, int y, int flags) {
+	paxc_membuf_t mem = {0};
+	if (!read_fd(fd, &mem)) return false;
+	bool ret = jpeg_decode(framebuffer, mem.data, mem.len, framebuffer->type, flags | CODEC_FLAG_EXISTING, x, y);
+	free(mem.data);
+	return ret;
+}
+
+// Decodes a JPEG buffer into an existing PAX buffer.
+// Takes an x/y pair for offset.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_insert_jpeg_buf(pax_buf_t *framebuffer, const void *jpeg, size_t jpeg_len, int x, int y, int flags) {
+	return jpeg_decode(framebuffer, jpeg, jpeg_len, framebuffer->type, flags | CODEC_FLAG_EXISTING, x, y);
+}
+
+
+
+/* ==== Markers ==== */
+
+// Reads the big-endian 16-bit value at `in`.
+static inline int read_be16(const uint8_t *in) {
+	return (in[0] << 8) | in[1];
+}
+
+// Reads a DQT segment.
+static bool parse_dqt(jpeg_t *j, const uint8_t *seg, const uint8_t *end) {
+	while (seg < end) {
+		int pq = seg[0] >> 4;
+		int tq = seg[0] & 15;
+		if (pq > 1 || tq > 3 || end - seg < 1 + 64 * (pq + 1)) goto corrupt;
+		seg++;
+		for (int i = 0; i < 64; i++) {
+			j->qt[tq][zigzag[i]] = pq ? read_be16(seg + 2 * i) : seg[i];
+		}
+		seg += 64 * (pq + 1);
+	}
+	return true;
+
+	corrupt:
+	PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid JPEG quantization table");
+	return false;
+}
+
+// Builds the lookup tables of a Huffman table from the code counts per length.
+static bool huff_build(jpeg_huff_t *h, const uint8_t counts[16], const uint8_t *symbols, int total) {
+	memset(h->fast, 0, sizeof(h->fast));
+	memcpy(h->symbols, symbols, total);
+	int code = 0;
+	int k    = 0;
+	for (int len = 1; len <= 16; len++) {
+		h->delta[len] = k - code;
+		for (int i = 0; i < counts[len - 1]; i++, k++, code++) {
+			// More codes than fit in this many bits.
+			if (code >= 1 << len) return false;
+			if (len <= FAST_BITS) {
+				// Every lookup that starts with this code.
+				int base = code << (FAST_BITS - len);
+				for (int f = 0; f < 1 << (FAST_BITS - len); f++) {
+					h->fast[base + f] = (len << 8) | symbols[k];
+				}
+			}
+		}
+		h->maxcode[len] = counts[len - 1] ? code - 1 : -1;
+		code <<= 1;
+	}
+	h->present = true;
+	return true;
+}
+
+// Builds the table that decodes short AC coefficients in one lookup.
+static void huff_build_fast_ac(jpeg_huff_t *h) {
+	for (int i = 0; i < 1 << FAST_BITS; i++) {
+		h->fast_ac[i] = 0;
+		int len = h->fast[i] >> 8;
+		int r   = (h->fast[i] >> 4) & 15;
+		int s   = h->fast[i] & 15;
+		if (!len || !s || len + s > FAST_BITS) continue;
+		int value = (i >> (FAST_BITS - len - s)) & ((1 << s) - 1);
+		if (value < 1 << (s - 1)) value += 1 - (1 << s);
+		if (value >= -128 && value <= 127) h->fast_ac[i] = value * 256 + r * 16 + len + s;
+	}
+}
+
+// Reads a DHT segment.
+static bool parse_dht(jpeg_t *j, const uint8_t *seg, const uint8_t *end) {
+	while (seg < end) {
+		if (end - seg < 17) goto corrupt;
+		int tc = seg[0] >> 4;
+		int th = seg[0] & 15;
+		int total = 0;
+		for (int i = 0; i < 16; i++) total += seg[1 + i];
+		if (tc > 1 || th > 3 || total > 256 || end - seg < 17 + total) goto corrupt;
+		if (!huff_build(tc ? &j->ac[th] : &j->dc[th], seg + 1, seg + 17, total)) goto corrupt;
+		if (tc) huff_build_fast_ac(&j->ac[th]);
+		seg += 17 + total;
+	}
+	return true;
+
+	corrupt:
+	PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid JPEG Huffman table");
+	return false;
+}
+
+// Reads a SOF segment.
+static bool parse_sof(jpeg_t *j, const uint8_t *seg, const uint8_t *end) {
+	if (j->seen_sof) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "JPEG has more than one frame");
+		return false;
+	}
+	if (end - seg < 6) goto corrupt;
+	if (seg[0] != 8) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Unsupported JPEG precision %d", seg[0]);
+		return false;
+	}
+	j->height = read_be16(seg + 1);
+	j->width  = read_be16(seg + 3);
+	j->ncomp  = seg[5];
+	if (!j->width || !j->height) {
+		// A height of 0 defers it to a DNL marker, which nothing writes in practice.
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Unsupported JPEG without a size");
+		return false;
+	}
+	if (j->ncomp != 1 && j->ncomp != 3) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Unsupported JPEG with %d components", j->ncomp);
+		return false;
+	}
+	if (end - seg < 6 + 3 * j->ncomp) goto corrupt;
+
+	j->hmax = 1;
+	j->vmax = 1;
+	for (int i = 0; i < j->ncomp; i++) {
+		jpeg_comp_t *c = &j->comp[i];
+		const uint8_t *in = seg + 6 + 3 * i;
+		c->id = in[0];
+		c->h  = in[1] >> 4;
+		c->v  = in[1] & 15;
+		c->tq = in[2];
+		if (c->h < 1 || c->h > 4 || c->v < 1 || c->v > 4 || c->tq > 3) goto corrupt;
+		if (j->ncomp == 1) {
+			// A single component is never subsampled.
+			c->h = 1;
+			c->v = 1;
+		}
+		if (c->h > j->hmax) j->hmax = c->h;
+		if (c->v > j->vmax) j->vmax = c->v;
+	}
+	j->mcux = (j->width  + 8 * j->hmax - 1) / (8 * j->hmax);
+	j->mcuy = (j->height + 8 * j->vmax - 1) / (8 * j->vmax);
+	for (int i = 0; i < j->ncomp; i++) {
+		j->comp[i].bw = j->mcux * j->comp[i].h;
+		j->comp[i].bh = j->mcuy * j->comp[i].v;
+	}
+	j->seen_sof = true;
+	return true;
+
+	corrupt:
+	PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid JPEG frame header");
+	return false;
+}
+
+// Reads a SOS segment.
+static bool parse_sos(jpeg_t *j, const uint8_t *seg, const uint8_t *end) {
+	if (!j->seen_sof) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "JPEG scan before the frame header");
+		return false;
+	}
+	if (end - seg < 1) goto corrupt;
+	j->ns = seg[0];
+	if (j->ns < 1 || j->ns > j->ncomp || end - seg < 4 + 2 * j->ns) goto corrupt;
+	for (int i = 0; i < j->ns; i++) {
+		int id = seg[1 + 2 * i];
+		int t  = seg[2 + 2 * i];
+		jpeg_comp_t *c = NULL;
+		for (int k = 0; k < j->ncomp; k++) {
+			if (j->comp[k].id == id) c = &j->comp[k];
+		}
+		if (!c || (t >> 4) > 3 || (t & 15) > 3) goto corrupt;
+		c->td = t >> 4;
+		c->ta = t & 15;
+		j->scomp[i] = c;
+	}
+	seg += 1 + 2 * j->ns;
+	j->ss = seg[0];
+	j->se = seg[1];
+	j->ah = seg[2] >> 4;
+	j->al = seg[2] & 15;
+
+	if (j->progressive) {
+		if (j->ss > j->se || j->se > 63 || (j->ss == 0) != (j->se == 0) || (j->ss && j->ns != 1) || j->ah > 13 || j->al > 13) {
+			goto corrupt;
+		}
+	} else {
+		j->ss = 0;
+		j->se = 63;
+		j->ah = 0;
+		j->al = 0;
+	}
+
+	// Make sure the tables this scan needs exist.
+	for (int i = 0; i < j->ns; i++) {
+		jpeg_comp_t *c = j->scomp[i];
+		if ((j->ss == 0 && j->ah == 0 && !j->dc[c->td].present) || (j->se > 0 && !j->ac[c->ta].present)) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "JPEG scan uses a missing Huffman table");
+			return false;
+		}
+	}
+	return true;
+
+	corrupt:
+	PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid JPEG scan header");
+	return false;
+}
+
+// Reads an APPn segment for the color space hints of JFIF and Adobe.
+static void parse_app(jpeg_t *j, int marker, const uint8_t *seg, const uint8_t *end) {
+	if (marker == M_APP0 && end - seg >= 5 && !memcmp(seg, "JFIF", 5)) {
+		j->jfif = true;
+	} else if (marker == M_APP14 && end - seg >= 12 && !memcmp(seg, "Adobe", 5)) {
+		j->adobe_transform = seg[11];
+	}
+}
+
+// Reads markers up to and including the next SOS, or up to the frame header if `header_only`.
+// Returns the marker that stopped it, or -1 on error.
+static int read_markers(jpeg_t *j, bool header_only) {
+	while (true) {
+		// Skip anything that isn't a marker, like the leftovers of a scan.
+		while (j->ptr < j->end && *j->ptr != 0xff) j->ptr++;
+		while (j->ptr < j->end && *j->ptr == 0xff) j->ptr++;
+		if (j->ptr >= j->end) return j->seen_sof && !header_only ? M_EOI : -2;
+		int marker = *j->ptr++;
+		if (marker == M_SOI || (marker >= M_RST0 && marker <= M_RST7)) continue;
+		if (marker == M_EOI) return M_EOI;
+
+		if (j->end - j->ptr < 2 || read_be16(j->ptr) < 2 || read_be16(j->ptr) > j->end - j->ptr) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "JPEG data ends early");
+			return -1;
+		}
+		const uint8_t *seg = j->ptr + 2;
+		const uint8_t *end = j->ptr + read_be16(j->ptr);
+		j->ptr = end;
+
+		if (marker == M_SOF0 || marker == M_SOF1 || marker == M_SOF2) {
+			j->progressive = marker == M_SOF2;
+			if (!parse_sof(j, seg, end)) return -1;
+			if (header_only) return marker;
+		} else if (marker >= 0xc3 && marker <= 0xcf && marker != M_DHT && marker != 0xc8) {
+			// Lossless, hierarchical and arithmetic coded JPEGs are rare enough not to support.
+			PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Unsupported JPEG type (SOF%d)", marker - M_SOF0);
+			return -1;
+		} else if (marker == M_DHT) {
+			if (!parse_dht(j, seg, end)) return -1;
+		} else if (marker == M_DQT) {
+			if (!parse_dqt(j, seg, end)) return -1;
+		} else if (marker == M_DRI) {
+			if (end - seg < 2) {
+				PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid JPEG restart interval");
+				return -1;
+			}
+			j->restart_interval = read_be16(seg);
+		} else if (marker >= M_APP0 && marker <= 0xef) {
+			parse_app(j, marker, seg, end);
+		} else if (marker == M_SOS) {
+			if (!parse_sos(j, seg, end)) return -1;
+			return M_SOS;
+		}
+	}
+}
+
+// Reads up to the frame header.
+static bool jpeg_info(pax_jpeg_info_t *info, const uint8_t *data, size_t len) {
+	jpeg_t *j = paxc_calloc(1, sizeof(jpeg_t));
+	if (!j) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return false;
+	}
+	j->ptr = data;
+	j->end = data + len;
+	bool ok = len >= 2 && data[0] == 0xff && data[1] == M_SOI;
+	if (!ok) {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a JPEG file");
+	} else {
+		int marker = read_markers(j, true);
+		ok = marker >= 0 && j->seen_sof;
+		if (!ok && marker != -1) PAXC_ERROR(PAX_ERR_CORRUPT, "JPEG has no frame header");
+	}
+	if (ok) {
+		info->width       = j->width;
+		info->height      = j->height;
+		info->components  = j->ncomp;
+		info->progressive = j->progressive;
+	}
+	paxc_free(j);
+	return ok;
+}
+
+
+
+/* ==== Entropy decoding ==== */
+
+// Tops up the bit reader to at least 25 bits.
+// Stops at markers, after which it reads zeroes, as libjpeg does.
+static void fill_bits(jpeg_t *j) {
+	while (j->nbits <= 24) {
+		uint32_t byte = 0;
+		if (!j->stopped) {
+			if (j->ptr >= j->end) {
+				j->stopped = true;
+				j->ran_out = true;
+			} else if (j->ptr[0] != 0xff) {
+				byte = *j->ptr++;
+			} else if (j->ptr + 1 < j->end && j->ptr[1] == 0) {
+				// A stuffed zero byte.
+				byte = 0xff;
+				j->ptr += 2;
+			} else {
+				j->stopped = true;
+			}
+		}
+		j->bits  |= byte << (24 - j->nbits);
+		j->nbits += 8;
+	}
+}
+
+// Reads `n` bits, where 0 < `n` <= 16.
+static inline int get_bits(jpeg_t *j, int n) {
+	if (j->nbits < n) fill_bits(j);
+	int value  = j->bits >> (32 - n);
+	j->bits  <<= n;
+	j->nbits  -= n;
+	return value;
+}
+
+// Reads an `s`-bit value in JPEG's sign-magnitude format.
+static inline int receive_extend(jpeg_t *j, int s) {
+	if (!s) return 0;
+	int value = get_bits(j, s);
+	return value < 1 << (s - 1) ? value - (1 << s) + 1 : value;
+}
+
+// Decodes a Huffman-coded symbol; returns -1 for an invalid code.
+static inline int huff_decode(jpeg_t *j, const jpeg_huff_t *h) {
+	if (j->nbits < 16) fill_bits(j);
+	int fast = h->fast[j->bits >> (32 - FAST_BITS)];
+	if (fast) {
+		j->bits  <<= fast >> 8;
+		j->nbits  -= fast >> 8;
+		return fast & 0xff;
+	}
+	for (int len = FAST_BITS + 1; len <= 16; len++) {
+		int32_t code = j->bits >> (32 - len);
+		if (code <= h->maxcode[len]) {
+			j->bits  <<= len;
+			j->nbits  -= len;
+			return h->symbols[code + h->delta[len]];
+		}
+	}
+	return -1;
+}
+
+// Reports corrupt entropy-coded data.
+static bool corrupt_data(void) {
+	PAXC_ERROR(PAX_ERR_CORRUPT, "Corrupt JPEG data");
+	return false;
+}
+
+// Decodes a block of a sequential scan into `blk`, which must be zeroed.
+// Returns the zigzag index of the last coefficient, or -1 on error.
+static int decode_block(jpeg_t *j, jpeg_comp_t *c, int16_t *blk) {
+	int t = huff_decode(j, &j->dc[c->td]);
+	if (t < 0 || t > 15) goto corrupt;
+	c->dc_pred = (int16_t) (c->dc_pred + receive_extend(j, t));
+	blk[0]     = c->dc_pred;
+
+	const jpeg_huff_t *ac   = &j->ac[c->ta];
+	int                last = 0;
+	for (int k = 1; k < 64; k++) {
+		if (j->nbits < 16) fill_bits(j);
+		int fast = ac->fast_ac[j->bits >> (32 - FAST_BITS)];
+		if (fast) {
+			k += (fast >> 4) & 15;
+			if (k > 63) goto corrupt;
+			j->bits      <<= fast & 15;
+			j->nbits      -= fast & 15;
+			blk[zigzag[k]] = fast >> 8;
+			last           = k;
+			continue;
+		}
+		int rs = huff_decode(j, ac);
+		if (rs < 0) goto corrupt;
+		int r = rs >> 4;
+		int s = rs & 15;
+		if (!s) {
+			// End of block, or a run of 16 zeroes.
+			if (r != 15) break;
+			k += 15;
+			continue;
+		}
+		k += r;
+		if (k > 63) goto corrupt;
+		blk[zigzag[k]] = receive_extend(j, s);
+		last           = k;
+	}
+	return last;
+
+	corrupt:
+	corrupt_data();
+	return -1;
+}
+
+// Decodes a block of a sequential scan in the multi-scan case.
+static bool decode_seq(jpeg_t *j, jpeg_comp_t *c, int16_t *blk) {
+	return decode_block(j, c, blk) >= 0;
+}
+
+// Decodes the first bits of the DC coefficient in a progressive scan.
+static bool decode_dc_first(jpeg_t *j, jpeg_comp_t *c, int16_t *blk) {
+	int t = huff_decode(j, &j->dc[c->td]);
+	if (t < 0 || t > 15) return corrupt_data();
+	c->dc_pred = (int16_t) (c->dc_pred + receive_extend(j, t));
+	blk[0]     = (int16_t) (c->dc_pred * (1 << j->al));
+	return true;
+}
+
+// Decodes another bit of the DC coefficient in a progressive scan.
+static bool decode_dc_refine(jpeg_t *j, jpeg_comp_t *c, int16_t *blk) {
+	(void) c;
+	if (get_bits(j, 1)) blk[0] |= 1 << j->al;
+	return true;
+}
+
+// Decodes the first bits of a band of AC coefficients in a progressive scan.
+static bool decode_ac_first(jpeg_t *j, jpeg_comp_t *c, int16_t *blk) {
+	if (j->eobrun) {
+		j->eobrun--;
+		return true;
+	}
+	const jpeg_huff_t *ac = &j->ac[c->ta];
+	for (int k = j->ss; k <= j->se; k++) {
+		int rs = huff_decode(j, ac);
+		if (rs < 0) return corrupt_data();
+		int r = rs >> 4;
+		int s = rs & 15;
+		if (!s) {
+			if (r < 15) {
+				// A run of blocks with nothing left in this band, including this one.
+				j->eobrun = (1 << r) - 1;
+				if (r) j->eobrun += get_bits(j, r);
+				break;
+			}
+			k += 15;
+			continue;
+		}
+		k += r;
+		if (k > 63) return corrupt_data();
+		blk[zigzag[k]] = (int16_t) (receive_extend(j, s) * (1 << j->al));
+	}
+	return true;
+}
+
+// Decodes another bit of a band of AC coefficients in a progressive scan.
+// Coefficients that are already nonzero get a correction bit each as they are passed.
+static bool decode_ac_refine(jpeg_t *j, jpeg_comp_t *c, int16_t *blk) {
+	const jpeg_huff_t *ac = &j->ac[c->ta];
+	int p1 = 1 << j->al;
+	int m1 = -p1;
+	int k  = j->ss;
+	if (!j->eobrun) {
+		for (; k <= j->se; k++) {
+			int rs = huff_decode(j, ac);
+			if (rs < 0) return corrupt_data();
+			int r = rs >> 4;
+			int s = rs & 15;
+			if (s) {
+				s = get_bits(j, 1) ? p1 : m1;
+			} else if (r != 15) {
+				j->eobrun = 1 << r;
+				if (r) j->eobrun += get_bits(j, r);
+				break;
+			}
+			// Skip `r` zero coefficients, refining the nonzero ones on the way.
+			for (; k <= j->se; k++) {
+				int16_t *coef = &blk[zigzag[k]];
+				if (*coef) {
+					if (get_bits(j, 1) && !(*coef & p1)) *coef += *coef >= 0 ? p1 : m1;
+				} else if (--r < 0) {
+					break;
+				}
+			}
+			if (s && k <= j->se) blk[zigzag[k]] = s;
+		}
+	}
+	if (j->eobrun) {
+		for (; k <= j->se; k++) {
+			int16_t *coef = &blk[zigzag[k]];
+			if (*coef && get_bits(j, 1) && !(*coef & p1)) *coef += *coef >= 0 ? p1 : m1;
+		}
+		j->eobrun--;
+	}
+	return true;
+}
+
+
+
+/* ==== IDCT and output ==== */
+
+// Clamps to the range of a sample.
+static inline uint8_t clamp8(int32_t value) {
+	return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+// Saturates to 16 bits.
+static inline int32_t sat16(int32_t value) {
+	return value < -32768 ? -32768 : value > 32767 ? 32767 : value;
+}
+
+// Lanes of 32-bit integers that the IDCT works on, `LANES` at a time.
+#if PAXC_SIMD_SSE2
+#define LANES 4
+typedef __m128i lanes_t;
+#define LANE_LOAD(ptr)     _mm_loadu_si128((const __m128i *) (ptr))
+#define LANE_STORE(ptr, v) _mm_storeu_si128((__m128i *) (ptr), v)
+#define LANE_SET(k)        _mm_set1_epi32(k)
+#define LANE_ADD(a, b)     _mm_add_epi32(a, b)
+#define LANE_SUB(a, b)     _mm_sub_epi32(a, b)
+#define LANE_MUL(a, k)     mul_lanes(a, k)
+#define LANE_SHR(a, n)     _mm_sra_epi32(a, _mm_cvtsi32_si128(n))
+#define LANE_SAT16(a)      _mm_srai_epi32(_mm_unpacklo_epi16(_mm_packs_epi32(a, a), _mm_packs_epi32(a, a)), 16)
+
+// SSE2 has no 32-bit multiply; the low halves of two 64-bit multiplies give the same bits.
+static inline __m128i mul_lanes(__m128i a, int32_t k) {
+	__m128i kk   = _mm_set1_epi32(k);
+	__m128i even = _mm_mul_epu32(a, kk);
+	__m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), kk);
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+#elif PAXC_SIMD_NEON
+#define LANES 4
+typedef int32x4_t lanes_t;
+#define LANE_LOAD(ptr)     vld1q_s32(ptr)
+#define LANE_STORE(ptr, v) vst1q_s32(ptr, v)
+#define LANE_SET(k)        vdupq_n_s32(k)
+#define LANE_ADD(a, b)     vaddq_s32(a, b)
+#define LANE_SUB(a, b)     vsubq_s32(a, b)
+#define LANE_MUL(a, k)     vmulq_n_s32(a, k)
+#define LANE_SHR(a, n)     vshlq_s32(a, vdupq_n_s32(-(n)))
+#define LANE_SAT16(a)      vmovl_s16(vqmovn_s32(a))
+#else
+#define LANES 1
+typedef int32_t lanes_t;
+#define LANE_LOAD(ptr)     (*(ptr))
+#define LANE_STORE(ptr, v) (*(ptr) = (v))
+#define LANE_SET(k)        (k)
+#define LANE_ADD(a, b)     ((a) + (b))
+#define LANE_SUB(a, b)     ((a) - (b))
+#define LANE_MUL(a, k)     ((a) * (k))
+#define LANE_SHR(a, n)     ((a) >> (n))
+#define LANE_SAT16(a)      sat16(a)
+#endif
+
+// One dimension of the IDCT on eight lanes: `in[k]` holds coefficient `k` of every lane.
+// The arithmetic is that of the libjpeg "islow" IDCT, so output matches libjpeg exactly.
+// Inputs must fit in 16 bits, and so must the output if it feeds another pass; `sat` enforces that.
+// Valid images never get near the limits, but corrupt ones must not overflow.
+static inline void idct_1d(int32_t in[8][8], int32_t out[8][8], int shift, bool sat) {
+	lanes_t round = LANE_SET(1 << (shift - 1));
+	for (int i = 0; i < 8; i += LANES) {
+		// Even part.
+		lanes_t in0   = LANE_LOAD(&in[0][i]);
+		lanes_t in2   = LANE_LOAD(&in[2][i]);
+		lanes_t in4   = LANE_LOAD(&in[4][i]);
+		lanes_t in6   = LANE_LOAD(&in[6][i]);
+		lanes_t z1    = LANE_MUL(LANE_ADD(in2, in6), FIX_0_541196100);
+		lanes_t tmp2  = LANE_SUB(z1, LANE_MUL(in6, FIX_1_847759065));
+		lanes_t tmp3  = LANE_ADD(z1, LANE_MUL(in2, FIX_0_765366865));
+		lanes_t tmp0  = LANE_ADD(LANE_MUL(LANE_ADD(in0, in4), 1 << CONST_BITS), round);
+		lanes_t tmp1  = LANE_ADD(LANE_MUL(LANE_SUB(in0, in4), 1 << CONST_BITS), round);
+		lanes_t tmp10 = LANE_ADD(tmp0, tmp3);
+		lanes_t tmp13 = LANE_SUB(tmp0, tmp3);
+		lanes_t tmp11 = LANE_ADD(tmp1, tmp2);
+		lanes_t tmp12 = LANE_SUB(tmp1, tmp2);
+
+		// Odd part.
+		lanes_t o0 = LANE_LOAD(&in[7][i]);
+		lanes_t o1 = LANE_LOAD(&in[5][i]);
+		lanes_t o2 = LANE_LOAD(&in[3][i]);
+		lanes_t o3 = LANE_LOAD(&in[1][i]);
+		lanes_t z5 = LANE_MUL(LANE_ADD(LANE_ADD(o0, o1), LANE_ADD(o2, o3)), FIX_1_175875602);
+		lanes_t za = LANE_MUL(LANE_ADD(o0, o3), -FIX_0_899976223);
+		lanes_t zb = LANE_MUL(LANE_ADD(o1, o2), -FIX_2_562915447);
+		lanes_t zc = LANE_ADD(LANE_MUL(LANE_ADD(o0, o2), -FIX_1_961570560), z5);
+		lanes_t zd = LANE_ADD(LANE_MUL(LANE_ADD(o1, o3), -FIX_0_390180644), z5);
+		o0 = LANE_ADD(LANE_MUL(o0, FIX_0_298631336), LANE_ADD(za, zc));
+		o1 = LANE_ADD(LANE_MUL(o1, FIX_2_053119869), LANE_ADD(zb, zd));
+		o2 = LANE_ADD(LANE_MUL(o2, FIX_3_072711026), LANE_ADD(zb, zc));
+		o3 = LANE_ADD(LANE_MUL(o3, FIX_1_501321110), LANE_ADD(za, zd));
+
+#define IDCT_OUT(k, value) do { \
+			lanes_t res_ = LANE_SHR(value, shift); \
+			if (sat) res_ = LANE_SAT16(res_); \
+			LANE_STORE(&out[k][i], res_); \
+		} while (0)
+		IDCT_OUT(0, LANE_ADD(tmp10, o3));
+		IDCT_OUT(7, LANE_SUB(tmp10, o3));
+		IDCT_OUT(1, LANE_ADD(tmp11, o2));
+		IDCT_OUT(6, LANE_SUB(tmp11, o2));
+		IDCT_OUT(2, LANE_ADD(tmp12, o1));
+		IDCT_OUT(5, LANE_SUB(tmp12, o1));
+		IDCT_OUT(3, LANE_ADD(tmp13, o0));
+		IDCT_OUT(4, LANE_SUB(tmp13, o0));
+#undef IDCT_OUT
+	}
+}
+
+// Full size IDCT of a block.
+static void idct_8x8(const int16_t *coef, const uint16_t *q, uint8_t *out, int stride) {
+	int32_t a[8][8], b[8][8];
+	for (int i = 0; i < 64; i++) a[i >> 3][i & 7] = sat16(coef[i] * q[i]);
+	// Columns, then rows by way of a transpose.
+	idct_1d(a, b, CONST_BITS - PASS1_BITS, true);
+	for (int y = 0; y < 8; y++) {
+		for (int x = 0; x < 8; x++) a[x][y] = b[y][x];
+	}
+	idct_1d(a, b, CONST_BITS + PASS1_BITS + 3, false);
+	for (int y = 0; y < 8; y++) {
+		for (int x = 0; x < 8; x++) out[y * stride + x] = clamp8(b[x][y] + 128);
+	}
+}
+
+// IDCT of a block straight to `n` by `n` samples, for n = 2 or 4.
+// Only the rows and columns up to zigzag index `last` can hold coefficients, so the rest are skipped.
+static void idct_scaled(const int16_t *coef, const uint16_t *q, int last, uint8_t *out, int stride, int n) {
+	const int16_t (*w)[8] = n == 4 ? idct_w4 : idct_w2;
+	int     rows = zz_extent[last] >> 4;
+	int     cols = zz_extent[last] & 15;
+	int32_t a[8][8], ws[4][8];
+	for (int v = 0; v < rows; v++) {
+		for (int u = 0; u < cols; u++) a[v][u] = sat16(coef[v * 8 + u] * q[v * 8 + u]);
+	}
+
+	// Samples x and n - 1 - x share the even terms and negate the odd ones.
+	int32_t round = 1 << (CONST_BITS - PASS1_BITS - 1);
+	for (int y = 0; y < n / 2; y++) {
+		for (int i = 0; i < cols; i++) {
+			int32_t even = round;
+			int32_t odd  = 0;
+			for (int k = 0; k < rows; k += 2) even += w[y][k] * a[k][i];
+			for (int k = 1; k < rows; k += 2) odd  += w[y][k] * a[k][i];
+			ws[y][i]         = sat16((even + odd) >> (CONST_BITS - PASS1_BITS));
+			ws[n - 1 - y][i] = sat16((even - odd) >> (CONST_BITS - PASS1_BITS));
+		}
+	}
+	round = 1 << (CONST_BITS + PASS1_BITS - 1);
+	for (int y = 0; y < n; y++) {
+		for (int x = 0; x < n / 2; x++) {
+			int32_t even = round;
+			int32_t odd  = 0;
+			for (int k = 0; k < cols; k += 2) even += w[x][k] * ws[y][k];
+			for (int k = 1; k < cols; k += 2) odd  += w[x][k] * ws[y][k];
+			out[y * stride + x]         = clamp8(((even + odd) >> (CONST_BITS + PASS1_BITS)) + 128);
+			out[y * stride + n - 1 - x] = clamp8(((even - odd) >> (CONST_BITS + PASS1_BITS)) + 128);
+		}
+	}
+}
+
+// Turns a block of component `c` into samples at block column `bx` and block row `brow` of its plane.
+// `last` is the zigzag index of the last nonzero coefficient.
+static void idct_block(jpeg_t *j, jpeg_comp_t *c, const int16_t *coef, int last, int bx, int brow) {
+	int             bs  = j->bs;
+	uint8_t        *out = c->plane + (size_t) brow * bs * c->stride + bx * bs;
+	const uint16_t *q   = j->qt[c->tq];
+	if (last == 0 || bs == 1) {
+		// Flat blocks are common and need no transform.
+		uint8_t value = clamp8(((coef[0] * q[0] + 4) >> 3) + 128);
+		for (int y = 0; y < bs; y++) memset(out + y * c->stride, value, bs);
+	} else if (bs == 8) {
+		idct_8x8(coef, q, out, c->stride);
+	} else {
+		idct_scaled(coef, q, last, out, c->stride, bs);
+	}
+}
+
+// Zigzag index of the last nonzero coefficient of a block, 0 if there are none.
+static int last_nonzero(const int16_t *blk) {
+	int k = 63;
+	while (k > 0 && !blk[zigzag[k]]) k--;
+	return k;
+}
+
+// Row `ly` of the current MCU row of component `c`, upsampled to the width of the image.
+// Subsampled components are upsampled by replicating samples.
+static const uint8_t *comp_row(jpeg_t *j, jpeg_comp_t *c, int ly) {
+	const uint8_t *row = c->plane + (size_t) (ly * c->v / j->vmax) * c->stride;
+	if (c->h == j->hmax) return row;
+	uint8_t *up = c->up;
+	if (c->h * 2 == j->hmax) {
+		for (int x = j->x0 >> 1; x < (j->x1 + 1) >> 1; x++) {
+			up[2 * x]     = row[x];
+			up[2 * x + 1] = row[x];
+		}
+	} else {
+		for (int x = j->x0; x < j->x1; x++) up[x] = row[x * c->h / j->hmax];
+	}
+	return up;
+}
+
+// Converts YCbCr samples to RGBA, with libjpeg's fixed-point coefficients.
+// The SIMD versions split each coefficient into a whole part and a 16-bit fraction, which gives identical results.
+static void ycc_to_rgba(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint8_t *rgba, int n) {
+	int i = 0;
+
+#if PAXC_SIMD_SSE2
+	const __m128i zero  = _mm_setzero_si128();
+	const __m128i c128  = _mm_set1_epi16(128);
+	const __m128i two   = _mm_set1_epi16(2);
+	const __m128i half  = _mm_set1_epi32(32768);
+	const __m128i k_r   = _mm_set_epi16(16384, 26345, 16384, 26345, 16384, 26345, 16384, 26345);
+	const __m128i k_g   = _mm_set_epi16(18734, -22554, 18734, -22554, 18734, -22554, 18734, -22554);
+	const __m128i k_b   = _mm_set_epi16(16384, -14942, 16384, -14942, 16384, -14942, 16384, -14942);
+	const __m128i alpha = _mm_set1_epi8((char) 255);
+	for (; i + 8 <= n; i += 8) {
+		__m128i yy = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (y + i)), zero);
+		__m128i u  = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (cb + i)), zero), c128);
+		__m128i v  = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (cr + i)), zero), c128);
+		// R = Y + V + (26345 V + 32768) >> 16
+		__m128i lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(v, two), k_r), 16);
+		__m128i hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(v, two), k_r), 16);
+		__m128i r  = _mm_add_epi16(_mm_add_epi16(yy, v), _mm_packs_epi32(lo, hi));
+		// G = Y - V + (-22554 U + 18734 V + 32768) >> 16
+		lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(u, v), k_g), half), 16);
+		hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(u, v), k_g), half), 16);
+		__m128i g  = _mm_add_epi16(_mm_sub_epi16(yy, v), _mm_packs_epi32(lo, hi));
+		// B = Y + 2 U + (-14942 U + 32768) >> 16
+		lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(u, two), k_b), 16);
+		hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(u, two), k_b), 16);
+		__m128i b  = _mm_add_epi16(_mm_add_epi16(yy, _mm_add_epi16(u, u)), _mm_packs_epi32(lo, hi));
+
+		__m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g));
+		__m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), alpha);
+		_mm_storeu_si128((__m128i *) (rgba + 4*i),      _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i *) (rgba + 4*i + 16), _mm_unpackhi_epi16(rg, ba));
+	}
+#elif PAXC_SIMD_NEON
+	const int32x4_t half = vdupq_n_s32(32768);
+	const int16x8_t c128 = vdupq_n_s16(128);
+	for (; i + 8 <= n; i += 8) {
+		int16x8_t yy = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y + i)));
+		int16x8_t u  = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(cb + i))), c128);
+		int16x8_t v  = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(cr + i))), c128);
+		int32x4_t lo = vmlal_n_s16(half, vget_low_s16(v), 26345);
+		int32x4_t hi = vmlal_n_s16(half, vget_high_s16(v), 26345);
+		int16x8_t r  = vaddq_s16(vaddq_s16(yy, v), vcombine_s16(vshrn_n_s32(lo, 16), vshrn_n_s32(hi, 16)));
+		lo = vmlal_n_s16(vmlal_n_s16(half, vget_low_s16(u), -22554), vget_low_s16(v), 18734);
+		hi = vmlal_n_s16(vmlal_n_s16(half, vget_high_s16(u), -22554), vget_high_s16(v), 18734);
+		int16x8_t g  = vaddq_s16(vsubq_s16(yy, v), vcombine_s16(vshrn_n_s32(lo, 16), vshrn_n_s32(hi, 16)));
+		lo = vmlal_n_s16(half, vget_low_s16(u), -14942);
+		hi = vmlal_n_s16(half, vget_high_s16(u), -14942);
+		int16x8_t b  = vaddq_s16(vaddq_s16(yy, vaddq_s16(u, u)), vcombine_s16(vshrn_n_s32(lo, 16), vshrn_n_s32(hi, 16)));
+
+		uint8x8x4_t px;
+		px.val[0] = vqmovun_s16(r);
+		px.val[1] = vqmovun_s16(g);
+		px.val[2] = vqmovun_s16(b);
+		px.val[3] = vdup_n_u8(255);
+		vst4_u8(rgba + 4*i, px);
+	}
+#endif
+
+	for (; i < n; i++) {
+		int32_t u     = cb[i] - 128;
+		int32_t v     = cr[i] - 128;
+		rgba[4*i + 0] = clamp8(y[i] + ((91881 * v + 32768) >> 16));
+		rgba[4*i + 1] = clamp8(y[i] + ((-22554 * u - 46802 * v + 32768) >> 16));
+		rgba[4*i + 2] = clamp8(y[i] + ((116130 * u + 32768) >> 16));
+		rgba[4*i + 3] = 255;
+	}
+}
+
+// Interleaves RGB samples into RGBA.
+static void rgb_to_rgba(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint8_t *rgba, int n) {
+	for (int i = 0; i < n; i++) {
+		rgba[4*i + 0] = r[i];
+		rgba[4*i + 1] = g[i];
+		rgba[4*i + 2] = b[i];
+		rgba[4*i + 3] = 255;
+	}
+}
+
+// Expands greyscale samples into RGBA.
+static void grey_to_rgba(const uint8_t *grey, uint8_t *rgba, int n) {
+	for (int i = 0; i < n; i++) {
+		rgba[4*i + 0] = grey[i];
+		rgba[4*i + 1] = grey[i];
+		rgba[4*i + 2] = grey[i];
+		rgba[4*i + 3] = 255;
+	}
+}
+
+// Writes the visible rows of MCU row `my` to the buffer.
+static void emit_mcu_row(jpeg_t *j, int my) {
+	int rows = j->vmax * j->bs;
+	int x0   = j->x0;
+	int n    = j->x1 - j->x0;
+	for (int ly = 0; ly < rows; ly++) {
+		int y = my * rows + ly;
+		if (y < j->y0) continue;
+		if (y >= j->y1) break;
+		const uint8_t *src[3];
+		for (int i = 0; i < j->ncomp; i++) src[i] = comp_row(j, &j->comp[i], ly) + x0;
+		if (j->ncomp == 1) {
+			grey_to_rgba(src[0], j->rgba, n);
+		} else if (j->rgb) {
+			rgb_to_rgba(src[0], src[1], src[2], j->rgba, n);
+		} else {
+			ycc_to_rgba(src[0], src[1], src[2], j->rgba, n);
+		}
+		j->store(j->fb, j->x_offset + x0, j->y_offset + y, n, j->rgba);
+	}
+}
+
+
+
+/* ==== Scans ==== */
+
+// Handles the restart marker due before the next MCU, if any.
+static void restart_check(jpeg_t *j) {
+	if (!j->restart_interval) return;
+	if (j->restart_left--) return;
+	j->restart_left = j->restart_interval - 1;
+
+	// The bit reader stops at markers, so whatever it holds is padding.
+	j->bits  = 0;
+	j->nbits = 0;
+	while (j->ptr + 1 < j->end && !(j->ptr[0] == 0xff && j->ptr[1] != 0 && j->ptr[1] != 0xff)) j->ptr++;
+	if (j->ptr + 1 < j->end && j->ptr[1] >= M_RST0 && j->ptr[1] <= M_RST7) {
+		j->ptr     += 2;
+		j->stopped  = false;
+	} else {
+		// Carry on with zeroes, as libjpeg does.
+		PAX_LOGW(TAG, "Missing JPEG restart marker");
+		j->stopped = true;
+	}
+	for (int i = 0; i < j->ncomp; i++) j->comp[i].dc_pred = 0;
+	j->eobrun = 0;
+}
+
+// Decodes a block of component `c` at block column `bx` and row `by`.
+static bool scan_block(jpeg_t *j, jpeg_comp_t *c, int bx, int by) {
+	if (j->direct) {
+		memset(j->block, 0, sizeof(j->block));
+		int last = decode_block(j, c, j->block);
+		if (last < 0) return false;
+		idct_block(j, c, j->block, last, bx, by % c->v);
+		return true;
+	}
+	return j->decode(j, c, c->coefs + ((size_t) by * c->bw + bx) * 64);
+}
+
+// Decodes the scan that starts at the current position.
+static bool decode_scan(jpeg_t *j) {
+	j->bits         = 0;
+	j->nbits        = 0;
+	j->stopped      = false;
+	j->eobrun       = 0;
+	j->restart_left = j->restart_interval;
+	for (int i = 0; i < j->ncomp; i++) j->comp[i].dc_pred = 0;
+
+	if (!j->progressive) {
+		j->decode = decode_seq;
+	} else if (j->ss == 0) {
+		j->decode = j->ah ? decode_dc_refine : decode_dc_first;
+	} else {
+		j->decode = j->ah ? decode_ac_refine : decode_ac_first;
+	}
+
+	if (j->ns == 1 && j->ncomp > 1) {
+		// Scans of one component cover only the blocks inside the image, in raster order.
+		jpeg_comp_t *c  = j->scomp[0];
+		int          cw = ((j->width  * c->h + j->hmax - 1) / j->hmax + 7) / 8;
+		int          ch = ((j->height * c->v + j->vmax - 1) / j->vmax + 7) / 8;
+		for (int by = 0; by < ch; by++) {
+			for (int bx = 0; bx < cw; bx++) {
+				restart_check(j);
+				if (!scan_block(j, c, bx, by)) return false;
+			}
+		}
+		return true;
+	}
+
+	int rows = j->vmax * j->bs;
+	for (int my = 0; my < j->mcuy; my++) {
+		for (int mx = 0; mx < j->mcux; mx++) {
+			restart_check(j);
+			for (int i = 0; i < j->ns; i++) {
+				jpeg_comp_t *c = j->scomp[i];
+				for (int v = 0; v < c->v; v++) {
+					for (int h = 0; h < c->h; h++) {
+						if (!scan_block(j, c, mx * c->h + h, my * c->v + v)) return false;
+					}
+				}
+			}
+		}
+		if (j->direct) {
+			emit_mcu_row(j, my);
+			// Nothing further down would be visible.
+			if ((my + 1) * rows >= j->y1) break;
+		}
+	}
+	return true;
+}
+
+// Turns the coefficients of every MCU row into pixels, after the last scan.
+static void emit_coefs(jpeg_t *j) {
+	int rows = j->vmax * j->bs;
+	for (int my = 0; my < j->mcuy; my++) {
+		if ((my + 1) * rows <= j->y0) continue;
+		if (my * rows >= j->y1) break;
+		for (int i = 0; i < j->ncomp; i++) {
+			jpeg_comp_t *c = &j->comp[i];
+			for (int v = 0; v < c->v; v++) {
+				const int16_t *blk = c->coefs + (size_t) (my * c->v + v) * c->bw * 64;
+				for (int bx = 0; bx < c->bw; bx++, blk += 64) {
+					idct_block(j, c, blk, last_nonzero(blk), bx, v);
+				}
+			}
+		}
+		emit_mcu_row(j, my);
+	}
+}
+
+// Allocates the planes and coefficients.
+static bool alloc_comps(jpeg_t *j) {
+	for (int i = 0; i < j->ncomp; i++) {
+		jpeg_comp_t *c = &j->comp[i];
+		c->stride = c->bw * j->bs;
+		c->plane  = paxc_malloc((size_t) c->stride * c->v * j->bs);
+		if (!c->plane) return false;
+		if (c->h != j->hmax) {
+			c->up = paxc_malloc(j->out_w + 1);
+			if (!c->up) return false;
+		}
+		if (!j->direct) {
+			uint64_t size = (uint64_t) c->bw * c->bh * 64 * sizeof(int16_t);
+			if (size > SIZE_MAX) return false;
+			c->coefs = paxc_calloc(1, size);
+			if (!c->coefs) return false;
+		}
+	}
+	j->rgba = paxc_malloc((size_t) j->out_w * 4);
+	return j->rgba != NULL;
+}
+
+// A generic wrapper for decoding JPEGs.
+// Sets up the framebuffer if required.
+static bool jpeg_decode(pax_buf_t *framebuffer, const uint8_t *data, size_t len, pax_buf_type_t buf_type, int flags, int x_offset, int y_offset) {
+	PAXC_STATS_CALL_BEGIN();
+	bool do_alloc = !(flags & CODEC_FLAG_EXISTING);
+	bool ok       = false;
+	if (do_alloc) {
+		framebuffer->width  = 0;
+		framebuffer->height = 0;
+	}
+
+	jpeg_t *j = paxc_calloc(1, sizeof(jpeg_t));
+	if (!j) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		goto cleanup;
+	}
+	j->ptr             = data;
+	j->end             = data + len;
+	j->adobe_transform = -1;
+	if (len < 2 || data[0] != 0xff || data[1] != M_SOI) {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a JPEG file");
+		goto cleanup;
+	}
+	int marker = read_markers(j, false);
+	if (marker != M_SOS) {
+		if (marker != -1) PAXC_ERROR(PAX_ERR_CORRUPT, "JPEG has no image data");
+		goto cleanup;
+	}
+	PAXC_STATS_ADD(bytes_in, len);
+
+	// Color space, by the same rules as libjpeg.
+	if (j->ncomp == 3 && !j->jfif) {
+		if (j->adobe_transform >= 0) {
+			j->rgb = j->adobe_transform == 0;
+		} else {
+			j->rgb = j->comp[0].id == 'R' && j->comp[1].id == 'G' && j->comp[2].id == 'B';
+		}
+	}
+
+	j->scale = (flags & CODEC_FLAG_SCALE_MASK) / CODEC_FLAG_SCALE_1_2;
+	j->bs    = 8 >> j->scale;
+	j->out_w = (j->width  + (1 << j->scale) - 1) >> j->scale;
+	j->out_h = (j->height + (1 << j->scale) - 1) >> j->scale;
+
+	if (do_alloc) {
+		// JPEG has no palettes, so pick a direct color type if a palette type was asked for.
+		if (PAX_IS_PALETTE(buf_type)) {
+			buf_type = paxc_pick_buf_type(buf_type, j->ncomp == 3, false);
+			PAX_LOGW(TAG, "Changing buffer type to %08x", (int)buf_type);
+		}
+		PAX_LOGD(TAG, "Decoding JPEG %dx%d to %08x", j->out_w, j->out_h, buf_type);
+		if (!paxc_buf_init(framebuffer, NULL, j->out_w, j->out_h, buf_type)) goto cleanup;
+	}
+	// Only the part that lands on the buffer gets written.
+	j->fb       = framebuffer;
+	j->store    = paxc_get_row_store(framebuffer);
+	j->x_offset = x_offset;
+	j->y_offset = y_offset;
+	j->x0       = x_offset < 0 ? -x_offset : 0;
+	j->y0       = y_offset < 0 ? -y_offset : 0;
+	j->x1       = pax_buf_get_width(framebuffer)  - x_offset < j->out_w ? pax_buf_get_width(framebuffer)  - x_offset : j->out_w;
+	j->y1       = pax_buf_get_height(framebuffer) - y_offset < j->out_h ? pax_buf_get_height(framebuffer) - y_offset : j->out_h;
+	if (j->x0 >= j->x1 || j->y0 >= j->y1) {
+		ok = true;
+		goto cleanup;
+	}
+
+	// A scan with every component holds the whole image; otherwise coefficients are collected first.
+	j->direct = !j->progressive && j->ns == j->ncomp;
+	if (!alloc_comps(j)) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		goto error;
+	}
+
+	if (j->direct) {
+		if (!decode_scan(j)) goto error;
+	} else {
+		do {
+			if (!decode_scan(j)) goto error;
+			marker = read_markers(j, false);
+			if (marker < 0) goto error;
+		} while (marker == M_SOS);
+		emit_coefs(j);
+	}
+	if (j->ran_out) PAX_LOGW(TAG, "JPEG data ends early");
+
+	PAXC_STATS_ADD(rows, j->y1 - j->y0);
+	pax_mark_dirty2(framebuffer, x_offset + j->x0, y_offset + j->y0, j->x1 - j->x0, j->y1 - j->y0);
+	ok = true;
+	goto cleanup;
+
+	error:
+	if (do_alloc) {
+		// Clean up in case of erruer.
+		pax_buf_destroy(framebuffer);
+	}
+	cleanup:
+	if (j) {
+		for (int i = 0; i < 3; i++) {
+			paxc_free(j->comp[i].plane);
+			paxc_free(j->comp[i].up);
+			paxc_free(j->comp[i].coefs);
+		}
+		paxc_free(j->rgba);
+		paxc_free(j);
+	}
+	PAXC_STATS_CALL_END();
+	return ok;
+}
@@ -0,0 +1,820 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if PAXC_HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#if PAX_CODECS_THREADS
+#include <pthread.h>
+#endif
+
+static const char *TAG = "pax_native";
+
+// Native image layout: a little-endian header followed by pixel data in the buffer's own
+// memory layout, then the palette as native pax_col_t values.
+//   0  char[4]  magic "PAXN"
+//   4  uint16   version
+//   6  uint16   header size
+//   8  uint32   pax_buf_type_t
+//   12 uint32   width
+//   16 uint32   height
+//   20 uint32   bytes per row; 0 for types below 8 bits per pixel, which pack rows back to back
+//   24 uint32   flags, NATIVE_FLAG_*
+//   28 uint32   palette entries
+//   32 uint32   palette offset
+//   36 uint32   pixel data offset
+//   40 uint64   pixel data size
+#define NATIVE_VERSION     1
+#define NATIVE_HEADER_SIZE 64
+#define NATIVE_MIN_HEADER  48
+// Pixel data alignment used by the writer; enough for SIMD loads and cache lines.
+#define NATIVE_DATA_ALIGN  64
+
+// Native archive layout: a little-endian header, a table of entries sorted by name, the names,
+// then the entries' data, each aligned to NATIVE_DATA_ALIGN so they can be used in place.
+//   0  char[4]  magic "PAXA"
+//   4  uint32   version
+//   8  uint32   entry count
+//   12 uint32   reserved
+// Followed by ARCHIVE_ENTRY_SIZE bytes per entry:
+//   0  uint32   name offset
+//   4  uint32   name length
+//   8  uint64   data offset
+//   16 uint64   data length
+//   24 uint32   flags, PAX_NATIVE_ENTRY_*
+//   28 uint32   reserved
+#define ARCHIVE_VERSION     1
+#define ARCHIVE_HEADER_SIZE 16
+#define ARCHIVE_ENTRY_SIZE  32
+
+// Banded image layout: the same pixel data as a native image, cut into bands of whole rows that
+// are each a separate zlib stream, so they can be inflated in parallel or on their own.
+//   0  char[4]  magic "PAXB"
+//   4  uint16   version
+//   6  uint16   header size
+//   8  uint32   pax_buf_type_t
+//   12 uint32   width
+//   16 uint32   height
+//   20 uint32   flags, NATIVE_FLAG_*
+//   24 uint32   rows per band; a multiple of 8 for types below 8 bits per pixel
+//   28 uint32   band count
+//   32 uint32   palette entries
+//   36 uint32   palette offset, stored uncompressed
+//   40 uint32   band table offset
+// The band table holds band count + 1 uint64 file offsets; band i spans table[i] to table[i+1].
+#define BANDED_VERSION     1
+#define BANDED_HEADER_SIZE 64
+#define BANDED_MIN_HEADER  44
+// Rows per band when the encoder is given 0.
+#define BANDED_DEFAULT_ROWS 32
+// Stack size for the band decoding threads.
+#define BANDED_WORKER_STACK 16384
+
+// The buffer has reverse_endianness set.
+#define NATIVE_FLAG_REVERSED   0x0001
+// Pixel words were written on a big-endian machine.
+#define NATIVE_FLAG_BIG_ENDIAN 0x0002
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_ORDER_FLAG NATIVE_FLAG_BIG_ENDIAN
+#else
+#define HOST_ORDER_FLAG 0
+#endif
+
+// Parsed native image header.
+typedef struct {
+	pax_buf_type_t type;
+	uint32_t       width, height;
+	uint32_t       flags;
+	uint32_t       palette_size;
+	uint32_t       palette_offset;
+	uint32_t       data_offset;
+	uint64_t       data_size;
+} native_header_t;
+
+
+
+static inline uint16_t read_le16(const uint8_t *in) {
+	return in[0] | (in[1] << 8);
+}
+
+static inline uint32_t read_le32(const uint8_t *in) {
+	return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+static inline uint64_t read_le64(const uint8_t *in) {
+	return read_le32(in) | ((uint64_t) read_le32(in + 4) << 32);
+}
+
+static inline void write_le32(uint8_t *out, uint32_t value) {
+	out[0] = value;
+	out[1] = value >> 8;
+	out[2] = value >> 16;
+	out[3] = value >> 24;
+}
+
+// Row size in bytes as stored in the header.
+static uint32_t native_stride(pax_buf_type_t type, uint32_t width) {
+	int bpp = PAX_GET_BPP(type);
+	return bpp < 8 ? 0 : width * (bpp / 8);
+}
+
+// Parses and checks the header against the data it describes.
+static bool parse_header(native_header_t *hdr, const uint8_t *data, size_t len) {
+	if (len < NATIVE_MIN_HEADER || memcmp(data, "PAXN", 4)) {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a native image");
+		return false;
+	}
+	uint16_t version     = read_le16(data + 4);
+	uint16_t header_size = read_le16(data + 6);
+	if (version != NATIVE_VERSION) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Unsupported version %d", version);
+		return false;
+	}
+	hdr->type           = read_le32(data + 8);
+	hdr->width          = read_le32(data + 12);
+	hdr->height         = read_le32(data + 16);
+	uint32_t stride     = read_le32(data + 20);
+	hdr->flags          = read_le32(data + 24);
+	hdr->palette_size   = read_le32(data + 28);
+	hdr->palette_offset = read_le32(data + 32);
+	hdr->data_offset    = read_le32(data + 36);
+	hdr->data_size      = read_le32(data + 40) | ((uint64_t) read_le32(data + 44) << 32);
+
+	int bpp = PAX_GET_BPP(hdr->type);
+	if (header_size < NATIVE_MIN_HEADER || !hdr->width || !hdr->height || hdr->width > 0x7fffffff || hdr->height > 0x7fffffff
+		|| !bpp || bpp > 32 || stride != native_stride(hdr->type, hdr->width)
+		|| hdr->data_size != PAX_BUF_CALC_SIZE((uint64_t) hdr->width, hdr->height, hdr->type)
+		|| hdr->data_offset < header_size || hdr->data_offset > len || hdr->data_size > len - hdr->data_offset
+		|| hdr->palette_size > 256 || (hdr->palette_size && (hdr->palette_offset < header_size
+		|| hdr->palette_offset > len || hdr->palette_size * sizeof(pax_col_t) > len - hdr->palette_offset))) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid native image header");
+		return false;
+	}
+	if ((hdr->flags & NATIVE_FLAG_BIG_ENDIAN) != HOST_ORDER_FLAG && bpp >= 16) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Native image was written with a different byte order");
+		return false;
+	}
+	return true;
+}
+
+// Points `buf` at the pixels and palette in `data` after checking the header.
+static bool native_init(pax_buf_t *buf, const uint8_t *data, size_t len) {
+	native_header_t hdr;
+	if (!parse_header(&hdr, data, len)) return false;
+
+	// The buffer is used in place, so the pixels and palette have to be aligned for it.
+	const uint8_t *pixels  = data + hdr.data_offset;
+	const uint8_t *palette = data + hdr.palette_offset;
+	size_t         align   = PAX_GET_BPP(hdr.type) >= 32 ? 4 : PAX_GET_BPP(hdr.type) >= 16 ? 2 : 1;
+	if ((uintptr_t) pixels % align || (hdr.palette_size && (uintptr_t) palette % sizeof(pax_col_t))) {
+		PAXC_ERROR(PAX_ERR_PARAM, "Native image data is misaligned");
+		return false;
+	}
+
+	if (!paxc_buf_init(buf, (void *) pixels, hdr.width, hdr.height, hdr.type)) return false;
+	buf->reverse_endianness = hdr.flags & NATIVE_FLAG_REVERSED;
+	if (hdr.palette_size) {
+		buf->palette      = (pax_col_t *) palette;
+		buf->palette_size = hdr.palette_size;
+		buf->do_free_pal  = false;
+	}
+	return true;
+}
+
+// Points `buf` at a native image held in memory, such as an asset embedded in flash; nothing is copied.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_load_native_buf(pax_buf_t *buf, const void *data, size_t len) {
+	return native_init(buf, data, len);
+}
+
+// Maps a file into memory, or reads it where mmap isn't available.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_native_map_t *paxc_map_file(FILE *fd) {
+	pax_native_map_t *map = calloc(1, sizeof(pax_native_map_t));
+	if (!map) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return NULL;
+	}
+
+#if PAXC_HAVE_MMAP
+	// A private writable mapping: drawing into the buffer never touches the file.
+	struct stat st;
+	if (!fstat(fileno(fd), &st) && st.st_size > 0) {
+		void *mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fd), 0);
+		if (mem != MAP_FAILED) {
+			map->mem    = mem;
+			map->len    = st.st_size;
+			map->mapped = true;
+		}
+	}
+#endif
+
+	if (!map->mem) {
+		// No mmap available, or not a regular file: read it into memory instead.
+		paxc_membuf_t mem = {0};
+		uint8_t       tmp[1024];
+		size_t        len;
+		while ((len = fread(tmp, 1, sizeof(tmp), fd)) > 0) {
+			if (!paxc_sink_mem(&mem, tmp, len)) {
+				free(mem.data);
+				free(map);
+				PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+				return NULL;
+			}
+		}
+		map->mem = mem.data;
+		map->len = mem.len;
+	}
+	return map;
+}
+
+// Releases the file memory of `map`, keeping anything else it owns.
+void paxc_map_release_file(pax_native_map_t *map) {
+#if PAXC_HAVE_MMAP
+	if (map->mapped) {
+		munmap(map->mem, map->len);
+	} else
+#endif
+	{
+		free(map->mem);
+	}
+	map->mem    = NULL;
+	map->len    = 0;
+	map->mapped = false;
+}
+
+// Maps a native image file into memory and points `buf` at it without decoding or copying.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_native_map_t *pax_map_native_fd(pax_buf_t *buf, FILE *fd) {
+	pax_native_map_t *map = paxc_map_file(fd);
+	if (!map) return NULL;
+	if (!native_init(buf, map->mem, map->len)) {
+		pax_unmap_native(map);
+		return NULL;
+	}
+	return map;
+}
+
+// Releases the memory behind a buffer loaded with pax_map_native_fd or pax_map_bitmap_fd.
+// The buffer must not be used afterwards.
+void pax_unmap_native(pax_native_map_t *map) {
+	if (!map) return;
+	paxc_map_release_file(map);
+	free(map->owned);
+	free(map);
+}
+
+// Inflates exactly `len` bytes, or skips them if `out` is NULL.
+static bool inflate_exact(z_stream *zs, void *out, size_t len) {
+	uint8_t skip[64];
+	while (len) {
+		size_t part = len;
+		if (!out && part > sizeof(skip)) part = sizeof(skip);
+		zs->next_out  = out ? out : skip;
+		zs->avail_out = part;
+		while (zs->avail_out) {
+			int zerr = inflate(zs, Z_NO_FLUSH);
+			if (zerr == Z_STREAM_END && zs->avail_out) return false;
+			if (zerr != Z_OK && zerr != Z_STREAM_END) return false;
+		}
+		if (out) out = (uint8_t *) out + part;
+		len -= part;
+	}
+	return true;
+}
+
+// Decodes a zlib-compressed native image into a newly allocated buffer.
+// The pixels are inflated straight into the buffer; there is no format conversion.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_native_z_buf(pax_buf_t *buf, const void *data, size_t len) {
+	z_stream zs = {0};
+	if (inflateInit(&zs) != Z_OK) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return false;
+	}
+	zs.next_in  = (Bytef *) data;
+	zs.avail_in = len;
+	buf->width  = 0;
+	buf->height = 0;
+
+	// The header says how much follows; sizes are checked against the stream instead of `len`.
+	uint8_t         header[NATIVE_MIN_HEADER];
+	native_header_t hdr;
+	bool            alloc = false;
+	if (!inflate_exact(&zs, header, sizeof(header))) goto corrupt;
+	if (!parse_header(&hdr, header, SIZE_MAX)) goto error;
+	if (hdr.palette_size && hdr.palette_offset < hdr.data_offset + hdr.data_size) {
+		// Only the order the writer uses is supported.
+		goto corrupt;
+	}
+
+	if (!paxc_buf_init(buf, NULL, hdr.width, hdr.height, hdr.type)) goto error;
+	alloc = true;
+	buf->reverse_endianness = hdr.flags & NATIVE_FLAG_REVERSED;
+	if (!inflate_exact(&zs, NULL, hdr.data_offset - sizeof(header)) || !inflate_exact(&zs, buf->buf, hdr.data_size)) {
+		goto corrupt;
+	}
+	if (hdr.palette_size) {
+		pax_col_t *palette = malloc(sizeof(pax_col_t) * hdr.palette_size);
+		if (!palette) {
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			goto error;
+		}
+		buf->palette      = palette;
+		buf->palette_size = hdr.palette_size;
+		buf->do_free_pal  = true;
+		if (!inflate_exact(&zs, NULL, hdr.palette_offset - hdr.data_offset - hdr.data_size)
+			|| !inflate_exact(&zs, palette, sizeof(pax_col_t) * hdr.palette_size)) {
+			goto corrupt;
+		}
+	}
+	inflateEnd(&zs);
+	return true;
+
+	corrupt:
+	PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid compressed native image");
+	error:
+	inflateEnd(&zs);
+	if (alloc) pax_buf_destroy(buf);
+	return false;
+}
+
+// Looks up an entry of a native archive by name.
+// Returns 1 if found, refer to pax_codec_last_error otherwise.
+bool pax_native_archive_find(const void *archive, size_t archive_len, const char *name, pax_native_entry_t *entry) {
+	const uint8_t *arc = archive;
+	if (archive_len < ARCHIVE_HEADER_SIZE || memcmp(arc, "PAXA", 4) || read_le32(arc + 4) != ARCHIVE_VERSION) {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a native archive");
+		return false;
+	}
+	uint32_t count = read_le32(arc + 8);
+	if (count > (archive_len - ARCHIVE_HEADER_SIZE) / ARCHIVE_ENTRY_SIZE) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Native archive entry table is truncated");
+		return false;
+	}
+
+	// Entries are sorted by name.
+	size_t name_len = strlen(name);
+	size_t lo = 0, hi = count;
+	while (lo < hi) {
+		size_t         mid = (lo + hi) / 2;
+		const uint8_t *ent = arc + ARCHIVE_HEADER_SIZE + mid * ARCHIVE_ENTRY_SIZE;
+		uint32_t       off = read_le32(ent);
+		uint32_t       len = read_le32(ent + 4);
+		uint64_t       doff = read_le64(ent + 8);
+		uint64_t       dlen = read_le64(ent + 16);
+		if (off > archive_len || len > archive_len - off || doff > archive_len || dlen > archive_len - doff) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid archive entry");
+			return false;
+		}
+		int cmp = memcmp(name, arc + off, name_len < len ? name_len : len);
+		if (!cmp) cmp = (name_len > len) - (name_len < len);
+		if (cmp < 0) {
+			hi = mid;
+		} else if (cmp > 0) {
+			lo = mid + 1;
+		} else {
+			entry->data  = arc + doff;
+			entry->len   = dlen;
+			entry->flags = read_le32(ent + 24);
+			return true;
+		}
+	}
+	PAXC_ERROR(PAX_ERR_NODATA, "No entry named %.*s in the archive", (int) name_len, name);
+	return false;
+}
+
+// Writes a native image of `buf` to `sink`.
+static bool native_encode(const pax_buf_t *buf, paxc_sink_t sink, void *cookie) {
+	if (pax_buf_get_orientation(buf) != PAX_O_UPRIGHT) {
+		// The pixels are stored as they are in memory, so orientation can't be represented.
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Only upright buffers can be stored");
+		return false;
+	}
+	uint64_t data_size    = PAX_BUF_CALC_SIZE((uint64_t) buf->width, buf->height, buf->type);
+	uint32_t palette_size = PAX_IS_PALETTE(buf->type) && buf->palette ? buf->palette_size : 0;
+	uint64_t palette_off  = (NATIVE_DATA_ALIGN + data_size + 3) & ~(uint64_t) 3;
+	if (palette_off > 0xffffffff) {
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Image is too large to store");
+		return false;
+	}
+
+	uint8_t header[NATIVE_DATA_ALIGN] = {0};
+	memcpy(header, "PAXN", 4);
+	header[4] = NATIVE_VERSION;
+	header[6] = NATIVE_HEADER_SIZE;
+	write_le32(header + 8,  buf->type);
+	write_le32(header + 12, buf->width);
+	write_le32(header + 16, buf->height);
+	write_le32(header + 20, native_stride(buf->type, buf->width));
+	write_le32(header + 24, (buf->reverse_endianness ? NATIVE_FLAG_REVERSED : 0) | HOST_ORDER_FLAG);
+	write_le32(header + 28, palette_size);
+	write_le32(header + 32, palette_size ? palette_off : 0);
+	write_le32(header + 36, NATIVE_DATA_ALIGN);
+	write_le32(header + 40, data_size);
+	write_le32(header + 44, data_size >> 32);
+
+	static const uint8_t pad[3] = {0};
+	size_t pad_len = palette_off - NATIVE_DATA_ALIGN - data_size;
+	bool ok = sink(cookie, header, sizeof(header)) && sink(cookie, buf->buf, data_size)
+		&& (!palette_size || ((!pad_len || sink(cookie, pad, pad_len)) && sink(cookie, buf->palette, palette_size * sizeof(pax_col_t))));
+	if (!ok) {
+		PAXC_ERROR(PAX_ERR_ENCODE, "Output sink failed");
+	}
+	return ok;
+}
+
+// Stores a pax buffer as a native image file.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_encode_native_fd(const pax_buf_t *buf, FILE *fd) {
+	return native_encode(buf, paxc_sink_file, fd);
+}
+
+// Stores a pax buffer as a native image in memory.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_encode_native_buf(const pax_buf_t *buf, void **outbuf, size_t *len) {
+	paxc_membuf_t out = {0};
+	*outbuf = NULL;
+	*len    = 0;
+	if (!native_encode(buf, paxc_sink_mem, &out)) {
+		free(out.data);
+		return false;
+	}
+	*outbuf = out.data;
+	*len    = out.len;
+	return true;
+}
+
+
+
+/* ==== Banded images ==== */
+
+// Parsed banded image header.
+typedef struct {
+	pax_buf_type_t type;
+	uint32_t       width, height;
+	uint32_t       flags;
+	uint32_t       band_rows;
+	uint32_t       band_count;
+	uint32_t       palette_size;
+	uint32_t       palette_offset;
+	// The band table, pointing into the image.
+	const uint8_t *table;
+	// The whole image.
+	const uint8_t *data;
+	size_t         len;
+} banded_t;
+
+// Byte offset of the first pixel of row `y`; band boundaries are always whole bytes.
+static inline uint64_t banded_row_offset(pax_buf_type_t type, uint32_t width, uint32_t y) {
+	return (uint64_t) y * width * PAX_GET_BPP(type) / 8;
+}
+
+// Parses and checks a banded image header and its band table.
+static bool parse_banded(banded_t *img, const uint8_t *data, size_t len) {
+	if (len < BANDED_MIN_HEADER || memcmp(data, "PAXB", 4)) {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a banded image");
+		return false;
+	}
+	uint16_t version     = read_le16(data + 4);
+	uint16_t header_size = read_le16(data + 6);
+	if (version != BANDED_VERSION) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Unsupported version %d", version);
+		return false;
+	}
+	img->type           = read_le32(data + 8);
+	img->width          = read_le32(data + 12);
+	img->height         = read_le32(data + 16);
+	img->flags          = read_le32(data + 20);
+	img->band_rows      = read_le32(data + 24);
+	img->band_count     = read_le32(data + 28);
+	img->palette_size   = read_le32(data + 32);
+	img->palette_offset = read_le32(data + 36);
+	uint32_t table_off  = read_le32(data + 40);
+	img->data           = data;
+	img->len            = len;
+
+	int bpp = PAX_GET_BPP(img->type);
+	if (header_size < BANDED_MIN_HEADER || !img->width || !img->height || img->width > 0x7fffffff || img->height > 0x7fffffff
+		|| !bpp || bpp > 32 || !img->band_rows || (bpp < 8 && img->band_rows % 8)
+		|| img->band_count != (img->height - 1) / img->band_rows + 1
+		|| table_off < header_size || table_off > len || (img->band_count + 1) > (len - table_off) / 8
+		|| img->palette_size > 256 || (img->palette_size && (img->palette_offset < header_size
+		|| img->palette_offset > len || img->palette_size * sizeof(pax_col_t) > len - img->palette_offset))) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid banded image header");
+		return false;
+	}
+	if ((img->flags & NATIVE_FLAG_BIG_ENDIAN) != HOST_ORDER_FLAG && bpp >= 16) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Banded image was written with a different byte order");
+		return false;
+	}
+	img->table = data + table_off;
+	return true;
+}
+
+// Work for one band decoding thread: bands `first`, `first + stride`, ... up to `last`.
+typedef struct {
+	const banded_t *img;
+	pax_buf_t      *buf;
+	uint32_t        first, last, stride;
+	// Error to report, PAX_OK on success.
+	int             error;
+} banded_job_t;
+
+// Inflates a range of bands straight into the buffer memory.
+static void *banded_worker(void *arg) {
+	banded_job_t   *job = arg;
+	const banded_t *img = job->img;
+	z_stream        zs  = {0};
+	if (inflateInit(&zs) != Z_OK) {
+		job->error = PAX_ERR_NOMEM;
+		return NULL;
+	}
+	uint64_t total = PAX_BUF_CALC_SIZE((uint64_t) img->width, img->height, img->type);
+	for (uint32_t band = job->first; band <= job->last; band += job->stride) {
+		uint64_t start = read_le64(img->table + band * 8);
+		uint64_t end   = read_le64(img->table + band * 8 + 8);
+		uint32_t y0    = band * img->band_rows;
+		uint32_t y1    = img->height - y0 > img->band_rows ? y0 + img->band_rows : img->height;
+		uint64_t out0  = banded_row_offset(img->type, img->width, y0);
+		uint64_t out1  = y1 == img->height ? total : banded_row_offset(img->type, img->width, y1);
+		if (start > end || end > img->len) {
+			job->error = PAX_ERR_CORRUPT;
+			break;
+		}
+		inflateReset(&zs);
+		zs.next_in   = (Bytef *) img->data + start;
+		zs.avail_in  = end - start;
+		zs.next_out  = (Bytef *) job->buf->buf + out0;
+		zs.avail_out = out1 - out0;
+		if (inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.avail_out) {
+			job->error = PAX_ERR_CORRUPT;
+			break;
+		}
+	}
+	inflateEnd(&zs);
+	return NULL;
+}
+
+// Inflates bands `first` to `last` using up to `threads` threads.
+static bool banded_decode(const banded_t *img, pax_buf_t *buf, uint32_t first, uint32_t last, int threads) {
+	uint32_t bands = last - first + 1;
+	if (threads < 1) threads = 1;
+	if (threads > PAXC_MAX_THREADS) threads = PAXC_MAX_THREADS;
+	if ((uint32_t) threads > bands) threads = bands;
+#if !PAX_CODECS_THREADS
+	threads = 1;
+#endif
+
+	banded_job_t jobs[PAXC_MAX_THREADS];
+	for (int i = 0; i < threads; i++) {
+		jobs[i] = (banded_job_t) {
+			.img    = img,
+			.buf    = buf,
+			.first  = first + i,
+			.last   = last,
+			.stride = threads,
+			.error  = PAX_OK,
+		};
+	}
+
+#if PAX_CODECS_THREADS
+	// Job 0 runs on the calling thread.
+	pthread_t      workers[PAXC_MAX_THREADS];
+	bool           started[PAXC_MAX_THREADS] = {0};
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, BANDED_WORKER_STACK);
+	for (int i = 1; i < threads; i++) {
+		started[i] = !pthread_create(&workers[i], &attr, banded_worker, &jobs[i]);
+	}
+	banded_worker(&jobs[0]);
+	for (int i = 1; i < threads; i++) {
+		if (started[i]) {
+			pthread_join(workers[i], NULL);
+		} else {
+			// Couldn't start a thread; do the work here instead.
+			banded_worker(&jobs[i]);
+		}
+	}
+	pthread_attr_destroy(&attr);
+#else
+	banded_worker(&jobs[0]);
+#endif
+
+	for (int i = 0; i < threads; i++) {
+		if (jobs[i].error) {
+			PAXC_ERROR(jobs[i].error, jobs[i].error == PAX_ERR_NOMEM ? "Out of memory" : "Invalid band data");
+			return false;
+		}
+	}
+	return true;
+}
+
+// Allocates a buffer for a parsed banded image, with its palette.
+static bool banded_alloc(pax_buf_t *buf, const banded_t *img) {
+	if (!paxc_buf_init(buf, NULL, img->width, img->height, img->type)) return false;
+	buf->reverse_endianness = img->flags & NATIVE_FLAG_REVERSED;
+	if (img->palette_size) {
+		pax_col_t *palette = malloc(sizeof(pax_col_t) * img->palette_size);
+		if (!palette) {
+			pax_buf_destroy(buf);
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			return false;
+		}
+		memcpy(palette, img->data + img->palette_offset, sizeof(pax_col_t) * img->palette_size);
+		buf->palette      = palette;
+		buf->palette_size = img->palette_size;
+		buf->do_free_pal  = true;
+	}
+	return true;
+}
+
+// Allocates a buffer matching a banded image, with its palette, but doesn't decode any pixels.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_alloc_banded_buf(pax_buf_t *buf, const void *data, size_t len) {
+	banded_t img;
+	return parse_banded(&img, data, len) && banded_alloc(buf, &img);
+}
+
+// Decodes a banded image into a newly allocated buffer, inflating bands on up to `threads` threads.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_banded_buf(pax_buf_t *buf, const void *data, size_t len, int threads) {
+	banded_t img;
+	if (!parse_banded(&img, data, len) || !banded_alloc(buf, &img)) return false;
+	if (!banded_decode(&img, buf, 0, img.band_count - 1, threads)) {
+		pax_buf_destroy(buf);
+		return false;
+	}
+	return true;
+}
+
+// Decodes only the bands of a banded image that cover rows `y` to `y + height - 1`.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_banded_rows(pax_buf_t *buf, const void *data, size_t len, int y, int height, int threads) {
+	banded_t img;
+	if (!parse_banded(&img, data, len)) return false;
+	if (buf->type != img.type || (uint32_t) buf->width != img.width || (uint32_t) buf->height != img.height) {
+		PAXC_ERROR(PAX_ERR_PARAM, "Buffer doesn't match the banded image");
+		return false;
+	}
+	if (y < 0) {
+		height += y;
+		y       = 0;
+	}
+	if (height > buf->height - y) height = buf->height - y;
+	if (height <= 0) return true;
+
+	uint32_t first = y / img.band_rows;
+	uint32_t last  = (y + height - 1) / img.band_rows;
+	if (!banded_decode(&img, buf, first, last, threads)) return false;
+	uint32_t y0 = first * img.band_rows;
+	uint32_t y1 = (last + 1) * img.band_rows < img.height ? (last + 1) * img.band_rows : img.height;
+	pax_mark_dirty2(buf, 0, y0, buf->width, y1 - y0);
+	return true;
+}
+
+// Writes a banded image of `buf` to `sink`.
+static bool banded_encode(const pax_buf_t *buf, int band_rows, int level, paxc_sink_t sink, void *cookie) {
+	if (pax_buf_get_orientation(buf) != PAX_O_UPRIGHT) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Only upright buffers can be stored");
+		return false;
+	}
+	if (band_rows < 0 || level < -1 || level > 9) {
+		PAXC_ERROR(PAX_ERR_PARAM, "Invalid band size or compression level");
+		return false;
+	}
+	if (!band_rows) band_rows = BANDED_DEFAULT_ROWS;
+	if (PAX_GET_BPP(buf->type) < 8) {
+		// Bands have to start on a byte boundary.
+		band_rows = (band_rows + 7) & ~7;
+	}
+
+	uint32_t width        = buf->width;
+	uint32_t height       = buf->height;
+	uint32_t band_count   = (height - 1) / band_rows + 1;
+	uint32_t palette_size = PAX_IS_PALETTE(buf->type) && buf->palette ? buf->palette_size : 0;
+	uint32_t table_off    = (BANDED_HEADER_SIZE + palette_size * sizeof(pax_col_t) + 7) & ~7;
+	uint64_t total        = PAX_BUF_CALC_SIZE((uint64_t) width, height, buf->type);
+	uint8_t *table        = malloc(8 * (band_count + 1));
+	uint8_t *zbuf         = NULL;
+	// All bands are compressed up front, since the table comes before them.
+	paxc_membuf_t bands   = {0};
+	if (!table) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return false;
+	}
+
+	uint64_t pos = table_off + 8 * (band_count + 1);
+	for (uint32_t band = 0; band < band_count; band++) {
+		uint32_t y0   = band * band_rows;
+		uint32_t y1   = height - y0 > (uint32_t) band_rows ? y0 + band_rows : height;
+		uint64_t in0  = banded_row_offset(buf->type, width, y0);
+		uint64_t in1  = y1 == height ? total : banded_row_offset(buf->type, width, y1);
+		uLongf   zlen = compressBound(in1 - in0);
+		zbuf = malloc(zlen);
+		if (!zbuf) {
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			goto error;
+		}
+		int zerr = compress2(zbuf, &zlen, (const Bytef *) buf->buf + in0, in1 - in0, level);
+		if (zerr != Z_OK) {
+			PAXC_ERROR(zerr == Z_MEM_ERROR ? PAX_ERR_NOMEM : PAX_ERR_ENCODE, "Deflate error %d", zerr);
+			goto error;
+		}
+		if (!paxc_sink_mem(&bands, zbuf, zlen)) {
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			goto error;
+		}
+		free(zbuf);
+		zbuf = NULL;
+		write_le32(table + band * 8,     pos);
+		write_le32(table + band * 8 + 4, pos >> 32);
+		pos += zlen;
+	}
+	write_le32(table + band_count * 8,     pos);
+	write_le32(table + band_count * 8 + 4, pos >> 32);
+
+	uint8_t header[BANDED_HEADER_SIZE] = {0};
+	memcpy(header, "PAXB", 4);
+	header[4] = BANDED_VERSION;
+	header[6] = BANDED_HEADER_SIZE;
+	write_le32(header + 8,  buf->type);
+	write_le32(header + 12, width);
+	write_le32(header + 16, height);
+	write_le32(header + 20, (buf->reverse_endianness ? NATIVE_FLAG_REVERSED : 0) | HOST_ORDER_FLAG);
+	write_le32(header + 24, band_rows);
+	write_le32(header + 28, band_count);
+	write_le32(header + 32, palette_size);
+	write_le32(header + 36, palette_size ? BANDED_HEADER_SIZE : 0);
+	write_le32(header + 40, table_off);
+
+	static const uint8_t pad[7] = {0};
+	size_t pad_len = table_off - BANDED_HEADER_SIZE - palette_size * sizeof(pax_col_t);
+	bool ok = sink(cookie, header, sizeof(header))
+		&& (!palette_size || sink(cookie, buf->palette, palette_size * sizeof(pax_col_t)))
+		&& (!pad_len || sink(cookie, pad, pad_len))
+		&& sink(cookie, table, 8 * (band_count + 1)) && sink(cookie, bands.data, bands.len);
+	if (!ok) {
+		PAXC_ERROR(PAX_ERR_ENCODE, "Output sink failed");
+	}
+	free(table);
+	free(bands.data);
+	return ok;
+
+	error:
+	free(zbuf);
+	free(table);
+	free(bands.data);
+	return false;
+}
+
+// Stores a pax buffer as a banded image file.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_encode_banded_fd(const pax_buf_t *buf, FILE *fd, int band_rows, int level) {
+	return banded_encode(buf, band_rows, level, paxc_sink_file, fd);
+}
+
+// Stores a pax buffer as a banded image in memory.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_encode_banded_buf(const pax_buf_t *buf, void **outbuf, size_t *len, int band_rows, int level) {
+	paxc_membuf_t out = {0};
+	*outbuf = NULL;
+	*len    = 0;
+	if (!banded_encode(buf, band_rows, level, paxc_sink_mem, &out)) {
+		free(out.data);
+		return false;
+	}
+	*outbuf = out.data;
+	*len    = out.len;
+	return true;
+}
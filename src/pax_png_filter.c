@@ -0,0 +1,286 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#include "pax_codecs_internal.h"
+#include <string.h>
+
+#if PAXC_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+#if PAXC_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// Bytes per sampled block of the fast filter estimate.
+#define SAMPLE_BLOCK      16
+// Maximum number of blocks sampled per row.
+#define SAMPLE_MAX_BLOCKS 16
+
+// Applies PNG filter `type` to `row`, writing the filter byte and `row_bytes` filtered bytes to `out`.
+// `prev` is the previous raw row, all zeroes for the first row.
+void paxc_png_filter_row(int type, uint8_t *out, const uint8_t *row, const uint8_t *prev, size_t row_bytes, size_t bpp) {
+	size_t n = row_bytes;
+	size_t i;
+	*out++ = type;
+	switch (type) {
+		default:
+		case PAX_PNG_ROW_FILTER_NONE:
+			memcpy(out, row, n);
+			break;
+
+		case PAX_PNG_ROW_FILTER_SUB:
+			for (i = 0; i < bpp && i < n; i++) out[i] = row[i];
+			for (; i < n; i++) out[i] = row[i] - row[i - bpp];
+			break;
+
+		case PAX_PNG_ROW_FILTER_UP:
+			for (i = 0; i < n; i++) out[i] = row[i] - prev[i];
+			break;
+
+		case PAX_PNG_ROW_FILTER_AVG:
+			for (i = 0; i < bpp && i < n; i++) out[i] = row[i] - (prev[i] >> 1);
+			for (; i < n; i++) out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+			break;
+
+		case PAX_PNG_ROW_FILTER_PAETH:
+			for (i = 0; i < bpp && i < n; i++) out[i] = row[i] - prev[i];
+			for (; i < n; i++) out[i] = row[i] - paxc_paeth(row[i - bpp], prev[i], prev[i - bpp]);
+			break;
+	}
+}
+
+// Reverses PNG filter `type` on `row` in place; `prev` is the previous unfiltered row, all zeroes for the first.
+// Returns false for an invalid filter type.
+bool paxc_png_unfilter_row(int type, uint8_t *row, const uint8_t *prev, size_t row_bytes, size_t bpp) {
+	size_t n = row_bytes;
+	size_t i;
+	switch (type) {
+		case PAX_PNG_ROW_FILTER_NONE:
+			break;
+
+		case PAX_PNG_ROW_FILTER_SUB:
+			for (i = bpp; i < n; i++) row[i] += row[i - bpp];
+			break;
+
+		case PAX_PNG_ROW_FILTER_UP:
+			for (i = 0; i < n; i++) row[i] += prev[i];
+			break;
+
+		case PAX_PNG_ROW_FILTER_AVG:
+			for (i = 0; i < bpp && i < n; i++) row[i] += prev[i] >> 1;
+			for (; i < n; i++) row[i] += (row[i - bpp] + prev[i]) >> 1;
+			break;
+
+		case PAX_PNG_ROW_FILTER_PAETH:
+			for (i = 0; i < bpp && i < n; i++) row[i] += prev[i];
+			for (; i < n; i++) row[i] += paxc_paeth(row[i - bpp], prev[i], prev[i - bpp]);
+			break;
+
+		default:
+			return false;
+	}
+	return true;
+}
+
+
+
+#if PAXC_SIMD_SSE2
+// Sum of absolute values of 16 bytes interpreted as signed.
+static inline uint32_t sse2_abs_sum(__m128i v) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i sum  = _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero);
+	return _mm_cvtsi128_si32(sum) + _mm_extract_epi16(sum, 4);
+}
+
+// Absolute value of signed 16-bit lanes.
+static inline __m128i sse2_abs16(__m128i v) {
+	return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+// Paeth predictor for eight 16-bit lanes.
+static inline __m128i sse2_paeth16(__m128i a, __m128i b, __m128i c) {
+	__m128i pa     = sse2_abs16(_mm_sub_epi16(b, c));
+	__m128i pb     = sse2_abs16(_mm_sub_epi16(a, c));
+	__m128i pc     = sse2_abs16(_mm_add_epi16(_mm_sub_epi16(b, c), _mm_sub_epi16(a, c)));
+	__m128i not_a  = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+	__m128i pick_c = _mm_cmpgt_epi16(pb, pc);
+	__m128i bc     = _mm_or_si128(_mm_and_si128(pick_c, c), _mm_andnot_si128(pick_c, b));
+	return _mm_or_si128(_mm_andnot_si128(not_a, a), _mm_and_si128(not_a, bc));
+}
+#endif
+
+// Adds the cost of all five filters over 16 bytes to `cost`.
+// `x` is the current row, `a` the byte to the left, `b` the byte above and `c` the byte above-left.
+static void cost_block(const uint8_t *x, const uint8_t *a, const uint8_t *b, const uint8_t *c, uint32_t cost[5]) {
+#if PAXC_SIMD_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128i vx   = _mm_loadu_si128((const __m128i *) x);
+	__m128i va   = _mm_loadu_si128((const __m128i *) a);
+	__m128i vb   = _mm_loadu_si128((const __m128i *) b);
+	__m128i vc   = _mm_loadu_si128((const __m128i *) c);
+	// pavgb rounds up, PNG's average rounds down.
+	__m128i avg  = _mm_sub_epi8(_mm_avg_epu8(va, vb), _mm_and_si128(_mm_xor_si128(va, vb), _mm_set1_epi8(1)));
+	__m128i pth  = _mm_packus_epi16(
+		sse2_paeth16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero), _mm_unpacklo_epi8(vc, zero)),
+		sse2_paeth16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero), _mm_unpackhi_epi8(vc, zero))
+	);
+	cost[PAX_PNG_ROW_FILTER_NONE]  += sse2_abs_sum(vx);
+	cost[PAX_PNG_ROW_FILTER_SUB]   += sse2_abs_sum(_mm_sub_epi8(vx, va));
+	cost[PAX_PNG_ROW_FILTER_UP]    += sse2_abs_sum(_mm_sub_epi8(vx, vb));
+	cost[PAX_PNG_ROW_FILTER_AVG]   += sse2_abs_sum(_mm_sub_epi8(vx, avg));
+	cost[PAX_PNG_ROW_FILTER_PAETH] += sse2_abs_sum(_mm_sub_epi8(vx, pth));
+
+#elif PAXC_SIMD_NEON
+	uint8x16_t vx = vld1q_u8(x);
+	uint8x16_t va = vld1q_u8(a);
+	uint8x16_t vb = vld1q_u8(b);
+	uint8x16_t vc = vld1q_u8(c);
+	// Paeth distances; pc can exceed 255 but saturating keeps the comparisons correct.
+	uint8x16_t pa = vabdq_u8(vb, vc);
+	uint8x16_t pb = vabdq_u8(va, vc);
+	uint8x16_t pc = vcombine_u8(
+		vqmovn_u16(vabdq_u16(vaddl_u8(vget_low_u8(va), vget_low_u8(vb)), vshll_n_u8(vget_low_u8(vc), 1))),
+		vqmovn_u16(vabdq_u16(vaddl_u8(vget_high_u8(va), vget_high_u8(vb)), vshll_n_u8(vget_high_u8(vc), 1)))
+	);
+	uint8x16_t use_a = vandq_u8(vcleq_u8(pa, pb), vcleq_u8(pa, pc));
+	uint8x16_t pth   = vbslq_u8(use_a, va, vbslq_u8(vcleq_u8(pb, pc), vb, vc));
+	uint8x16_t res[5] = {
+		vx,
+		vsubq_u8(vx, va),
+		vsubq_u8(vx, vb),
+		vsubq_u8(vx, vhaddq_u8(va, vb)),
+		vsubq_u8(vx, pth),
+	};
+	for (int i = 0; i < 5; i++) {
+		uint8x16_t m = vminq_u8(res[i], vsubq_u8(vdupq_n_u8(0), res[i]));
+		uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(m)));
+		cost[i] += vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+	}
+
+#else
+	for (int i = 0; i < SAMPLE_BLOCK; i++) {
+		uint8_t res[5] = {
+			x[i],
+			x[i] - a[i],
+			x[i] - b[i],
+			x[i] - ((a[i] + b[i]) >> 1),
+			x[i] - paxc_paeth(a[i], b[i], c[i]),
+		};
+		for (int f = 0; f < 5; f++) {
+			cost[f] += res[f] < 128 ? res[f] : 256 - res[f];
+		}
+	}
+#endif
+}
+
+// Picks a filter for `row` from a sampled cost estimate, without filtering the row.
+// Up to SAMPLE_MAX_BLOCKS evenly spaced blocks of the row are scored with all five filters.
+int paxc_png_filter_estimate(const uint8_t *row, const uint8_t *prev, size_t row_bytes, int bpp) {
+	uint32_t cost[5] = {0};
+	uint8_t  left[SAMPLE_BLOCK];
+	uint8_t  up_left[SAMPLE_BLOCK];
+	uint8_t  tmp_row[SAMPLE_BLOCK];
+	uint8_t  tmp_prev[SAMPLE_BLOCK];
+
+	size_t blocks = row_bytes / SAMPLE_BLOCK;
+	if (!blocks) {
+		// Short row; score it as a single zero-padded block.
+		memset(tmp_row, 0, sizeof(tmp_row));
+		memset(tmp_prev, 0, sizeof(tmp_prev));
+		memcpy(tmp_row, row, row_bytes);
+		memcpy(tmp_prev, prev, row_bytes);
+		row    = tmp_row;
+		prev   = tmp_prev;
+		blocks = 1;
+	}
+
+	size_t step = (blocks + SAMPLE_MAX_BLOCKS - 1) / SAMPLE_MAX_BLOCKS;
+	for (size_t blk = 0; blk < blocks; blk += step) {
+		size_t i = blk * SAMPLE_BLOCK;
+		if (i < (size_t) bpp) {
+			// The first bpp bytes have nothing to their left; bpp is at most 8.
+			for (int j = 0; j < SAMPLE_BLOCK; j++) {
+				left[j]    = j >= bpp ? row[j - bpp]  : 0;
+				up_left[j] = j >= bpp ? prev[j - bpp] : 0;
+			}
+			cost_block(row, left, prev, up_left, cost);
+		} else {
+			cost_block(row + i, row + i - bpp, prev + i, prev + i - bpp, cost);
+		}
+	}
+
+	// Lowest cost wins, ties go to the simpler filter.
+	int best = PAX_PNG_ROW_FILTER_NONE;
+	for (int type = PAX_PNG_ROW_FILTER_SUB; type <= PAX_PNG_ROW_FILTER_PAETH; type++) {
+		if (cost[type] < cost[best]) best = type;
+	}
+	return best;
+}
+
+// Sum of absolute values of the filtered bytes, interpreted as signed.
+// Stops counting once `limit` is exceeded.
+static uint32_t filter_cost(const uint8_t *filtered, size_t len, uint32_t limit) {
+	uint32_t sum = 0;
+	for (size_t i = 0; i < len; i++) {
+		uint8_t v = filtered[i];
+		sum += v < 128 ? v : 256 - v;
+		if (sum > limit) break;
+	}
+	return sum;
+}
+
+// Scratch memory needed by paxc_png_filter_apply.
+size_t paxc_png_filter_scratch(const pax_png_encode_opts_t *opts, size_t row_bytes) {
+	return (opts->filter_mode == PAX_PNG_FILTER_ADAPTIVE ? 5 : 1) * (row_bytes + 1);
+}
+
+// Filters `row` according to the filter selection in `opts`.
+// Returns the filter type byte followed by the filtered row, stored somewhere in `scratch`.
+const uint8_t *paxc_png_filter_apply(const pax_png_encode_opts_t *opts, uint8_t *scratch, const uint8_t *row, const uint8_t *prev, size_t row_bytes, int bpp) {
+	if (opts->filter_mode == PAX_PNG_FILTER_ADAPTIVE) {
+		// Try every filter and keep the cheapest.
+		const uint8_t *out       = scratch;
+		uint32_t       best_cost = UINT32_MAX;
+		for (int type = PAX_PNG_ROW_FILTER_NONE; type <= PAX_PNG_ROW_FILTER_PAETH; type++) {
+			uint8_t *cur = scratch + type * (row_bytes + 1);
+			paxc_png_filter_row(type, cur, row, prev, row_bytes, bpp);
+			uint32_t cost = filter_cost(cur + 1, row_bytes, best_cost);
+			if (cost < best_cost) {
+				best_cost = cost;
+				out       = cur;
+			}
+		}
+		return out;
+	}
+
+	int type = PAX_PNG_ROW_FILTER_NONE;
+	if (opts->filter_mode == PAX_PNG_FILTER_FIXED) {
+		type = opts->filter;
+	} else if (opts->filter_mode == PAX_PNG_FILTER_FAST) {
+		type = paxc_png_filter_estimate(row, prev, row_bytes, bpp);
+	}
+	paxc_png_filter_row(type, scratch, row, prev, row_bytes, bpp);
+	return scratch;
+}
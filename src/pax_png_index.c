@@ -0,0 +1,512 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "pax_png_index";
+
+static const uint8_t png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+// Size of the deflate window.
+#define WINDOW_SIZE 32768
+// Smallest default span between checkpoints, in bytes of image data.
+#define SPAN_MIN    (1024 * 1024)
+
+// A point in the image data where inflating can start over, like the access points of zlib's zran example.
+// Deflate can only be resumed at block boundaries, which rarely line up with rows, so each point
+// also holds the part of the row inflated before it.
+typedef struct {
+	// Image row being inflated at this point, and how many of its bytes, filter type included, came before it.
+	uint32_t row;
+	size_t   partial;
+	// Next input byte, what's left of its chunk, and the offset of the chunk after it.
+	size_t   in_pos;
+	uint32_t in_avail;
+	size_t   chunk_next;
+	// Bits of the byte before `in_pos` that belong to the next block, and their value.
+	uint8_t  bits;
+	uint8_t  prime;
+	// The inflate window, followed by the unfiltered previous row and the partial row.
+	uint32_t window_len;
+	uint8_t *data;
+} png_point_t;
+
+struct pax_png_index {
+	// The file, and the mapping owned by the index if any.
+	const uint8_t     *png;
+	size_t             png_len;
+	pax_native_map_t  *map;
+	// Image header.
+	pax_png_info_t     info;
+	uint8_t            filter_bpp;
+	uint8_t            channels;
+	size_t             row_bytes;
+	// Palette, resolved to ARGB.
+	pax_col_t          palette[256];
+	size_t             palette_size;
+	// Format of the rows handed to paxc_png_put_row, which always have 8 bits per channel.
+	paxc_png_row_fmt_t fmt;
+	// Offset of the first IDAT chunk.
+	size_t             data;
+	// Checkpoints, in order of row.
+	png_point_t       *points;
+	size_t             num_points;
+	// Inflate state, and the offset of the next data chunk to feed it.
+	z_stream           zs;
+	bool               zs_init;
+	size_t             chunk_next;
+	// Whether the inflate state is in row `live_row`, with `live_pos` bytes of it in `row` and its previous row in `prev`.
+	bool               live;
+	uint32_t           live_row;
+	size_t             live_pos;
+	// Row buffers, sized for the full image width.
+	uint8_t           *row;
+	uint8_t           *prev;
+	uint8_t           *conv;
+};
+
+
+
+// Number of channels for a PNG color type.
+static int png_channels(int color_type) {
+	switch (color_type) {
+		case 2:  return 3;
+		case 4:  return 2;
+		case 6:  return 4;
+		default: return 1;
+	}
+}
+
+// Checks the IHDR fields.
+static bool ihdr_valid(int bit_depth, int color_type) {
+	switch (color_type) {
+		case 0:  return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8 || bit_depth == 16;
+		case 3:  return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8;
+		case 2:
+		case 4:
+		case 6:  return bit_depth == 8 || bit_depth == 16;
+		default: return false;
+	}
+}
+
+// Reads the header, palette and position of the image data.
+static bool parse_file(pax_png_index_t *idx) {
+	const uint8_t *png = idx->png;
+	size_t         pos = sizeof(png_signature);
+	bool     have_ihdr = false, have_iend = false, in_data = false;
+	uint8_t  interlace = 0;
+
+	if (idx->png_len < sizeof(png_signature) || memcmp(png, png_signature, sizeof(png_signature))) {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a PNG file");
+		return false;
+	}
+
+	while (!have_iend) {
+		if (idx->png_len - pos < 12) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "File ends before IEND");
+			return false;
+		}
+		uint32_t       len  = paxc_read_be32(png + pos);
+		const uint8_t *type = png + pos + 4;
+		const uint8_t *data = png + pos + 8;
+		if (len > 0x7fffffff || len > idx->png_len - pos - 12) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "Chunk runs past the end of the file");
+			return false;
+		}
+		if (crc32(crc32(0, type, 4), data, len) != paxc_read_be32(data + len)) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "Bad CRC in %.4s chunk", (const char *) type);
+			return false;
+		}
+		if (!have_ihdr && memcmp(type, "IHDR", 4)) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "IHDR is not the first chunk");
+			return false;
+		}
+		bool is_data = !memcmp(type, "IDAT", 4);
+
+		if (!memcmp(type, "IHDR", 4)) {
+			if (have_ihdr || len != 13) goto corrupt;
+			idx->info.width      = paxc_read_be32(data);
+			idx->info.height     = paxc_read_be32(data + 4);
+			idx->info.bit_depth  = data[8];
+			idx->info.color_type = data[9];
+			interlace            = data[12];
+			if (!idx->info.width || !idx->info.height || idx->info.width > 0x7fffffff || idx->info.height > 0x7fffffff
+				|| !ihdr_valid(idx->info.bit_depth, idx->info.color_type) || data[10] || data[11] || interlace > 1) {
+				goto corrupt;
+			}
+			have_ihdr = true;
+
+		} else if (!memcmp(type, "PLTE", 4)) {
+			idx->palette_size = len / 3 > 256 ? 256 : len / 3;
+			for (size_t i = 0; i < idx->palette_size; i++) {
+				idx->palette[i] = 0xff000000 | (data[3*i] << 16) | (data[3*i+1] << 8) | data[3*i+2];
+			}
+
+		} else if (!memcmp(type, "tRNS", 4) && idx->info.color_type == 3) {
+			for (size_t i = 0; i < len && i < idx->palette_size; i++) {
+				idx->palette[i] = (idx->palette[i] & 0x00ffffff) | (data[i] << 24);
+			}
+
+		} else if (is_data) {
+			if (!idx->data) {
+				idx->data = pos;
+			} else if (!in_data) {
+				PAXC_ERROR(PAX_ERR_CORRUPT, "IDAT chunks are not consecutive");
+				return false;
+			}
+
+		} else if (!memcmp(type, "IEND", 4)) {
+			have_iend = true;
+		}
+
+		in_data = is_data;
+		pos    += 12 + len;
+	}
+
+	if (!idx->data) {
+		PAXC_ERROR(PAX_ERR_NODATA, "No image data");
+		return false;
+	}
+	if (idx->info.color_type == 3 && !idx->palette_size) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Palette image without PLTE");
+		return false;
+	}
+	if (interlace) {
+		// Adam7 passes spread every band of rows over the whole stream.
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Interlaced PNGs can't be indexed");
+		return false;
+	}
+	return true;
+
+	corrupt:
+	PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid %.4s chunk", (const char *) png + pos + 4);
+	return false;
+}
+
+// Makes sure inflate has input, moving on to the next IDAT chunk if needed.
+static bool feed_input(pax_png_index_t *idx) {
+	while (!idx->zs.avail_in) {
+		const uint8_t *chunk = idx->png + idx->chunk_next;
+		if (memcmp(chunk + 4, "IDAT", 4)) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "Image data ends early");
+			return false;
+		}
+		uint32_t clen = paxc_read_be32(chunk);
+		idx->zs.next_in   = (Bytef *) chunk + 8;
+		idx->zs.avail_in  = clen;
+		idx->chunk_next  += 12 + clen;
+	}
+	return true;
+}
+
+// Checks the result of an inflate call that should have produced more data.
+static bool inflate_ok(pax_png_index_t *idx, int zerr) {
+	bool ended = zerr == Z_STREAM_END && idx->zs.avail_out;
+	if ((zerr != Z_OK && zerr != Z_BUF_ERROR && zerr != Z_STREAM_END) || ended) {
+		PAXC_ERROR(zerr == Z_MEM_ERROR ? PAX_ERR_NOMEM : PAX_ERR_CORRUPT, "Inflate error %d", zerr);
+		return false;
+	}
+	return true;
+}
+
+// Inflates exactly `len` bytes of image data.
+static bool inflate_bytes(pax_png_index_t *idx, uint8_t *out, size_t len) {
+	idx->zs.next_out  = out;
+	idx->zs.avail_out = len;
+	while (idx->zs.avail_out) {
+		if (!feed_input(idx) || !inflate_ok(idx, inflate(&idx->zs, Z_NO_FLUSH))) return false;
+	}
+	return true;
+}
+
+// Reverses the filter of the row in `idx->row` and makes it the previous row.
+static bool finish_row(pax_png_index_t *idx) {
+	uint8_t *row = idx->row + 1;
+	if (!paxc_png_unfilter_row(idx->row[0], row, idx->prev, idx->row_bytes, idx->filter_bpp)) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid filter type %d", idx->row[0]);
+		return false;
+	}
+	memcpy(idx->prev, row, idx->row_bytes);
+	return true;
+}
+
+// Records a checkpoint at the block boundary inflate just stopped at, in row `row` after `partial` bytes of it.
+static bool add_point(pax_png_index_t *idx, uint32_t row, size_t partial) {
+	if (idx->num_points % 16 == 0) {
+		png_point_t *mem = realloc(idx->points, (idx->num_points + 16) * sizeof(png_point_t));
+		if (!mem) goto nomem;
+		idx->points = mem;
+	}
+	// The window goes straight into the checkpoint; 32 KiB is too much for the stack of small targets.
+	png_point_t *point = &idx->points[idx->num_points];
+	uInt         window_len = 0;
+	point->data = malloc(WINDOW_SIZE + idx->row_bytes + partial);
+	if (!point->data) goto nomem;
+	inflateGetDictionary(&idx->zs, point->data, &window_len);
+	if (window_len < WINDOW_SIZE) {
+		// Only checkpoints near the start have a partial window; the bigger block still works if this fails.
+		uint8_t *mem = realloc(point->data, window_len + idx->row_bytes + partial);
+		if (mem) point->data = mem;
+	}
+	point->row        = row;
+	point->partial    = partial;
+	point->in_pos     = idx->zs.next_in - idx->png;
+	point->in_avail   = idx->zs.avail_in;
+	point->chunk_next = idx->chunk_next;
+	point->bits       = idx->zs.data_type & 7;
+	point->prime      = point->bits ? idx->zs.next_in[-1] >> (8 - point->bits) : 0;
+	point->window_len = window_len;
+	memcpy(point->data + window_len, idx->prev, idx->row_bytes);
+	memcpy(point->data + window_len + idx->row_bytes, idx->row, partial);
+	idx->num_points++;
+	return true;
+
+	nomem:
+	PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+	return false;
+}
+
+// Inflates the whole image once, recording a checkpoint at the first block boundary after every `span` bytes.
+static bool build_index(pax_png_index_t *idx, size_t span) {
+	size_t   stride = 1 + idx->row_bytes;
+	size_t   pos    = 0;
+	uint32_t row    = 0;
+	uint64_t last   = 0;
+	inflateReset2(&idx->zs, 15);
+	idx->zs.avail_in = 0;
+	idx->chunk_next  = idx->data;
+	memset(idx->prev, 0, idx->row_bytes);
+
+	while (row < idx->info.height) {
+		if (!feed_input(idx)) return false;
+		// Z_BLOCK stops at every deflate block boundary as well as when the row is full.
+		idx->zs.next_out  = idx->row + pos;
+		idx->zs.avail_out = stride - pos;
+		if (!inflate_ok(idx, inflate(&idx->zs, Z_BLOCK))) return false;
+		pos = stride - idx->zs.avail_out;
+		if (pos == stride) {
+			if (!finish_row(idx)) return false;
+			pos = 0;
+			row++;
+		}
+		// Bit 7 of data_type marks a block boundary, bit 6 the end of the last block.
+		uint64_t total = (uint64_t) row * stride + pos;
+		if ((idx->zs.data_type & 128) && !(idx->zs.data_type & 64) && row < idx->info.height && total - last >= span) {
+			if (!add_point(idx, row, pos)) return false;
+			last = total;
+		}
+	}
+	PAX_LOGD(TAG, "Indexed %" PRIu32 " rows with %zu checkpoints", idx->info.height, idx->num_points);
+	return true;
+}
+
+// Opens a PNG held in memory and builds its index; the memory must stay valid until the index is freed.
+pax_png_index_t *pax_png_index_new_buf(const void *png, size_t png_len, uint32_t span_rows) {
+	pax_png_index_t *idx = calloc(1, sizeof(pax_png_index_t));
+	if (!idx) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return NULL;
+	}
+	idx->png     = png;
+	idx->png_len = png_len;
+	if (!parse_file(idx)) goto error;
+	idx->channels   = png_channels(idx->info.color_type);
+	idx->filter_bpp = (idx->channels * idx->info.bit_depth + 7) / 8;
+	idx->row_bytes  = ((size_t) idx->info.width * idx->channels * idx->info.bit_depth + 7) / 8;
+	paxc_png_row_fmt(&idx->fmt, idx->info.color_type, 8);
+	idx->fmt.palette      = idx->palette;
+	idx->fmt.palette_size = idx->palette_size;
+
+	// Rows get some slack for paxc_png_put_row.
+	idx->row  = malloc(1 + idx->row_bytes + 3);
+	idx->prev = malloc(idx->row_bytes + 3);
+	idx->conv = malloc((size_t) idx->info.width * idx->channels + 3);
+	if (!idx->row || !idx->prev || !idx->conv) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		goto error;
+	}
+	int zerr = inflateInit(&idx->zs);
+	if (zerr != Z_OK) {
+		PAXC_ERROR(zerr == Z_MEM_ERROR ? PAX_ERR_NOMEM : PAX_ERR_DECODE, "Inflate init error %d", zerr);
+		goto error;
+	}
+	idx->zs_init = true;
+
+	// By default, keep the checkpoints to a few percent of the image data.
+	size_t stride = 1 + idx->row_bytes;
+	size_t span   = (size_t) span_rows * stride;
+	if (!span_rows) {
+		span = 16 * (WINDOW_SIZE + 2 * stride);
+		if (span < SPAN_MIN) span = SPAN_MIN;
+	}
+	if (!build_index(idx, span)) goto error;
+	return idx;
+
+	error:
+	pax_png_index_free(idx);
+	return NULL;
+}
+
+// Opens a PNG file and builds its index; the file is mapped into memory where possible.
+pax_png_index_t *pax_png_index_new_fd(FILE *fd, uint32_t span_rows) {
+	pax_native_map_t *map = paxc_map_file(fd);
+	if (!map) return NULL;
+	pax_png_index_t *idx = pax_png_index_new_buf(map->mem, map->len, span_rows);
+	if (!idx) {
+		pax_unmap_native(map);
+		return NULL;
+	}
+	idx->map = map;
+	return idx;
+}
+
+// Frees a PNG index.
+void pax_png_index_free(pax_png_index_t *idx) {
+	if (!idx) return;
+	if (idx->zs_init) inflateEnd(&idx->zs);
+	for (size_t i = 0; i < idx->num_points; i++) {
+		free(idx->points[i].data);
+	}
+	free(idx->points);
+	free(idx->row);
+	free(idx->prev);
+	free(idx->conv);
+	pax_unmap_native(idx->map);
+	free(idx);
+}
+
+// Gets the size and format of the PNG.
+void pax_png_index_info(const pax_png_index_t *idx, pax_png_info_t *info) {
+	*info = idx->info;
+}
+
+// Inflates and unfilters the rest of the live row into `prev`, moving on to the next row.
+static bool next_row(pax_png_index_t *idx) {
+	size_t stride = 1 + idx->row_bytes;
+	if (!inflate_bytes(idx, idx->row + idx->live_pos, stride - idx->live_pos) || !finish_row(idx)) {
+		idx->live = false;
+		return false;
+	}
+	idx->live_row++;
+	idx->live_pos = 0;
+	return true;
+}
+
+// Puts the inflate state in row `y`, from the live state or the closest checkpoint above it.
+static bool seek_row(pax_png_index_t *idx, uint32_t y) {
+	// Find the last checkpoint in or before row `y`.
+	size_t lo = 0, hi = idx->num_points;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (idx->points[mid].row <= y) lo = mid + 1;
+		else hi = mid;
+	}
+	const png_point_t *point = lo ? &idx->points[lo - 1] : NULL;
+	uint32_t           start = point ? point->row : 0;
+
+	if (!idx->live || idx->live_row > y || idx->live_row < start) {
+		// Carrying on from where the last decode stopped would take longer.
+		idx->live = false;
+		if (point) {
+			// A raw deflate stream picking up at the block boundary.
+			inflateReset2(&idx->zs, -15);
+			if (point->bits) inflatePrime(&idx->zs, point->bits, point->prime);
+			inflateSetDictionary(&idx->zs, point->data, point->window_len);
+			idx->zs.next_in  = (Bytef *) idx->png + point->in_pos;
+			idx->zs.avail_in = point->in_avail;
+			idx->chunk_next  = point->chunk_next;
+			memcpy(idx->prev, point->data + point->window_len, idx->row_bytes);
+			memcpy(idx->row, point->data + point->window_len + idx->row_bytes, point->partial);
+			idx->live_row = point->row;
+			idx->live_pos = point->partial;
+		} else {
+			inflateReset2(&idx->zs, 15);
+			idx->zs.avail_in = 0;
+			idx->chunk_next  = idx->data;
+			memset(idx->prev, 0, idx->row_bytes);
+			idx->live_row = 0;
+			idx->live_pos = 0;
+		}
+		idx->live = true;
+	}
+
+	// Skip the rows in between; they still have to be unfiltered for the next one.
+	while (idx->live_row < y) {
+		if (!next_row(idx)) return false;
+	}
+	return true;
+}
+
+// Brings columns `x` to `x + width` of an unfiltered row to 8 bits per channel.
+static const uint8_t *convert_cols(pax_png_index_t *idx, const uint8_t *row, uint32_t x, uint32_t width) {
+	int bits = idx->info.bit_depth;
+	if (bits == 8) {
+		return row + (size_t) x * idx->channels;
+	}
+	uint8_t *out = idx->conv;
+	if (bits == 16) {
+		// Keep the high byte of each sample.
+		const uint8_t *in = row + (size_t) x * idx->channels * 2;
+		size_t         n  = (size_t) width * idx->channels;
+		for (size_t i = 0; i < n; i++) out[i] = in[2*i];
+	} else {
+		// Unpack 1, 2 or 4 bit palette indices, and expand greyscale of those depths.
+		uint8_t mask  = (1 << bits) - 1;
+		uint8_t scale = idx->info.color_type == 3 ? 1 : 255 / mask;
+		for (uint32_t i = 0; i < width; i++) {
+			size_t bit = (size_t) (x + i) * bits;
+			out[i] = ((row[bit / 8] >> (8 - bits - bit % 8)) & mask) * scale;
+		}
+	}
+	return out;
+}
+
+// Draws the region at (`x`, `y`) sized `width` by `height` of the PNG onto `buf` with its top-left corner at (`dx`, `dy`).
+bool pax_png_index_decode(pax_png_index_t *idx, pax_buf_t *buf, int x, int y, int width, int height, int dx, int dy) {
+	if (x < 0 || y < 0 || width <= 0 || height <= 0 || (uint32_t) x + width > idx->info.width || (uint32_t) y + height > idx->info.height) {
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Region is not inside the image");
+		return false;
+	}
+	if (dx < 0 || dy < 0 || dx + width > pax_buf_get_width(buf) || dy + height > pax_buf_get_height(buf)) {
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Region does not fit the buffer");
+		return false;
+	}
+	PAXC_STATS_CALL_BEGIN();
+	bool ok = seek_row(idx, y);
+	int  mode = paxc_png_put_mode(buf, idx->info.color_type, false);
+	for (int py = 0; ok && py < height; py++) {
+		ok = next_row(idx);
+		if (ok) paxc_png_put_row(buf, &idx->fmt, convert_cols(idx, idx->prev, x, width), 0, 1, width, dx, dy + py, mode);
+	}
+	PAXC_STATS_ADD(rows, height);
+	PAXC_STATS_CALL_END();
+	if (ok) pax_mark_dirty2(buf, dx, dy, width, height);
+	return ok;
+}
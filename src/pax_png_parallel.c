@@ -0,0 +1,270 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+
+#if PAX_CODECS_THREADS
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "pax_png_parallel";
+
+// Bands smaller than this aren't worth a thread.
+#define MIN_BAND_ROWS   16
+// The deflate window, and thus the most dictionary a band can use.
+#define MAX_DICT_SIZE   32768
+// Stack size for the worker threads.
+#define WORKER_STACK    16384
+
+// One horizontal band of the image.
+typedef struct {
+	// Source region.
+	const pax_buf_t             *buf;
+	paxc_row_fetch_t             fetch;
+	const pax_png_encode_opts_t *opts;
+	int                          x, y, width, rows;
+	size_t                       row_bytes;
+	int                          bpp;
+	bool                         first;
+	bool                         last;
+	// Filtered image data for this band.
+	uint8_t                     *filtered;
+	size_t                       filtered_len;
+	uint32_t                     adler;
+	// Tail of the filtered data before this band.
+	uint8_t                     *dict;
+	size_t                       dict_len;
+	// Raw deflate output.
+	paxc_membuf_t                out;
+	// Error to report, PAX_OK on success.
+	int                          error;
+} band_t;
+
+// Phase one: fetch and filter the rows of a band.
+static void *band_filter(void *arg) {
+	band_t  *band    = arg;
+	size_t   n       = band->row_bytes;
+	uint8_t *prev    = calloc(1, n);
+	uint8_t *row     = malloc(n);
+	uint8_t *scratch = malloc(paxc_png_filter_scratch(band->opts, n));
+	band->filtered   = malloc(band->rows * (n + 1));
+	if (!prev || !row || !scratch || !band->filtered) {
+		band->error = PAX_ERR_NOMEM;
+		goto cleanup;
+	}
+
+	// The row above the band is filtered against, but belongs to the previous band.
+	if (!band->first) {
+		band->fetch(band->buf, band->x, band->y - 1, band->width, prev);
+	}
+	for (int i = 0; i < band->rows; i++) {
+		band->fetch(band->buf, band->x, band->y + i, band->width, row);
+		const uint8_t *out = paxc_png_filter_apply(band->opts, scratch, row, prev, n, band->bpp);
+		memcpy(band->filtered + i * (n + 1), out, n + 1);
+		uint8_t *tmp = prev;
+		prev = row;
+		row  = tmp;
+	}
+	band->filtered_len = band->rows * (n + 1);
+	band->adler        = adler32(adler32(0, NULL, 0), band->filtered, band->filtered_len);
+
+	cleanup:
+	free(prev);
+	free(row);
+	free(scratch);
+	return NULL;
+}
+
+// Phase two: deflate a band, primed with the data before it.
+// Every band but the last ends in a sync flush so the pieces can be concatenated.
+static void *band_deflate(void *arg) {
+	band_t  *band = arg;
+	z_stream zs   = {0};
+	uint8_t  buf[4096];
+
+	int zerr = deflateInit2(&zs, band->opts->level, Z_DEFLATED, -band->opts->window_bits, band->opts->mem_level, paxc_png_zstrategy(band->opts->strategy));
+	if (zerr != Z_OK) {
+		band->error = zerr == Z_MEM_ERROR ? PAX_ERR_NOMEM : PAX_ERR_ENCODE;
+		return NULL;
+	}
+	if (band->dict_len && deflateSetDictionary(&zs, band->dict, band->dict_len) != Z_OK) {
+		band->error = PAX_ERR_ENCODE;
+		goto cleanup;
+	}
+
+	zs.next_in  = band->filtered;
+	zs.avail_in = band->filtered_len;
+	int flush   = band->last ? Z_FINISH : Z_SYNC_FLUSH;
+	do {
+		zs.next_out  = buf;
+		zs.avail_out = sizeof(buf);
+		zerr = deflate(&zs, flush);
+		if (zerr != Z_OK && zerr != Z_STREAM_END && zerr != Z_BUF_ERROR) {
+			band->error = PAX_ERR_ENCODE;
+			goto cleanup;
+		}
+		if (!paxc_sink_mem(&band->out, buf, sizeof(buf) - zs.avail_out)) {
+			band->error = PAX_ERR_NOMEM;
+			goto cleanup;
+		}
+	} while (zs.avail_out == 0);
+
+	cleanup:
+	deflateEnd(&zs);
+	return NULL;
+}
+
+// Runs `func` for every band, one thread each; band 0 runs on the calling thread.
+static void run_bands(band_t *bands, int n_bands, void *(*func)(void *)) {
+	pthread_t      threads[PAXC_MAX_THREADS];
+	bool           started[PAXC_MAX_THREADS] = {0};
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, WORKER_STACK);
+
+	for (int i = 1; i < n_bands; i++) {
+		started[i] = !pthread_create(&threads[i], &attr, func, &bands[i]);
+	}
+	func(&bands[0]);
+	for (int i = 1; i < n_bands; i++) {
+		if (started[i]) {
+			pthread_join(threads[i], NULL);
+		} else {
+			// Couldn't start a thread; do the work here instead.
+			func(&bands[i]);
+		}
+	}
+	pthread_attr_destroy(&attr);
+}
+
+// Takes the first error reported by any band.
+static int bands_error(const band_t *bands, int n_bands) {
+	for (int i = 0; i < n_bands; i++) {
+		if (bands[i].error) return bands[i].error;
+	}
+	return PAX_OK;
+}
+
+// Compresses the image data for a region of `buf` on several threads and writes the IDAT chunks.
+// Each band is filtered and deflated independently, primed with the last 32 KiB of data before it,
+// and the pieces are stitched into one zlib stream with an Adler-32 combined from the bands.
+bool paxc_png_image_parallel(paxc_png_writer_t *w, const pax_buf_t *buf, int x, int y, int width, int height) {
+	int n_bands = w->opts.threads;
+	if (n_bands > height / MIN_BAND_ROWS) n_bands = height / MIN_BAND_ROWS;
+	if (n_bands < 1) n_bands = 1;
+
+	band_t *bands = calloc(n_bands, sizeof(band_t));
+	if (!bands) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return false;
+	}
+	size_t row_bytes = paxc_png_row_bytes(width, w->bit_depth, w->color_type);
+	int    row       = 0;
+	for (int i = 0; i < n_bands; i++) {
+		bands[i].buf       = buf;
+		bands[i].fetch     = paxc_get_row_fetch(buf);
+		bands[i].opts      = &w->opts;
+		bands[i].x         = x;
+		bands[i].y         = y + row;
+		bands[i].width     = width;
+		bands[i].rows      = (height - row) / (n_bands - i);
+		bands[i].row_bytes = row_bytes;
+		bands[i].bpp       = w->filter_bpp;
+		bands[i].first     = i == 0;
+		bands[i].last      = i == n_bands - 1;
+		row += bands[i].rows;
+	}
+
+	// Filter all bands.
+	// Stats only see the wall time of each phase; allocations made by the workers aren't counted.
+	bool ok = false;
+	PAXC_STATS_BEGIN(filter);
+	run_bands(bands, n_bands, band_filter);
+	PAXC_STATS_END(filter, filter_ns);
+	PAXC_STATS_ADD(rows, height);
+	PAXC_STATS_ADD(bytes_in, (uint64_t) 4 * width * height);
+	int error = bands_error(bands, n_bands);
+	if (error) goto cleanup;
+
+	// Collect each band's dictionary from the filtered data before it.
+	for (int i = 1; i < n_bands; i++) {
+		size_t want = MAX_DICT_SIZE;
+		size_t have = 0;
+		for (int j = i - 1; j >= 0 && have < want; j--) have += bands[j].filtered_len;
+		if (have > want) have = want;
+		bands[i].dict     = malloc(have);
+		bands[i].dict_len = have;
+		if (!bands[i].dict) {
+			error = PAX_ERR_NOMEM;
+			goto cleanup;
+		}
+		size_t fill = have;
+		for (int j = i - 1; fill; j--) {
+			size_t part = bands[j].filtered_len < fill ? bands[j].filtered_len : fill;
+			memcpy(bands[i].dict + fill - part, bands[j].filtered + bands[j].filtered_len - part, part);
+			fill -= part;
+		}
+	}
+
+	// Deflate all bands.
+	PAXC_STATS_BEGIN(deflate);
+	run_bands(bands, n_bands, band_deflate);
+	PAXC_STATS_END(deflate, deflate_ns);
+	error = bands_error(bands, n_bands);
+	if (error) goto cleanup;
+
+	// Stitch together the zlib stream.
+	uint8_t header[2];
+	paxc_zlib_header(&w->opts, header);
+	uint32_t adler = bands[0].adler;
+	for (int i = 1; i < n_bands; i++) {
+		adler = adler32_combine(adler, bands[i].adler, bands[i].filtered_len);
+	}
+	uint8_t trailer[4];
+	paxc_write_be32(trailer, adler);
+
+	ok = paxc_png_write_idat(w, header, sizeof(header));
+	for (int i = 0; ok && i < n_bands; i++) {
+		ok = paxc_png_write_idat(w, bands[i].out.data, bands[i].out.len);
+	}
+	ok = ok && paxc_png_write_idat(w, trailer, sizeof(trailer)) && paxc_png_flush_idat(w);
+
+	cleanup:
+	if (error) {
+		PAXC_ERROR(error, "Parallel encode failed: %d", error);
+	}
+	for (int i = 0; i < n_bands; i++) {
+		free(bands[i].filtered);
+		free(bands[i].dict);
+		free(bands[i].out.data);
+	}
+	free(bands);
+	return ok;
+}
+
+#endif // PAX_CODECS_THREADS
@@ -0,0 +1,290 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "pax_png_screen";
+
+// Default number of rows per band.
+#define DEFAULT_BAND_ROWS 16
+
+// Final empty fixed-Huffman block that terminates the stitched deflate stream.
+static const uint8_t final_block[2] = { 0x03, 0x00 };
+
+// Cached compressed form of one band.
+typedef struct {
+	// Raw deflate data, ending in a sync flush.
+	paxc_membuf_t data;
+	// CRC-32 of `data`.
+	uint32_t      crc;
+	// Adler-32 and length of the filtered rows it decompresses to.
+	uint32_t      adler;
+	size_t        raw_len;
+	// Whether the cache matches the buffer contents.
+	bool          valid;
+} screen_band_t;
+
+struct pax_png_screen_enc {
+	// Captured region.
+	int               x, y, width, height;
+	int               band_rows;
+	int               n_bands;
+	// Settings and chunk output.
+	paxc_png_writer_t writer;
+	// Raw deflate stream, reset for every band.
+	z_stream          zs;
+	bool              zs_init;
+	// Row buffers.
+	size_t            row_bytes;
+	uint8_t          *row;
+	uint8_t          *prev;
+	uint8_t          *scratch;
+	// Per-band caches.
+	screen_band_t    *bands;
+};
+
+
+
+// Creates an incremental encoder for a `width` by `height` region at (`x`, `y`).
+pax_png_screen_enc_t *pax_png_screen_enc_new(int x, int y, int width, int height, int band_rows, const pax_png_encode_opts_t *opts) {
+	if (width <= 0 || height <= 0 || band_rows < 0) {
+		PAXC_ERROR(PAX_ERR_PARAM, "Invalid region or band size");
+		return NULL;
+	}
+	pax_png_screen_enc_t *enc = calloc(1, sizeof(pax_png_screen_enc_t));
+	if (!enc) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return NULL;
+	}
+	if (!paxc_png_writer_init(&enc->writer, opts, NULL, NULL)) {
+		free(enc);
+		return NULL;
+	}
+
+	enc->x         = x;
+	enc->y         = y;
+	enc->width     = width;
+	enc->height    = height;
+	enc->band_rows = band_rows ? band_rows : DEFAULT_BAND_ROWS;
+	enc->n_bands   = (height + enc->band_rows - 1) / enc->band_rows;
+	enc->row_bytes = paxc_png_row_bytes(width, 8, 6);
+	enc->row       = malloc(enc->row_bytes);
+	enc->prev      = malloc(enc->row_bytes);
+	enc->scratch   = malloc(paxc_png_filter_scratch(&enc->writer.opts, enc->row_bytes));
+	enc->bands     = calloc(enc->n_bands, sizeof(screen_band_t));
+	if (!enc->row || !enc->prev || !enc->scratch || !enc->bands) {
+		pax_png_screen_enc_free(enc);
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return NULL;
+	}
+
+	const pax_png_encode_opts_t *o = &enc->writer.opts;
+	int zerr = deflateInit2(&enc->zs, o->level, Z_DEFLATED, -o->window_bits, o->mem_level, paxc_png_zstrategy(o->strategy));
+	if (zerr != Z_OK) {
+		pax_png_screen_enc_free(enc);
+		PAXC_ERROR(zerr == Z_MEM_ERROR ? PAX_ERR_NOMEM : PAX_ERR_ENCODE, "Deflate init error %d", zerr);
+		return NULL;
+	}
+	enc->zs_init = true;
+
+	return enc;
+}
+
+// Frees an incremental encoder and all cached data.
+void pax_png_screen_enc_free(pax_png_screen_enc_t *enc) {
+	if (!enc) return;
+	if (enc->zs_init) deflateEnd(&enc->zs);
+	if (enc->bands) {
+		for (int i = 0; i < enc->n_bands; i++) {
+			free(enc->bands[i].data.data);
+		}
+	}
+	paxc_png_writer_destroy(&enc->writer);
+	free(enc->bands);
+	free(enc->row);
+	free(enc->prev);
+	free(enc->scratch);
+	free(enc);
+}
+
+// Forces the next encode to recompress every band.
+void pax_png_screen_enc_invalidate(pax_png_screen_enc_t *enc) {
+	for (int i = 0; i < enc->n_bands; i++) {
+		enc->bands[i].valid = false;
+	}
+}
+
+// Compresses data into a band's cache.
+static bool band_deflate(pax_png_screen_enc_t *enc, screen_band_t *band, const uint8_t *data, size_t len, int flush) {
+	uint8_t tmp[1024];
+	enc->zs.next_in  = (Bytef *) data;
+	enc->zs.avail_in = len;
+	do {
+		enc->zs.next_out  = tmp;
+		enc->zs.avail_out = sizeof(tmp);
+		int zerr = deflate(&enc->zs, flush);
+		if (zerr != Z_OK && zerr != Z_BUF_ERROR) {
+			PAXC_ERROR(PAX_ERR_ENCODE, "Deflate error %d", zerr);
+			return false;
+		}
+		if (!paxc_sink_mem(&band->data, tmp, sizeof(tmp) - enc->zs.avail_out)) {
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			return false;
+		}
+	} while (enc->zs.avail_out == 0);
+	return true;
+}
+
+// Filters and compresses one band into its cache.
+// The first row of a band only uses filters that don't look at the row above,
+// so a band never depends on the contents of another band.
+static bool band_encode(pax_png_screen_enc_t *enc, const pax_buf_t *buf, paxc_row_fetch_t fetch, int index) {
+	screen_band_t *band  = &enc->bands[index];
+	const pax_png_encode_opts_t *opts = &enc->writer.opts;
+	int  row0  = index * enc->band_rows;
+	int  rows  = enc->height - row0 < enc->band_rows ? enc->height - row0 : enc->band_rows;
+	size_t n   = enc->row_bytes;
+	int  first = opts->filter_mode == PAX_PNG_FILTER_NONE ? PAX_PNG_ROW_FILTER_NONE : PAX_PNG_ROW_FILTER_SUB;
+
+	band->valid    = false;
+	band->data.len = 0;
+	band->adler    = adler32(0, NULL, 0);
+	band->raw_len  = 0;
+	deflateReset(&enc->zs);
+
+	for (int i = 0; i < rows; i++) {
+		fetch(buf, enc->x, enc->y + row0 + i, enc->width, enc->row);
+		const uint8_t *out;
+		if (i == 0) {
+			paxc_png_filter_row(first, enc->scratch, enc->row, enc->prev, n, 4);
+			out = enc->scratch;
+		} else {
+			out = paxc_png_filter_apply(opts, enc->scratch, enc->row, enc->prev, n, 4);
+		}
+		band->adler    = adler32(band->adler, out, n + 1);
+		band->raw_len += n + 1;
+		if (!band_deflate(enc, band, out, n + 1, i == rows - 1 ? Z_SYNC_FLUSH : Z_NO_FLUSH)) return false;
+
+		uint8_t *tmp = enc->prev;
+		enc->prev = enc->row;
+		enc->row  = tmp;
+	}
+
+	band->crc   = crc32(0, band->data.data, band->data.len);
+	band->valid = true;
+	return true;
+}
+
+// Writes one IDAT chunk of `pre`, the band data and `post`.
+// The CRC is spliced together from the band's cached CRC instead of being recomputed.
+static bool write_band_chunk(pax_png_screen_enc_t *enc, const screen_band_t *band, const uint8_t *pre, size_t pre_len, const uint8_t *post, size_t post_len) {
+	paxc_png_writer_t *w   = &enc->writer;
+	size_t             len = pre_len + band->data.len + post_len;
+	uint8_t            head[8];
+	uint8_t            tail[4];
+	paxc_write_be32(head, len);
+	memcpy(head + 4, "IDAT", 4);
+
+	uint32_t crc = crc32(0, head + 4, 4);
+	crc = crc32(crc, pre, pre_len);
+	crc = crc32_combine(crc, band->crc, band->data.len);
+	crc = crc32(crc, post, post_len);
+	paxc_write_be32(tail, crc);
+
+	bool ok = w->sink(w->cookie, head, sizeof(head))
+		&& (!pre_len || w->sink(w->cookie, pre, pre_len))
+		&& (!band->data.len || w->sink(w->cookie, band->data.data, band->data.len))
+		&& (!post_len || w->sink(w->cookie, post, post_len))
+		&& w->sink(w->cookie, tail, sizeof(tail));
+	if (!ok) {
+		PAXC_ERROR(PAX_ERR_ENCODE, "Output sink failed");
+	}
+	return ok;
+}
+
+// Encodes the region as a complete PNG, recompressing only the bands that overlap the
+// dirty rectangle (`dirty_x`, `dirty_y`, `dirty_w`, `dirty_h`) in buffer coordinates.
+bool pax_png_screen_enc_encode(pax_png_screen_enc_t *enc, const pax_buf_t *buf, int dirty_x, int dirty_y, int dirty_w, int dirty_h, pax_codec_sink_t sink, void *cookie) {
+	if (enc->x < 0 || enc->y < 0 || enc->x + enc->width > pax_buf_get_width(buf) || enc->y + enc->height > pax_buf_get_height(buf)) {
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Region does not fit the buffer");
+		return false;
+	}
+
+	// Invalidate bands that intersect the dirty area.
+	if (dirty_w > 0 && dirty_h > 0 && dirty_x < enc->x + enc->width && dirty_x + dirty_w > enc->x) {
+		int y0 = dirty_y - enc->y;
+		int y1 = dirty_y + dirty_h - enc->y;
+		if (y0 < 0) y0 = 0;
+		if (y1 > enc->height) y1 = enc->height;
+		for (int i = y0 / enc->band_rows; y0 < y1 && i <= (y1 - 1) / enc->band_rows; i++) {
+			enc->bands[i].valid = false;
+		}
+	}
+
+	// Recompress what's out of date.
+	paxc_row_fetch_t fetch = paxc_get_row_fetch(buf);
+	for (int i = 0; i < enc->n_bands; i++) {
+		if (!enc->bands[i].valid && !band_encode(enc, buf, fetch, i)) return false;
+	}
+
+	// Combine the checksums and write the PNG.
+	uint32_t adler = adler32(0, NULL, 0);
+	for (int i = 0; i < enc->n_bands; i++) {
+		adler = adler32_combine(adler, enc->bands[i].adler, enc->bands[i].raw_len);
+	}
+	uint8_t header[2];
+	uint8_t trailer[sizeof(final_block) + 4];
+	paxc_zlib_header(&enc->writer.opts, header);
+	memcpy(trailer, final_block, sizeof(final_block));
+	paxc_write_be32(trailer + sizeof(final_block), adler);
+
+	enc->writer.sink   = sink;
+	enc->writer.cookie = cookie;
+	if (!paxc_png_write_ihdr(&enc->writer, enc->width, enc->height, 8, 6)) return false;
+	for (int i = 0; i < enc->n_bands; i++) {
+		bool first = i == 0;
+		bool last  = i == enc->n_bands - 1;
+		if (!write_band_chunk(enc, &enc->bands[i], header, first ? sizeof(header) : 0, trailer, last ? sizeof(trailer) : 0)) {
+			return false;
+		}
+	}
+	return paxc_png_write_iend(&enc->writer);
+}
+
+// Encodes the region using the buffer's own dirty rectangle, as maintained by pax.
+bool pax_png_screen_enc_encode_dirty(pax_png_screen_enc_t *enc, const pax_buf_t *buf, pax_codec_sink_t sink, void *cookie) {
+	if (!pax_is_dirty(buf)) {
+		return pax_png_screen_enc_encode(enc, buf, 0, 0, 0, 0, sink, cookie);
+	}
+	return pax_png_screen_enc_encode(
+		enc, buf,
+		buf->dirty_x0, buf->dirty_y0,
+		buf->dirty_x1 - buf->dirty_x0 + 1, buf->dirty_y1 - buf->dirty_y0 + 1,
+		sink, cookie
+	);
+}
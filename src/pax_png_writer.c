@@ -0,0 +1,374 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "pax_png_writer";
+
+static const uint8_t png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+// Space reserved in front of the IDAT payload for the fdAT sequence number.
+#define IDAT_HEAD 4
+
+// The settings used by pax_encode_png_fd and pax_encode_png_buf.
+const pax_png_encode_opts_t pax_png_opts_default = {
+	.level       = -1,
+	.strategy    = PAX_PNG_STRATEGY_DEFAULT,
+	.window_bits = 15,
+	.mem_level   = 8,
+	.filter_mode = PAX_PNG_FILTER_ADAPTIVE,
+	.filter      = PAX_PNG_ROW_FILTER_NONE,
+	.idat_size   = 32768,
+};
+
+// Fastest useful encode, for screenshots and telemetry.
+// Z_RLE only finds distance-1 matches, which RGBA pixels only produce after the Sub filter.
+const pax_png_encode_opts_t pax_png_opts_fast_screenshot = {
+	.level       = 1,
+	.strategy    = PAX_PNG_STRATEGY_RLE,
+	.window_bits = 15,
+	.mem_level   = 8,
+	.filter_mode = PAX_PNG_FILTER_FIXED,
+	.filter      = PAX_PNG_ROW_FILTER_SUB,
+	.idat_size   = 32768,
+};
+
+// Smallest output, for assets that are encoded once.
+const pax_png_encode_opts_t pax_png_opts_archive = {
+	.level       = 9,
+	.strategy    = PAX_PNG_STRATEGY_DEFAULT,
+	.window_bits = 15,
+	.mem_level   = 9,
+	.filter_mode = PAX_PNG_FILTER_ADAPTIVE,
+	.filter      = PAX_PNG_ROW_FILTER_NONE,
+	.idat_size   = 65536,
+};
+
+
+
+// Sink that writes to a FILE *.
+bool paxc_sink_file(void *cookie, const void *data, size_t len) {
+	return fwrite(data, 1, len, (FILE *) cookie) == len;
+}
+
+// Sink that appends to a paxc_membuf_t.
+bool paxc_sink_mem(void *cookie, const void *data, size_t len) {
+	paxc_membuf_t *mem = cookie;
+	if (mem->len + len > mem->cap) {
+		size_t cap = mem->cap ? mem->cap : 4096;
+		while (cap < mem->len + len) cap *= 2;
+		// Not a paxc_malloc allocation; the caller takes ownership of it.
+		void *mem_new = realloc(mem->data, cap);
+		if (!mem_new) return false;
+		PAXC_STATS_MEM(mem->data ? 0 : 1, cap - mem->cap);
+		mem->data = mem_new;
+		mem->cap  = cap;
+	}
+	memcpy(mem->data + mem->len, data, len);
+	mem->len += len;
+	return true;
+}
+
+
+
+// Number of channels for a PNG color type.
+static int png_channels(int color_type) {
+	switch (color_type) {
+		case 2:  return 3;
+		case 4:  return 2;
+		case 6:  return 4;
+		default: return 1;
+	}
+}
+
+// Bytes in a PNG row without the filter type byte.
+size_t paxc_png_row_bytes(uint32_t width, int bit_depth, int color_type) {
+	return ((size_t) width * png_channels(color_type) * bit_depth + 7) / 8;
+}
+
+// Maps a pax_png_strategy_t to the zlib strategy.
+int paxc_png_zstrategy(pax_png_strategy_t strategy) {
+	static const int strategies[] = { Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE, Z_HUFFMAN_ONLY };
+	return strategies[strategy];
+}
+
+// The two-byte zlib stream header for the given settings, without preset dictionary.
+void paxc_zlib_header(const pax_png_encode_opts_t *opts, uint8_t out[2]) {
+	int flevel;
+	if (opts->strategy >= PAX_PNG_STRATEGY_RLE || (opts->level >= 0 && opts->level < 2)) {
+		flevel = 0;
+	} else if (opts->level >= 2 && opts->level < 6) {
+		flevel = 1;
+	} else if (opts->level == 6 || opts->level == -1) {
+		flevel = 2;
+	} else {
+		flevel = 3;
+	}
+	out[0]  = ((opts->window_bits - 8) << 4) | Z_DEFLATED;
+	out[1]  = flevel << 6;
+	out[1] += 31 - ((out[0] << 8) + out[1]) % 31;
+}
+
+// Prepares a PNG writer; `opts` may be NULL for the defaults.
+bool paxc_png_writer_init(paxc_png_writer_t *w, const pax_png_encode_opts_t *opts, paxc_sink_t sink, void *cookie) {
+	memset(w, 0, sizeof(*w));
+	w->sink   = sink;
+	w->cookie = cookie;
+	w->opts   = opts ? *opts : pax_png_opts_default;
+
+	// Validate settings.
+	pax_png_encode_opts_t *o = &w->opts;
+	if (o->level < -1 || o->level > 9
+		|| o->window_bits < 9 || o->window_bits > 15
+		|| o->mem_level < 1 || o->mem_level > 9
+		|| o->strategy < PAX_PNG_STRATEGY_DEFAULT || o->strategy > PAX_PNG_STRATEGY_HUFFMAN_ONLY
+		|| o->filter_mode < PAX_PNG_FILTER_NONE || o->filter_mode > PAX_PNG_FILTER_FAST
+		|| o->filter < PAX_PNG_ROW_FILTER_NONE || o->filter > PAX_PNG_ROW_FILTER_PAETH
+		|| o->idat_size < 256 || o->idat_size > 0x7fffffff
+		|| o->threads < 0 || o->threads > PAXC_MAX_THREADS) {
+		PAXC_ERROR(PAX_ERR_PARAM, "Invalid encoder options");
+		return false;
+	}
+
+	return true;
+}
+
+// Points a PNG writer at a new output for the next image, keeping its buffers and deflate state.
+void paxc_png_writer_reuse(paxc_png_writer_t *w, paxc_sink_t sink, void *cookie) {
+	w->sink      = sink;
+	w->cookie    = cookie;
+	w->rows_left = 0;
+	w->idat_len  = 0;
+	w->fdat_seq  = NULL;
+}
+
+// Frees all memory held by a PNG writer.
+void paxc_png_writer_destroy(paxc_png_writer_t *w) {
+	if (w->zs_init) deflateEnd(&w->zs);
+	paxc_free(w->prev_row);
+	paxc_free(w->filt);
+	paxc_free(w->idat);
+	paxc_free(w->rgba);
+	w->zs_init  = false;
+	w->prev_row = NULL;
+	w->filt     = NULL;
+	w->idat     = NULL;
+	w->rgba     = NULL;
+	w->rgba_cap = 0;
+}
+
+// Writes a single chunk with the given type and payload.
+bool paxc_png_write_chunk(paxc_png_writer_t *w, const char type[4], const void *data, size_t len) {
+	uint8_t head[8];
+	uint8_t tail[4];
+	paxc_write_be32(head, len);
+	memcpy(head + 4, type, 4);
+	uint32_t crc = crc32(0, head + 4, 4);
+	if (len) crc = crc32(crc, data, len);
+	paxc_write_be32(tail, crc);
+
+	PAXC_STATS_BEGIN(write);
+	bool ok = w->sink(w->cookie, head, 8) && (!len || w->sink(w->cookie, data, len)) && w->sink(w->cookie, tail, 4);
+	PAXC_STATS_END(write, write_ns);
+	if (!ok) {
+		PAXC_ERROR(PAX_ERR_ENCODE, "Output sink failed");
+		return false;
+	}
+	PAXC_STATS_ADD(bytes_out, 12 + len);
+	return true;
+}
+
+// Writes the PNG signature and IHDR chunk.
+bool paxc_png_write_ihdr(paxc_png_writer_t *w, uint32_t width, uint32_t height, int bit_depth, int color_type) {
+	if (!width || !height || width > 0x7fffffff || height > 0x7fffffff) {
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Invalid image size %" PRIu32 "x%" PRIu32, width, height);
+		return false;
+	}
+	w->bit_depth  = bit_depth;
+	w->color_type = color_type;
+	w->filter_bpp = (png_channels(color_type) * bit_depth + 7) / 8;
+
+	uint8_t ihdr[13];
+	paxc_write_be32(ihdr + 0, width);
+	paxc_write_be32(ihdr + 4, height);
+	ihdr[8]  = bit_depth;
+	ihdr[9]  = color_type;
+	ihdr[10] = 0; // Compression: deflate.
+	ihdr[11] = 0; // Filter method: adaptive.
+	ihdr[12] = 0; // Interlace: none.
+
+	PAXC_STATS_BEGIN(write);
+	bool ok = w->sink(w->cookie, png_signature, sizeof(png_signature));
+	PAXC_STATS_END(write, write_ns);
+	if (!ok) {
+		PAXC_ERROR(PAX_ERR_ENCODE, "Output sink failed");
+		return false;
+	}
+	PAXC_STATS_ADD(bytes_out, sizeof(png_signature));
+	return paxc_png_write_chunk(w, "IHDR", ihdr, sizeof(ihdr));
+}
+
+// Allocates the IDAT payload buffer if it isn't there yet.
+static bool idat_alloc(paxc_png_writer_t *w) {
+	if (!w->idat) {
+		w->idat     = paxc_malloc(IDAT_HEAD + w->opts.idat_size);
+		w->idat_len = 0;
+		if (!w->idat) {
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			return false;
+		}
+	}
+	return true;
+}
+
+// Writes out the pending IDAT payload, if any.
+bool paxc_png_flush_idat(paxc_png_writer_t *w) {
+	size_t len = w->idat_len;
+	if (!len) return true;
+	w->idat_len = 0;
+	if (w->fdat_seq) {
+		// APNG frame data is an IDAT payload with a sequence number in front.
+		paxc_write_be32(w->idat, (*w->fdat_seq)++);
+		return paxc_png_write_chunk(w, "fdAT", w->idat, IDAT_HEAD + len);
+	}
+	return paxc_png_write_chunk(w, "IDAT", w->idat + IDAT_HEAD, len);
+}
+
+// Appends already compressed image data to the pending IDAT payload.
+bool paxc_png_write_idat(paxc_png_writer_t *w, const void *data, size_t len) {
+	if (!idat_alloc(w)) return false;
+	const uint8_t *ptr = data;
+	while (len) {
+		size_t part = w->opts.idat_size - w->idat_len;
+		if (part > len) part = len;
+		memcpy(w->idat + IDAT_HEAD + w->idat_len, ptr, part);
+		w->idat_len += part;
+		ptr         += part;
+		len         -= part;
+		if (w->idat_len == w->opts.idat_size && !paxc_png_flush_idat(w)) return false;
+	}
+	return true;
+}
+
+// Compresses data into the pending IDAT payload.
+static bool idat_deflate(paxc_png_writer_t *w, const void *data, size_t len, int flush) {
+	w->zs.next_in  = (Bytef *) data;
+	w->zs.avail_in = len;
+	while (1) {
+		w->zs.next_out  = w->idat + IDAT_HEAD + w->idat_len;
+		w->zs.avail_out = w->opts.idat_size - w->idat_len;
+		PAXC_STATS_BEGIN(deflate);
+		int zerr = deflate(&w->zs, flush);
+		PAXC_STATS_END(deflate, deflate_ns);
+		w->idat_len = w->opts.idat_size - w->zs.avail_out;
+		if (zerr != Z_OK && zerr != Z_STREAM_END && zerr != Z_BUF_ERROR) {
+			PAXC_ERROR(PAX_ERR_ENCODE, "Deflate error %d: %s", zerr, w->zs.msg ? w->zs.msg : "?");
+			return false;
+		}
+		// Space left in the output means deflate has consumed everything.
+		if (w->zs.avail_out) return true;
+		if (!paxc_png_flush_idat(w)) return false;
+	}
+}
+
+// Starts compressing image data for an image of the given size.
+bool paxc_png_image_begin(paxc_png_writer_t *w, uint32_t width, uint32_t height) {
+	w->width     = width;
+	w->height    = height;
+	w->rows_left = height;
+	w->row_bytes = paxc_png_row_bytes(width, w->bit_depth, w->color_type);
+
+	// (Re-)allocate row buffers.
+	if (w->row_bytes > w->row_cap) {
+		paxc_free(w->prev_row);
+		paxc_free(w->filt);
+		w->prev_row = paxc_malloc(w->row_bytes);
+		w->filt     = paxc_malloc(paxc_png_filter_scratch(&w->opts, w->row_bytes));
+		w->row_cap  = w->row_bytes;
+		if (!w->prev_row || !w->filt) {
+			w->row_cap = 0;
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			return false;
+		}
+	}
+	memset(w->prev_row, 0, w->row_bytes);
+
+	if (!idat_alloc(w)) return false;
+
+	// Set up deflate.
+	int zerr;
+	if (w->zs_init) {
+		zerr = deflateReset(&w->zs);
+	} else {
+		PAXC_STATS_ZSTREAM(&w->zs);
+		zerr = deflateInit2(&w->zs, w->opts.level, Z_DEFLATED, w->opts.window_bits, w->opts.mem_level, paxc_png_zstrategy(w->opts.strategy));
+		w->zs_init = zerr == Z_OK;
+	}
+	if (zerr != Z_OK) {
+		PAXC_ERROR(zerr == Z_MEM_ERROR ? PAX_ERR_NOMEM : PAX_ERR_ENCODE, "Deflate init error %d", zerr);
+		return false;
+	}
+	return true;
+}
+
+// Filters and compresses one row of raw pixel data.
+bool paxc_png_image_row(paxc_png_writer_t *w, const uint8_t *row) {
+	if (!w->rows_left) {
+		PAXC_ERROR(PAX_ERR_ENCODE, "Too many rows");
+		return false;
+	}
+
+	size_t n = w->row_bytes;
+	if (w->opts.filter_mode == PAX_PNG_FILTER_NONE) {
+		// No filtering; no need to copy the row first.
+		uint8_t none = PAX_PNG_ROW_FILTER_NONE;
+		if (!idat_deflate(w, &none, 1, Z_NO_FLUSH) || !idat_deflate(w, row, n, Z_NO_FLUSH)) return false;
+	} else {
+		PAXC_STATS_BEGIN(filter);
+		const uint8_t *out = paxc_png_filter_apply(&w->opts, w->filt, row, w->prev_row, n, w->filter_bpp);
+		PAXC_STATS_END(filter, filter_ns);
+		if (!idat_deflate(w, out, n + 1, Z_NO_FLUSH)) return false;
+	}
+	memcpy(w->prev_row, row, n);
+	w->rows_left--;
+	return true;
+}
+
+// Finishes the image data and flushes the remaining IDAT chunks.
+bool paxc_png_image_end(paxc_png_writer_t *w) {
+	if (w->rows_left) {
+		PAXC_ERROR(PAX_ERR_ENCODE, "Missing %" PRIu32 " rows", w->rows_left);
+		return false;
+	}
+	return idat_deflate(w, NULL, 0, Z_FINISH) && paxc_png_flush_idat(w);
+}
+
+// Writes the IEND chunk.
+bool paxc_png_write_iend(paxc_png_writer_t *w) {
+	return paxc_png_write_chunk(w, "IEND", NULL, 0);
+}
@@ -0,0 +1,444 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "pax_qoi";
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+#define QOI_MASK_2   0xc0
+
+#define QOI_HEADER_SIZE 14
+// Pixels above this are refused, as in the reference implementation.
+#define QOI_PIXELS_MAX  400000000
+
+static const uint8_t qoi_padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+// Index of a pixel in the table of recently seen colors.
+#define QOI_HASH(p) (((p)[0] * 3 + (p)[1] * 5 + (p)[2] * 7 + (p)[3] * 11) % 64)
+
+// Buffered input, from memory or a file.
+typedef struct {
+	const uint8_t *ptr;
+	const uint8_t *end;
+	FILE          *fd;
+	uint8_t        buf[1024];
+} qoi_reader_t;
+
+static bool qoi_info(pax_qoi_info_t *info, qoi_reader_t *rd);
+static bool qoi_decode(pax_buf_t *framebuffer, qoi_reader_t *rd, pax_buf_type_t buf_type, int flags, int x_offset, int y_offset);
+static bool qoi_encode(const pax_buf_t *framebuffer, paxc_sink_t sink, void *cookie, int x, int y, int width, int height);
+
+// Makes at least `n` bytes available, unless the input ends first.
+// Returns the number of bytes available.
+static inline size_t reader_fill(qoi_reader_t *rd, size_t n) {
+	size_t avail = rd->end - rd->ptr;
+	if (avail >= n || !rd->fd) return avail;
+	memmove(rd->buf, rd->ptr, avail);
+	avail   += fread(rd->buf + avail, 1, sizeof(rd->buf) - avail, rd->fd);
+	rd->ptr  = rd->buf;
+	rd->end  = rd->buf + avail;
+	return avail;
+}
+
+// Sets up a reader for a file.
+static void reader_fd(qoi_reader_t *rd, FILE *fd) {
+	rd->fd  = fd;
+	rd->ptr = rd->buf;
+	rd->end = rd->buf;
+}
+
+// Sets up a reader for memory.
+static void reader_buf(qoi_reader_t *rd, const void *buf, size_t buf_len) {
+	rd->fd  = NULL;
+	rd->ptr = buf;
+	rd->end = rd->ptr + buf_len;
+}
+
+
+
+// Reads the header of a QOI file.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_info_qoi_fd(pax_qoi_info_t *info, FILE *fd) {
+	qoi_reader_t rd;
+	reader_fd(&rd, fd);
+	return qoi_info(info, &rd);
+}
+
+// Reads the header of a QOI buffer.
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_info_qoi_buf(pax_qoi_info_t *info, const void *qoi, size_t qoi_len) {
+	qoi_reader_t rd;
+	reader_buf(&rd, qoi, qoi_len);
+	return qoi_info(info, &rd);
+}
+
+// Encodes a pax buffer into a QOI file.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_encode_qoi_fd(const pax_buf_t *buf, FILE *fd, int x, int y, int width, int height) {
+	return qoi_encode(buf, paxc_sink_file, fd, x, y, width, height);
+}
+
+// Encodes a pax buffer into a QOI buffer.
+// Returns 1 on successful encode, refer to pax_codec_last_error otherwise.
+bool pax_encode_qoi_buf(const pax_buf_t *buf, void **outbuf, size_t *len, int x, int y, int width, int height) {
+	paxc_membuf_t out = {0};
+	*outbuf = NULL;
+	*len    = 0;
+	if (!qoi_encode(buf, paxc_sink_mem, &out, x, y, width, height)) {
+		free(out.data);
+		return false;
+	}
+	*outbuf = out.data;
+	*len    = out.len;
+	return true;
+}
+
+// Decodes a QOI file into a buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_qoi_fd(pax_buf_t *framebuffer, FILE *fd, pax_buf_type_t buf_type, int flags) {
+	qoi_reader_t rd;
+	reader_fd(&rd, fd);
+	return qoi_decode(framebuffer, &rd, buf_type, flags, 0, 0);
+}
+
+// Decodes a QOI buffer into a PAX buffer with the specified type.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_qoi_buf(pax_buf_t *framebuffer, const void *qoi, size_t qoi_len, pax_buf_type_t buf_type, int flags) {
+	qoi_reader_t rd;
+	reader_buf(&rd, qoi, qoi_len);
+	return qoi_decode(framebuffer, &rd, buf_type, flags, 0, 0);
+}
+
+// Decodes a QOI file into an existing PAX buffer.
+// Takes an x/y pair for offset.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_insert_qoi_fd(pax_buf_t *framebuffer, FILE *fd, int x, int y, int flags) {
+	qoi_reader_t rd;
+	reader_fd(&rd, fd);
+	return qoi_decode(framebuffer, &rd, framebuffer->type, flags | CODEC_FLAG_EXISTING, x, y);
+}
+
+// Decodes a QOI buffer into an existing PAX buffer.
+// Takes an x/y pair for offset.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_insert_qoi_buf(pax_buf_t *framebuffer, const void *qoi, size_t qoi_len, int x, int y, int flags) {
+	qoi_reader_t rd;
+	reader_buf(&rd, qoi, qoi_len);
+	return qoi_decode(framebuffer, &rd, framebuffer->type, flags | CODEC_FLAG_EXISTING, x, y);
+}
+
+
+
+// Reads and checks the QOI header.
+static bool qoi_info(pax_qoi_info_t *info, qoi_reader_t *rd) {
+	if (reader_fill(rd, QOI_HEADER_SIZE) < QOI_HEADER_SIZE || memcmp(rd->ptr, "qoif", 4)) {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a QOI file");
+		return false;
+	}
+	info->width      = paxc_read_be32(rd->ptr + 4);
+	info->height     = paxc_read_be32(rd->ptr + 8);
+	info->channels   = rd->ptr[12];
+	info->colorspace = rd->ptr[13];
+	rd->ptr += QOI_HEADER_SIZE;
+
+	if (!info->width || !info->height || info->width > 0x7fffffff || info->height > QOI_PIXELS_MAX / info->width
+		|| info->channels < 3 || info->channels > 4 || info->colorspace > 1) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid QOI header");
+		return false;
+	}
+	return true;
+}
+
+// Whether a row of RGBA pixels is fully opaque.
+static bool row_opaque(const uint8_t *rgba, int width) {
+	for (int i = 0; i < width; i++) {
+		if (rgba[4*i+3] != 255) return false;
+	}
+	return true;
+}
+
+// A generic wrapper for decoding QOIs.
+// Sets up the framebuffer if required.
+static bool qoi_decode(pax_buf_t *framebuffer, qoi_reader_t *rd, pax_buf_type_t buf_type, int flags, int x_offset, int y_offset) {
+	bool do_alloc = !(flags & CODEC_FLAG_EXISTING);
+	if (do_alloc) {
+		framebuffer->width  = 0;
+		framebuffer->height = 0;
+	}
+
+	pax_qoi_info_t info;
+	if (!qoi_info(&info, rd)) return false;
+	int width  = info.width;
+	int height = info.height;
+
+	if (do_alloc) {
+		// QOI has no palettes, so pick a direct color type if a palette type was asked for.
+		if (PAX_IS_PALETTE(buf_type)) {
+			buf_type = paxc_pick_buf_type(buf_type, true, info.channels == 4);
+			PAX_LOGW(TAG, "Changing buffer type to %08x", (int)buf_type);
+		}
+		PAX_LOGD(TAG, "Decoding QOI %dx%d to %08x", width, height, buf_type);
+		if (!paxc_buf_init(framebuffer, NULL, width, height, buf_type)) return false;
+	}
+	// Only the part that lands on the buffer gets written.
+	int x0 = x_offset < 0 ? -x_offset : 0;
+	int y0 = y_offset < 0 ? -y_offset : 0;
+	int x1 = pax_buf_get_width(framebuffer)  - x_offset < width  ? pax_buf_get_width(framebuffer)  - x_offset : width;
+	int y1 = pax_buf_get_height(framebuffer) - y_offset < height ? pax_buf_get_height(framebuffer) - y_offset : height;
+	if (x0 >= x1 || y0 >= y1) return true;
+
+	uint8_t *row = malloc((size_t) width * 4);
+	if (!row) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		goto error;
+	}
+
+	// Rows are decoded to RGBA and then written to the buffer in one go.
+	paxc_row_store_t store = paxc_get_row_store(framebuffer);
+	uint8_t index[64][4] = {{0}};
+	uint8_t px[4]        = { 0, 0, 0, 255 };
+	int     run          = 0;
+	for (int y = 0; y < y1; y++) {
+		for (int x = 0; x < width; x++) {
+			if (run > 0) {
+				run--;
+			} else {
+				// The longest op is 5 bytes.
+				size_t avail = reader_fill(rd, 5);
+				if (!avail) goto truncated;
+				uint8_t op = rd->ptr[0];
+				size_t  op_len;
+				if (op == QOI_OP_RGB) {
+					op_len = 4;
+				} else if (op == QOI_OP_RGBA) {
+					op_len = 5;
+				} else if ((op & QOI_MASK_2) == QOI_OP_LUMA) {
+					op_len = 2;
+				} else {
+					op_len = 1;
+				}
+				if (avail < op_len) goto truncated;
+				const uint8_t *in = rd->ptr;
+				rd->ptr += op_len;
+
+				if (op == QOI_OP_RGB) {
+					px[0] = in[1];
+					px[1] = in[2];
+					px[2] = in[3];
+				} else if (op == QOI_OP_RGBA) {
+					px[0] = in[1];
+					px[1] = in[2];
+					px[2] = in[3];
+					px[3] = in[4];
+				} else if ((op & QOI_MASK_2) == QOI_OP_INDEX) {
+					memcpy(px, index[op], 4);
+				} else if ((op & QOI_MASK_2) == QOI_OP_DIFF) {
+					px[0] += ((op >> 4) & 3) - 2;
+					px[1] += ((op >> 2) & 3) - 2;
+					px[2] += ( op       & 3) - 2;
+				} else if ((op & QOI_MASK_2) == QOI_OP_LUMA) {
+					int vg = (op & 0x3f) - 32;
+					px[0] += vg - 8 + ((in[1] >> 4) & 0x0f);
+					px[1] += vg;
+					px[2] += vg - 8 + (in[1] & 0x0f);
+				} else {
+					run = op & 0x3f;
+				}
+				memcpy(index[QOI_HASH(px)], px, 4);
+			}
+			memcpy(row + 4*x, px, 4);
+		}
+
+		if (y < y0) continue;
+		if ((flags & CODEC_FLAG_EXISTING) && !row_opaque(row + 4*x0, x1 - x0)) {
+			// Translucent pixels get blended into the existing image.
+			bool palette = PAX_IS_PALETTE(framebuffer->type);
+			for (int x = x0; x < x1; x++) {
+				const uint8_t *p   = row + 4*x;
+				pax_col_t      col = ((pax_col_t) p[3] << 24) | (p[0] << 16) | (p[1] << 8) | p[2];
+				if (palette) {
+					// pax_merge_pixel takes an index on palette buffers, so blend with the color underneath here.
+					col = pax_col_merge(pax_get_pixel(framebuffer, x_offset + x, y_offset + y), col);
+					pax_set_pixel(framebuffer, paxc_closest_palette_index(framebuffer, col, true), x_offset + x, y_offset + y);
+				} else {
+					pax_merge_pixel(framebuffer, col, x_offset + x, y_offset + y);
+				}
+			}
+		} else {
+			store(framebuffer, x_offset + x0, y_offset + y, x1 - x0, row + 4*x0);
+		}
+	}
+	free(row);
+
+	pax_mark_dirty2(framebuffer, x_offset + x0, y_offset + y0, x1 - x0, y1 - y0);
+	return true;
+
+	truncated:
+	PAXC_ERROR(PAX_ERR_CORRUPT, "QOI data ends early");
+	error:
+	free(row);
+	if (do_alloc) {
+		// Clean up in case of erruer.
+		pax_buf_destroy(framebuffer);
+	}
+	return false;
+}
+
+// Whether pixels of this buffer type can be translucent.
+static bool type_has_alpha(pax_buf_type_t type) {
+	switch (type) {
+		case PAX_BUF_16_565RGB:
+		case PAX_BUF_8_332RGB:
+		case PAX_BUF_1_GREY:
+		case PAX_BUF_2_GREY:
+		case PAX_BUF_4_GREY:
+		case PAX_BUF_8_GREY:
+			return false;
+		default:
+			return true;
+	}
+}
+
+// A generic wrapper for encoding QOIs.
+static bool qoi_encode(const pax_buf_t *framebuffer, paxc_sink_t sink, void *cookie, int dx, int dy, int width, int height) {
+	// Clamp to the buffer.
+	if (dx < 0) {
+		width += dx;
+		dx     = 0;
+	}
+	if (dy < 0) {
+		height += dy;
+		dy      = 0;
+	}
+	if (dx + width > pax_buf_get_width(framebuffer)) {
+		width = pax_buf_get_width(framebuffer) - dx;
+	}
+	if (dy + height > pax_buf_get_height(framebuffer)) {
+		height = pax_buf_get_height(framebuffer) - dy;
+	}
+	if (width <= 0 || height <= 0) {
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Region is empty");
+		return false;
+	}
+
+	// Room for one row of worst-case output, so the output is flushed once per row at most.
+	size_t   out_cap = (size_t) width * 5 + QOI_HEADER_SIZE + sizeof(qoi_padding);
+	uint8_t *out     = malloc(out_cap);
+	uint8_t *rgba    = malloc((size_t) width * 4);
+	if (!out || !rgba) {
+		free(out);
+		free(rgba);
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return false;
+	}
+
+	// Header.
+	size_t len = 0;
+	memcpy(out, "qoif", 4);
+	paxc_write_be32(out + 4, width);
+	paxc_write_be32(out + 8, height);
+	out[12] = type_has_alpha(framebuffer->type) ? 4 : 3;
+	out[13] = 0; // sRGB with linear alpha.
+	len     = QOI_HEADER_SIZE;
+
+	paxc_row_fetch_t fetch       = paxc_get_row_fetch(framebuffer);
+	uint8_t          index[64][4] = {{0}};
+	uint8_t          prev[4]      = { 0, 0, 0, 255 };
+	int              run          = 0;
+	bool             ok           = true;
+	for (int y = 0; ok && y < height; y++) {
+		fetch(framebuffer, dx, dy + y, width, rgba);
+		bool last_row = y == height - 1;
+
+		for (int x = 0; x < width; x++) {
+			const uint8_t *px = rgba + 4*x;
+			if (!memcmp(px, prev, 4)) {
+				run++;
+				if (run == 62 || (last_row && x == width - 1)) {
+					out[len++] = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+				continue;
+			}
+			if (run > 0) {
+				out[len++] = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+
+			int hash = QOI_HASH(px);
+			if (!memcmp(index[hash], px, 4)) {
+				out[len++] = QOI_OP_INDEX | hash;
+			} else {
+				memcpy(index[hash], px, 4);
+				if (px[3] == prev[3]) {
+					int8_t vr   = px[0] - prev[0];
+					int8_t vg   = px[1] - prev[1];
+					int8_t vb   = px[2] - prev[2];
+					int8_t vg_r = vr - vg;
+					int8_t vg_b = vb - vg;
+					if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+						out[len++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+					} else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+						out[len++] = QOI_OP_LUMA | (vg + 32);
+						out[len++] = (vg_r + 8) << 4 | (vg_b + 8);
+					} else {
+						out[len++] = QOI_OP_RGB;
+						out[len++] = px[0];
+						out[len++] = px[1];
+						out[len++] = px[2];
+					}
+				} else {
+					out[len++] = QOI_OP_RGBA;
+					memcpy(out + len, px, 4);
+					len += 4;
+				}
+			}
+			memcpy(prev, px, 4);
+		}
+
+		if (last_row) {
+			memcpy(out + len, qoi_padding, sizeof(qoi_padding));
+			len += sizeof(qoi_padding);
+		}
+		if (!sink(cookie, out, len)) {
+			PAXC_ERROR(PAX_ERR_ENCODE, "Output sink failed");
+			ok = false;
+		}
+		len = 0;
+	}
+
+	free(out);
+	free(rgba);
+	return ok;
+}
@@ -0,0 +1,421 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+
+#include "pax_codecs_internal.h"
+#include "pax_internal.h"
+#include <inttypes.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if PAXC_HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char *TAG = "pax_tiles";
+
+// Tile store layout: a little-endian header, the palette as native pax_col_t values, then the
+// tiles in row-major order. Each tile is a buffer of tile width by tile height in pax's own memory
+// layout, padded to TILES_DATA_ALIGN bytes; tiles at the right and bottom edges are padded with zeroes.
+//   0  char[4]  magic "PAXT"
+//   4  uint16   version
+//   6  uint16   header size
+//   8  uint32   pax_buf_type_t
+//   12 uint32   width
+//   16 uint32   height
+//   20 uint32   tile width; a multiple of 8
+//   24 uint32   tile height; a multiple of 8
+//   28 uint32   flags, TILES_FLAG_*
+//   32 uint32   palette entries
+//   36 uint32   palette offset
+//   40 uint64   tile data offset
+//   48 uint64   bytes per tile
+#define TILES_VERSION      1
+#define TILES_HEADER_SIZE  64
+#define TILES_MIN_HEADER   56
+// Alignment of the palette, the tile data and every tile; enough for SIMD loads and cache lines.
+#define TILES_DATA_ALIGN   64
+// Tile size when the decoder is given 0, and the largest one it accepts.
+#define TILES_DEFAULT_SIZE 256
+#define TILES_MAX_SIZE     4096
+
+// The buffers have reverse_endianness set.
+#define TILES_FLAG_REVERSED   0x0001
+// Pixel words and palette entries were written on a big-endian machine.
+#define TILES_FLAG_BIG_ENDIAN 0x0002
+// Every tile has been written; set last, so an interrupted decode doesn't leave a usable store.
+#define TILES_FLAG_COMPLETE   0x0004
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_ORDER_FLAG TILES_FLAG_BIG_ENDIAN
+#else
+#define HOST_ORDER_FLAG 0
+#endif
+
+struct pax_tile_store {
+	// The store file, which stays open until the store is closed.
+	FILE                 *fd;
+	// Mapping of the whole file, NULL when tiles are read instead.
+	uint8_t              *map;
+	size_t                map_len;
+	// Image and tile size.
+	pax_tile_store_info_t info;
+	uint32_t              flags;
+	uint64_t              data_offset;
+	uint64_t              tile_bytes;
+	// Palette, in the mapping or owned by the store.
+	pax_col_t            *palette;
+	size_t                palette_size;
+	uint32_t              palette_offset;
+	bool                  own_palette;
+	// The tile last read, when the file isn't mapped.
+	uint8_t              *tile;
+};
+
+
+
+static inline uint16_t read_le16(const uint8_t *in) {
+	return in[0] | (in[1] << 8);
+}
+
+static inline uint32_t read_le32(const uint8_t *in) {
+	return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+static inline uint64_t read_le64(const uint8_t *in) {
+	return read_le32(in) | ((uint64_t) read_le32(in + 4) << 32);
+}
+
+static inline void write_le32(uint8_t *out, uint32_t value) {
+	out[0] = value;
+	out[1] = value >> 8;
+	out[2] = value >> 16;
+	out[3] = value >> 24;
+}
+
+static inline void write_le64(uint8_t *out, uint64_t value) {
+	write_le32(out, value);
+	write_le32(out + 4, value >> 32);
+}
+
+// Size of one tile in the file.
+static inline uint64_t tile_size_bytes(pax_buf_type_t type, uint32_t tile_width, uint32_t tile_height) {
+	uint64_t size = PAX_BUF_CALC_SIZE((uint64_t) tile_width, tile_height, type);
+	return (size + TILES_DATA_ALIGN - 1) & ~(uint64_t) (TILES_DATA_ALIGN - 1);
+}
+
+// Writes the header for the tiles of `rows` and everything up to the first tile.
+static bool write_header(FILE *fd, const paxc_png_rows_t *rows, const pax_buf_t *tile, uint32_t palette_size, uint32_t flags) {
+	uint8_t  header[TILES_HEADER_SIZE] = {0};
+	uint64_t data_offset = (TILES_HEADER_SIZE + palette_size * sizeof(pax_col_t) + TILES_DATA_ALIGN - 1) & ~(uint64_t) (TILES_DATA_ALIGN - 1);
+	memcpy(header, "PAXT", 4);
+	header[4] = TILES_VERSION;
+	header[6] = TILES_HEADER_SIZE;
+	write_le32(header + 8,  tile->type);
+	write_le32(header + 12, rows->width);
+	write_le32(header + 16, rows->height);
+	write_le32(header + 20, tile->width);
+	write_le32(header + 24, tile->height);
+	write_le32(header + 28, (tile->reverse_endianness ? TILES_FLAG_REVERSED : 0) | HOST_ORDER_FLAG | flags);
+	write_le32(header + 32, palette_size);
+	write_le32(header + 36, TILES_HEADER_SIZE);
+	write_le64(header + 40, data_offset);
+	write_le64(header + 48, tile_size_bytes(tile->type, tile->width, tile->height));
+	if (fwrite(header, 1, sizeof(header), fd) != sizeof(header)) return false;
+	
+	// The palette, then padding up to the tile data.
+	if (palette_size && fwrite(rows->argb_pal, sizeof(pax_col_t), palette_size, fd) != palette_size) return false;
+	uint8_t pad[TILES_DATA_ALIGN] = {0};
+	size_t  pad_len = data_offset - TILES_HEADER_SIZE - palette_size * sizeof(pax_col_t);
+	return fwrite(pad, 1, pad_len, fd) == pad_len;
+}
+
+// Decodes a PNG file row by row into a tile store file, keeping only one band of tiles in memory.
+// Returns 1 on successful decode, refer to pax_codec_last_error otherwise.
+bool pax_decode_png_tiles_fd(FILE *png, FILE *store, pax_buf_type_t buf_type, uint32_t tile_size) {
+	if (!tile_size) tile_size = TILES_DEFAULT_SIZE;
+	if (tile_size % 8 || tile_size > TILES_MAX_SIZE) {
+		PAXC_ERROR(PAX_ERR_PARAM, "Tile size must be a multiple of 8 up to %d", TILES_MAX_SIZE);
+		return false;
+	}
+	PAXC_STATS_CALL_BEGIN();
+	paxc_png_rows_t rows;
+	pax_buf_t      *tiles = NULL;
+	uint8_t        *band  = NULL;
+	bool            ok    = false;
+	if (!paxc_png_rows_begin_fd(&rows, png)) goto cleanup;
+	if (rows.interlaced) {
+		// Adam7 revisits every band in each pass, so the whole image would have to be held.
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Interlaced PNGs can't be decoded into tiles");
+		goto cleanup;
+	}
+	
+	// Select a good buffer type, like pax_decode_png_fd does.
+	bool has_palette = rows.color_type == 3;
+	if (PAX_IS_PALETTE(buf_type) && !has_palette) {
+		buf_type = paxc_pick_buf_type(buf_type, rows.color_type & 2, rows.color_type & 4);
+		PAX_LOGW(TAG, "Changing buffer type to %08x", (int) buf_type);
+	}
+	
+	// A band is one row of tiles, laid out in memory just like in the file.
+	uint32_t tiles_x    = (rows.width  + tile_size - 1) / tile_size;
+	uint64_t tile_bytes = tile_size_bytes(buf_type, tile_size, tile_size);
+	if (tile_bytes * tiles_x > SIZE_MAX) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Band of %" PRIu32 " tiles is too big", tiles_x);
+		goto cleanup;
+	}
+	size_t band_len = tile_bytes * tiles_x;
+	band  = paxc_calloc(1, band_len);
+	tiles = paxc_malloc(sizeof(pax_buf_t) * tiles_x);
+	if (!band || !tiles) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		goto cleanup;
+	}
+	for (uint32_t tx = 0; tx < tiles_x; tx++) {
+		if (!paxc_buf_init(&tiles[tx], band + tx * tile_bytes, tile_size, tile_size, buf_type)) goto cleanup;
+	}
+	PAX_LOGD(TAG, "Decoding PNG %" PRIu32 "x%" PRIu32 " to tiles of %" PRIu32 " pixels of %08x", rows.width, rows.height, tile_size, buf_type);
+	
+	// The header is written again once all tiles are there.
+	uint32_t palette_size = has_palette && PAX_IS_PALETTE(buf_type) ? rows.fmt.palette_size : 0;
+	if (fseek(store, 0, SEEK_SET) || !write_header(store, &rows, &tiles[0], palette_size, 0)) {
+		PAXC_ERROR(PAX_ERR_ENCODE, "Output sink failed");
+		goto cleanup;
+	}
+	
+	// Rows go into the tiles of the current band, which is written out once its last row is in.
+	int      mode    = paxc_png_put_mode(&tiles[0], rows.color_type, false);
+	uint32_t band_y  = 0;
+	int      res;
+	while ((res = paxc_png_rows_next(&rows)) > 0) {
+		for (uint32_t tx = 0; tx < tiles_x; tx++) {
+			// Tiles are a multiple of 8 pixels wide, so every tile starts on a whole byte of the row.
+			uint32_t x0    = tx * tile_size;
+			uint32_t width = rows.width - x0 < tile_size ? rows.width - x0 : tile_size;
+			paxc_png_put_row(&tiles[tx], &rows.fmt, rows.row + (size_t) x0 * rows.fmt.bits_per_pixel / 8, 0, 1, width, 0, rows.y - band_y, mode);
+		}
+		if (rows.y + 1 == band_y + tile_size || rows.done) {
+			PAXC_STATS_BEGIN(flush);
+			bool written = fwrite(band, 1, band_len, store) == band_len;
+			PAXC_STATS_END(flush, write_ns);
+			if (!written) {
+				PAXC_ERROR(PAX_ERR_ENCODE, "Output sink failed");
+				goto cleanup;
+			}
+			memset(band, 0, band_len);
+			band_y += tile_size;
+		}
+		if (rows.done) break;
+	}
+	if (res < 0) goto cleanup;
+	if (band_y < rows.height) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Image data ends early");
+		goto cleanup;
+	}
+	
+	// Mark the store as complete.
+	if (fseek(store, 0, SEEK_SET) || !write_header(store, &rows, &tiles[0], palette_size, TILES_FLAG_COMPLETE) || fflush(store)) {
+		PAXC_ERROR(PAX_ERR_ENCODE, "Output sink failed");
+		goto cleanup;
+	}
+	PAXC_STATS_ADD(bytes_out, tile_bytes * tiles_x * (band_y / tile_size));
+	ok = true;
+	
+	cleanup:
+	paxc_png_rows_end(&rows);
+	paxc_free(tiles);
+	paxc_free(band);
+	PAXC_STATS_CALL_END();
+	return ok;
+}
+
+// Parses and checks `header_len` bytes of header against a tile store file `len` bytes long.
+static bool parse_header(pax_tile_store_t *store, const uint8_t *data, size_t header_len, uint64_t len) {
+	if (header_len < TILES_MIN_HEADER || memcmp(data, "PAXT", 4)) {
+		PAXC_ERROR(PAX_ERR_DECODE, "Not a tile store");
+		return false;
+	}
+	uint16_t version     = read_le16(data + 4);
+	uint16_t header_size = read_le16(data + 6);
+	if (version != TILES_VERSION) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Unsupported version %d", version);
+		return false;
+	}
+	pax_tile_store_info_t *info = &store->info;
+	info->type            = read_le32(data + 8);
+	info->width           = read_le32(data + 12);
+	info->height          = read_le32(data + 16);
+	info->tile_width      = read_le32(data + 20);
+	info->tile_height     = read_le32(data + 24);
+	store->flags          = read_le32(data + 28);
+	store->palette_size   = read_le32(data + 32);
+	store->palette_offset = read_le32(data + 36);
+	store->data_offset    = read_le64(data + 40);
+	store->tile_bytes     = read_le64(data + 48);
+	uint32_t palette_off  = store->palette_offset;
+	
+	int bpp = PAX_GET_BPP(info->type);
+	if (header_size < TILES_MIN_HEADER || !info->width || !info->height || info->width > 0x7fffffff || info->height > 0x7fffffff
+		|| !info->tile_width || !info->tile_height || info->tile_width % 8 || info->tile_height % 8
+		|| info->tile_width > TILES_MAX_SIZE || info->tile_height > TILES_MAX_SIZE || !bpp || bpp > 32
+		|| store->tile_bytes != tile_size_bytes(info->type, info->tile_width, info->tile_height)
+		|| store->data_offset < header_size || store->data_offset % TILES_DATA_ALIGN
+		|| store->palette_size > 256 || (store->palette_size && (palette_off < header_size || palette_off % sizeof(pax_col_t)
+		|| palette_off + store->palette_size * sizeof(pax_col_t) > store->data_offset))) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Invalid tile store header");
+		return false;
+	}
+	info->tiles_x = (info->width  + info->tile_width  - 1) / info->tile_width;
+	info->tiles_y = (info->height + info->tile_height - 1) / info->tile_height;
+	if (store->data_offset > len || (uint64_t) info->tiles_x * info->tiles_y > (len - store->data_offset) / store->tile_bytes) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Tile store is truncated");
+		return false;
+	}
+	if (!(store->flags & TILES_FLAG_COMPLETE)) {
+		PAXC_ERROR(PAX_ERR_CORRUPT, "Tile store was not finished");
+		return false;
+	}
+	// The palette is stored as native pax_col_t values, so it's as byte order dependent as wide pixels.
+	if ((store->flags & TILES_FLAG_BIG_ENDIAN) != HOST_ORDER_FLAG && (bpp >= 16 || store->palette_size)) {
+		PAXC_ERROR(PAX_ERR_UNSUPPORTED, "Tile store was written with a different byte order");
+		return false;
+	}
+	return true;
+}
+
+// Opens a tile store file for fetching tiles; the file must stay open until the store is closed.
+// Returns NULL on error, refer to pax_codec_last_error.
+pax_tile_store_t *pax_tile_store_open(FILE *fd) {
+	pax_tile_store_t *store = calloc(1, sizeof(pax_tile_store_t));
+	if (!store) {
+		PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+		return NULL;
+	}
+	store->fd = fd;
+	
+	// Find the length of the file.
+	uint8_t header[TILES_HEADER_SIZE];
+	long    len;
+	if (fseek(fd, 0, SEEK_END) || (len = ftell(fd)) < 0 || fseek(fd, 0, SEEK_SET)) {
+		PAXC_ERROR(PAX_ERR_DECODE, "Tile store is not seekable");
+		goto error;
+	}
+	size_t header_len = fread(header, 1, sizeof(header), fd);
+	if (!parse_header(store, header, header_len, len)) goto error;
+	
+#if PAXC_HAVE_MMAP
+	// A private writable mapping: drawing into a tile never touches the file.
+	// Only the pages of tiles that get fetched are ever read.
+	if ((unsigned long) len <= SIZE_MAX) {
+		void *mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fd), 0);
+		if (mem != MAP_FAILED) {
+			store->map     = mem;
+			store->map_len = len;
+			store->palette = (pax_col_t *) (store->map + store->palette_offset);
+		}
+	}
+#endif
+	
+	if (!store->map) {
+		// No mmap available: read the palette now and each tile when it is fetched.
+		store->tile = malloc(store->tile_bytes);
+		if (!store->tile) {
+			PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+			goto error;
+		}
+		if (store->palette_size) {
+			store->palette     = malloc(store->palette_size * sizeof(pax_col_t));
+			store->own_palette = true;
+			if (!store->palette) {
+				PAXC_ERROR(PAX_ERR_NOMEM, "Out of memory");
+				goto error;
+			}
+			if (fseek(fd, store->palette_offset, SEEK_SET) || fread(store->palette, sizeof(pax_col_t), store->palette_size, fd) != store->palette_size) {
+				PAXC_ERROR(PAX_ERR_CORRUPT, "Tile store is truncated");
+				goto error;
+			}
+		}
+	}
+	PAX_LOGD(TAG, "Opened %" PRIu32 "x%" PRIu32 " tile store, %s", store->info.width, store->info.height, store->map ? "mapped" : "read");
+	return store;
+	
+	error:
+	pax_tile_store_close(store);
+	return NULL;
+}
+
+// Closes a tile store; buffers from pax_tile_store_get must not be used afterwards.
+void pax_tile_store_close(pax_tile_store_t *store) {
+	if (!store) return;
+#if PAXC_HAVE_MMAP
+	if (store->map) munmap(store->map, store->map_len);
+#endif
+	if (store->own_palette) free(store->palette);
+	free(store->tile);
+	free(store);
+}
+
+// Gets the size of the image and its tiles.
+void pax_tile_store_info(const pax_tile_store_t *store, pax_tile_store_info_t *info) {
+	*info = store->info;
+}
+
+// Points `tile` at tile (`tx`, `ty`), which covers the image from (`tx` * tile width, `ty` * tile height).
+// Returns 1 on success, refer to pax_codec_last_error otherwise.
+bool pax_tile_store_get(pax_tile_store_t *store, pax_buf_t *tile, uint32_t tx, uint32_t ty) {
+	const pax_tile_store_info_t *info = &store->info;
+	if (tx >= info->tiles_x || ty >= info->tiles_y) {
+		PAXC_ERROR(PAX_ERR_BOUNDS, "Tile (%" PRIu32 ", %" PRIu32 ") is not inside the store", tx, ty);
+		return false;
+	}
+	uint64_t offset = store->data_offset + ((uint64_t) ty * info->tiles_x + tx) * store->tile_bytes;
+	uint8_t *pixels;
+	if (store->map) {
+		pixels = store->map + offset;
+	} else {
+		// Read the tile into the store's own memory, replacing the last one.
+		if (offset > LONG_MAX || fseek(store->fd, offset, SEEK_SET)) {
+			PAXC_ERROR(PAX_ERR_BOUNDS, "Tile is out of reach of fseek");
+			return false;
+		}
+		if (fread(store->tile, 1, store->tile_bytes, store->fd) != store->tile_bytes) {
+			PAXC_ERROR(PAX_ERR_CORRUPT, "Tile store is truncated");
+			return false;
+		}
+		pixels = store->tile;
+	}
+	
+	// The memory is already there, so this can't fail.
+	paxc_buf_init(tile, pixels, info->tile_width, info->tile_height, info->type);
+	tile->reverse_endianness = store->flags & TILES_FLAG_REVERSED;
+	if (store->palette_size) {
+		tile->palette      = store->palette;
+		tile->palette_size = store->palette_size;
+		tile->do_free_pal  = false;
+	}
+	return true;
+}
@@ -28,3 +28,55 @@ target_link_libraries(pax_codecs pax_graphics)
 
 # Link to ZLIB
 target_link_libraries(${TARGET} z)
+
+# Link to pthreads for the multithreaded encoder
+find_package(Threads)
+if(Threads_FOUND)
+	target_link_libraries(pax_codecs Threads::Threads)
+else()
+	target_compile_definitions(pax_codecs PUBLIC PAX_CODECS_THREADS=0)
+endif()
+
+# Per-stage timing and counters for pax_codec_set_stats
+option(PAX_CODECS_STATS "Collect codec statistics" OFF)
+if(PAX_CODECS_STATS)
+	target_compile_definitions(pax_codecs PUBLIC PAX_CODECS_STATS=1)
+endif()
+
+# Host-side tools
+option(PAX_CODECS_BUILD_TOOLS "Build the host-side asset tools" OFF)
+if(PAX_CODECS_BUILD_TOOLS)
+	add_executable(pax_bake ${CMAKE_CURRENT_LIST_DIR}/tools/pax_bake.c)
+	target_link_libraries(pax_bake pax_codecs pax_graphics z)
+
+	# Doesn't use the library, only zlib.
+	add_executable(pax_corpus
+		${CMAKE_CURRENT_LIST_DIR}/tools/pax_corpus.c
+		${CMAKE_CURRENT_LIST_DIR}/tools/png_synth.c
+	)
+	target_include_directories(pax_corpus PRIVATE ${CMAKE_CURRENT_LIST_DIR}/zlib)
+	target_link_libraries(pax_corpus z m)
+endif()
+
+# Benchmark over the PNG format matrix
+option(PAX_CODECS_BUILD_BENCH "Build the codec benchmark" OFF)
+if(PAX_CODECS_BUILD_BENCH)
+	add_executable(pax_bench
+		${CMAKE_CURRENT_LIST_DIR}/tools/pax_bench.c
+		${CMAKE_CURRENT_LIST_DIR}/tools/png_synth.c
+	)
+	target_link_libraries(pax_bench pax_codecs pax_graphics z m)
+endif()
+
+# Codec tests, run with ctest
+option(PAX_CODECS_BUILD_TESTS "Build the codec tests" OFF)
+if(PAX_CODECS_BUILD_TESTS)
+	enable_testing()
+	add_executable(qoi_test ${CMAKE_CURRENT_LIST_DIR}/codec-test-images/qoi_test.c)
+	target_link_libraries(qoi_test pax_codecs pax_graphics z)
+	add_test(NAME qoi_test COMMAND qoi_test)
+
+	add_executable(jpeg_test ${CMAKE_CURRENT_LIST_DIR}/codec-test-images/jpeg_test.c)
+	target_link_libraries(jpeg_test pax_codecs pax_graphics z)
+	add_test(NAME jpeg_test COMMAND jpeg_test ${CMAKE_CURRENT_LIST_DIR}/codec-test-images)
+endif()
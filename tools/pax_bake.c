@@ -0,0 +1,376 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+// pax_bake: converts a tree of PNGs into native images ahead of time.
+// Every PNG is decoded with the same code and buffer type selection as pax_decode_png_fd would use
+// on the device, then stored in pax's in-memory layout, so loading it costs nothing at runtime.
+
+#include "pax_codecs.h"
+#include "tool_buf_types.h"
+#include "tool_files.h"
+#include "zlib.h"
+#include <dirent.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Archive layout constants; must match src/pax_native.c.
+#define ARCHIVE_VERSION     1
+#define ARCHIVE_HEADER_SIZE 16
+#define ARCHIVE_ENTRY_SIZE  32
+#define ARCHIVE_ALIGN       64
+
+// One baked asset.
+typedef struct {
+	// Path relative to the input directory, without the .png extension.
+	char          *name;
+	pax_buf_type_t type;
+	uint32_t       width, height;
+	// Size of the native image before compression.
+	size_t         raw_len;
+	// Stored data, compressed if requested.
+	void          *data;
+	size_t         len;
+} asset_t;
+
+// Settings from the command line.
+typedef struct {
+	pax_buf_type_t type;
+	bool           compress;
+	// Rows per band for banded images, 0 for plain native images.
+	int            band_rows;
+	bool           reverse_endianness;
+	const char    *archive;
+	const char    *manifest;
+	const char    *in_dir;
+	const char    *out_dir;
+} options_t;
+
+static asset_t *assets;
+static size_t   assets_len, assets_cap;
+
+
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"Usage: %s [options] <input dir> <output dir>\n"
+		"Converts every .png under <input dir> into a native pax image.\n"
+		"\n"
+		"  -t, --type <type>      Buffer type to decode to, e.g. 16_565RGB or PAX_BUF_16_565RGB (default 32_8888ARGB)\n"
+		"  -r, --reversed         Store 16-bit pixels byte-swapped, as for most SPI displays\n"
+		"  -z, --compress         Deflate each image; load with pax_decode_native_z_buf\n"
+		"  -b, --bands <rows>     Write banded images with this many rows per band; load with pax_decode_banded_buf\n"
+		"  -a, --archive <file>   Pack everything into one archive instead of separate files\n"
+		"  -m, --manifest <file>  Where to write the manifest (default <output dir>/manifest.tsv)\n"
+		"  -h, --help             Show this help\n",
+		argv0
+	);
+}
+
+// Decodes one PNG and stores the result in the asset list.
+static bool bake_file(const options_t *opts, const char *path, const char *name) {
+	FILE *fd = fopen(path, "rb");
+	if (!fd) {
+		perror(path);
+		return false;
+	}
+	pax_buf_t buf;
+	bool      ok = pax_decode_png_fd(&buf, fd, opts->type, 0);
+	fclose(fd);
+	if (!ok) {
+		fprintf(stderr, "%s: PNG decode failed: %s\n", path, pax_codec_last_error()->message);
+		return false;
+	}
+	if (PAX_GET_BPP(buf.type) == 16) {
+		// Pixels are stored as they'll be sent to the display.
+		buf.reverse_endianness = opts->reverse_endianness;
+		if (opts->reverse_endianness) {
+			uint16_t *px = buf.buf;
+			for (size_t i = 0; i < (size_t) buf.width * buf.height; i++) {
+				px[i] = (px[i] << 8) | (px[i] >> 8);
+			}
+		}
+	}
+
+	void  *raw;
+	size_t raw_len;
+	ok = pax_encode_native_buf(&buf, &raw, &raw_len);
+	asset_t asset = {
+		.name   = strdup(name),
+		.type   = buf.type,
+		.width  = buf.width,
+		.height = buf.height,
+	};
+	// Banded images are encoded from the same buffer, so it's kept around until then.
+	pax_buf_t banded = buf;
+	if (!opts->band_rows) pax_buf_destroy(&buf);
+	if (!ok) {
+		if (opts->band_rows) pax_buf_destroy(&banded);
+		fprintf(stderr, "%s: native encode failed: %s\n", path, pax_codec_last_error()->message);
+		return false;
+	}
+	asset.raw_len = raw_len;
+
+	if (opts->band_rows) {
+		free(raw);
+		if (!pax_encode_banded_buf(&banded, &asset.data, &asset.len, opts->band_rows, Z_BEST_COMPRESSION)) {
+			fprintf(stderr, "%s: banded encode failed: %s\n", path, pax_codec_last_error()->message);
+			pax_buf_destroy(&banded);
+			return false;
+		}
+		pax_buf_destroy(&banded);
+	} else if (opts->compress) {
+		uLongf zlen = compressBound(raw_len);
+		void  *zbuf = malloc(zlen);
+		if (!zbuf || compress2(zbuf, &zlen, raw, raw_len, Z_BEST_COMPRESSION) != Z_OK) {
+			fprintf(stderr, "%s: compression failed\n", path);
+			free(zbuf);
+			free(raw);
+			return false;
+		}
+		free(raw);
+		asset.data = zbuf;
+		asset.len  = zlen;
+	} else {
+		asset.data = raw;
+		asset.len  = raw_len;
+	}
+
+	if (assets_len == assets_cap) {
+		assets_cap = assets_cap ? assets_cap * 2 : 64;
+		assets     = realloc(assets, sizeof(asset_t) * assets_cap);
+	}
+	assets[assets_len++] = asset;
+	return true;
+}
+
+// Recursively bakes all PNGs under `dir`; `prefix` is the path relative to the input directory.
+static bool walk(const options_t *opts, const char *dir, const char *prefix) {
+	DIR *d = opendir(dir);
+	if (!d) {
+		perror(dir);
+		return false;
+	}
+	bool           ok = true;
+	struct dirent *ent;
+	while (ok && (ent = readdir(d))) {
+		if (ent->d_name[0] == '.') continue;
+		size_t plen  = strlen(dir) + strlen(ent->d_name) + 2;
+		size_t nlen  = strlen(prefix) + strlen(ent->d_name) + 2;
+		char  *path  = malloc(plen);
+		char  *name  = malloc(nlen);
+		snprintf(path, plen, "%s/%s", dir, ent->d_name);
+		snprintf(name, nlen, "%s%s%s", prefix, *prefix ? "/" : "", ent->d_name);
+
+		struct stat st;
+		if (stat(path, &st)) {
+			perror(path);
+			ok = false;
+		} else if (S_ISDIR(st.st_mode)) {
+			ok = walk(opts, path, name);
+		} else {
+			size_t len = strlen(name);
+			if (len > 4 && !strcasecmp(name + len - 4, ".png")) {
+				name[len - 4] = 0;
+				ok = bake_file(opts, path, name);
+			}
+		}
+		free(path);
+		free(name);
+	}
+	closedir(d);
+	return ok;
+}
+
+// File extension for the kind of image being written.
+static const char *extension(const options_t *opts) {
+	return opts->band_rows ? ".paxb" : opts->compress ? ".paxz" : ".pax";
+}
+
+static int asset_cmp(const void *a, const void *b) {
+	return strcmp(((const asset_t *) a)->name, ((const asset_t *) b)->name);
+}
+
+static void put_le32(uint8_t *out, uint32_t value) {
+	out[0] = value;
+	out[1] = value >> 8;
+	out[2] = value >> 16;
+	out[3] = value >> 24;
+}
+
+static void put_le64(uint8_t *out, uint64_t value) {
+	put_le32(out, value);
+	put_le32(out + 4, value >> 32);
+}
+
+// Packs all assets into one archive; see src/pax_native.c for the layout.
+static bool write_archive(const options_t *opts, const char *path) {
+	uint32_t flags = opts->band_rows ? PAX_NATIVE_ENTRY_BANDED : opts->compress ? PAX_NATIVE_ENTRY_COMPRESSED : 0;
+	size_t names_len = 0;
+	for (size_t i = 0; i < assets_len; i++) names_len += strlen(assets[i].name);
+
+	size_t pos = ARCHIVE_HEADER_SIZE + ARCHIVE_ENTRY_SIZE * assets_len + names_len;
+	size_t *offsets = malloc(sizeof(size_t) * (assets_len + 1));
+	for (size_t i = 0; i < assets_len; i++) {
+		pos        = (pos + ARCHIVE_ALIGN - 1) & ~(size_t) (ARCHIVE_ALIGN - 1);
+		offsets[i] = pos;
+		pos       += assets[i].len;
+	}
+
+	uint8_t *arc = calloc(1, pos);
+	memcpy(arc, "PAXA", 4);
+	put_le32(arc + 4, ARCHIVE_VERSION);
+	put_le32(arc + 8, assets_len);
+	size_t name_pos = ARCHIVE_HEADER_SIZE + ARCHIVE_ENTRY_SIZE * assets_len;
+	for (size_t i = 0; i < assets_len; i++) {
+		uint8_t *ent = arc + ARCHIVE_HEADER_SIZE + ARCHIVE_ENTRY_SIZE * i;
+		size_t   len = strlen(assets[i].name);
+		put_le32(ent + 0,  name_pos);
+		put_le32(ent + 4,  len);
+		put_le64(ent + 8,  offsets[i]);
+		put_le64(ent + 16, assets[i].len);
+		put_le32(ent + 24, flags);
+		memcpy(arc + name_pos, assets[i].name, len);
+		memcpy(arc + offsets[i], assets[i].data, assets[i].len);
+		name_pos += len;
+	}
+
+	bool ok = tool_write_file(path, arc, pos);
+	free(arc);
+	free(offsets);
+	return ok;
+}
+
+// Writes one tab separated line per asset.
+static bool write_manifest(const options_t *opts, const char *path) {
+	if (!tool_make_parents(path)) return false;
+	FILE *fd = fopen(path, "w");
+	if (!fd) {
+		perror(path);
+		return false;
+	}
+	fprintf(fd, "# name\tfile\ttype\twidth\theight\tbytes\tstored\n");
+	for (size_t i = 0; i < assets_len; i++) {
+		const asset_t *a = &assets[i];
+		fprintf(fd, "%s\t%s%s\t%s\t%" PRIu32 "\t%" PRIu32 "\t%zu\t%zu\n",
+			a->name, opts->archive ? "" : a->name, opts->archive ? "-" : extension(opts),
+			tool_buf_type_name(a->type), a->width, a->height, a->raw_len, a->len);
+	}
+	bool ok = !fclose(fd);
+	if (!ok) perror(path);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	options_t opts = {
+		.type = PAX_BUF_32_8888ARGB,
+	};
+	static const struct option long_opts[] = {
+		{ "type",     required_argument, NULL, 't' },
+		{ "reversed", no_argument,       NULL, 'r' },
+		{ "compress", no_argument,       NULL, 'z' },
+		{ "bands",    required_argument, NULL, 'b' },
+		{ "archive",  required_argument, NULL, 'a' },
+		{ "manifest", required_argument, NULL, 'm' },
+		{ "help",     no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "t:rzb:a:m:h", long_opts, NULL)) != -1) {
+		switch (c) {
+			case 't':
+				if (!tool_parse_buf_type(optarg, &opts.type)) {
+					fprintf(stderr, "Unknown buffer type: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'r': opts.reverse_endianness = true; break;
+			case 'z': opts.compress = true; break;
+			case 'b':
+				opts.band_rows = atoi(optarg);
+				if (opts.band_rows <= 0) {
+					fprintf(stderr, "Invalid band size: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'a': opts.archive  = optarg; break;
+			case 'm': opts.manifest = optarg; break;
+			case 'h': usage(argv[0]); return 0;
+			default:  usage(argv[0]); return 1;
+		}
+	}
+	if (opts.compress && opts.band_rows) {
+		fprintf(stderr, "Banded images are already compressed; -z and -b can't be combined\n");
+		return 1;
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	opts.in_dir  = argv[optind];
+	opts.out_dir = argv[optind + 1];
+
+	if (!walk(&opts, opts.in_dir, "")) return 1;
+	qsort(assets, assets_len, sizeof(asset_t), asset_cmp);
+
+	// Output the blobs.
+	bool ok = true;
+	if (opts.archive) {
+		ok = write_archive(&opts, opts.archive);
+	} else {
+		for (size_t i = 0; ok && i < assets_len; i++) {
+			size_t len  = strlen(opts.out_dir) + strlen(assets[i].name) + 7;
+			char  *path = malloc(len);
+			snprintf(path, len, "%s/%s%s", opts.out_dir, assets[i].name, extension(&opts));
+			ok = tool_write_file(path, assets[i].data, assets[i].len);
+			free(path);
+		}
+	}
+
+	// And the manifest.
+	if (ok) {
+		char  *manifest = NULL;
+		if (!opts.manifest) {
+			size_t len = strlen(opts.out_dir) + 14;
+			manifest   = malloc(len);
+			snprintf(manifest, len, "%s/manifest.tsv", opts.out_dir);
+		}
+		ok = write_manifest(&opts, opts.manifest ? opts.manifest : manifest);
+		free(manifest);
+	}
+
+	size_t raw = 0, stored = 0;
+	for (size_t i = 0; i < assets_len; i++) {
+		raw    += assets[i].raw_len;
+		stored += assets[i].len;
+		free(assets[i].name);
+		free(assets[i].data);
+	}
+	free(assets);
+	if (ok) printf("Baked %zu images, %zu bytes (%zu before compression)\n", assets_len, stored, raw);
+	return ok ? 0 : 1;
+}
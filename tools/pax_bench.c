@@ -0,0 +1,406 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+// pax_bench: measures PNG decode and encode throughput over the whole format matrix.
+// Inputs are synthesized, so results are reproducible without shipping test images.
+// Every decode case is a PNG color type, bit depth and interlace mode decoded into one buffer type;
+// every encode case is a buffer type encoded at one compression level.
+
+#include "pax_codecs.h"
+#include "png_synth.h"
+#include "tool_buf_types.h"
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Version of the JSON results layout.
+#define RESULTS_VERSION 1
+
+// Settings from the command line.
+typedef struct {
+	uint32_t    width, height;
+	int         iterations;
+	const char *filter;
+	const char *json;
+	bool        no_decode, no_encode;
+} options_t;
+
+// Measurements for one case.
+typedef struct {
+	char   name[64];
+	bool   ok;
+	// Error code of the failing call.
+	int    error;
+	// Per-call latency in milliseconds, sorted.
+	double min, p50, p90, p99, max;
+	// Megapixels per second at the median latency.
+	double mpix_s;
+	// Allocations and bytes allocated per call, -1 if they couldn't be counted.
+	double allocs, alloc_bytes;
+	// Size of the PNG read or written.
+	size_t png_bytes;
+} result_t;
+
+
+
+/* ==== Allocation counting ==== */
+
+#if defined(__GLIBC__)
+// glibc lets the executable replace malloc and friends; everything, zlib included, goes through these.
+#define COUNT_ALLOCS 1
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static size_t alloc_count, alloc_bytes;
+
+void *malloc(size_t size) {
+	__atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+	__atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&alloc_bytes, n * size, __ATOMIC_RELAXED);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	__atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&alloc_bytes, size, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+#else
+#define COUNT_ALLOCS 0
+static size_t alloc_count, alloc_bytes;
+#endif
+
+
+
+/* ==== Measurement ==== */
+
+static double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples.
+static double percentile(const double *sorted, int n, double p) {
+	int i = (int) (p * (n - 1) + 0.5);
+	return sorted[i];
+}
+
+// One benchmarked operation; returns false on failure.
+typedef bool (*bench_fn_t)(void *cookie);
+
+// Runs `fn` once to warm up, then `iterations` times while measuring.
+static void measure(result_t *res, const options_t *opts, bench_fn_t fn, void *cookie) {
+	double *times = malloc(sizeof(double) * opts->iterations);
+	res->ok       = fn(cookie);
+	if (!res->ok || !times) {
+		res->error = res->ok ? PAX_ERR_NOMEM : pax_codec_last_error()->code;
+		res->ok    = false;
+		free(times);
+		return;
+	}
+	size_t count0 = alloc_count, bytes0 = alloc_bytes;
+	for (int i = 0; i < opts->iterations && res->ok; i++) {
+		double t0 = now_ms();
+		res->ok   = fn(cookie);
+		times[i]  = now_ms() - t0;
+	}
+	// The times array itself isn't part of the measured calls.
+	size_t count = alloc_count - count0, bytes = alloc_bytes - bytes0;
+	if (res->ok) {
+		qsort(times, opts->iterations, sizeof(double), cmp_double);
+		res->min         = times[0];
+		res->p50         = percentile(times, opts->iterations, 0.50);
+		res->p90         = percentile(times, opts->iterations, 0.90);
+		res->p99         = percentile(times, opts->iterations, 0.99);
+		res->max         = times[opts->iterations - 1];
+		res->mpix_s      = (double) opts->width * opts->height / 1e3 / res->p50;
+		res->allocs      = COUNT_ALLOCS ? (double) count / opts->iterations : -1;
+		res->alloc_bytes = COUNT_ALLOCS ? (double) bytes / opts->iterations : -1;
+	}
+	if (!res->ok) res->error = pax_codec_last_error()->code;
+	free(times);
+}
+
+
+
+/* ==== Cases ==== */
+
+// Test image: smooth gradients with hard edges and some noise, roughly like UI art.
+static void bench_pixel(void *cookie, uint32_t x, uint32_t y, uint16_t rgba[4]) {
+	const options_t *opts = cookie;
+	uint32_t         hash = (x * 73856093u) ^ (y * 19349663u);
+	hash ^= hash >> 13;
+	hash *= 0x5bd1e995;
+	uint32_t noise = (hash >> 24) & 0x0f;
+	rgba[0] = x * 65535ull / opts->width;
+	rgba[1] = y * 65535ull / opts->height;
+	rgba[2] = ((x / 32 + y / 32) & 1) ? 0xc000 : 0x3000 + noise * 0x100;
+	rgba[3] = (x / 64 + y / 48) % 3 ? 0xffff : 0x8000 + rgba[0] / 2;
+}
+
+typedef struct {
+	const uint8_t *png;
+	size_t         len;
+	pax_buf_type_t type;
+} decode_case_t;
+
+static bool run_decode(void *cookie) {
+	decode_case_t *dc = cookie;
+	pax_buf_t      buf;
+	if (!pax_decode_png_buf(&buf, dc->png, dc->len, dc->type, 0)) return false;
+	pax_buf_destroy(&buf);
+	return true;
+}
+
+typedef struct {
+	const pax_buf_t      *buf;
+	pax_png_encode_opts_t opts;
+	size_t                len;
+} encode_case_t;
+
+static bool run_encode(void *cookie) {
+	encode_case_t *ec = cookie;
+	void          *out;
+	if (!pax_encode_png_buf_opts(ec->buf, &out, &ec->len, 0, 0, ec->buf->width, ec->buf->height, &ec->opts)) return false;
+	free(out);
+	return true;
+}
+
+static result_t *results;
+static size_t    results_len, results_cap;
+
+// Adds a case to the results if it passes the name filter.
+static result_t *new_result(const options_t *opts, const char *name) {
+	if (opts->filter && !strstr(name, opts->filter)) return NULL;
+	if (results_len == results_cap) {
+		results_cap = results_cap ? results_cap * 2 : 128;
+		results     = realloc(results, sizeof(result_t) * results_cap);
+	}
+	result_t *res = &results[results_len++];
+	memset(res, 0, sizeof(result_t));
+	snprintf(res->name, sizeof(res->name), "%s", name);
+	return res;
+}
+
+static void print_result(const result_t *res) {
+	if (!res->ok) {
+		printf("%-40s FAILED (%d)\n", res->name, res->error);
+	} else {
+		printf("%-40s %9.2f %9.3f %9.3f %9.3f %8.1f %10zu\n",
+			res->name, res->mpix_s, res->p50, res->p90, res->p99, res->allocs, res->png_bytes);
+	}
+	fflush(stdout);
+}
+
+static void bench_decode(const options_t *opts) {
+	static const uint8_t color_types[] = {0, 2, 3, 4, 6};
+	static const uint8_t depths[]      = {1, 2, 4, 8, 16};
+	for (size_t ct = 0; ct < sizeof(color_types); ct++) {
+		for (size_t d = 0; d < sizeof(depths); d++) {
+			if (!synth_valid_format(color_types[ct], depths[d])) continue;
+			for (int interlace = 0; interlace < 2; interlace++) {
+				synth_fmt_t fmt = {
+					.width      = opts->width,
+					.height     = opts->height,
+					.color_type = color_types[ct],
+					.bit_depth  = depths[d],
+					.interlace  = interlace,
+					.level      = 6,
+				};
+				uint8_t *png = NULL;
+				size_t   len = 0;
+				for (size_t t = 0; t < TOOL_BUF_TYPE_COUNT; t++) {
+					char name[64];
+					snprintf(name, sizeof(name), "decode/ct%d_d%d_%s/%s", color_types[ct], depths[d],
+						interlace ? "adam7" : "flat", tool_buf_types[t].name);
+					result_t *res = new_result(opts, name);
+					if (!res) continue;
+					// Only synthesized once a case of this format is actually run.
+					if (!png && !synth_png(&fmt, bench_pixel, (void *) opts, &png, &len, NULL)) {
+						fprintf(stderr, "Failed to synthesize %s\n", name);
+						exit(1);
+					}
+					decode_case_t dc = {png, len, tool_buf_types[t].type};
+					res->png_bytes   = len;
+					measure(res, opts, run_decode, &dc);
+					print_result(res);
+				}
+				free(png);
+			}
+		}
+	}
+}
+
+static void bench_encode(const options_t *opts) {
+	for (size_t t = 0; t < TOOL_BUF_TYPE_COUNT; t++) {
+		// Source image in this buffer type, drawn with the same pattern as the decode inputs.
+		pax_buf_t buf;
+		bool      have_buf = false;
+		for (int level = 0; level <= 9; level++) {
+			char name[64];
+			snprintf(name, sizeof(name), "encode/level%d/%s", level, tool_buf_types[t].name);
+			result_t *res = new_result(opts, name);
+			if (!res) continue;
+			if (!have_buf) {
+				pax_buf_init(&buf, NULL, opts->width, opts->height, tool_buf_types[t].type);
+				if (PAX_IS_PALETTE(buf.type)) {
+					// A grey ramp palette, filled to the buffer's capacity.
+					int size     = 1 << PAX_GET_BPP(buf.type);
+					if (size > 256) size = 256;
+					buf.palette  = malloc(sizeof(pax_col_t) * size);
+					for (int i = 0; i < size; i++) buf.palette[i] = 0xff000000 | (i * 255 / (size - 1)) * 0x010101;
+					buf.palette_size = size;
+					buf.do_free_pal  = true;
+				}
+				for (uint32_t y = 0; y < opts->height; y++) {
+					for (uint32_t x = 0; x < opts->width; x++) {
+						uint16_t rgba[4];
+						bench_pixel((void *) opts, x, y, rgba);
+						pax_col_t col = ((pax_col_t) (rgba[3] >> 8) << 24) | ((rgba[0] >> 8) << 16) | (rgba[1] & 0xff00) | (rgba[2] >> 8);
+						if (PAX_IS_PALETTE(buf.type)) col = (rgba[0] >> 8) * (buf.palette_size - 1) / 255;
+						pax_set_pixel(&buf, col, x, y);
+					}
+				}
+				have_buf = true;
+			}
+			encode_case_t ec = {.buf = &buf, .opts = pax_png_opts_default};
+			ec.opts.level    = level;
+			measure(res, opts, run_encode, &ec);
+			res->png_bytes = ec.len;
+			print_result(res);
+		}
+		if (have_buf) pax_buf_destroy(&buf);
+	}
+}
+
+// Writes all results as JSON, to be compared between releases.
+static bool write_json(const options_t *opts, const char *path) {
+	FILE *fd = fopen(path, "w");
+	if (!fd) {
+		perror(path);
+		return false;
+	}
+	fprintf(fd, "{\n\t\"version\": %d,\n\t\"width\": %u,\n\t\"height\": %u,\n\t\"iterations\": %d,\n\t\"results\": [",
+		RESULTS_VERSION, opts->width, opts->height, opts->iterations);
+	for (size_t i = 0; i < results_len; i++) {
+		const result_t *res = &results[i];
+		fprintf(fd, "%s\n\t\t{\"name\": \"%s\", \"ok\": %s", i ? "," : "", res->name, res->ok ? "true" : "false");
+		if (!res->ok) {
+			fprintf(fd, ", \"error\": %d", res->error);
+		} else {
+			fprintf(fd, ", \"mpix_s\": %.3f, \"min_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f"
+				", \"allocs\": %.1f, \"alloc_bytes\": %.0f, \"png_bytes\": %zu",
+				res->mpix_s, res->min, res->p50, res->p90, res->p99, res->max, res->allocs, res->alloc_bytes, res->png_bytes);
+		}
+		fputc('}', fd);
+	}
+	fprintf(fd, "\n\t]\n}\n");
+	bool ok = !fclose(fd);
+	if (!ok) perror(path);
+	return ok;
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"Benchmarks PNG decode and encode over every format and buffer type.\n"
+		"\n"
+		"  -s, --size <WxH>        Image size (default 512x512)\n"
+		"  -n, --iterations <n>    Measured calls per case (default 20)\n"
+		"  -f, --filter <text>     Only run cases whose name contains this\n"
+		"  -j, --json <file>       Write the results as JSON\n"
+		"  -D, --no-decode         Skip the decode cases\n"
+		"  -E, --no-encode         Skip the encode cases\n"
+		"  -h, --help              Show this help\n",
+		argv0
+	);
+}
+
+int main(int argc, char **argv) {
+	options_t opts = {
+		.width      = 512,
+		.height     = 512,
+		.iterations = 20,
+	};
+	static const struct option long_opts[] = {
+		{ "size",       required_argument, NULL, 's' },
+		{ "iterations", required_argument, NULL, 'n' },
+		{ "filter",     required_argument, NULL, 'f' },
+		{ "json",       required_argument, NULL, 'j' },
+		{ "no-decode",  no_argument,       NULL, 'D' },
+		{ "no-encode",  no_argument,       NULL, 'E' },
+		{ "help",       no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "s:n:f:j:DEh", long_opts, NULL)) != -1) {
+		switch (c) {
+			case 's':
+				if (sscanf(optarg, "%ux%u", &opts.width, &opts.height) != 2 || !opts.width || !opts.height) {
+					fprintf(stderr, "Invalid size: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'n':
+				opts.iterations = atoi(optarg);
+				if (opts.iterations < 1) {
+					fprintf(stderr, "Invalid iteration count: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'f': opts.filter    = optarg; break;
+			case 'j': opts.json      = optarg; break;
+			case 'D': opts.no_decode = true; break;
+			case 'E': opts.no_encode = true; break;
+			case 'h': usage(argv[0]); return 0;
+			default:  usage(argv[0]); return 1;
+		}
+	}
+
+	printf("%ux%u, %d iterations per case%s\n", opts.width, opts.height, opts.iterations,
+		COUNT_ALLOCS ? "" : ", allocations not counted on this platform");
+	printf("%-40s %9s %9s %9s %9s %8s %10s\n", "case", "MP/s", "p50 ms", "p90 ms", "p99 ms", "allocs", "png bytes");
+	if (!opts.no_decode) bench_decode(&opts);
+	if (!opts.no_encode) bench_encode(&opts);
+
+	bool ok = true;
+	for (size_t i = 0; i < results_len; i++) ok &= results[i].ok;
+	if (opts.json && !write_json(&opts, opts.json)) ok = false;
+	free(results);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+// pax_corpus: writes a deterministic corpus of synthetic PNGs for benchmarks and correctness tests.
+// The same seed always produces byte-identical files, so the corpus doesn't have to be checked in.
+
+#include "png_synth.h"
+#include "tool_files.h"
+#include "zlib.h"
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every format variant the corpus can contain.
+typedef struct {
+	uint8_t  color_type;
+	uint8_t  bit_depth;
+	bool     trns;
+	uint16_t palette_size;
+	// Also written at large sizes without --full.
+	bool     common;
+} variant_t;
+
+static const variant_t variants[] = {
+	{ 0, 1,  false, 0,   false },
+	{ 0, 2,  false, 0,   false },
+	{ 0, 4,  false, 0,   false },
+	{ 0, 8,  false, 0,   true  },
+	{ 0, 8,  true,  0,   false },
+	{ 0, 16, false, 0,   false },
+	{ 0, 16, true,  0,   false },
+	{ 2, 8,  false, 0,   true  },
+	{ 2, 8,  true,  0,   false },
+	{ 2, 16, false, 0,   false },
+	{ 2, 16, true,  0,   false },
+	{ 3, 1,  false, 0,   false },
+	{ 3, 2,  false, 0,   false },
+	{ 3, 2,  true,  0,   false },
+	{ 3, 4,  false, 0,   false },
+	{ 3, 4,  true,  0,   false },
+	{ 3, 8,  false, 0,   true  },
+	{ 3, 8,  true,  0,   false },
+	{ 3, 8,  false, 100, false },
+	{ 4, 8,  false, 0,   false },
+	{ 4, 16, false, 0,   false },
+	{ 6, 8,  false, 0,   true  },
+	{ 6, 16, false, 0,   false },
+};
+#define VARIANT_COUNT (sizeof(variants) / sizeof(*variants))
+
+// Default sizes, from icons to 8K.
+static const char *const default_sizes = "16x16,48x48,128x128,320x240,800x480,1920x1080,3840x2160,7680x4320";
+// Images with more pixels than this only get the common variants unless --full is given.
+#define FULL_MATRIX_PIXELS (800 * 480)
+
+// Settings from the command line.
+typedef struct {
+	const char *out_dir;
+	const char *sizes;
+	bool        content[SYNTH_CONTENT_COUNT];
+	bool        full;
+	bool        reference;
+	uint32_t    seed;
+	int         level;
+} options_t;
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"Usage: %s [options] <output dir>\n"
+		"Writes a deterministic corpus of synthetic PNGs covering every color type, bit depth,\n"
+		"interlace mode, tRNS and palette variant, plus a manifest.tsv describing each file.\n"
+		"\n"
+		"  -c, --content <list>   Comma-separated content classes: flat, gradient, noise, photo (default all)\n"
+		"  -s, --sizes <list>     Comma-separated WxH sizes (default %s)\n"
+		"  -f, --full             Every variant at every size; by default large sizes only get common formats\n"
+		"  -r, --reference        Also write <name>.rgba with the expected 8-bit RGBA decode\n"
+		"  -S, --seed <n>         Seed for the content (default 1)\n"
+		"  -l, --level <n>        zlib compression level (default 6)\n"
+		"  -h, --help             Show this help\n",
+		argv0, default_sizes
+	);
+}
+
+// Parses the comma-separated content class list.
+static bool parse_content(options_t *opts, const char *list) {
+	memset(opts->content, 0, sizeof(opts->content));
+	char *tmp = strdup(list);
+	bool  ok  = true;
+	for (char *tok = strtok(tmp, ","); tok && ok; tok = strtok(NULL, ",")) {
+		ok = false;
+		for (int i = 0; i < SYNTH_CONTENT_COUNT; i++) {
+			if (!strcmp(tok, synth_content_names[i])) {
+				opts->content[i] = true;
+				ok = true;
+			}
+		}
+		if (!ok) fprintf(stderr, "Unknown content class: %s\n", tok);
+	}
+	free(tmp);
+	return ok;
+}
+
+// Writes every variant of one content class at one size.
+static bool write_size(const options_t *opts, FILE *manifest, synth_content_t content, uint32_t width, uint32_t height) {
+	synth_content_opts_t copts = {
+		.content = content,
+		.width   = width,
+		.height  = height,
+		.seed    = opts->seed,
+	};
+	bool     full      = opts->full || (uint64_t) width * height <= FULL_MATRIX_PIXELS;
+	uint8_t *reference = NULL;
+	if (opts->reference) {
+		reference = malloc((size_t) width * height * 4);
+		if (!reference) {
+			fprintf(stderr, "Out of memory\n");
+			return false;
+		}
+	}
+
+	bool ok = true;
+	for (size_t v = 0; v < VARIANT_COUNT && ok; v++) {
+		if (!full && !variants[v].common) continue;
+		for (int interlace = 0; interlace < 2 && ok; interlace++) {
+			synth_fmt_t fmt = {
+				.width        = width,
+				.height       = height,
+				.color_type   = variants[v].color_type,
+				.bit_depth    = variants[v].bit_depth,
+				.interlace    = interlace,
+				.trns         = variants[v].trns,
+				.palette_size = variants[v].palette_size,
+				.level        = opts->level,
+			};
+			char name[128];
+			int  n = snprintf(name, sizeof(name), "%s/%ux%u/ct%d_d%d%s%s",
+				synth_content_names[content], width, height, fmt.color_type, fmt.bit_depth,
+				interlace ? "_adam7" : "", fmt.trns ? "_trns" : "");
+			if (fmt.palette_size) snprintf(name + n, sizeof(name) - n, "_p%d", fmt.palette_size);
+
+			uint8_t *png;
+			size_t   len;
+			if (!synth_png(&fmt, synth_content_pixel, &copts, &png, &len, reference)) {
+				fprintf(stderr, "%s: failed to synthesize\n", name);
+				ok = false;
+				break;
+			}
+			size_t path_len = strlen(opts->out_dir) + strlen(name) + 8;
+			char  *path     = malloc(path_len);
+			snprintf(path, path_len, "%s/%s.png", opts->out_dir, name);
+			ok = tool_write_file(path, png, len);
+			if (ok && reference) {
+				snprintf(path, path_len, "%s/%s.rgba", opts->out_dir, name);
+				ok = tool_write_file(path, reference, (size_t) width * height * 4);
+			}
+			free(path);
+
+			uint32_t crc = crc32(crc32(0, NULL, 0), png, len);
+			fprintf(manifest, "%s.png\t%s\t%u\t%u\t%d\t%d\t%d\t%d\t%d\t%zu\t%08x\n",
+				name, synth_content_names[content], width, height, fmt.color_type, fmt.bit_depth,
+				interlace, fmt.trns, fmt.palette_size, len, crc);
+			free(png);
+		}
+	}
+	free(reference);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	options_t opts = {
+		.sizes = default_sizes,
+		.seed  = 1,
+		.level = 6,
+	};
+	for (int i = 0; i < SYNTH_CONTENT_COUNT; i++) opts.content[i] = true;
+	static const struct option long_opts[] = {
+		{ "content",   required_argument, NULL, 'c' },
+		{ "sizes",     required_argument, NULL, 's' },
+		{ "full",      no_argument,       NULL, 'f' },
+		{ "reference", no_argument,       NULL, 'r' },
+		{ "seed",      required_argument, NULL, 'S' },
+		{ "level",     required_argument, NULL, 'l' },
+		{ "help",      no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int c;
+	while ((c = getopt_long(argc, argv, "c:s:frS:l:h", long_opts, NULL)) != -1) {
+		switch (c) {
+			case 'c':
+				if (!parse_content(&opts, optarg)) return 1;
+				break;
+			case 's': opts.sizes     = optarg; break;
+			case 'f': opts.full      = true; break;
+			case 'r': opts.reference = true; break;
+			case 'S': opts.seed      = strtoul(optarg, NULL, 0); break;
+			case 'l':
+				opts.level = atoi(optarg);
+				if (opts.level < 0 || opts.level > 9) {
+					fprintf(stderr, "Invalid compression level: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'h': usage(argv[0]); return 0;
+			default:  usage(argv[0]); return 1;
+		}
+	}
+	if (argc - optind != 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	opts.out_dir = argv[optind];
+
+	// Check the sizes before writing anything.
+	char *sizes = strdup(opts.sizes);
+	for (char *tok = sizes; *tok;) {
+		unsigned w, h;
+		int      used;
+		if (sscanf(tok, "%ux%u%n", &w, &h, &used) != 2 || !w || !h || (tok[used] && tok[used] != ',')) {
+			fprintf(stderr, "Invalid size list: %s\n", opts.sizes);
+			free(sizes);
+			return 1;
+		}
+		tok += used + (tok[used] == ',');
+	}
+
+	size_t manifest_len = strlen(opts.out_dir) + 14;
+	char  *manifest_path = malloc(manifest_len);
+	snprintf(manifest_path, manifest_len, "%s/manifest.tsv", opts.out_dir);
+	FILE *manifest = tool_make_parents(manifest_path) ? fopen(manifest_path, "w") : NULL;
+	if (!manifest) {
+		perror(manifest_path);
+		free(manifest_path);
+		free(sizes);
+		return 1;
+	}
+	fprintf(manifest, "# file\tcontent\twidth\theight\tcolor_type\tbit_depth\tinterlace\ttrns\tpalette_size\tbytes\tcrc32\n");
+
+	bool ok = true;
+	for (int content = 0; content < SYNTH_CONTENT_COUNT && ok; content++) {
+		if (!opts.content[content]) continue;
+		for (char *tok = sizes; *tok && ok;) {
+			unsigned w, h;
+			int      used;
+			sscanf(tok, "%ux%u%n", &w, &h, &used);
+			tok += used + (tok[used] == ',');
+			printf("%s %ux%u\n", synth_content_names[content], w, h);
+			fflush(stdout);
+			ok = write_size(&opts, manifest, content, w, h);
+		}
+	}
+
+	ok &= !fclose(manifest);
+	free(manifest_path);
+	free(sizes);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,470 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+// Minimal PNG writer that, unlike the library's encoder, supports every bit depth and
+// interlacing, so tools can produce inputs for the full decoder format matrix.
+
+#include "png_synth.h"
+#include "zlib.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Largest IDAT chunk written.
+#define IDAT_MAX 65536
+
+// Adam7 pass geometry.
+static const uint8_t adam7_x0[7] = {0, 4, 0, 2, 0, 1, 0};
+static const uint8_t adam7_y0[7] = {0, 0, 4, 0, 2, 0, 1};
+static const uint8_t adam7_dx[7] = {8, 8, 4, 4, 2, 2, 1};
+static const uint8_t adam7_dy[7] = {8, 8, 8, 4, 4, 2, 2};
+
+// Growable output.
+typedef struct {
+	uint8_t *data;
+	size_t   len, cap;
+	bool     error;
+} out_t;
+
+static void put(out_t *out, const void *data, size_t len) {
+	if (out->error) return;
+	if (out->len + len > out->cap) {
+		size_t cap = out->cap ? out->cap : 4096;
+		while (cap < out->len + len) cap *= 2;
+		uint8_t *mem = realloc(out->data, cap);
+		if (!mem) {
+			out->error = true;
+			return;
+		}
+		out->data = mem;
+		out->cap  = cap;
+	}
+	memcpy(out->data + out->len, data, len);
+	out->len += len;
+}
+
+static void put_be32(uint8_t *out, uint32_t value) {
+	out[0] = value >> 24;
+	out[1] = value >> 16;
+	out[2] = value >> 8;
+	out[3] = value;
+}
+
+static void put_chunk(out_t *out, const char type[4], const void *data, size_t len) {
+	uint8_t head[8], tail[4];
+	put_be32(head, len);
+	memcpy(head + 4, type, 4);
+	uint32_t crc = crc32(crc32(0, NULL, 0), head + 4, 4);
+	if (len) crc = crc32(crc, data, len);
+	put_be32(tail, crc);
+	put(out, head, 8);
+	put(out, data, len);
+	put(out, tail, 4);
+}
+
+static int channels(int color_type) {
+	switch (color_type) {
+		case 0: return 1;
+		case 2: return 3;
+		case 3: return 1;
+		case 4: return 2;
+		case 6: return 4;
+		default: return 0;
+	}
+}
+
+// Whether `color_type` and `bit_depth` form a valid PNG format.
+bool synth_valid_format(int color_type, int bit_depth) {
+	switch (color_type) {
+		case 0: return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8 || bit_depth == 16;
+		case 3: return bit_depth == 1 || bit_depth == 2 || bit_depth == 4 || bit_depth == 8;
+		case 2:
+		case 4:
+		case 6: return bit_depth == 8 || bit_depth == 16;
+		default: return false;
+	}
+}
+
+// Entry `i` of the fixed palette for `n` entries; ordered by brightness so that indices follow luma.
+static void palette_entry(int i, int n, uint8_t rgb[3]) {
+	int v  = n > 1 ? i * 255 / (n - 1) : 0;
+	rgb[0] = v;
+	rgb[1] = (v * 3 + (i * 37 & 63)) / 4;
+	rgb[2] = 255 - (255 - v) * 3 / 4;
+}
+
+// Alpha of palette entry `i` when there is a tRNS chunk.
+static uint8_t palette_alpha(int i, int n) {
+	return n > 1 ? i * 255 / (n - 1) : 255;
+}
+
+// Brightness of a 16-bit color.
+static uint32_t luma16(const uint16_t rgba[4]) {
+	return (rgba[0] * 77u + rgba[1] * 150u + rgba[2] * 29u) >> 8;
+}
+
+// Reduces a 16-bit color to the samples of one pixel, each of `bit_depth` bits.
+static void reduce_pixel(const synth_fmt_t *fmt, int pal_size, const uint16_t rgba[4], uint16_t out[4]) {
+	int shift = 16 - fmt->bit_depth;
+	switch (fmt->color_type) {
+		case 0: out[0] = luma16(rgba) >> shift; break;
+		case 3: out[0] = luma16(rgba) * pal_size >> 16; break;
+		case 4:
+			out[0] = luma16(rgba) >> shift;
+			out[1] = rgba[3] >> shift;
+			break;
+		default:
+			for (int c = 0; c < 4; c++) out[c] = rgba[c] >> shift;
+			break;
+	}
+}
+
+// Scales a sample to 8 bits the way decoders do: bit replication up, truncation down.
+static uint8_t sample_to_8(uint16_t value, int depth) {
+	if (depth == 16) return value >> 8;
+	if (depth == 8) return value;
+	return value * 255 / ((1 << depth) - 1);
+}
+
+// The decoded 8-bit RGBA of one pixel's samples.
+static void decode_pixel(const synth_fmt_t *fmt, int pal_size, const uint16_t samples[4], uint8_t rgba[4]) {
+	int d = fmt->bit_depth;
+	switch (fmt->color_type) {
+		case 0:
+			rgba[0] = rgba[1] = rgba[2] = sample_to_8(samples[0], d);
+			rgba[3] = fmt->trns && !samples[0] ? 0 : 255;
+			break;
+		case 2:
+			for (int c = 0; c < 3; c++) rgba[c] = sample_to_8(samples[c], d);
+			rgba[3] = fmt->trns && !samples[0] && !samples[1] && !samples[2] ? 0 : 255;
+			break;
+		case 3:
+			palette_entry(samples[0], pal_size, rgba);
+			rgba[3] = fmt->trns ? palette_alpha(samples[0], pal_size) : 255;
+			break;
+		case 4:
+			rgba[0] = rgba[1] = rgba[2] = sample_to_8(samples[0], d);
+			rgba[3] = sample_to_8(samples[1], d);
+			break;
+		default:
+			for (int c = 0; c < 4; c++) rgba[c] = sample_to_8(samples[c], d);
+			break;
+	}
+}
+
+// Stores one sample of `depth` bits at sample index `index` of a packed row.
+static void put_sample(uint8_t *row, size_t index, int depth, uint16_t value) {
+	if (depth == 16) {
+		row[index * 2]     = value >> 8;
+		row[index * 2 + 1] = value;
+	} else if (depth == 8) {
+		row[index] = value;
+	} else {
+		size_t bit = index * depth;
+		row[bit / 8] |= value << (8 - depth - bit % 8);
+	}
+}
+
+// Sum of the filtered bytes as signed values, the heuristic libpng uses to pick filters.
+static uint32_t filter_cost(const uint8_t *row, size_t len) {
+	uint32_t sum = 0;
+	for (size_t i = 0; i < len; i++) sum += row[i] < 128 ? row[i] : 256 - row[i];
+	return sum;
+}
+
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+	int p  = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	return pb <= pc ? b : c;
+}
+
+// Filters `row` with the cheapest filter into `out`, which gets the filter type byte first.
+static void filter_row(uint8_t *out, uint8_t *tmp, const uint8_t *row, const uint8_t *prev, size_t len, int bpp) {
+	uint32_t best_cost = UINT32_MAX;
+	for (int type = 0; type < 5; type++) {
+		tmp[0] = type;
+		for (size_t i = 0; i < len; i++) {
+			uint8_t a = i >= (size_t) bpp ? row[i - bpp] : 0;
+			uint8_t b = prev[i];
+			uint8_t c = i >= (size_t) bpp ? prev[i - bpp] : 0;
+			uint8_t p = type == 1 ? a : type == 2 ? b : type == 3 ? (a + b) / 2 : type == 4 ? paeth(a, b, c) : 0;
+			tmp[i + 1] = row[i] - p;
+		}
+		uint32_t cost = filter_cost(tmp + 1, len);
+		if (cost < best_cost) {
+			best_cost = cost;
+			memcpy(out, tmp, len + 1);
+		}
+	}
+}
+
+// Writes a PNG with the given format, taking pixels from `pixel`.
+bool synth_png(const synth_fmt_t *fmt, synth_pixel_t pixel, void *cookie, uint8_t **out_data, size_t *out_len, uint8_t *reference) {
+	if (!fmt->width || !fmt->height || !synth_valid_format(fmt->color_type, fmt->bit_depth)) return false;
+	int max_pal = 1 << (fmt->bit_depth < 8 ? fmt->bit_depth : 8);
+	if (fmt->color_type == 3 && fmt->palette_size > max_pal) return false;
+	int      ch        = channels(fmt->color_type);
+	int      depth     = fmt->bit_depth;
+	int      bpp       = ch * depth >= 8 ? ch * depth / 8 : 1;
+	size_t   row_cap   = ((size_t) fmt->width * ch * depth + 7) / 8;
+	int      pal_size  = fmt->palette_size ? fmt->palette_size : max_pal;
+	uint8_t *row       = malloc(row_cap);
+	uint8_t *prev      = malloc(row_cap);
+	uint8_t *filtered  = malloc(row_cap + 1);
+	uint8_t *tmp       = malloc(row_cap + 1);
+	uint8_t  zout[16384];
+	out_t    out       = {0};
+	out_t    idat      = {0};
+	z_stream zs        = {0};
+	bool     zinit     = false;
+	if (!row || !prev || !filtered || !tmp) goto error;
+
+	// Header chunks.
+	static const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	put(&out, sig, 8);
+	uint8_t ihdr[13];
+	put_be32(ihdr, fmt->width);
+	put_be32(ihdr + 4, fmt->height);
+	ihdr[8]  = depth;
+	ihdr[9]  = fmt->color_type;
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = fmt->interlace;
+	put_chunk(&out, "IHDR", ihdr, 13);
+	if (fmt->color_type == 3) {
+		uint8_t plte[256 * 3], alpha[256];
+		for (int i = 0; i < pal_size; i++) {
+			palette_entry(i, pal_size, plte + i * 3);
+			alpha[i] = palette_alpha(i, pal_size);
+		}
+		put_chunk(&out, "PLTE", plte, pal_size * 3);
+		if (fmt->trns) put_chunk(&out, "tRNS", alpha, pal_size);
+	} else if (fmt->trns && (fmt->color_type == 0 || fmt->color_type == 2)) {
+		// Black is transparent.
+		static const uint8_t key[6] = {0};
+		put_chunk(&out, "tRNS", key, fmt->color_type == 0 ? 2 : 6);
+	}
+
+	// Image data, one pass or seven.
+	if (deflateInit(&zs, fmt->level) != Z_OK) goto error;
+	zinit = true;
+	for (int pass = fmt->interlace ? 0 : 6; pass < 7; pass++) {
+		uint32_t x0 = fmt->interlace ? adam7_x0[pass] : 0, dx = fmt->interlace ? adam7_dx[pass] : 1;
+		uint32_t y0 = fmt->interlace ? adam7_y0[pass] : 0, dy = fmt->interlace ? adam7_dy[pass] : 1;
+		if (x0 >= fmt->width || y0 >= fmt->height) continue;
+		uint32_t pw  = (fmt->width - x0 + dx - 1) / dx;
+		size_t   len = ((size_t) pw * ch * depth + 7) / 8;
+		memset(prev, 0, len);
+		for (uint32_t y = y0; y < fmt->height; y += dy) {
+			memset(row, 0, len);
+			for (uint32_t i = 0; i < pw; i++) {
+				uint16_t rgba[4], samples[4];
+				pixel(cookie, x0 + i * dx, y, rgba);
+				reduce_pixel(fmt, pal_size, rgba, samples);
+				for (int c = 0; c < ch; c++) put_sample(row, i * ch + c, depth, samples[c]);
+				if (reference) {
+					decode_pixel(fmt, pal_size, samples, reference + ((size_t) y * fmt->width + x0 + i * dx) * 4);
+				}
+			}
+			filter_row(filtered, tmp, row, prev, len, bpp);
+			zs.next_in  = filtered;
+			zs.avail_in = len + 1;
+			do {
+				zs.next_out  = zout;
+				zs.avail_out = sizeof(zout);
+				deflate(&zs, Z_NO_FLUSH);
+				put(&idat, zout, sizeof(zout) - zs.avail_out);
+			} while (zs.avail_in || !zs.avail_out);
+			uint8_t *swap = prev;
+			prev = row;
+			row  = swap;
+		}
+	}
+	int zerr;
+	do {
+		zs.next_out  = zout;
+		zs.avail_out = sizeof(zout);
+		zerr = deflate(&zs, Z_FINISH);
+		put(&idat, zout, sizeof(zout) - zs.avail_out);
+	} while (zerr == Z_OK);
+	if (zerr != Z_STREAM_END || idat.error) goto error;
+
+	for (size_t pos = 0; pos < idat.len; pos += IDAT_MAX) {
+		put_chunk(&out, "IDAT", idat.data + pos, idat.len - pos < IDAT_MAX ? idat.len - pos : IDAT_MAX);
+	}
+	put_chunk(&out, "IEND", NULL, 0);
+	if (out.error) goto error;
+
+	deflateEnd(&zs);
+	free(row);
+	free(prev);
+	free(filtered);
+	free(tmp);
+	free(idat.data);
+	*out_data = out.data;
+	*out_len  = out.len;
+	return true;
+
+	error:
+	if (zinit) deflateEnd(&zs);
+	free(row);
+	free(prev);
+	free(filtered);
+	free(tmp);
+	free(idat.data);
+	free(out.data);
+	return false;
+}
+
+
+
+/* ==== Content ==== */
+
+// Names of the content classes, indexed by synth_content_t.
+const char *const synth_content_names[SYNTH_CONTENT_COUNT] = {
+	"flat",
+	"gradient",
+	"noise",
+	"photo",
+};
+
+// Integer hash of a lattice point, for noise that is the same regardless of image size.
+static uint32_t hash3(uint32_t x, uint32_t y, uint32_t seed) {
+	uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u ^ seed * 0xcb1ab31fu;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	h *= 0x297a2d39u;
+	h ^= h >> 15;
+	return h;
+}
+
+// Smooth value noise in [0, 1] with lattice spacing `scale` pixels.
+static float value_noise(uint32_t x, uint32_t y, uint32_t scale, uint32_t seed) {
+	uint32_t gx = x / scale, gy = y / scale;
+	float    fx = (float) (x % scale) / scale, fy = (float) (y % scale) / scale;
+	fx = fx * fx * (3 - 2 * fx);
+	fy = fy * fy * (3 - 2 * fy);
+	float a = hash3(gx, gy, seed) / 4294967295.0f;
+	float b = hash3(gx + 1, gy, seed) / 4294967295.0f;
+	float c = hash3(gx, gy + 1, seed) / 4294967295.0f;
+	float d = hash3(gx + 1, gy + 1, seed) / 4294967295.0f;
+	return (a + (b - a) * fx) * (1 - fy) + (c + (d - c) * fx) * fy;
+}
+
+static uint16_t clamp16(float value) {
+	return value <= 0 ? 0 : value >= 1 ? 65535 : (uint16_t) (value * 65535 + 0.5f);
+}
+
+static void flat_pixel(const synth_content_opts_t *opts, uint32_t x, uint32_t y, uint16_t rgba[4]) {
+	// A grid of widgets; sizes scale with the image so icons and 8K screens look alike.
+	uint32_t cell = opts->width / 8 > 8 ? opts->width / 8 : 8;
+	uint32_t cx = x / cell, cy = y / cell, lx = x % cell, ly = y % cell;
+	uint32_t h  = hash3(cx, cy, opts->seed);
+	uint32_t border = cell / 16 ? cell / 16 : 1;
+	uint16_t bg[3]  = {0x2020, 0x2428, 0x2c30};
+	if (lx < border || ly < border || lx >= cell - border || ly >= cell - border) {
+		// Widget border.
+		rgba[0] = rgba[1] = rgba[2] = 0x5858;
+		rgba[3] = 0xffff;
+		return;
+	}
+	int kind = h % 4;
+	if (kind == 0) {
+		// Empty background.
+		memcpy(rgba, bg, sizeof(bg));
+		rgba[3] = 0xffff;
+	} else if (kind == 1) {
+		// Solid button in one of a few theme colors.
+		static const uint16_t theme[4][3] = {{0x1e1e, 0x8888, 0xe5e5}, {0xe5e5, 0x3939, 0x3535}, {0x4c4c, 0xafaf, 0x5050}, {0xffff, 0xc1c1, 0x0707}};
+		memcpy(rgba, theme[(h >> 4) % 4], sizeof(theme[0]));
+		rgba[3] = 0xffff;
+	} else if (kind == 2) {
+		// Rows of text: glyph cells with hashed bits on a light background.
+		uint32_t glyph = cell / 10 ? cell / 10 : 2;
+		uint32_t gx = lx / glyph, gy = ly / glyph;
+		bool     line = gy % 2 == 0 && (gy / 2) % 4 != 3;
+		bool     on   = line && (hash3(x / (glyph / 2 ? glyph / 2 : 1), y / (glyph / 2 ? glyph / 2 : 1), opts->seed ^ gx) & 3) == 0;
+		rgba[0] = rgba[1] = rgba[2] = on ? 0x1010 : 0xf0f0;
+		rgba[3] = 0xffff;
+	} else {
+		// Translucent overlay panel.
+		rgba[0] = 0x0000;
+		rgba[1] = 0x0000;
+		rgba[2] = 0x0000;
+		rgba[3] = 0x8000;
+	}
+}
+
+static void gradient_pixel(const synth_content_opts_t *opts, uint32_t x, uint32_t y, uint16_t rgba[4]) {
+	float fx = (float) x / (opts->width > 1 ? opts->width - 1 : 1);
+	float fy = (float) y / (opts->height > 1 ? opts->height - 1 : 1);
+	float dx = fx - 0.5f, dy = fy - 0.5f;
+	float r  = sqrtf(dx * dx + dy * dy) * 1.41421356f;
+	float t  = (opts->seed % 16) / 16.0f;
+	rgba[0] = clamp16(fx);
+	rgba[1] = clamp16(fmodf(fy + t, 1.0f));
+	rgba[2] = clamp16(1 - r);
+	rgba[3] = clamp16(1 - r * 0.5f);
+}
+
+static void noise_pixel(const synth_content_opts_t *opts, uint32_t x, uint32_t y, uint16_t rgba[4]) {
+	uint32_t a = hash3(x, y, opts->seed);
+	uint32_t b = hash3(x, y, opts->seed + 1);
+	rgba[0] = a;
+	rgba[1] = a >> 16;
+	rgba[2] = b;
+	rgba[3] = b >> 16;
+}
+
+static void photo_pixel(const synth_content_opts_t *opts, uint32_t x, uint32_t y, uint16_t rgba[4]) {
+	// Features are sized relative to the image, plus fine grain at a fixed scale.
+	uint32_t base = (opts->width > opts->height ? opts->width : opts->height) / 4;
+	if (base < 4) base = 4;
+	float v = 0, amp = 0.5f;
+	for (uint32_t scale = base; scale >= 2 && amp > 0.03f; scale /= 2, amp *= 0.5f) {
+		v += value_noise(x, y, scale, opts->seed + scale) * amp;
+	}
+	float hue   = value_noise(x, y, base * 2, opts->seed ^ 0x55);
+	float grain = (hash3(x, y, opts->seed ^ 0xaa) & 0xff) / 255.0f * 0.03f;
+	float light = 1.0f - 0.4f * (float) y / opts->height;
+	v = (v * light) + grain;
+	rgba[0] = clamp16(v * (0.8f + 0.4f * hue));
+	rgba[1] = clamp16(v * 0.95f);
+	rgba[2] = clamp16(v * (1.2f - 0.4f * hue));
+	rgba[3] = 0xffff;
+}
+
+// A synth_pixel_t producing the content described by the synth_content_opts_t in `cookie`.
+void synth_content_pixel(void *cookie, uint32_t x, uint32_t y, uint16_t rgba[4]) {
+	const synth_content_opts_t *opts = cookie;
+	switch (opts->content) {
+		case SYNTH_FLAT:     flat_pixel(opts, x, y, rgba); break;
+		case SYNTH_GRADIENT: gradient_pixel(opts, x, y, rgba); break;
+		case SYNTH_NOISE:    noise_pixel(opts, x, y, rgba); break;
+		default:             photo_pixel(opts, x, y, rgba); break;
+	}
+}
@@ -0,0 +1,90 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+
+#ifndef PNG_SYNTH_H
+#define PNG_SYNTH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Format of a synthesized PNG.
+typedef struct {
+	uint32_t width, height;
+	// PNG color type and bit depth; any combination the PNG spec allows.
+	uint8_t  color_type;
+	uint8_t  bit_depth;
+	// Adam7 interlacing.
+	bool     interlace;
+	// Add a tRNS chunk: a transparent key color for grey and RGB, per-entry alpha for palettes.
+	bool     trns;
+	// Number of palette entries for color type 3, at most 1 << bit_depth; 0 for all of them.
+	uint16_t palette_size;
+	// zlib compression level.
+	int      level;
+} synth_fmt_t;
+
+// Produces the color of pixel (x, y) as 16-bit RGBA.
+typedef void (*synth_pixel_t)(void *cookie, uint32_t x, uint32_t y, uint16_t rgba[4]);
+
+// Whether `color_type` and `bit_depth` form a valid PNG format.
+bool synth_valid_format(int color_type, int bit_depth);
+
+// Writes a PNG with the given format, taking pixels from `pixel`.
+// Colors are reduced to the format as needed; palette images use a fixed palette
+// indexed by brightness. Rows are filtered like libpng does by default.
+// If `reference` is not NULL, it receives width * height pixels of 8-bit RGBA: what a correct
+// decoder produces from the PNG, with samples scaled up by bit replication and down by truncation.
+// Returns false if out of memory or the format is invalid.
+bool synth_png(const synth_fmt_t *fmt, synth_pixel_t pixel, void *cookie, uint8_t **out, size_t *out_len, uint8_t *reference);
+
+// Classes of generated image content.
+typedef enum {
+	// Flat UI: solid panels, borders, text-like glyph rows and a few translucent overlays.
+	SYNTH_FLAT,
+	// Smooth 16-bit linear and radial gradients, including alpha.
+	SYNTH_GRADIENT,
+	// Uncorrelated noise in every channel; the worst case for deflate.
+	SYNTH_NOISE,
+	// Multi-octave value noise with soft lighting, which compresses like a photograph.
+	SYNTH_PHOTO,
+	SYNTH_CONTENT_COUNT,
+} synth_content_t;
+
+// Names of the content classes, indexed by synth_content_t.
+extern const char *const synth_content_names[SYNTH_CONTENT_COUNT];
+
+// Settings for synth_content_pixel.
+typedef struct {
+	synth_content_t content;
+	uint32_t        width, height;
+	// Different seeds give different images of the same class.
+	uint32_t        seed;
+} synth_content_opts_t;
+
+// A synth_pixel_t producing the content described by the synth_content_opts_t in `cookie`.
+void synth_content_pixel(void *cookie, uint32_t x, uint32_t y, uint16_t rgba[4]);
+
+#endif //PNG_SYNTH_H
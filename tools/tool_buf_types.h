@@ -0,0 +1,82 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef TOOL_BUF_TYPES_H
+#define TOOL_BUF_TYPES_H
+
+#include "pax_codecs.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Every buffer type by name, as accepted on the command line of the tools.
+static const struct {
+	const char    *name;
+	pax_buf_type_t type;
+} tool_buf_types[] = {
+	{ "1_PAL",       PAX_BUF_1_PAL       },
+	{ "2_PAL",       PAX_BUF_2_PAL       },
+	{ "4_PAL",       PAX_BUF_4_PAL       },
+	{ "8_PAL",       PAX_BUF_8_PAL       },
+	{ "16_PAL",      PAX_BUF_16_PAL      },
+	{ "1_GREY",      PAX_BUF_1_GREY      },
+	{ "2_GREY",      PAX_BUF_2_GREY      },
+	{ "4_GREY",      PAX_BUF_4_GREY      },
+	{ "8_GREY",      PAX_BUF_8_GREY      },
+	{ "8_332RGB",    PAX_BUF_8_332RGB    },
+	{ "16_565RGB",   PAX_BUF_16_565RGB   },
+	{ "4_1111ARGB",  PAX_BUF_4_1111ARGB  },
+	{ "8_2222ARGB",  PAX_BUF_8_2222ARGB  },
+	{ "16_4444ARGB", PAX_BUF_16_4444ARGB },
+	{ "32_8888ARGB", PAX_BUF_32_8888ARGB },
+};
+#define TOOL_BUF_TYPE_COUNT (sizeof(tool_buf_types) / sizeof(*tool_buf_types))
+
+// Parses a buffer type name or number.
+static inline bool tool_parse_buf_type(const char *str, pax_buf_type_t *type) {
+	if (!strncmp(str, "PAX_BUF_", 8)) str += 8;
+	for (size_t i = 0; i < TOOL_BUF_TYPE_COUNT; i++) {
+		if (!strcasecmp(str, tool_buf_types[i].name)) {
+			*type = tool_buf_types[i].type;
+			return true;
+		}
+	}
+	char *end;
+	unsigned long num = strtoul(str, &end, 0);
+	if (*str && !*end) {
+		*type = num;
+		return true;
+	}
+	return false;
+}
+
+// Short name of a buffer type, "?" if unknown.
+static inline const char *tool_buf_type_name(pax_buf_type_t type) {
+	for (size_t i = 0; i < TOOL_BUF_TYPE_COUNT; i++) {
+		if (tool_buf_types[i].type == type) return tool_buf_types[i].name;
+	}
+	return "?";
+}
+
+#endif //TOOL_BUF_TYPES_H
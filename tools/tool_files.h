@@ -0,0 +1,66 @@
+/*
+	MIT License
+
+	Copyright (c) 2022 Julian Scheffers
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef TOOL_FILES_H
+#define TOOL_FILES_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Creates all missing parent directories of `path`.
+static inline bool tool_make_parents(const char *path) {
+	char *tmp = strdup(path);
+	for (char *p = tmp + 1; *p; p++) {
+		if (*p != '/') continue;
+		*p = 0;
+		if (mkdir(tmp, 0777) && errno != EEXIST) {
+			perror(tmp);
+			free(tmp);
+			return false;
+		}
+		*p = '/';
+	}
+	free(tmp);
+	return true;
+}
+
+// Writes a whole file.
+static inline bool tool_write_file(const char *path, const void *data, size_t len) {
+	if (!tool_make_parents(path)) return false;
+	FILE *fd = fopen(path, "wb");
+	if (!fd) {
+		perror(path);
+		return false;
+	}
+	bool ok = fwrite(data, 1, len, fd) == len;
+	ok &= !fclose(fd);
+	if (!ok) perror(path);
+	return ok;
+}
+
+#endif //TOOL_FILES_H